@@ -18,6 +18,8 @@
 #include "../postgis_config.h"
 #include <stdarg.h>
 #include <stdio.h>
+/* Solaris9 does not provide stdint.h */
+#include <inttypes.h>
 
 /**
 * @file liblwgeom.h
@@ -63,6 +65,23 @@
 #define LW_TRUE 1
 #define LW_FALSE 0
 
+/*
+** Storage class for the unparser working state, so that frontend
+** programs (shp2pgsql -j) may unparse from several threads at once.
+** Without one LW_HAVE_THREAD_LOCAL is 0 and the state is shared, so
+** callers must not unparse from more than one thread.
+*/
+#if defined(__GNUC__)
+#define LW_THREAD_LOCAL __thread
+#define LW_HAVE_THREAD_LOCAL 1
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define LW_THREAD_LOCAL _Thread_local
+#define LW_HAVE_THREAD_LOCAL 1
+#else
+#define LW_THREAD_LOCAL
+#define LW_HAVE_THREAD_LOCAL 0
+#endif
+
 /*
 * this will change to NaN when I figure out how to
 * get NaN in a platform-independent way
@@ -1447,6 +1466,13 @@ LWGEOM_UNPARSER_RESULT;
 #define UNPARSER_ERROR_MOREPOINTS 	1
 #define UNPARSER_ERROR_ODDPOINTS	2
 #define UNPARSER_ERROR_UNCLOSED		3
+#define UNPARSER_ERROR_TWKBTYPE		4
+
+/*
+ * Optional TWKB sections, see serialized_lwgeom_to_twkb
+ */
+#define TWKB_BBOX		0x01
+#define TWKB_SIZE		0x02
 
 
 /* Parser access routines */
@@ -1461,6 +1487,8 @@ extern int serialized_lwgeom_from_ewkt(LWGEOM_PARSER_RESULT *lwg_parser_result,
 extern int serialized_lwgeom_to_hexwkb(LWGEOM_UNPARSER_RESULT *lwg_unparser_result, uchar *serialized, int flags, unsigned int byteorder);
 extern int serialized_lwgeom_from_hexwkb(LWGEOM_PARSER_RESULT *lwg_parser_result, char *hexwkb_input, int flags);
 extern int serialized_lwgeom_to_ewkb(LWGEOM_UNPARSER_RESULT *lwg_unparser_result, uchar *serialized, int flags, unsigned int byteorder);
+extern int serialized_lwgeom_to_twkb(LWGEOM_UNPARSER_RESULT *lwg_unparser_result, uchar *serialized, int flags, int precision, uchar variant, const int64_t *ids);
+extern int serialized_lwgeom_from_twkb(LWGEOM_PARSER_RESULT *lwg_parser_result, uchar *twkb, size_t size, int flags);
 
 extern void *lwalloc(size_t size);
 extern void *lwrealloc(void *mem, size_t size);
@@ -760,6 +760,31 @@ serialized_lwgeom_to_ewkb(LWGEOM_UNPARSER_RESULT *lwg_unparser_result, uchar *se
 	return result;
 }
 
+/**
+ * Return an alloced TWKB buffer, ordinates rounded to precision
+ * decimal digits. variant is a mask of TWKB_SIZE and TWKB_BBOX,
+ * ids, if not NULL, has one id per part of a MULTI* or collection.
+ */
+int
+serialized_lwgeom_to_twkb(LWGEOM_UNPARSER_RESULT *lwg_unparser_result, uchar *serialized, int flags, int precision, uchar variant, const int64_t *ids)
+{
+	int result;
+
+	result = unparse_TWKB(lwg_unparser_result, serialized, lwalloc, lwfree, flags, precision, variant, ids);
+
+	return result;
+}
+
+int
+serialized_lwgeom_from_twkb(LWGEOM_PARSER_RESULT *lwg_parser_result, uchar *twkb, size_t size, int flags)
+{
+	int result = parse_twkb(lwg_parser_result, twkb, size, flags, lwalloc, lwerror);
+
+	LWDEBUGF(2, "serialized_lwgeom_from_twkb with %d bytes", (int)size);
+
+	return result;
+}
+
 /**
  * @brief geom1 same as geom2
  *  	iff
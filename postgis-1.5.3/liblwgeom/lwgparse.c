@@ -7,6 +7,7 @@
  */
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 /* Solaris9 does not provide stdint.h */
 /* #include <stdint.h> */
 #include <inttypes.h>
@@ -255,6 +256,14 @@ void alloc_wkb(const char *parser);
 int parse_it(LWGEOM_PARSER_RESULT *lwg_parser_result, const char* geometry, int flags, allocator allocfunc, report_error errfunc);
 int parse_lwg(LWGEOM_PARSER_RESULT *lwg_parser_result, const char* geometry, int flags, allocator allocfunc, report_error errfunc);
 int parse_lwgi(LWGEOM_PARSER_RESULT *lwg_parser_result, const char* geometry, int flags, allocator allocfunc, report_error errfunc);
+uint64_t read_twkb_uvarint(void);
+uint64_t read_twkb_count(void);
+int64_t read_twkb_varint(void);
+uchar read_twkb_byte(void);
+void read_twkb_point(void);
+void read_twkb_ordinate_array(void);
+void read_twkb_polygon(void);
+void read_twkb(int header, int type);
 
 void
 set_srid(double d_srid)
@@ -1706,6 +1715,319 @@ parse_lwgi(LWGEOM_PARSER_RESULT *lwg_parser_result, const char* geometry, int fl
 	return parse_it(lwg_parser_result, geometry, flags, allocfunc, errfunc);
 }
 
+/*
+ * TWKB reader, the inverse of unparse_TWKB in lwgunparse.c. The varints
+ * are decoded straight into the same tuple stack the WKB reader builds.
+ */
+
+static const uchar *twkb_pos;
+static const uchar *twkb_end;
+static double twkb_factor[4];
+static int64_t twkb_last[4];
+
+uint64_t
+read_twkb_uvarint(void)
+{
+	uint64_t ret = 0;
+	int shift = 0;
+	uchar b;
+
+	do
+	{
+		if ( twkb_pos >= twkb_end || shift > 63 )
+		{
+			LWGEOM_WKB_PARSER_ERROR(PARSER_ERROR_INVALIDGEOM);
+			return 0;
+		}
+		b = *twkb_pos++;
+		ret |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+	}
+	while ( b & 0x80 );
+
+	return ret;
+}
+
+int64_t
+read_twkb_varint(void)
+{
+	uint64_t val = read_twkb_uvarint();
+	return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+/*
+ * Every counted item takes at least one byte, so a count larger than
+ * what is left can only come from a corrupt or hostile buffer.
+ */
+uint64_t
+read_twkb_count(void)
+{
+	uint64_t cnt = read_twkb_uvarint();
+
+	if ( cnt > (uint64_t)(twkb_end - twkb_pos) )
+	{
+		LWGEOM_WKB_PARSER_ERROR(PARSER_ERROR_INVALIDGEOM);
+		return 0;
+	}
+	return cnt;
+}
+
+uchar
+read_twkb_byte(void)
+{
+	if ( twkb_pos >= twkb_end )
+	{
+		LWGEOM_WKB_PARSER_ERROR(PARSER_ERROR_INVALIDGEOM);
+		return 0;
+	}
+	return *twkb_pos++;
+}
+
+void
+read_twkb_point(void)
+{
+	tuple* p = NULL;
+	int i;
+
+	switch (the_geom.ndims)
+	{
+	case 2:
+		p=alloc_tuple(write_point_2,16);
+		break;
+	case 3:
+		p=alloc_tuple(write_point_3,24);
+		break;
+	case 4:
+		p=alloc_tuple(write_point_4,32);
+		break;
+	}
+
+	for (i=0; i<the_geom.ndims; i++)
+	{
+		twkb_last[i] += read_twkb_varint();
+		p->uu.points[i] = twkb_last[i] / twkb_factor[i];
+	}
+
+	inc_num();
+	check_dims(the_geom.ndims);
+}
+
+void
+read_twkb_ordinate_array(void)
+{
+	uint64_t cnt = read_twkb_count();
+	alloc_counter();
+
+	while (cnt--)
+	{
+		if ( parser_ferror_occured )	return;
+		read_twkb_point();
+	}
+
+	pop();
+}
+
+void
+read_twkb_polygon(void)
+{
+	uint64_t cnt = read_twkb_count();
+	alloc_counter();
+
+	while (cnt--)
+	{
+		if ( parser_ferror_occured )	return;
+		read_twkb_ordinate_array();
+	}
+
+	pop();
+}
+
+void
+read_twkb(int header, int type)
+{
+	uchar metadata = 0;
+	uint64_t cnt, j;
+	int precision;
+	int i;
+
+	LWDEBUGF(3, "read_twkb header %d", header);
+
+	if ( header )
+	{
+		uchar typebyte = read_twkb_byte();
+		int hasz = 0, hasm = 0, zprecision = 0, mprecision = 0;
+
+		metadata = read_twkb_byte();
+
+		/* quick exit on error */
+		if ( parser_ferror_occured ) return;
+
+		type = typebyte & 0x0f;
+		precision = (typebyte >> 5) ^ -((typebyte >> 4) & 1);
+
+		if ( metadata & 0x08 )
+		{
+			uchar ext = read_twkb_byte();
+			hasz = ext & 0x01;
+			hasm = (ext >> 1) & 0x01;
+			zprecision = (ext >> 2) & 0x07;
+			mprecision = (ext >> 5) & 0x07;
+		}
+
+		if ( the_geom.ndims && ( hasz != the_geom.hasZ || hasm != the_geom.hasM ) )
+		{
+			LWGEOM_WKB_PARSER_ERROR(PARSER_ERROR_MIXDIMS);
+			return;
+		}
+		the_geom.hasZ = hasz;
+		the_geom.hasM = hasm;
+		the_geom.ndims = 2 + hasz + hasm;
+
+		twkb_factor[0] = twkb_factor[1] = pow(10.0, precision);
+		twkb_factor[2] = pow(10.0, hasz ? zprecision : mprecision);
+		twkb_factor[3] = pow(10.0, mprecision);
+		for ( i = 0 ; i < 4 ; i++ )
+			twkb_last[i] = 0;
+
+		/* The size has to fit what is left, the bbox is only a hint */
+		if ( ( metadata & 0x02 ) && read_twkb_uvarint() > (uint64_t)(twkb_end - twkb_pos) )
+		{
+			LWGEOM_WKB_PARSER_ERROR(PARSER_ERROR_INVALIDGEOM);
+			return;
+		}
+		if ( metadata & 0x01 )
+		{
+			for ( i = 0 ; i < 2 * the_geom.ndims ; i++ )
+				read_twkb_varint();
+		}
+	}
+
+	switch (type)
+	{
+	case	POINTTYPE:
+		alloc_point();
+		break;
+	case	LINETYPE:
+		alloc_linestring();
+		break;
+	case	POLYGONTYPE:
+		alloc_polygon();
+		break;
+	case	MULTIPOINTTYPE:
+		alloc_multipoint();
+		break;
+	case	MULTILINETYPE:
+		alloc_multilinestring();
+		break;
+	case	MULTIPOLYGONTYPE:
+		alloc_multipolygon();
+		break;
+	case	COLLECTIONTYPE:
+		alloc_geomertycollection();
+		break;
+	default:
+		LWGEOM_WKB_PARSER_ERROR(PARSER_ERROR_INVALIDWKBTYPE);
+		return;
+	}
+
+	if ( metadata & 0x10 )
+	{
+		alloc_empty();
+		pop();
+		return;
+	}
+
+	switch (type)
+	{
+	case	POINTTYPE:
+		read_twkb_point();
+		break;
+	case	LINETYPE:
+		read_twkb_ordinate_array();
+		break;
+	case	POLYGONTYPE:
+		read_twkb_polygon();
+		break;
+	case	MULTIPOINTTYPE:
+	case	MULTILINETYPE:
+	case	MULTIPOLYGONTYPE:
+		/* Parts have no header and continue the deltas */
+		cnt = read_twkb_count();
+		if ( metadata & 0x04 )
+		{
+			for ( j = 0 ; j < cnt && ! parser_ferror_occured ; j++ )
+				read_twkb_varint();
+		}
+		alloc_counter();
+		while (cnt--)
+		{
+			if ( parser_ferror_occured )	return;
+			read_twkb(0, type - 3);
+		}
+		pop();
+		break;
+	case	COLLECTIONTYPE:
+		cnt = read_twkb_count();
+		if ( metadata & 0x04 )
+		{
+			for ( j = 0 ; j < cnt && ! parser_ferror_occured ; j++ )
+				read_twkb_varint();
+		}
+		alloc_counter();
+		while (cnt--)
+		{
+			if ( parser_ferror_occured )	return;
+			read_twkb(1, 0);
+		}
+		pop();
+		break;
+	}
+
+	pop();
+}
+
+/*
+	Parse a TWKB buffer and return a LW_GEOM
+*/
+int
+parse_twkb(LWGEOM_PARSER_RESULT *lwg_parser_result, const uchar *twkb, size_t size, int flags, allocator allocfunc, report_error errfunc)
+{
+	LWDEBUGF(3, "parse_twkb: %d bytes with parser flags %d", (int)size, flags);
+
+	local_malloc = allocfunc;
+	error_func=errfunc;
+
+	parser_ferror_occured = 0;
+
+	/* Setup the inital parser flags and empty the return struct */
+	current_lwg_parser_result = lwg_parser_result;
+	current_parser_check_flags = flags;
+	lwg_parser_result->serialized_lwgeom = NULL;
+	lwg_parser_result->size = 0;
+	lwg_parser_result->wkinput = (const char *)twkb;
+
+	the_geom.lwgi=0;
+	the_geom.from_lwgi=0;
+	alloc_lwgeom(-1);
+
+	twkb_pos = twkb;
+	twkb_end = twkb + size;
+
+	read_twkb(1, 0);
+
+	/* Anything left over is not ours */
+	if ( twkb_pos != twkb_end )
+		LWGEOM_WKB_PARSER_ERROR(PARSER_ERROR_INVALIDGEOM);
+
+	if ( parser_ferror_occured )
+		return parser_ferror_occured;
+
+	/* Return the parsed geometry */
+	make_serialized_lwgeom(lwg_parser_result);
+
+	return parser_ferror_occured;
+}
+
 void
 set_zm(char z, char m)
 {
@@ -60,29 +60,44 @@ uchar* output_wkb_circstring_collection(uchar* geom,outwkbfunc func);
 uchar* output_wkb_point(uchar* geom);
 uchar* output_wkb(uchar* geom);
 
+void write_twkb_uvarint(uint64_t val);
+void write_twkb_varint(int64_t val);
+uchar* output_twkb_point(uchar* geom);
+uchar* output_twkb_ordinate_array(uchar* geom);
+uchar* output_twkb_polygon(uchar* geom);
+uchar* output_twkb(uchar* geom, int header);
+void output_twkb_prefix(size_t body_start, int has_size, int has_bbox);
+
 /*-- Globals ----------------------------------------------- */
 
-static int unparser_ferror_occured;
-static int dims;
-static allocator local_malloc;
-static freeor local_free;
-static char*  out_start;
-static char*  out_pos;
-static int len;
-static int lwgi;
-static uchar endianbyte;
-void (*write_wkb_bytes)(uchar* ptr,unsigned int cnt,size_t size);
+static LW_THREAD_LOCAL int unparser_ferror_occured;
+static LW_THREAD_LOCAL int dims;
+static LW_THREAD_LOCAL allocator local_malloc;
+static LW_THREAD_LOCAL freeor local_free;
+static LW_THREAD_LOCAL char*  out_start;
+static LW_THREAD_LOCAL char*  out_pos;
+static LW_THREAD_LOCAL int len;
+static LW_THREAD_LOCAL int lwgi;
+static LW_THREAD_LOCAL uchar endianbyte;
+LW_THREAD_LOCAL void (*write_wkb_bytes)(uchar* ptr,unsigned int cnt,size_t size);
+static LW_THREAD_LOCAL int twkb_precision;
+static LW_THREAD_LOCAL uchar twkb_variant;
+static LW_THREAD_LOCAL const int64_t *twkb_ids;
+static LW_THREAD_LOCAL double twkb_factor[4];
+static LW_THREAD_LOCAL int64_t twkb_last[4];
+static LW_THREAD_LOCAL int64_t twkb_min[4];
+static LW_THREAD_LOCAL int64_t twkb_max[4];
 
 /*
  * Unparser current instance check flags - a bitmap of flags that determine which checks are enabled during the current unparse
  * (see liblwgeom.h for the related PARSER_CHECK constants)
  */
-int current_unparser_check_flags;
+LW_THREAD_LOCAL int current_unparser_check_flags;
 
 /*
  * Unparser current instance result structure - the result structure being used for the current unparse
  */
-LWGEOM_UNPARSER_RESULT *current_lwg_unparser_result;
+LW_THREAD_LOCAL LWGEOM_UNPARSER_RESULT *current_lwg_unparser_result;
 
 /*
  * Unparser error messages
@@ -96,7 +111,8 @@ const char *unparser_error_messages[] =
 	"",
 	"geometry requires more points",
 	"geometry must have an odd number of points",
-	"geometry contains non-closed rings"
+	"geometry contains non-closed rings",
+	"geometry type not supported by TWKB"
 };
 
 /* Macro to return the error message and the current position within WKT */
@@ -1116,6 +1132,300 @@ unparse_WKB(LWGEOM_UNPARSER_RESULT *lwg_unparser_result, uchar* serialized, allo
 }
 
 
+/*-- TWKB ------------------------------------------------- */
+
+/*
+ * TWKB (tiny WKB) scales every ordinate by 10^precision, rounds it to
+ * an integer and writes the difference from the previous point as a
+ * zig-zag encoded varint, so data known to a centimetre or so packs in
+ * one or two bytes per ordinate instead of eight.
+ *
+ * Each geometry starts with a type byte (type in the low nibble, the
+ * zig-zagged xy precision in the high one) and a metadata byte, followed
+ * by an extended dimensions byte when there is a Z or M. The parts of a
+ * MULTI* carry no header of their own and keep on from the deltas of the
+ * previous part; the members of a GEOMETRYCOLLECTION are complete TWKB
+ * geometries.
+ *
+ * Optional sections follow the header, flagged in the metadata byte: the
+ * byte size of the rest of the geometry (TWKB_SIZE), the scaled bounding
+ * box as a minimum and extent per dimension (TWKB_BBOX), and for the
+ * top level MULTI* or collection a list of ids, one per part.
+ */
+
+void
+write_twkb_uvarint(uint64_t val)
+{
+	ensure(10);
+	while ( val >= 0x80 )
+	{
+		*out_pos++ = (char)((val & 0x7f) | 0x80);
+		val >>= 7;
+	}
+	*out_pos++ = (char)val;
+}
+
+void
+write_twkb_varint(int64_t val)
+{
+	/* Zig-zag, so small negative deltas stay small too */
+	write_twkb_uvarint(((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+uchar *
+output_twkb_point(uchar* geom)
+{
+	int64_t val;
+	int i;
+
+	for ( i = 0 ; i < dims ; i++ )
+	{
+		val = (int64_t)round(read_double(&geom) * twkb_factor[i]);
+		write_twkb_varint(val - twkb_last[i]);
+		twkb_last[i] = val;
+		if ( val < twkb_min[i] ) twkb_min[i] = val;
+		if ( val > twkb_max[i] ) twkb_max[i] = val;
+	}
+	return geom;
+}
+
+uchar *
+output_twkb_ordinate_array(uchar* geom)
+{
+	int cnt = read_int(&geom);
+
+	write_twkb_uvarint(cnt);
+	while (cnt--) geom = output_twkb_point(geom);
+	return geom;
+}
+
+uchar *
+output_twkb_polygon(uchar* geom)
+{
+	int cnt = read_int(&geom);
+
+	write_twkb_uvarint(cnt);
+	while (cnt--) geom = output_twkb_ordinate_array(geom);
+	return geom;
+}
+
+/*
+ * The size and the bounding box are only known once the body has been
+ * written, so write them after it and rotate them in front.
+ */
+void
+output_twkb_prefix(size_t body_start, int has_size, int has_bbox)
+{
+	size_t body_end = out_pos - out_start;
+	size_t bbox_len, prefix_len;
+	char *prefix;
+	int i;
+
+	if ( has_bbox )
+	{
+		for ( i = 0 ; i < dims ; i++ )
+		{
+			write_twkb_varint(twkb_min[i]);
+			write_twkb_varint(twkb_max[i] - twkb_min[i]);
+		}
+	}
+	bbox_len = (out_pos - out_start) - body_end;
+
+	/* The size counts everything after itself */
+	if ( has_size )
+		write_twkb_uvarint(bbox_len + body_end - body_start);
+	prefix_len = (out_pos - out_start) - body_end;
+
+	/* Now [body][bbox][size], want [size][bbox][body] */
+	prefix = local_malloc(prefix_len);
+	memcpy(prefix, out_start + body_end, prefix_len);
+	memmove(out_start + body_start + prefix_len, out_start + body_start, body_end - body_start);
+	memcpy(out_start + body_start, prefix + bbox_len, prefix_len - bbox_len);
+	memcpy(out_start + body_start + prefix_len - bbox_len, prefix, bbox_len);
+	local_free(prefix);
+
+	out_pos = out_start + body_end + prefix_len;
+}
+
+uchar *
+output_twkb(uchar* geom, int header)
+{
+	uchar type = *geom++;
+	int twkbtype = TYPE_GETTYPE(type);
+	int hasz = TYPE_HASZ(type);
+	int hasm = TYPE_HASM(type);
+	int ndims = TYPE_NDIMS(type);
+	const int64_t *ids = NULL;
+	int has_size = 0, has_bbox = 0;
+	int64_t outer_min[4], outer_max[4];
+	size_t body_start = 0;
+	int zmprecision;
+	int empty = 0;
+	int cnt;
+	int i;
+
+	LWDEBUGF(2, "output_twkb type %d header %d", twkbtype, header);
+
+	dims = ndims;
+
+	/* TWKB carries neither the bounding box nor the SRID */
+	if ( TYPE_HASBBOX(type) )
+		geom += 16;
+	if ( TYPE_HASSRID(type) )
+		geom += 4;
+
+	switch (twkbtype)
+	{
+	case POINTTYPE:
+	case LINETYPE:
+	case POLYGONTYPE:
+	case MULTIPOINTTYPE:
+	case MULTILINETYPE:
+	case MULTIPOLYGONTYPE:
+	case COLLECTIONTYPE:
+		break;
+	default:
+		LWGEOM_WKB_UNPARSER_ERROR(UNPARSER_ERROR_TWKBTYPE);
+		return geom;
+	}
+
+	if ( twkbtype != POINTTYPE )
+	{
+		memcpy(&cnt, geom, 4);
+		empty = ( cnt == 0 );
+	}
+
+	if ( header )
+	{
+		/* Z and M keep their own, non negative, precision */
+		zmprecision = twkb_precision < 0 ? 0 : ( twkb_precision > 7 ? 7 : twkb_precision );
+
+		/* Empties have nothing to measure, ids go on the top level only */
+		if ( ! empty )
+		{
+			has_size = twkb_variant & TWKB_SIZE;
+			has_bbox = twkb_variant & TWKB_BBOX;
+			if ( twkbtype >= MULTIPOINTTYPE )
+				ids = twkb_ids;
+		}
+		twkb_ids = NULL;
+
+		ensure(3);
+		*out_pos++ = (char)(twkbtype | (((twkb_precision << 1) ^ (twkb_precision >> 31)) << 4));
+		*out_pos++ = (char)((has_bbox ? 0x01 : 0) | (has_size ? 0x02 : 0) | (ids ? 0x04 : 0) |
+		                    ((hasz || hasm) ? 0x08 : 0) | (empty ? 0x10 : 0));
+		if ( hasz || hasm )
+		{
+			*out_pos++ = (char)(hasz | (hasm << 1) |
+			                    (hasz ? zmprecision << 2 : 0) |
+			                    (hasm ? zmprecision << 5 : 0));
+		}
+
+		twkb_factor[0] = twkb_factor[1] = pow(10.0, twkb_precision);
+		twkb_factor[2] = twkb_factor[3] = pow(10.0, zmprecision);
+		for ( i = 0 ; i < 4 ; i++ )
+			twkb_last[i] = 0;
+
+		if ( empty )
+			return geom + 4;
+
+		body_start = out_pos - out_start;
+		for ( i = 0 ; i < 4 ; i++ )
+		{
+			outer_min[i] = twkb_min[i];
+			outer_max[i] = twkb_max[i];
+			twkb_min[i] = INT64_MAX;
+			twkb_max[i] = INT64_MIN;
+		}
+	}
+
+	switch (twkbtype)
+	{
+	case POINTTYPE:
+		geom = output_twkb_point(geom);
+		break;
+	case LINETYPE:
+		geom = output_twkb_ordinate_array(geom);
+		break;
+	case POLYGONTYPE:
+		geom = output_twkb_polygon(geom);
+		break;
+	case MULTIPOINTTYPE:
+	case MULTILINETYPE:
+	case MULTIPOLYGONTYPE:
+		cnt = read_int(&geom);
+		write_twkb_uvarint(cnt);
+		for ( i = 0 ; ids && i < cnt ; i++ )
+			write_twkb_varint(ids[i]);
+		while (cnt--) geom = output_twkb(geom, 0);
+		break;
+	case COLLECTIONTYPE:
+		cnt = read_int(&geom);
+		write_twkb_uvarint(cnt);
+		for ( i = 0 ; ids && i < cnt ; i++ )
+			write_twkb_varint(ids[i]);
+		while (cnt--) geom = output_twkb(geom, 1);
+		break;
+	}
+
+	if ( header )
+	{
+		dims = ndims;
+		if ( has_size || has_bbox )
+			output_twkb_prefix(body_start, has_size, has_bbox);
+
+		/* Fold our extent into the enclosing collection's */
+		for ( i = 0 ; i < 4 ; i++ )
+		{
+			twkb_min[i] = LW_MIN(outer_min[i], twkb_min[i]);
+			twkb_max[i] = LW_MAX(outer_max[i], twkb_max[i]);
+		}
+	}
+	return geom;
+}
+
+int
+unparse_TWKB(LWGEOM_UNPARSER_RESULT *lwg_unparser_result, uchar* serialized, allocator alloc, freeor free, int flags, int precision, uchar variant, const int64_t *ids)
+{
+	int i;
+
+	LWDEBUGF(2, "unparse_TWKB(%p,...) called with precision %d", serialized, precision);
+
+	if (serialized==NULL)
+		return 0;
+
+	/* Setup the inital parser flags and empty the return struct */
+	current_lwg_unparser_result = lwg_unparser_result;
+	current_unparser_check_flags = flags;
+	lwg_unparser_result->wkoutput = NULL;
+	lwg_unparser_result->size = 0;
+	lwg_unparser_result->serialized_lwgeom = serialized;
+
+	unparser_ferror_occured = 0;
+	local_malloc=alloc;
+	local_free=free;
+	len = 128;
+	out_start = out_pos = alloc(len);
+	lwgi=0;
+	twkb_precision = precision;
+	twkb_variant = variant;
+	twkb_ids = ids;
+	for ( i = 0 ; i < 4 ; i++ )
+	{
+		twkb_min[i] = INT64_MAX;
+		twkb_max[i] = INT64_MIN;
+	}
+
+	output_twkb(serialized, 1);
+
+	/* Store the result in the struct */
+	lwg_unparser_result->wkoutput = out_start;
+	lwg_unparser_result->size = (out_pos-out_start);
+
+	return unparser_ferror_occured;
+}
+
+
 /******************************************************************
  * $Log$
  * Revision 1.23  2006/02/06 11:12:22  strk
@@ -132,6 +132,8 @@ int parse_lwg(LWGEOM_PARSER_RESULT *lwg_parser_result, const char* wkt, int flag
 int parse_lwgi(LWGEOM_PARSER_RESULT *lwg_parser_result, const char* wkt, int flags, allocator allocfunc,report_error errfunc);
 int unparse_WKT(LWGEOM_UNPARSER_RESULT *lwg_unparser_result, uchar* serialized, allocator alloc, freeor free, int flags);
 int unparse_WKB(LWGEOM_UNPARSER_RESULT *lwg_unparser_result, uchar* serialized, allocator alloc, freeor free, int flags, char endian, uchar hexform);
+int parse_twkb(LWGEOM_PARSER_RESULT *lwg_parser_result, const uchar* twkb, size_t size, int flags, allocator allocfunc, report_error errfunc);
+int unparse_TWKB(LWGEOM_UNPARSER_RESULT *lwg_unparser_result, uchar* serialized, allocator alloc, freeor free, int flags, int precision, uchar variant, const int64_t *ids);
 int lwg_parse_yyparse(void);
 int lwg_parse_yyerror(char* s);
 void lwg_parse_yynotice(char* s);
@@ -1156,6 +1156,69 @@ DBFReadStringAttribute( DBFHandle psDBF, int iRecord, int iField )
     return( (const char *) DBFReadAttribute( psDBF, iRecord, iField, 'C' ) );
 }
 
+/************************************************************************/
+/*                        DBFReadAttributeView()                        */
+/*                                                                      */
+/*      Return a pointer to the value of a field as it is stored in     */
+/*      the record, with its length in *pnLength, instead of copying    */
+/*      it.  White space is trimmed as by DBFReadStringAttribute(),     */
+/*      but the value is not null terminated.  It is valid until the    */
+/*      next read from the file, or until it is closed if the file      */
+/*      was opened with the mmap hooks.                                 */
+/************************************************************************/
+
+const char SHPAPI_CALL1(*)
+DBFReadAttributeView( DBFHandle psDBF, int iRecord, int iField, int *pnLength )
+
+{
+    const char	*pszRec, *pszValue, *pszEnd;
+
+    if( iRecord < 0 || iRecord >= psDBF->nRecords )
+        return( NULL );
+
+    if( iField < 0 || iField >= psDBF->nFields )
+        return( NULL );
+
+/* -------------------------------------------------------------------- */
+/*      Use the record in place if the file is mapped, unless it is     */
+/*      the current record, which may have been modified.               */
+/* -------------------------------------------------------------------- */
+    pszRec = NULL;
+    if( psDBF->nCurrentRecord != iRecord )
+        pszRec = (const char *) psDBF->sHooks.FMap( psDBF->fp,
+            psDBF->nRecordLength * (SAOffset) iRecord + psDBF->nHeaderLength,
+            psDBF->nRecordLength );
+
+    if( pszRec == NULL )
+    {
+        if( !DBFLoadRecord( psDBF, iRecord ) )
+            return NULL;
+
+        pszRec = psDBF->pszCurrentRecord;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      The value ends at a null, as DBFReadAttribute() copies it with  */
+/*      strncpy().                                                      */
+/* -------------------------------------------------------------------- */
+    pszValue = pszRec + psDBF->panFieldOffset[iField];
+    pszEnd = (const char *) memchr( pszValue, '\0', psDBF->panFieldSize[iField] );
+    if( pszEnd == NULL )
+        pszEnd = pszValue + psDBF->panFieldSize[iField];
+
+#ifdef TRIM_DBF_WHITESPACE
+    while( pszValue < pszEnd && *pszValue == ' ' )
+        pszValue++;
+
+    while( pszEnd > pszValue && *(pszEnd - 1) == ' ' )
+        pszEnd--;
+#endif
+
+    *pnLength = (int) (pszEnd - pszValue);
+
+    return( pszValue );
+}
+
 /************************************************************************/
 /*                        DBFReadLogicalAttribute()                     */
 /*                                                                      */
@@ -1182,14 +1245,31 @@ DBFIsAttributeNULL( DBFHandle psDBF, int iRecord, int iField )
 
 {
     const char	*pszValue;
-    int i;
 
     pszValue = DBFReadStringAttribute( psDBF, iRecord, iField );
 
     if( pszValue == NULL )
         return TRUE;
 
-    switch(psDBF->pachFieldType[iField])
+    return DBFIsValueNULL( psDBF->pachFieldType[iField], pszValue,
+                           strlen(pszValue) );
+}
+
+/************************************************************************/
+/*                           DBFIsValueNULL()                           */
+/*                                                                      */
+/*      Return TRUE if the nLength byte value of a field of type        */
+/*      chType, as returned by DBFReadStringAttribute() or              */
+/*      DBFReadAttributeView(), is NULL.                                */
+/************************************************************************/
+
+int SHPAPI_CALL
+DBFIsValueNULL( char chType, const char *pszValue, int nLength )
+
+{
+    int i;
+
+    switch(chType)
     {
       case 'N':
       case 'F':
@@ -1198,10 +1278,10 @@ DBFIsAttributeNULL( DBFHandle psDBF, int iRecord, int iField )
         ** though according to the spec I think it should be all 
         ** asterisks. 
         */
-        if( pszValue[0] == '*' )
+        if( nLength > 0 && pszValue[0] == '*' )
             return TRUE;
 
-        for( i = 0; pszValue[i] != '\0'; i++ )
+        for( i = 0; i < nLength; i++ )
         {
             if( pszValue[i] != ' ' )
                 return FALSE;
@@ -1210,28 +1290,25 @@ DBFIsAttributeNULL( DBFHandle psDBF, int iRecord, int iField )
 
       case 'D':
         /* NULL date fields have value "00000000" */
-        if (pszValue[0] == '\0' ||                  // emtpy string
-            strncmp(pszValue,"00000000",8) == 0 || 
-            strncmp(pszValue,"        ",8) == 0) {
+        if (nLength == 0 ||                  // emtpy string
+            (nLength >= 8 && strncmp(pszValue,"00000000",8) == 0) || 
+            (nLength >= 8 && strncmp(pszValue,"        ",8) == 0)) {
             return 1;
         } else {
             return 0;
         }
-        // return strncmp(pszValue,"00000000",8) == 0;
 
       case 'L':
-        // printf("Is [%s] NULL?", pszValue);
         /* NULL boolean fields have value "?" */ 
-	if (pszValue[0] == '\0' || pszValue[0] == '?') {
+	if (nLength == 0 || pszValue[0] == '?') {
 		return 1;
 	} else {
 		return 0;
 	}
-        // return pszValue[0] == '?';
 
       default:
         /* empty string fields are considered NULL */
-        return strlen(pszValue) == 0;
+        return nLength == 0;
     }
 }
 
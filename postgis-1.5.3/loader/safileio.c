@@ -65,6 +65,13 @@
 #include <string.h>
 #include <stdio.h>
 
+#ifndef SHPAPI_WINDOWS
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#endif
+
 SHP_CVSID("$Id: safileio.c,v 1.4 2008-01-16 20:05:14 bram Exp $");
 
 #ifdef SHPAPI_UTF8_HOOKS
@@ -84,6 +91,7 @@ SAOffset SADFSeek( SAFile file, SAOffset offset, int whence );
 SAOffset SADFTell( SAFile file );
 int SADFFlush( SAFile file );
 int SADFClose( SAFile file );
+const void *SADFMap( SAFile file, SAOffset offset, SAOffset size );
 int SADRemove( const char *filename );
 void SADError( const char *message );
 
@@ -159,6 +167,18 @@ int SADFClose( SAFile file )
     return fclose( (FILE *) file );
 }
 
+/************************************************************************/
+/*                              SADFMap()                               */
+/*                                                                      */
+/*      stdio files are never mapped, so callers always have to read.   */
+/************************************************************************/
+
+const void *SADFMap( SAFile file, SAOffset offset, SAOffset size )
+
+{
+    return NULL;
+}
+
 /************************************************************************/
 /*                             SADFClose()                              */
 /************************************************************************/
@@ -193,12 +213,245 @@ void SASetupDefaultHooks( SAHooks *psHooks )
     psHooks->FTell   = SADFTell;
     psHooks->FFlush  = SADFFlush;
     psHooks->FClose  = SADFClose;
+    psHooks->FMap    = SADFMap;
     psHooks->Remove  = SADRemove;
 
     psHooks->Error   = SADError;
     psHooks->Atof    = atof;
 }
 
+#ifndef SHPAPI_WINDOWS
+
+/************************************************************************/
+/*                               SAMFile                                */
+/*                                                                      */
+/*      File of the mmap hooks.  Files opened for reading only are      */
+/*      mapped into memory whole, so that FRead() is a memcpy() and     */
+/*      FMap() can hand out pointers to records without copying them.   */
+/*      Anything else, or a file which cannot be mapped, uses stdio.    */
+/*      Setting SHAPELIB_NO_MMAP in the environment makes every file    */
+/*      use stdio, so that the regression tests can cover that path.    */
+/************************************************************************/
+
+typedef struct
+{
+    FILE          *fp;          /* stdio file, or NULL if mapped */
+    unsigned char *pabyData;    /* Mapping of the file */
+    SAOffset       nSize;
+    SAOffset       nOffset;
+} SAMFile;
+
+/************************************************************************/
+/*                              SAMFOpen()                              */
+/************************************************************************/
+
+static SAFile SAMFOpen( const char *pszFilename, const char *pszAccess )
+
+{
+    SAMFile *psFile;
+    struct stat sStat;
+    void *pData = MAP_FAILED;
+    int fd;
+
+    psFile = (SAMFile *) calloc( 1, sizeof(SAMFile) );
+
+    if( strpbrk( pszAccess, "wa+" ) == NULL && getenv( "SHAPELIB_NO_MMAP" ) == NULL )
+    {
+        fd = open( pszFilename, O_RDONLY );
+        if( fd == -1 )
+        {
+            free( psFile );
+            return NULL;
+        }
+
+        /* Empty files cannot be mapped, and are left to stdio */
+        if( fstat( fd, &sStat ) == 0 && sStat.st_size > 0 )
+            pData = mmap( NULL, (size_t) sStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        close( fd );
+
+        if( pData != MAP_FAILED )
+        {
+            psFile->pabyData = (unsigned char *) pData;
+            psFile->nSize = (SAOffset) sStat.st_size;
+
+            return (SAFile) psFile;
+        }
+    }
+
+    psFile->fp = fopen( pszFilename, pszAccess );
+    if( psFile->fp == NULL )
+    {
+        free( psFile );
+        return NULL;
+    }
+
+    return (SAFile) psFile;
+}
+
+/************************************************************************/
+/*                              SAMFRead()                              */
+/************************************************************************/
+
+static SAOffset SAMFRead( void *p, SAOffset size, SAOffset nmemb, SAFile file )
+
+{
+    SAMFile *psFile = (SAMFile *) file;
+    SAOffset nAvailable;
+
+    if( psFile->fp != NULL )
+        return (SAOffset) fread( p, (size_t) size, (size_t) nmemb, psFile->fp );
+
+    if( size == 0 || psFile->nOffset >= psFile->nSize )
+        return 0;
+
+    /* Only whole items are read, as fread() would return */
+    nAvailable = (psFile->nSize - psFile->nOffset) / size;
+    if( nmemb > nAvailable )
+        nmemb = nAvailable;
+
+    memcpy( p, psFile->pabyData + psFile->nOffset, (size_t) (size * nmemb) );
+    psFile->nOffset += size * nmemb;
+
+    return nmemb;
+}
+
+/************************************************************************/
+/*                             SAMFWrite()                              */
+/************************************************************************/
+
+static SAOffset SAMFWrite( void *p, SAOffset size, SAOffset nmemb, SAFile file )
+
+{
+    SAMFile *psFile = (SAMFile *) file;
+
+    if( psFile->fp != NULL )
+        return (SAOffset) fwrite( p, (size_t) size, (size_t) nmemb, psFile->fp );
+
+    /* Mapped files are read only */
+    return 0;
+}
+
+/************************************************************************/
+/*                              SAMFSeek()                              */
+/************************************************************************/
+
+static SAOffset SAMFSeek( SAFile file, SAOffset offset, int whence )
+
+{
+    SAMFile *psFile = (SAMFile *) file;
+
+    if( psFile->fp != NULL )
+        return (SAOffset) fseek( psFile->fp, (long) offset, whence );
+
+    /* As with fseek(), seeking past the end is allowed, and reads there return nothing */
+    if( whence == SEEK_SET )
+        psFile->nOffset = offset;
+    else if( whence == SEEK_CUR )
+        psFile->nOffset += offset;
+    else if( whence == SEEK_END )
+        psFile->nOffset = psFile->nSize + offset;
+    else
+        return (SAOffset) -1;
+
+    return 0;
+}
+
+/************************************************************************/
+/*                              SAMFTell()                              */
+/************************************************************************/
+
+static SAOffset SAMFTell( SAFile file )
+
+{
+    SAMFile *psFile = (SAMFile *) file;
+
+    if( psFile->fp != NULL )
+        return (SAOffset) ftell( psFile->fp );
+
+    return psFile->nOffset;
+}
+
+/************************************************************************/
+/*                             SAMFFlush()                              */
+/************************************************************************/
+
+static int SAMFFlush( SAFile file )
+
+{
+    SAMFile *psFile = (SAMFile *) file;
+
+    if( psFile->fp != NULL )
+        return fflush( psFile->fp );
+
+    return 0;
+}
+
+/************************************************************************/
+/*                             SAMFClose()                              */
+/************************************************************************/
+
+static int SAMFClose( SAFile file )
+
+{
+    SAMFile *psFile = (SAMFile *) file;
+    int nRet = 0;
+
+    if( psFile->fp != NULL )
+        nRet = fclose( psFile->fp );
+    else
+        nRet = munmap( psFile->pabyData, (size_t) psFile->nSize );
+
+    free( psFile );
+
+    return nRet;
+}
+
+/************************************************************************/
+/*                              SAMFMap()                               */
+/*                                                                      */
+/*      Return a pointer to size bytes at offset in a mapped file,      */
+/*      valid until the file is closed, or NULL if the file is not      */
+/*      mapped or is too short.                                         */
+/************************************************************************/
+
+static const void *SAMFMap( SAFile file, SAOffset offset, SAOffset size )
+
+{
+    SAMFile *psFile = (SAMFile *) file;
+
+    if( psFile->fp != NULL || offset > psFile->nSize
+        || size > psFile->nSize - offset )
+        return NULL;
+
+    return psFile->pabyData + offset;
+}
+
+#endif
+
+/************************************************************************/
+/*                          SASetupMmapHooks()                          */
+/*                                                                      */
+/*      Hooks which read files through mmap() where possible.  On       */
+/*      platforms without mmap() these are the default hooks.           */
+/************************************************************************/
+
+void SASetupMmapHooks( SAHooks *psHooks )
+
+{
+    SASetupDefaultHooks( psHooks );
+
+#ifndef SHPAPI_WINDOWS
+    psHooks->FOpen   = SAMFOpen;
+    psHooks->FRead   = SAMFRead;
+    psHooks->FWrite  = SAMFWrite;
+    psHooks->FSeek   = SAMFSeek;
+    psHooks->FTell   = SAMFTell;
+    psHooks->FFlush  = SAMFFlush;
+    psHooks->FClose  = SAMFClose;
+    psHooks->FMap    = SAMFMap;
+#endif
+}
+
 
 
 
@@ -289,6 +542,7 @@ void SASetupUtf8Hooks( SAHooks *psHooks )
     psHooks->FTell   = SADFTell;
     psHooks->FFlush  = SADFFlush;
     psHooks->FClose  = SADFClose;
+    psHooks->FMap    = SADFMap;
 
     psHooks->Error   = SADError;
     psHooks->Atof    = atof;
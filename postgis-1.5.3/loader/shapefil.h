@@ -243,6 +243,7 @@ typedef struct {
     SAOffset   (*FTell) ( SAFile file );
     int        (*FFlush)( SAFile file );
     int        (*FClose)( SAFile file );
+    const void *(*FMap) ( SAFile file, SAOffset offset, SAOffset size );
     int        (*Remove) ( const char *filename );
 
     void       (*Error) ( const char *message );
@@ -250,6 +251,7 @@ typedef struct {
 } SAHooks;
 
 void SHPAPI_CALL SASetupDefaultHooks( SAHooks *psHooks );
+void SHPAPI_CALL SASetupMmapHooks( SAHooks *psHooks );
 #ifdef SHPAPI_UTF8_HOOKS
 void SHPAPI_CALL SASetupUtf8Hooks( SAHooks *psHooks );
 #endif
@@ -346,8 +348,43 @@ typedef struct
     double	dfMMax;
 
     int		bMeasureIsUsed;
+
+    int		bArraysInObject; /* arrays allocated with the object by SHPReadObject() */
 } SHPObject;
 
+/* -------------------------------------------------------------------- */
+/*      SHPObjectView - a shape as it is stored in the .shp file,       */
+/*      pointing into the file mapping (or the handle's record          */
+/*      buffer) rather than copied.  The arrays are little endian and   */
+/*      may not be aligned.  A view is valid until the next read from   */
+/*      the handle, or until it is closed if the .shp file is mapped.   */
+/* -------------------------------------------------------------------- */
+typedef struct
+{
+    int		nSHPType;
+
+    int		nShapeId;
+
+    int		nParts;
+    const unsigned char *pabyPartStart;	/* nParts int32 */
+    const unsigned char *pabyPartType;	/* nParts int32, SHPT_MULTIPATCH only */
+
+    int		nVertices;
+    const unsigned char *pabyXY;	/* nVertices X,Y pairs of doubles */
+    const unsigned char *pabyZ;		/* nVertices doubles, or NULL */
+    const unsigned char *pabyM;		/* nVertices doubles, or NULL */
+
+    double	dfXMin;
+    double	dfYMin;
+    double	dfZMin;
+    double	dfMMin;
+
+    double	dfXMax;
+    double	dfYMax;
+    double	dfZMax;
+    double	dfMMax;
+} SHPObjectView;
+
 /* -------------------------------------------------------------------- */
 /*      SHP API Prototypes                                              */
 /* -------------------------------------------------------------------- */
@@ -370,6 +407,10 @@ void SHPAPI_CALL
 
 SHPObject SHPAPI_CALL1(*)
       SHPReadObject( SHPHandle hSHP, int iShape );
+int SHPAPI_CALL
+      SHPReadObjectView( SHPHandle hSHP, int iShape, SHPObjectView *psView );
+double SHPAPI_CALL
+      SHPViewGetDouble( const unsigned char *pabyValue );
 int SHPAPI_CALL
       SHPWriteObject( SHPHandle hSHP, int iShape, SHPObject * psObject );
 
@@ -563,6 +604,11 @@ double 	SHPAPI_CALL
       DBFReadDoubleAttribute( DBFHandle hDBF, int iShape, int iField );
 const char SHPAPI_CALL1(*)
       DBFReadStringAttribute( DBFHandle hDBF, int iShape, int iField );
+const char SHPAPI_CALL1(*)
+      DBFReadAttributeView( DBFHandle hDBF, int iShape, int iField,
+                            int *pnLength );
+int     SHPAPI_CALL
+      DBFIsValueNULL( char chType, const char *pszValue, int nLength );
 const char SHPAPI_CALL1(*)
       DBFReadLogicalAttribute( DBFHandle hDBF, int iShape, int iField );
 int     SHPAPI_CALL
@@ -15,6 +15,533 @@
 
 #include "shp2pgsql-core.h"
 
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "libpq-fe.h"
+
+
+/*
+ * Parallel conversion (-j)
+ *
+ * Shapelib handles are not thread safe, so the records are read by a
+ * single reader thread in batches of LOADER_BATCH_SIZE into a ring of
+ * batch slots. Worker threads take the batches in turn and convert each
+ * record with ShpLoaderFormatRecord(), and the main thread writes the
+ * converted batches out in order, freeing each slot for the reader to
+ * refill. The output is therefore the same as a serial run.
+ */
+
+#define LOADER_BATCH_SIZE	64
+#define LOADER_SLOTS_PER_WORKER	4
+#define LOADER_MAX_WORKERS	64
+
+#define SLOT_EMPTY	0
+#define SLOT_READ	1
+#define SLOT_DONE	2
+
+/* Binary COPY data file (-b), or NULL when writing text to stdout */
+static FILE *binary_file = NULL;
+
+
+/*
+ * Direct load (-C)
+ *
+ * Instead of printing SQL for psql, connect to the database and stream the
+ * rows to COPY ... FROM stdin with PQputCopyData(), in buffers of
+ * LOADER_COPY_BUFFER_SIZE bytes. The records are always converted by the
+ * pipeline above (with one worker if -j is not given), so the conversion
+ * overlaps with the server inserting the rows already sent. With -T the
+ * COPY is ended and the transaction committed every so many rows, so that
+ * a failure late in a large load keeps the rows committed before it.
+ */
+
+#define LOADER_COPY_BUFFER_SIZE	(1024 * 1024)
+
+typedef struct loader_direct
+{
+	PGconn *conn;
+
+	/* COPY statement to restart the COPY with after each commit */
+	char *copy_statement;
+
+	/* Rows waiting to be sent */
+	char *buffer;
+	int buffered;
+
+	/* Rows per transaction, 0 for a single transaction */
+	int commit_rows;
+
+	/* Rows sent in this transaction, in total, and committed */
+	int transaction_rows;
+	int sent_rows;
+	int committed_rows;
+
+	/* Rows expected, for the progress report */
+	int total_rows;
+
+	struct timeval start;
+	struct timeval last_report;
+
+} LOADERDIRECT;
+
+static LOADERDIRECT *direct = NULL;
+
+typedef struct loader_batch
+{
+	/* SLOT_EMPTY, SLOT_READ or SLOT_DONE */
+	int status;
+
+	/* Number of records in this batch */
+	int count;
+
+	SHPLOADERRECORD records[LOADER_BATCH_SIZE];
+
+	/* Return code of ShpLoaderReadRecord() then ShpLoaderFormatRecord() */
+	int ret[LOADER_BATCH_SIZE];
+
+	/* Converted records, and their sizes in binary COPY mode */
+	char *output[LOADER_BATCH_SIZE];
+	int length[LOADER_BATCH_SIZE];
+
+	/* Error or warning messages */
+	char message[LOADER_BATCH_SIZE][SHPLOADERMSGLEN];
+
+} LOADERBATCH;
+
+typedef struct loader_pipeline
+{
+	SHPLOADERSTATE *state;
+
+	/* Ring of batch slots; batch b lives in slot b % num_slots */
+	LOADERBATCH *slots;
+	int num_slots;
+
+	/* Total number of batches */
+	int num_batches;
+
+	/* Batches read so far, and the next batch to convert */
+	int batches_read;
+	int next_convert;
+
+	/* Set once the reader has stopped */
+	int reader_done;
+
+	/* Set by the writer after an error to stop the reader */
+	int cancelled;
+
+	pthread_mutex_t lock;
+	pthread_cond_t slot_free;
+	pthread_cond_t batch_read;
+	pthread_cond_t batch_done;
+
+} LOADERPIPELINE;
+
+
+static double
+elapsed_seconds(struct timeval *from, struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_usec - from->tv_usec) / 1000000.0;
+}
+
+/* Report the rows sent so far and the load rate; final reports end the line */
+static void
+direct_report(int final)
+{
+	struct timeval now;
+	double seconds;
+
+	gettimeofday(&now, NULL);
+	seconds = elapsed_seconds(&direct->start, &now);
+
+	if (!final)
+	{
+		/* At most once a second, overwriting the line on a terminal */
+		if (elapsed_seconds(&direct->last_report, &now) < 1.0)
+			return;
+
+		fprintf(stderr, "%d of %d rows loaded (%.0f rows/s)%s", direct->sent_rows, direct->total_rows,
+		        direct->sent_rows / seconds, isatty(fileno(stderr)) ? "\r" : "\n");
+	}
+	else
+	{
+		fprintf(stderr, "%d rows loaded in %.1f s (%.0f rows/s)\n", direct->sent_rows, seconds,
+		        seconds > 0 ? direct->sent_rows / seconds : 0.0);
+	}
+
+	direct->last_report = now;
+}
+
+/*
+ * Run a single SQL command, returning 0 on success or printing the error and
+ * returning 1. When PGRES_COMMAND_OK is expected, a command returning rows
+ * (such as SELECT AddGeometryColumn(...)) succeeds too.
+ */
+static int
+direct_exec(const char *sql, ExecStatusType expected)
+{
+	PGresult *res;
+	ExecStatusType status;
+	int failed;
+
+	res = PQexec(direct->conn, sql);
+	status = PQresultStatus(res);
+	failed = (status != expected && !(expected == PGRES_COMMAND_OK && status == PGRES_TUPLES_OK));
+	if (failed)
+		fprintf(stderr, "%s", PQerrorMessage(direct->conn));
+
+	PQclear(res);
+
+	return failed;
+}
+
+/*
+ * Run the statements of a header or footer one at a time, as psql would:
+ * a failure outside a transaction (such as dropping a table that does not
+ * exist) is reported and skipped, while one inside a transaction is fatal.
+ * Each statement ends with ";\n".
+ */
+static int
+direct_exec_script(char *script)
+{
+	char *sql = script, *end;
+
+	while (*sql)
+	{
+		end = strstr(sql, ";\n");
+		if (end)
+			end[1] = '\0';
+
+		if (direct_exec(sql, PGRES_COMMAND_OK) && PQtransactionStatus(direct->conn) != PQTRANS_IDLE)
+			return 1;
+
+		if (!end)
+			break;
+
+		sql = end + 2;
+	}
+
+	return 0;
+}
+
+/* Send the buffered rows to the server */
+static int
+direct_flush()
+{
+	if (direct->buffered > 0 && PQputCopyData(direct->conn, direct->buffer, direct->buffered) != 1)
+	{
+		fprintf(stderr, "%s", PQerrorMessage(direct->conn));
+		return 1;
+	}
+
+	direct->buffered = 0;
+
+	return 0;
+}
+
+/* Send the remaining rows and finish the COPY, checking that the server accepted them */
+static int
+direct_copy_end()
+{
+	PGresult *res;
+	int failed;
+
+	if (direct_flush())
+		return 1;
+
+	if (PQputCopyEnd(direct->conn, NULL) != 1)
+	{
+		fprintf(stderr, "%s", PQerrorMessage(direct->conn));
+		return 1;
+	}
+
+	res = PQgetResult(direct->conn);
+	failed = (PQresultStatus(res) != PGRES_COMMAND_OK);
+	if (failed)
+		fprintf(stderr, "COPY failed: %s", PQerrorMessage(direct->conn));
+
+	PQclear(res);
+
+	/* Collect the end of the command */
+	while ((res = PQgetResult(direct->conn)) != NULL)
+		PQclear(res);
+
+	return failed;
+}
+
+/* Queue a row for the COPY, committing and restarting the COPY every commit_rows rows */
+static int
+direct_write(char *record)
+{
+	int len = strlen(record);
+
+	/* Rows longer than the buffer are sent on their own */
+	if (direct->buffered + len + 1 > LOADER_COPY_BUFFER_SIZE && direct_flush())
+		return 1;
+
+	if (len + 1 > LOADER_COPY_BUFFER_SIZE)
+	{
+		if (PQputCopyData(direct->conn, record, len) != 1 || PQputCopyData(direct->conn, "\n", 1) != 1)
+		{
+			fprintf(stderr, "%s", PQerrorMessage(direct->conn));
+			return 1;
+		}
+	}
+	else
+	{
+		memcpy(direct->buffer + direct->buffered, record, len);
+		direct->buffer[direct->buffered + len] = '\n';
+		direct->buffered += len + 1;
+	}
+
+	direct->sent_rows++;
+	direct->transaction_rows++;
+
+	if (direct->commit_rows > 0 && direct->transaction_rows >= direct->commit_rows)
+	{
+		if (direct_copy_end() ||
+		        direct_exec("COMMIT", PGRES_COMMAND_OK) ||
+		        direct_exec("BEGIN", PGRES_COMMAND_OK) ||
+		        direct_exec(direct->copy_statement, PGRES_COPY_IN))
+			return 1;
+
+		direct->committed_rows = direct->sent_rows;
+		direct->transaction_rows = 0;
+	}
+
+	direct_report(0);
+
+	return 0;
+}
+
+
+/* Give up on a direct load, reporting how much of it was committed */
+static void
+direct_abort()
+{
+	if (direct->committed_rows > 0)
+		fprintf(stderr, "Load failed; the first %d rows were committed\n", direct->committed_rows);
+
+	PQfinish(direct->conn);
+}
+
+
+/*
+ * Write out a converted record: to the server, to the binary COPY file or
+ * as a line of SQL. Returns 0 on success, or 1 after printing an error.
+ */
+static int
+write_record(char *record, int len)
+{
+	if (direct)
+		return direct_write(record);
+
+	if (binary_file)
+		fwrite(record, 1, len, binary_file);
+	else
+		printf("%s\n", record);
+
+	return 0;
+}
+
+
+static void *
+loader_reader(void *arg)
+{
+	LOADERPIPELINE *pipeline = (LOADERPIPELINE *)arg;
+	SHPLOADERSTATE *state = pipeline->state;
+	int num_records = ShpLoaderGetRecordCount(state);
+	int b, i, failed = 0;
+
+	for (b = 0; b < pipeline->num_batches && !failed; b++)
+	{
+		LOADERBATCH *batch = &pipeline->slots[b % pipeline->num_slots];
+
+		/* Wait for the writer to hand back this slot */
+		pthread_mutex_lock(&pipeline->lock);
+		while (batch->status != SLOT_EMPTY && !pipeline->cancelled)
+			pthread_cond_wait(&pipeline->slot_free, &pipeline->lock);
+		failed = pipeline->cancelled;
+		pthread_mutex_unlock(&pipeline->lock);
+
+		if (failed)
+			break;
+
+		batch->count = 0;
+		for (i = b * LOADER_BATCH_SIZE; i < num_records && batch->count < LOADER_BATCH_SIZE; i++)
+		{
+			int n = batch->count++;
+
+			batch->output[n] = NULL;
+			batch->ret[n] = ShpLoaderReadRecord(state, i, &batch->records[n]);
+
+			/* Stop at the first read error; the writer reports it in order */
+			if (batch->ret[n] == SHPLOADERERR)
+			{
+				snprintf(batch->message[n], SHPLOADERMSGLEN, "%s", state->message);
+				failed = 1;
+				break;
+			}
+		}
+
+		pthread_mutex_lock(&pipeline->lock);
+		batch->status = SLOT_READ;
+		pipeline->batches_read++;
+		pthread_cond_broadcast(&pipeline->batch_read);
+		pthread_mutex_unlock(&pipeline->lock);
+	}
+
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->reader_done = 1;
+	pthread_cond_broadcast(&pipeline->batch_read);
+	pthread_cond_broadcast(&pipeline->batch_done);
+	pthread_mutex_unlock(&pipeline->lock);
+
+	return NULL;
+}
+
+
+static void *
+loader_worker(void *arg)
+{
+	LOADERPIPELINE *pipeline = (LOADERPIPELINE *)arg;
+	LOADERBATCH *batch;
+	int b, n;
+
+	for (;;)
+	{
+		/* Claim the next batch the reader has finished with */
+		pthread_mutex_lock(&pipeline->lock);
+		while (pipeline->next_convert >= pipeline->batches_read && !pipeline->reader_done)
+			pthread_cond_wait(&pipeline->batch_read, &pipeline->lock);
+
+		if (pipeline->next_convert >= pipeline->batches_read)
+		{
+			pthread_mutex_unlock(&pipeline->lock);
+			break;
+		}
+
+		b = pipeline->next_convert++;
+		pthread_mutex_unlock(&pipeline->lock);
+
+		batch = &pipeline->slots[b % pipeline->num_slots];
+		for (n = 0; n < batch->count; n++)
+		{
+			if (batch->ret[n] == SHPLOADEROK && pipeline->state->config->binary)
+				batch->ret[n] = ShpLoaderFormatRecordBinary(pipeline->state, &batch->records[n], &batch->output[n], &batch->length[n], batch->message[n]);
+			else if (batch->ret[n] == SHPLOADEROK)
+				batch->ret[n] = ShpLoaderFormatRecord(pipeline->state, &batch->records[n], &batch->output[n], batch->message[n]);
+
+			ShpLoaderFreeRecord(pipeline->state, &batch->records[n]);
+		}
+
+		pthread_mutex_lock(&pipeline->lock);
+		batch->status = SLOT_DONE;
+		pthread_cond_broadcast(&pipeline->batch_done);
+		pthread_mutex_unlock(&pipeline->lock);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Convert and write out all records using one reader thread and num_workers
+ * conversion threads. Returns 0 on success, or 1 after printing the
+ * first error.
+ */
+static int
+generate_rows_parallel(SHPLOADERSTATE *state, int num_workers)
+{
+	LOADERPIPELINE pipeline;
+	pthread_t reader;
+	pthread_t workers[LOADER_MAX_WORKERS];
+	int b, n, w, failed = 0;
+
+	pipeline.state = state;
+	pipeline.num_slots = num_workers * LOADER_SLOTS_PER_WORKER;
+	pipeline.slots = calloc(pipeline.num_slots, sizeof(LOADERBATCH));
+	pipeline.num_batches = (ShpLoaderGetRecordCount(state) + LOADER_BATCH_SIZE - 1) / LOADER_BATCH_SIZE;
+	pipeline.batches_read = 0;
+	pipeline.next_convert = 0;
+	pipeline.reader_done = 0;
+	pipeline.cancelled = 0;
+
+	pthread_mutex_init(&pipeline.lock, NULL);
+	pthread_cond_init(&pipeline.slot_free, NULL);
+	pthread_cond_init(&pipeline.batch_read, NULL);
+	pthread_cond_init(&pipeline.batch_done, NULL);
+
+	/* Set up the liblwgeom allocators before any thread can race to do it */
+	lwgeom_init_allocators();
+
+	pthread_create(&reader, NULL, loader_reader, &pipeline);
+	for (w = 0; w < num_workers; w++)
+		pthread_create(&workers[w], NULL, loader_worker, &pipeline);
+
+	/* Writer: print each batch once converted, in order */
+	for (b = 0; b < pipeline.num_batches && !failed; b++)
+	{
+		LOADERBATCH *batch = &pipeline.slots[b % pipeline.num_slots];
+
+		pthread_mutex_lock(&pipeline.lock);
+		while (batch->status != SLOT_DONE)
+			pthread_cond_wait(&pipeline.batch_done, &pipeline.lock);
+		pthread_mutex_unlock(&pipeline.lock);
+
+		for (n = 0; n < batch->count; n++)
+		{
+			switch (batch->ret[n])
+			{
+			case SHPLOADEROK:
+				failed = write_record(batch->output[n], batch->length[n]);
+				break;
+
+			case SHPLOADERERR:
+				/* Display the error message then stop */
+				fprintf(stderr, "%s\n", batch->message[n]);
+				failed = 1;
+				break;
+
+			case SHPLOADERWARN:
+				/* Display the warning, but continue */
+				fprintf(stderr, "%s\n", batch->message[n]);
+				failed = write_record(batch->output[n], batch->length[n]);
+				break;
+
+			case SHPLOADERRECDELETED:
+			case SHPLOADERRECISNULL:
+				/* Record is deleted, or NULL and skipped by policy - ignore */
+				break;
+			}
+
+			if (failed)
+				break;
+
+			free(batch->output[n]);
+		}
+
+		pthread_mutex_lock(&pipeline.lock);
+		batch->status = SLOT_EMPTY;
+		pipeline.cancelled = failed;
+		pthread_cond_broadcast(&pipeline.slot_free);
+		pthread_mutex_unlock(&pipeline.lock);
+	}
+
+	/* Once the reader has stopped the workers run out of batches and finish */
+	pthread_join(reader, NULL);
+	for (w = 0; w < num_workers; w++)
+		pthread_join(workers[w], NULL);
+
+	pthread_mutex_destroy(&pipeline.lock);
+	pthread_cond_destroy(&pipeline.slot_free);
+	pthread_cond_destroy(&pipeline.batch_read);
+	pthread_cond_destroy(&pipeline.batch_done);
+	free(pipeline.slots);
+
+	return failed;
+}
+
 
 static void
 usage()
@@ -22,7 +549,12 @@ usage()
 	printf("RCSID: %s RELEASE: %s\n", RCSID, POSTGIS_VERSION);
 	printf("USAGE: shp2pgsql [<options>] <shapefile> [<schema>.]<table>\n");
 	printf("OPTIONS:\n");
+#ifdef HAVE_LOADER_PROJ
+	printf("  -s [<from>:]<srid> Set the SRID field. Defaults to -1.\n");
+	printf("      Optionally reprojects from the given SRID.\n");
+#else
 	printf("  -s <srid>  Set the SRID field. Defaults to -1.\n");
+#endif
 	printf("  (-d|a|c|p) These are mutually exclusive options:\n");
 	printf("      -d  Drops the table, then recreates it and populates\n");
 	printf("          it with current shape file data.\n");
@@ -34,6 +566,8 @@ usage()
 	printf("  -g <geocolumn> Specify the name of the geometry/geography column.\n");
 	printf("      (mostly useful in append mode).\n");
 	printf("  -D  Use postgresql dump format (defaults to SQL insert statments).\n");
+	printf("  -b <file> Use binary dump format, writing the rows to <file> and\n");
+	printf("      loading them with \\copy (not with -G or -w).\n");
 	printf("  -G  Use geography type (requires lon/lat data).\n");
 	printf("  -k  Keep postgresql identifiers case.\n");
 	printf("  -i  Use int4 type for all integer dbf fields.\n");
@@ -44,6 +578,13 @@ usage()
 	printf("      attribute column. (default : \"WINDOWS-1252\").\n");
 	printf("  -N <policy> NULL geometries handling policy (insert*,skip,abort).\n");
 	printf("  -n  Only import DBF file.\n");
+	printf("  -H  Load the records in Hilbert curve order of their bounding boxes.\n");
+	printf("  -B <xmin,ymin,xmax,ymax> Only load the shapes intersecting this box,\n");
+	printf("      using the shapefile's .qix index if it has one.\n");
+	printf("  -j <threads> Convert records using this many threads.\n");
+	printf("  -C <conninfo> Load directly into the database given by the libpq\n");
+	printf("      connection string, using COPY, instead of printing SQL.\n");
+	printf("  -T <rows> With -C, commit every <rows> rows.\n");
 	printf("  -?  Display this help screen.\n");
 }
 
@@ -54,8 +595,12 @@ main (int argc, char **argv)
 	SHPLOADERCONFIG *config;
 	SHPLOADERSTATE *state;
 	char *header, *footer, *record;
+	char *binary_filename = NULL;
+	char *conninfo = NULL;
 	char c;
-	int ret, i;
+	int ret, i, len = 0;
+	int num_workers = 0;
+	int commit_rows = 0;
 
 
 	/* If no options are specified, display usage */
@@ -69,7 +614,7 @@ main (int argc, char **argv)
 	config = malloc(sizeof(SHPLOADERCONFIG));
 	set_config_defaults(config);
 
-	while ((c = pgis_getopt(argc, argv, "kcdapGDs:Sg:iW:wIN:n")) != EOF)
+	while ((c = pgis_getopt(argc, argv, "kcdapGDb:s:Sg:iW:wIN:nHB:j:C:T:")) != EOF)
 	{
 		switch (c)
 		{
@@ -84,6 +629,12 @@ main (int argc, char **argv)
 			config->dump_format = 1;
 			break;
 
+		case 'b':
+			config->dump_format = 1;
+			config->binary = 1;
+			binary_filename = pgis_optarg;
+			break;
+
 		case 'G':
 			config->geography = 1;
 			break;
@@ -95,7 +646,12 @@ main (int argc, char **argv)
 		case 's':
 			if (pgis_optarg)
 			{
-				sscanf(pgis_optarg, "%d", &(config->sr_id));
+				/* Either <srid> or <from>:<srid> to reproject */
+				if (sscanf(pgis_optarg, "%d:%d", &(config->shp_sr_id), &(config->sr_id)) != 2)
+				{
+					config->shp_sr_id = -1;
+					sscanf(pgis_optarg, "%d", &(config->sr_id));
+				}
 			}
 			else
 			{
@@ -133,6 +689,52 @@ main (int argc, char **argv)
 			config->encoding = pgis_optarg;
 			break;
 
+		case 'H':
+			config->spatial_order = 1;
+			break;
+
+		case 'B':
+			if (sscanf(pgis_optarg, "%lf,%lf,%lf,%lf", &(config->bbox[0]), &(config->bbox[1]),
+			           &(config->bbox[2]), &(config->bbox[3])) != 4 ||
+			        config->bbox[0] > config->bbox[2] || config->bbox[1] > config->bbox[3])
+			{
+				fprintf(stderr, "Bounding box must be given as xmin,ymin,xmax,ymax\n");
+				exit(1);
+			}
+			config->bbox_filter = 1;
+			break;
+
+		case 'j':
+			num_workers = atoi(pgis_optarg);
+			if (num_workers < 1 || num_workers > LOADER_MAX_WORKERS)
+			{
+				fprintf(stderr, "Number of threads must be between 1 and %d\n", LOADER_MAX_WORKERS);
+				exit(1);
+			}
+#if ! LW_HAVE_THREAD_LOCAL
+			/* The geometry unparser state is shared between threads in this build */
+			if (num_workers > 1)
+			{
+				fprintf(stderr, "This shp2pgsql was built without thread-local storage and cannot use more than 1 thread\n");
+				exit(1);
+			}
+#endif
+			break;
+
+		case 'C':
+			conninfo = pgis_optarg;
+			config->dump_format = 1;
+			break;
+
+		case 'T':
+			commit_rows = atoi(pgis_optarg);
+			if (commit_rows < 1)
+			{
+				fprintf(stderr, "Number of rows per transaction must be at least 1\n");
+				exit(1);
+			}
+			break;
+
 		case 'N':
 			switch (pgis_optarg[0])
 			{
@@ -161,6 +763,33 @@ main (int argc, char **argv)
 		}
 	}
 
+	/* Binary COPY carries raw EWKB, which only the geometry type can receive */
+	if (config->binary && (config->geography || config->hwgeom))
+	{
+		fprintf(stderr, "Binary dump format (-b) cannot be used with -G or -w\n");
+		exit(1);
+	}
+
+	/* A direct load streams text COPY rows itself; -T only applies to it */
+	if (conninfo && config->binary)
+	{
+		fprintf(stderr, "Direct load (-C) cannot be used with -b\n");
+		exit(1);
+	}
+
+	if (commit_rows && !conninfo)
+	{
+		fprintf(stderr, "-T can only be used with -C\n");
+		exit(1);
+	}
+
+	/* The bounding box filter works on the shapes, which -n does not read */
+	if (config->bbox_filter && !config->readshape)
+	{
+		fprintf(stderr, "-B cannot be used with -n\n");
+		exit(1);
+	}
+
 	/* Determine the shapefile name from the next argument, if no shape file, exit. */
 	if (pgis_optind < argc)
 	{
@@ -256,7 +885,23 @@ main (int argc, char **argv)
 		fprintf(stderr, "Postgis type: %s[%d]\n", state->pgtype, state->pgdims);
 	}
 
-	/* Print the header to stdout */
+	/* Connect for a direct load */
+	if (conninfo)
+	{
+		direct = calloc(1, sizeof(LOADERDIRECT));
+		direct->conn = PQconnectdb(conninfo);
+		if (PQstatus(direct->conn) == CONNECTION_BAD)
+		{
+			fprintf(stderr, "Connection failed: %s", PQerrorMessage(direct->conn));
+			exit(1);
+		}
+
+		direct->buffer = malloc(LOADER_COPY_BUFFER_SIZE);
+		direct->commit_rows = commit_rows;
+		direct->total_rows = ShpLoaderGetRecordCount(state);
+	}
+
+	/* Print the header to stdout, or run it on the server */
 	ret = ShpLoaderGetSQLHeader(state, &header);
 	if (ret != SHPLOADEROK)
 	{
@@ -266,15 +911,59 @@ main (int argc, char **argv)
 			exit(1);
 	}
 
-	printf("%s", header);
+	if (direct)
+	{
+		if (direct_exec_script(header))
+		{
+			direct_abort();
+			exit(1);
+		}
+	}
+	else
+		printf("%s", header);
+
 	free(header);
 
 	/* If we are not in "prepare" mode, go ahead and write out the data. */
 	if ( state->config->opt != 'p' )
 	{
 
+		/*
+		 * In binary COPY mode write the rows to the binary file and have psql
+		 * load it with \copy, as psql reads binary COPY data from stdin up to
+		 * the end of its input rather than up to a "\." line
+		 */
+		if (state->config->binary)
+		{
+			binary_file = fopen(binary_filename, "wb");
+			if (!binary_file)
+			{
+				fprintf(stderr, "Unable to open binary dump file \"%s\": %s\n", binary_filename, strerror(errno));
+				exit(1);
+			}
+
+			if (state->config->schema)
+				printf("\\copy \"%s\".\"%s\" %s from '", state->config->schema, state->config->table, state->col_names);
+			else
+				printf("\\copy \"%s\" %s from '", state->config->table, state->col_names);
+
+			/* Double any quotes in the file name */
+			for (i = 0; binary_filename[i]; i++)
+			{
+				if (binary_filename[i] == '\'')
+					putchar('\'');
+				putchar(binary_filename[i]);
+			}
+
+			printf("' with binary\n");
+
+			ShpLoaderGetBinaryCopyHeader(state, &header, &len);
+			fwrite(header, 1, len, binary_file);
+			free(header);
+		}
+
 		/* If in COPY mode, output the COPY statement */
-		if (state->config->dump_format)
+		else if (state->config->dump_format)
 		{
 			ret = ShpLoaderGetSQLCopyStatement(state, &header);
 			if (ret != SHPLOADEROK)
@@ -285,20 +974,57 @@ main (int argc, char **argv)
 					exit(1);
 			}
 
-			printf("%s", header);
-			free(header);
+			if (direct)
+			{
+				/* Keep the statement to restart the COPY after each commit */
+				direct->copy_statement = header;
+				if (direct_exec(header, PGRES_COPY_IN))
+				{
+					direct_abort();
+					exit(1);
+				}
+			}
+			else
+			{
+				printf("%s", header);
+				free(header);
+			}
+		}
+
+		/* A direct load always converts on worker threads, overlapping with sending the rows */
+		if (direct)
+		{
+			if (num_workers == 0)
+				num_workers = 1;
+
+			gettimeofday(&direct->start, NULL);
+			direct->last_report = direct->start;
+		}
+
+		/* Convert the records in parallel if asked to */
+		if (num_workers > 0)
+		{
+			if (generate_rows_parallel(state, num_workers))
+			{
+				if (direct)
+					direct_abort();
+				exit(1);
+			}
 		}
 
 		/* Main loop: iterate through all of the records and send them to stdout */
-		for (i = 0; i < ShpLoaderGetRecordCount(state); i++)
+		for (i = 0; num_workers == 0 && i < ShpLoaderGetRecordCount(state); i++)
 		{
-			ret = ShpLoaderGenerateSQLRowStatement(state, i, &record);
+			if (state->config->binary)
+				ret = ShpLoaderGenerateBinaryRow(state, i, &record, &len);
+			else
+				ret = ShpLoaderGenerateSQLRowStatement(state, i, &record);
 
 			switch (ret)
 			{
 			case SHPLOADEROK:
 				/* Simply display the geometry */
-				printf("%s\n", record);
+				write_record(record, len);
 				free(record);
 				break;
 
@@ -311,7 +1037,7 @@ main (int argc, char **argv)
 			case SHPLOADERWARN:
 				/* Display the warning, but continue */
 				fprintf(stderr, "%s\n", state->message);
-				printf("%s\n", record);
+				write_record(record, len);
 				free(record);
 				break;
 
@@ -325,8 +1051,28 @@ main (int argc, char **argv)
 			}
 		}
 
-		/* If in COPY mode, terminate the COPY statement */
-		if (state->config->dump_format)
+		/* Terminate the binary COPY data, or the COPY statement if in text COPY mode */
+		if (state->config->binary)
+		{
+			ShpLoaderGetBinaryCopyTrailer(state, &footer, &len);
+			fwrite(footer, 1, len, binary_file);
+			free(footer);
+
+			if (fclose(binary_file) != 0)
+			{
+				fprintf(stderr, "Unable to write binary dump file \"%s\": %s\n", binary_filename, strerror(errno));
+				exit(1);
+			}
+		}
+		else if (direct)
+		{
+			if (direct_copy_end())
+			{
+				direct_abort();
+				exit(1);
+			}
+		}
+		else if (state->config->dump_format)
 			printf("\\.\n");
 
 	}
@@ -341,7 +1087,25 @@ main (int argc, char **argv)
 			exit(1);
 	}
 
-	printf("%s", footer);
+	if (direct)
+	{
+		if (direct_exec_script(footer))
+		{
+			direct_abort();
+			exit(1);
+		}
+
+		if (state->config->opt != 'p')
+			direct_report(1);
+
+		PQfinish(direct->conn);
+		free(direct->copy_statement);
+		free(direct->buffer);
+		free(direct);
+	}
+	else
+		printf("%s", footer);
+
 	free(footer);
 
 
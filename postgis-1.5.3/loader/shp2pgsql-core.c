@@ -52,16 +52,16 @@ void lwgeom_init_allocators()
 #define UTF8_DROP_BAD_CHARACTERS 0
 
 
-int utf8(const char *fromcode, char *inputbuf, char **outputbuf);
+int utf8(iconv_t cd, char *inputbuf, size_t inbytesleft, char *outputbuf, size_t outbytesleft);
 char *escape_copy_string(char *str);
 char *escape_insert_string(char *str);
 
-int GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry);
-int GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry);
+int GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, int *size, char *message);
+int GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, int *size, char *message);
 int PIP(Point P, Point *V, int n);
 int FindPolygons(SHPObject *obj, Ring ***Out);
 void ReleasePolygons(Ring **polys, int npolys);
-int GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry);
+int GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, int *size, char *message);
 
 
 /* Append variadic formatted string to a stringbuffer */
@@ -86,60 +86,73 @@ vasbappend(stringbuffer_t *sb, char *fmt, ... )
 	va_end(ap);
 }
 
-/* Return allocated string containing UTF8 string converted from encoding fromcode */
-int utf8(const char *fromcode, char *inputbuf, char **outputbuf)
+/*
+ * Convert inbytesleft bytes at inputbuf to UTF8 using the iconv descriptor cd, writing a
+ * null-terminated string of at most outbytesleft bytes to outputbuf. The descriptor is
+ * left in its initial state, ready for the next value.
+ */
+int utf8(iconv_t cd, char *inputbuf, size_t inbytesleft, char *outputbuf, size_t outbytesleft)
 {
-	iconv_t cd;
-	char *outputptr;
-	size_t outbytesleft;
-	size_t inbytesleft;
-
-	inbytesleft = strlen(inputbuf);
-
-	cd = iconv_open("UTF-8", fromcode);
-	if ( cd == ((iconv_t)(-1)) )
-		return UTF8_NO_RESULT;
+	char *outputptr = outputbuf;
+	int rv = UTF8_GOOD_RESULT;
+	int err = 0;
 
-	outbytesleft = inbytesleft * 3 + 1; /* UTF8 string can be 3 times larger */
+	/* Leave room for the terminator */
+	outbytesleft--;
 
-	*outputbuf = (char *)malloc(outbytesleft);
-	if (!(*outputbuf))
-		return UTF8_NO_RESULT;
-
-    /* Clean out the buffer */
-	memset(*outputbuf, 0, outbytesleft);
-	outputptr = *outputbuf;
-
-    /* Does this string convert cleanly? */
+	/* Does this string convert cleanly? */
 	if ( iconv(cd, &inputbuf, &inbytesleft, &outputptr, &outbytesleft) == -1 )
 	{
 #ifdef HAVE_ICONVCTL
-        int on = 1;
-	    /* No. Try to convert it while transliterating. */
-        iconvctl(cd, ICONV_SET_TRANSLITERATE, &on);
-    	if ( iconv(cd, &inputbuf, &inbytesleft, &outputptr, &outbytesleft) == -1 )
-    	{
-	        /* No. Try to convert it while discarding errors. */
-            iconvctl(cd, ICONV_SET_DISCARD_ILSEQ, &on);
-        	if ( iconv(cd, &inputbuf, &inbytesleft, &outputptr, &outbytesleft) == -1 )
-        	{
-                /* Still no. Throw away the buffer and return. */
-                free(*outputbuf);
-                iconv_close(cd);
-                return UTF8_NO_RESULT;
-            }
-        }
-        iconv_close(cd);
-        return UTF8_BAD_RESULT;
+		int on = 1, off = 0;
+
+		/* No. Try to convert it while transliterating. */
+		iconvctl(cd, ICONV_SET_TRANSLITERATE, &on);
+		if ( iconv(cd, &inputbuf, &inbytesleft, &outputptr, &outbytesleft) == -1 )
+		{
+			/* No. Try to convert it while discarding errors. */
+			iconvctl(cd, ICONV_SET_DISCARD_ILSEQ, &on);
+			if ( iconv(cd, &inputbuf, &inbytesleft, &outputptr, &outbytesleft) == -1 )
+				rv = UTF8_NO_RESULT;
+			else
+				rv = UTF8_BAD_RESULT;
+		}
+		else
+			rv = UTF8_BAD_RESULT;
+		err = errno;
+
+		/* The descriptor is used for the rest of the load, so switch these back off */
+		iconvctl(cd, ICONV_SET_TRANSLITERATE, &off);
+		iconvctl(cd, ICONV_SET_DISCARD_ILSEQ, &off);
 #else
-        free(*outputbuf);
-        iconv_close(cd);
-        return UTF8_NO_RESULT;        
+		rv = UTF8_NO_RESULT;
+		err = errno;
 #endif
-    }
-    /* Return a good result, converted string is in buffer. */
-	iconv_close(cd);
-    return UTF8_GOOD_RESULT;
+	}
+
+	/* Reset the conversion state, writing out any final shift sequence */
+	iconv(cd, NULL, NULL, &outputptr, &outbytesleft);
+	*outputptr = '\0';
+
+	/* Callers report errno with the result */
+	if (rv != UTF8_GOOD_RESULT)
+		errno = err;
+
+	return rv;
+}
+
+/* Return true if the len bytes at str are all 7-bit ASCII */
+static int
+is_ascii(const char *str, size_t len)
+{
+	unsigned char bits = 0;
+	size_t i;
+
+	/* No early exit, so that the compiler can vectorise this */
+	for (i = 0; i < len; i++)
+		bits |= (unsigned char)str[i];
+
+	return !(bits & 0x80);
 }
 
 /**
@@ -310,7 +323,7 @@ escape_connection_string(char *str)
  * @brief Generate an allocated geometry string for shapefile object obj using the state parameters
  */
 int
-GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
+GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, int *size, char *message)
 {
 	LWCOLLECTION *lwcollection;
 
@@ -375,21 +388,25 @@ GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
 		serialized_lwgeom = lwgeom_serialize(lwmultipoints[0]);
 	}
 
-	if (!state->config->hwgeom)
+	if (state->config->binary)
+		result = serialized_lwgeom_to_ewkb(&lwg_unparser_result, serialized_lwgeom, PARSER_CHECK_NONE, -1);
+	else if (!state->config->hwgeom)
 		result = serialized_lwgeom_to_hexwkb(&lwg_unparser_result, serialized_lwgeom, PARSER_CHECK_NONE, -1);
 	else
 		result = serialized_lwgeom_to_ewkt(&lwg_unparser_result, serialized_lwgeom, PARSER_CHECK_NONE);
 
 	if (result)
 	{
-		snprintf(state->message, SHPLOADERMSGLEN, "%s", lwg_unparser_result.message);
+		snprintf(message, SHPLOADERMSGLEN, "%s", lwg_unparser_result.message);
 
 		return SHPLOADERERR;
 	}
 
-	/* Allocate a string containing the resulting geometry */
-	mem = malloc(strlen(lwg_unparser_result.wkoutput) + 1);
-	strcpy(mem, lwg_unparser_result.wkoutput);
+	/* Allocate a string containing the resulting geometry; raw EWKB may
+	   contain NUL bytes, so copy by size */
+	mem = malloc(lwg_unparser_result.size + 1);
+	memcpy(mem, lwg_unparser_result.wkoutput, lwg_unparser_result.size);
+	mem[lwg_unparser_result.size] = '\0';
 
 	/* Free all of the allocated items */
 	lwfree(lwg_unparser_result.wkoutput);
@@ -410,6 +427,7 @@ GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
 
 	/* Return the string - everything ok */
 	*geometry = mem;
+	*size = lwg_unparser_result.size;
 
 	return SHPLOADEROK;
 }
@@ -419,7 +437,7 @@ GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
  * @brief Generate an allocated geometry string for shapefile object obj using the state parameters
  */
 int
-GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
+GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, int *size, char *message)
 {
 	LWCOLLECTION *lwcollection = NULL;
 
@@ -450,7 +468,7 @@ GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometr
 
 	if (state->config->simple_geometries == 1 && obj->nParts > 1)
 	{
-		snprintf(state->message, SHPLOADERMSGLEN, "We have a Multilinestring with %d parts, can't use -S switch!", obj->nParts);
+		snprintf(message, SHPLOADERMSGLEN, "We have a Multilinestring with %d parts, can't use -S switch!", obj->nParts);
 
 		return SHPLOADERERR;
 	}
@@ -511,7 +529,9 @@ GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometr
 		serialized_lwgeom = lwgeom_serialize(lwmultilinestrings[0]);
 	}
 
-	if (!state->config->hwgeom)
+	if (state->config->binary)
+		result = serialized_lwgeom_to_ewkb(&lwg_unparser_result, serialized_lwgeom, PARSER_CHECK_NONE, -1);
+	else if (!state->config->hwgeom)
 		result = serialized_lwgeom_to_hexwkb(&lwg_unparser_result, serialized_lwgeom, PARSER_CHECK_NONE, -1);
 	else
 		result = serialized_lwgeom_to_ewkt(&lwg_unparser_result, serialized_lwgeom, PARSER_CHECK_NONE);
@@ -519,14 +539,16 @@ GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometr
 	/* Return the error message if we failed */
 	if (result)
 	{
-		snprintf(state->message, SHPLOADERMSGLEN, "%s", lwg_unparser_result.message);
+		snprintf(message, SHPLOADERMSGLEN, "%s", lwg_unparser_result.message);
 
 		return SHPLOADERERR;
 	}
 
-	/* Allocate a string containing the resulting geometry */
-	mem = malloc(strlen(lwg_unparser_result.wkoutput) + 1);
-	strcpy(mem, lwg_unparser_result.wkoutput);
+	/* Allocate a string containing the resulting geometry; raw EWKB may
+	   contain NUL bytes, so copy by size */
+	mem = malloc(lwg_unparser_result.size + 1);
+	memcpy(mem, lwg_unparser_result.wkoutput, lwg_unparser_result.size);
+	mem[lwg_unparser_result.size] = '\0';
 
 	/* Free all of the allocated items */
 	lwfree(lwg_unparser_result.wkoutput);
@@ -546,6 +568,7 @@ GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometr
 
 	/* Return the string - everything ok */
 	*geometry = mem;
+	*size = lwg_unparser_result.size;
 
 	return SHPLOADEROK;
 }
@@ -749,7 +772,7 @@ ReleasePolygons(Ring **polys, int npolys)
  *
  */
 int
-GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
+GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, int *size, char *message)
 {
 	Ring **Outer;
 	int polygon_total, ring_total;
@@ -788,7 +811,7 @@ GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
 
 	if (state->config->simple_geometries == 1 && polygon_total != 1) /* We write Non-MULTI geometries, but have several parts: */
 	{
-		snprintf(state->message, SHPLOADERMSGLEN, "We have a Multipolygon with %d parts, can't use -S switch!", polygon_total);
+		snprintf(message, SHPLOADERMSGLEN, "We have a Multipolygon with %d parts, can't use -S switch!", polygon_total);
 
 		return SHPLOADERERR;
 	}
@@ -892,40 +915,1118 @@ GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
 
 	ReleasePolygons(Outer, polygon_total);
 
-	if (!state->config->hwgeom)
+	if (state->config->binary)
+		result = serialized_lwgeom_to_ewkb(&lwg_unparser_result, serialized_lwgeom, PARSER_CHECK_NONE, -1);
+	else if (!state->config->hwgeom)
 		result = serialized_lwgeom_to_hexwkb(&lwg_unparser_result, serialized_lwgeom, PARSER_CHECK_NONE, -1);
 	else
 		result = serialized_lwgeom_to_ewkt(&lwg_unparser_result, serialized_lwgeom, PARSER_CHECK_NONE);
 
 	if (result)
 	{
-		snprintf(state->message, SHPLOADERMSGLEN, "%s", lwg_unparser_result.message);
+		snprintf(message, SHPLOADERMSGLEN, "%s", lwg_unparser_result.message);
+
+		return SHPLOADERERR;
+	}
+
+	/* Allocate a string containing the resulting geometry; raw EWKB may
+	   contain NUL bytes, so copy by size */
+	mem = malloc(lwg_unparser_result.size + 1);
+	memcpy(mem, lwg_unparser_result.wkoutput, lwg_unparser_result.size);
+	mem[lwg_unparser_result.size] = '\0';
+
+	/* Free all of the allocated items */
+	lwfree(lwg_unparser_result.wkoutput);
+	lwfree(serialized_lwgeom);
+
+	/* Cycle through each polygon, freeing everything we need... */
+	for (u = 0; u < polygon_total; u++)
+		lwpoly_free(lwgeom_as_lwpoly(lwpolygons[u]));
+
+	/* Free the pointer arrays */
+	lwfree(pas);
+	lwfree(lwpolygons);
+	if (lwcollection)
+		lwfree(lwcollection);
+
+	/* Return the string - everything ok */
+	*geometry = mem;
+	*size = lwg_unparser_result.size;
+
+	return SHPLOADEROK;
+}
+
+
+/*
+ * Copy attribute i of a record into val (MAXVALUELEN bytes), tidying up
+ * numeric values. The value has already been converted to UTF-8 by
+ * ShpLoaderReadRecord(). Truncation warnings are appended to sbwarn.
+ */
+static int
+ConvertAttribute(SHPLOADERSTATE *state, char *value, int i, char *val, stringbuffer_t *sbwarn, char *message)
+{
+	int rv;
+
+	switch (state->types[i])
+	{
+	case FTInteger:
+	case FTDouble:
+		rv = snprintf(val, MAXVALUELEN, "%s", value);
+		if (rv >= MAXVALUELEN || rv == -1)
+		{
+			vasbappend(sbwarn, "Warning: field %d name truncated\n", i);
+			val[MAXVALUELEN - 1] = '\0';
+		}
+
+		/* If the value is an empty string, change to 0 */
+		if (val[0] == '\0')
+		{
+			val[0] = '0';
+			val[1] = '\0';
+		}
+
+		/* If the value ends with just ".", remove the dot */
+		if (val[strlen(val) - 1] == '.')
+			val[strlen(val) - 1] = '\0';
+		break;
+
+	case FTString:
+	case FTLogical:
+	case FTDate:
+		rv = snprintf(val, MAXVALUELEN, "%s", value);
+		if (rv >= MAXVALUELEN || rv == -1)
+		{
+			vasbappend(sbwarn, "Warning: field %d name truncated\n", i);
+			val[MAXVALUELEN - 1] = '\0';
+		}
+		break;
+
+	default:
+		snprintf(message, SHPLOADERMSGLEN, "Error: field %d has invalid or unknown field type (%d)", i, state->types[i]);
+
+		return SHPLOADERERR;
+	}
+
+	return SHPLOADEROK;
+}
+
+
+/*
+ * Generate an allocated geometry for shapefile object obj, of size bytes, dispatching
+ * on the shape type
+ */
+static int
+GenerateGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, int *size, char *message)
+{
+	switch (obj->nSHPType)
+	{
+	case SHPT_POLYGON:
+	case SHPT_POLYGONM:
+	case SHPT_POLYGONZ:
+		return GeneratePolygonGeometry(state, obj, geometry, size, message);
+
+	case SHPT_POINT:
+	case SHPT_POINTM:
+	case SHPT_POINTZ:
+	case SHPT_MULTIPOINT:
+	case SHPT_MULTIPOINTM:
+	case SHPT_MULTIPOINTZ:
+		return GeneratePointGeometry(state, obj, geometry, size, message);
+
+	case SHPT_ARC:
+	case SHPT_ARCM:
+	case SHPT_ARCZ:
+		return GenerateLineStringGeometry(state, obj, geometry, size, message);
+
+	default:
+		snprintf(message, SHPLOADERMSGLEN, "Shape type is NOT SUPPORTED, type id = %d", obj->nSHPType);
+		return SHPLOADERERR;
+	}
+}
+
+
+/*
+ * Binary COPY support
+ *
+ * A binary COPY stream is the signature below, an int32 of flags and an
+ * int32 header extension length (both zero), then for each tuple an int16
+ * field count followed by an int32 length (-1 for NULL) and the field data
+ * for every field, and finally an int16 of -1. All integers are in network
+ * byte order and each field uses its type's send/receive format, so we
+ * encode the types generated by ShpLoaderGetSQLHeader() here, and raw EWKB
+ * for geometries (which geometry_recv accepts).
+ */
+
+static const char binary_copy_signature[11] = "PGCOPY\n\377\r\n";
+
+/* PostgreSQL dates count days from 2000-01-01, Julian day 2451545 */
+#define POSTGRES_EPOCH_JDATE	2451545
+
+/* Numeric sign flags as sent by numeric_send */
+#define NUMERIC_POS		0x0000
+#define NUMERIC_NEG		0x4000
+
+/* Growable byte buffer; binary tuples may contain NUL bytes so cannot use a stringbuffer */
+typedef struct
+{
+	uchar *data;
+	int len;
+	int size;
+} bytebuffer_t;
+
+static void
+bytebuffer_append(bytebuffer_t *bb, const void *data, int len)
+{
+	if (bb->len + len > bb->size)
+	{
+		while (bb->len + len > bb->size)
+			bb->size *= 2;
+
+		bb->data = realloc(bb->data, bb->size);
+	}
+
+	memcpy(bb->data + bb->len, data, len);
+	bb->len += len;
+}
+
+static void
+bytebuffer_append_int16(bytebuffer_t *bb, int val)
+{
+	uchar buf[2];
+
+	buf[0] = (val >> 8) & 0xff;
+	buf[1] = val & 0xff;
+
+	bytebuffer_append(bb, buf, 2);
+}
+
+static void
+bytebuffer_append_int32(bytebuffer_t *bb, int val)
+{
+	uchar buf[4];
+
+	buf[0] = (val >> 24) & 0xff;
+	buf[1] = (val >> 16) & 0xff;
+	buf[2] = (val >> 8) & 0xff;
+	buf[3] = val & 0xff;
+
+	bytebuffer_append(bb, buf, 4);
+}
+
+static void
+bytebuffer_append_float8(bytebuffer_t *bb, double val)
+{
+	union
+	{
+		double d;
+		uint64_t i;
+	} u;
+	uchar buf[8];
+	int j;
+
+	u.d = val;
+	for (j = 0; j < 8; j++)
+		buf[j] = (u.i >> (56 - 8 * j)) & 0xff;
+
+	bytebuffer_append(bb, buf, 8);
+}
+
+/* Parse an integer with optional surrounding whitespace, failing on anything else */
+static int
+parse_binary_integer(const char *str, long min, long max, long *result)
+{
+	char *end;
+
+	errno = 0;
+	*result = strtol(str, &end, 10);
+	if (end == str || errno == ERANGE || *result < min || *result > max)
+		return 0;
+
+	while (isspace((unsigned char)*end))
+		end++;
+
+	return *end == '\0';
+}
+
+/* Parse a double with optional surrounding whitespace, failing on anything else */
+static int
+parse_binary_float8(const char *str, double *result)
+{
+	char *end;
+
+	*result = strtod(str, &end);
+	if (end == str)
+		return 0;
+
+	while (isspace((unsigned char)*end))
+		end++;
+
+	return *end == '\0';
+}
+
+/* Parse a DBF YYYYMMDD date into days since the PostgreSQL epoch */
+static int
+parse_binary_date(const char *str, int *result)
+{
+	static const int mdays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	int y, m, d, j, century, leap;
+
+	for (j = 0; j < 8; j++)
+		if (!isdigit((unsigned char)str[j]))
+			return 0;
+	if (str[8] != '\0')
+		return 0;
+
+	y = (str[0] - '0') * 1000 + (str[1] - '0') * 100 + (str[2] - '0') * 10 + (str[3] - '0');
+	m = (str[4] - '0') * 10 + (str[5] - '0');
+	d = (str[6] - '0') * 10 + (str[7] - '0');
+
+	leap = (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0));
+	if (y == 0 || m < 1 || m > 12 || d < 1 || d > mdays[m - 1] + (m == 2 && leap))
+		return 0;
+
+	/* Julian day number, as date2j() in the backend */
+	if (m > 2)
+	{
+		m += 1;
+		y += 4800;
+	}
+	else
+	{
+		m += 13;
+		y += 4799;
+	}
+
+	century = y / 100;
+	*result = y * 365 - 32167 + y / 4 - century + century / 4 + 7834 * m / 256 + d - POSTGRES_EPOCH_JDATE;
+
+	return 1;
+}
+
+/*
+ * Append a plain decimal string as a binary numeric field: int16 ndigits,
+ * weight, sign and dscale followed by ndigits base 10000 digits, the first
+ * of which is multiplied by 10000^weight
+ */
+static int
+bytebuffer_append_numeric(bytebuffer_t *bb, const char *str)
+{
+	const char *intpart, *fracpart = NULL;
+	int intlen = 0, fraclen = 0, sign = NUMERIC_POS;
+	int ndigits, ngroups, weight, pad, first, j, k, pos;
+	short digits[MAXVALUELEN / 4 + 2];
+
+	while (isspace((unsigned char)*str))
+		str++;
+
+	if (*str == '-' || *str == '+')
+	{
+		if (*str == '-')
+			sign = NUMERIC_NEG;
+		str++;
+	}
+
+	intpart = str;
+	while (isdigit((unsigned char)*str))
+	{
+		str++;
+		intlen++;
+	}
+
+	if (*str == '.')
+	{
+		fracpart = ++str;
+		while (isdigit((unsigned char)*str))
+		{
+			str++;
+			fraclen++;
+		}
+	}
+
+	while (isspace((unsigned char)*str))
+		str++;
+
+	if (*str != '\0' || intlen + fraclen == 0 || intlen + fraclen >= MAXVALUELEN)
+		return 0;
+
+	/* Drop leading zeros, then group the digits in fours either side of the point */
+	while (intlen > 0 && *intpart == '0')
+	{
+		intpart++;
+		intlen--;
+	}
+
+	pad = (4 - intlen % 4) % 4;
+	weight = (intlen + pad) / 4 - 1;
+	ngroups = (intlen + pad) / 4 + (fraclen + 3) / 4;
+
+	for (j = 0; j < ngroups; j++)
+	{
+		digits[j] = 0;
+		for (k = 0; k < 4; k++)
+		{
+			pos = j * 4 + k - pad;
+			digits[j] *= 10;
+
+			if (pos >= 0 && pos < intlen)
+				digits[j] += intpart[pos] - '0';
+			else if (pos >= intlen && pos - intlen < fraclen)
+				digits[j] += fracpart[pos - intlen] - '0';
+		}
+	}
+
+	/* Strip zero groups from both ends */
+	for (first = 0; first < ngroups && digits[first] == 0; first++)
+		weight--;
+
+	for (ndigits = ngroups - first; ndigits > 0 && digits[first + ndigits - 1] == 0; ndigits--)
+		;
+
+	if (ndigits == 0)
+	{
+		weight = 0;
+		sign = NUMERIC_POS;
+	}
+
+	bytebuffer_append_int32(bb, 8 + 2 * ndigits);
+	bytebuffer_append_int16(bb, ndigits);
+	bytebuffer_append_int16(bb, weight);
+	bytebuffer_append_int16(bb, sign);
+	bytebuffer_append_int16(bb, fraclen);
+
+	for (j = 0; j < ndigits; j++)
+		bytebuffer_append_int16(bb, digits[first + j]);
+
+	return 1;
+}
+
+/*
+ * Append attribute i, already converted to UTF-8 in val, encoded as the
+ * column type chosen for it by ShpLoaderGetSQLHeader()
+ */
+static int
+bytebuffer_append_attribute(SHPLOADERSTATE *state, bytebuffer_t *bb, int i, char *val, char *message)
+{
+	long l;
+	double d;
+	int days;
+
+	switch (state->types[i])
+	{
+	case FTString:
+		bytebuffer_append_int32(bb, strlen(val));
+		bytebuffer_append(bb, val, strlen(val));
+		return SHPLOADEROK;
+
+	case FTDate:
+		if (!parse_binary_date(val, &days))
+			break;
+
+		bytebuffer_append_int32(bb, 4);
+		bytebuffer_append_int32(bb, days);
+		return SHPLOADEROK;
+
+	case FTInteger:
+		if (!state->config->forceint4 && state->widths[i] < 5)
+		{
+			if (!parse_binary_integer(val, -32768, 32767, &l))
+				break;
+
+			bytebuffer_append_int32(bb, 2);
+			bytebuffer_append_int16(bb, l);
+		}
+		else if (state->config->forceint4 || state->widths[i] < 10)
+		{
+			if (!parse_binary_integer(val, -2147483647L - 1, 2147483647L, &l))
+				break;
+
+			bytebuffer_append_int32(bb, 4);
+			bytebuffer_append_int32(bb, l);
+		}
+		else if (!bytebuffer_append_numeric(bb, val))
+			break;
+
+		return SHPLOADEROK;
+
+	case FTDouble:
+		if (state->widths[i] > 18)
+		{
+			if (!bytebuffer_append_numeric(bb, val))
+				break;
+		}
+		else
+		{
+			if (!parse_binary_float8(val, &d))
+				break;
+
+			bytebuffer_append_int32(bb, 8);
+			bytebuffer_append_float8(bb, d);
+		}
+		return SHPLOADEROK;
+
+	case FTLogical:
+		switch (val[0])
+		{
+		case 'T':
+		case 't':
+		case 'Y':
+		case 'y':
+			bytebuffer_append_int32(bb, 1);
+			bytebuffer_append(bb, "\1", 1);
+			return SHPLOADEROK;
+
+		case 'F':
+		case 'f':
+		case 'N':
+		case 'n':
+			bytebuffer_append_int32(bb, 1);
+			bytebuffer_append(bb, "\0", 1);
+			return SHPLOADEROK;
+		}
+		break;
+
+	default:
+		snprintf(message, SHPLOADERMSGLEN, "Error: field %d has invalid or unknown field type (%d)", i, state->types[i]);
+		return SHPLOADERERR;
+	}
+
+	/* Only quote the start of the value, the rest of the message must fit too */
+	snprintf(message, SHPLOADERMSGLEN, "Error: field %d value \"%.*s\" cannot be converted to binary COPY format", i, SHPLOADERMSGLEN / 2, val);
+
+	return SHPLOADERERR;
+}
+
+
+/*
+ * Attribute encoding
+ *
+ * The attribute values are converted to UTF8 with one iconv descriptor for the whole
+ * load, as the records are read by ShpLoaderReadRecord() so that the descriptor is
+ * never used from more than one thread. Values which are plain ASCII are copied
+ * without calling iconv at all when the encoding leaves ASCII unchanged, which is
+ * the case for all of the encodings DBF files are found in.
+ */
+
+static char *encoding_msg = "Try \"LATIN1\" (Western European), or one of the values described at http://www.postgresql.org/docs/current/static/multibyte.html.";
+
+/* Open the iconv descriptor for the configured encoding and check whether it changes ASCII */
+static int
+OpenEncoding(SHPLOADERSTATE *state)
+{
+	char ascii[128], converted[128 * 4];
+	int i;
+
+	state->cd = iconv_open("UTF-8", state->config->encoding);
+	if (state->cd == (iconv_t)-1)
+	{
+		snprintf(state->message, SHPLOADERMSGLEN, "Unable to convert field name to UTF-8 (iconv reports \"%s\"). Current encoding is \"%s\". %s", strerror(errno), state->config->encoding, encoding_msg);
 
 		return SHPLOADERERR;
 	}
 
-	/* Allocate a string containing the resulting geometry */
-	mem = malloc(strlen(lwg_unparser_result.wkoutput) + 1);
-	strcpy(mem, lwg_unparser_result.wkoutput);
+	for (i = 1; i < 128; i++)
+		ascii[i - 1] = i;
+	ascii[127] = '\0';
+
+	state->ascii_passthrough = (utf8(state->cd, ascii, 127, converted, sizeof(converted)) == UTF8_GOOD_RESULT &&
+	                            !strcmp(ascii, converted));
+
+	return SHPLOADEROK;
+}
+
+/*
+ * Grow the state value buffer so that at least needed bytes are free at *outptr, moving
+ * the first nvalues values of the record (which point into the buffer) along with it
+ */
+static void
+GrowValueBuffer(SHPLOADERSTATE *state, SHPLOADERRECORD *record, int nvalues, char **outptr, size_t *outbytesleft, size_t needed)
+{
+	size_t used = *outptr - state->valuebuf;
+	char *valuebuf;
+	int i;
+
+	state->valuebuflen = (used + needed) * 2;
+	valuebuf = malloc(state->valuebuflen);
+	memcpy(valuebuf, state->valuebuf, used);
+
+	for (i = 0; i < nvalues; i++)
+	{
+		if (record->values[i])
+			record->values[i] = valuebuf + (record->values[i] - state->valuebuf);
+	}
+
+	free(state->valuebuf);
+	state->valuebuf = valuebuf;
+
+	*outptr = valuebuf + used;
+	*outbytesleft = state->valuebuflen - used;
+}
+
+/*
+ * Read the attribute values of a record from the DBF, converting them to UTF8 into the
+ * state value buffer and then copying them to a single block for the record. The buffer
+ * is sized for the DBF field widths, and grown if a value does not fit.
+ */
+static int
+ReadRecordValues(SHPLOADERSTATE *state, int item, SHPLOADERRECORD *record)
+{
+	const char *value;
+	char *outptr = state->valuebuf;
+	size_t len, outbytesleft = state->valuebuflen;
+	int i, rv, length;
+
+	record->values = malloc(sizeof(char *) * state->num_fields);
+
+	for (i = 0; i < state->num_fields; i++)
+	{
+		/* The value is converted or copied straight from the DBF record */
+		value = DBFReadAttributeView(state->hDBFHandle, item, i, &length);
+		if (!value || DBFIsValueNULL(DBFGetNativeFieldType(state->hDBFHandle, i), value, length))
+		{
+			record->values[i] = NULL;
+			continue;
+		}
+
+		len = length;
+
+		if (!state->config->encoding || (state->ascii_passthrough && is_ascii(value, len)))
+		{
+			/* Nothing to convert, just copy */
+			if (len + 1 > outbytesleft)
+				GrowValueBuffer(state, record, i, &outptr, &outbytesleft, len + 1);
+
+			memcpy(outptr, value, len);
+			outptr[len] = '\0';
+		}
+		else
+		{
+			/* If we are converting from another encoding to UTF8, convert the field value to UTF8 */
+			if (len * 3 + 1 > outbytesleft)
+				GrowValueBuffer(state, record, i, &outptr, &outbytesleft, len * 3 + 1);
+
+			/* Some encodings can take more than 3 bytes per character in UTF8, so retry with more room */
+			while ((rv = utf8(state->cd, (char *)value, len, outptr, outbytesleft)) == UTF8_NO_RESULT && errno == E2BIG)
+				GrowValueBuffer(state, record, i, &outptr, &outbytesleft, outbytesleft * 2);
+
+			if ( !UTF8_DROP_BAD_CHARACTERS && rv != UTF8_GOOD_RESULT )
+			{
+				if ( rv == UTF8_BAD_RESULT )
+					snprintf(state->message, SHPLOADERMSGLEN, "Unable to convert data value \"%s\" to UTF-8 (iconv reports \"%s\"). Current encoding is \"%s\". %s", outptr, strerror(errno), state->config->encoding, encoding_msg);
+				else if ( rv == UTF8_NO_RESULT )
+					snprintf(state->message, SHPLOADERMSGLEN, "Unable to convert data value to UTF-8 (iconv reports \"%s\"). Current encoding is \"%s\". %s", strerror(errno), state->config->encoding, encoding_msg);
+				else
+					snprintf(state->message, SHPLOADERMSGLEN, "Unexpected return value from utf8()");
+
+				free(record->values);
+				record->values = NULL;
+
+				return SHPLOADERERR;
+			}
+
+			/* Optionally (compile-time) suppress bad UTF8 values */
+			if ( UTF8_DROP_BAD_CHARACTERS && rv != UTF8_GOOD_RESULT )
+				strcpy(outptr, ".");
+
+			len = strlen(outptr);
+		}
+
+		record->values[i] = outptr;
+		outptr += len + 1;
+		outbytesleft -= len + 1;
+	}
+
+	/* Move the values into a block of their own, since the buffer is reused for the next record */
+	record->data = malloc(outptr - state->valuebuf);
+	memcpy(record->data, state->valuebuf, outptr - state->valuebuf);
+
+	for (i = 0; i < state->num_fields; i++)
+	{
+		if (record->values[i])
+			record->values[i] = record->data + (record->values[i] - state->valuebuf);
+	}
+
+	return SHPLOADEROK;
+}
+
+
+/*
+ * Reprojection
+ *
+ * When shp_sr_id is set, the shape coordinates are reprojected in the
+ * loader from shp_sr_id to sr_id with PROJ.4, using the EPSG definitions
+ * installed with it (+init=epsg:<srid>). The loader has no database
+ * connection, so SRIDs that only exist in spatial_ref_sys cannot be used.
+ * PROJ.4 projections may not be used from several threads at once, so
+ * this is done as the records are read by ShpLoaderReadRecord().
+ *
+ * Without HAVE_LOADER_PROJ (configure --without-loader-proj) the loader
+ * does not link against PROJ.4 and refuses to reproject.
+ */
+
+#ifdef HAVE_LOADER_PROJ
+
+/* Initialise the PROJ.4 projection for an EPSG SRID, setting the state message on failure */
+static projPJ
+GetProjection(SHPLOADERSTATE *state, int srid)
+{
+	char proj4[32];
+	projPJ pj;
+
+	snprintf(proj4, sizeof(proj4), "+init=epsg:%d", srid);
+
+	pj = pj_init_plus(proj4);
+	if (!pj)
+		snprintf(state->message, SHPLOADERMSGLEN, "Unable to initialise the PROJ.4 projection for SRID %d (%s): %s\n"
+		         "Reprojecting in the loader only supports the EPSG codes of the PROJ.4 epsg init file (see PROJ_LIB), "
+		         "not the spatial_ref_sys table. Load with -s %d and use ST_Transform() in the database instead.",
+		         srid, proj4, pj_strerrno(*pj_get_errno_ref()), state->config->shp_sr_id);
+
+	return pj;
+}
+
+/* Reproject the coordinates of a shape in place, all vertices in one pj_transform() call */
+static int
+ReprojectShape(SHPLOADERSTATE *state, SHPObject *obj)
+{
+	double *z = NULL;
+	int i, ret;
+
+	if (state->wkbtype & WKBZOFFSET)
+		z = obj->padfZ;
+
+	/* PROJ.4 works in radians for lon/lat coordinates */
+	if (pj_is_latlong(state->shp_proj))
+	{
+		for (i = 0; i < obj->nVertices; i++)
+		{
+			obj->padfX[i] *= DEG_TO_RAD;
+			obj->padfY[i] *= DEG_TO_RAD;
+		}
+	}
+
+	ret = pj_transform(state->shp_proj, state->proj, obj->nVertices, 1, obj->padfX, obj->padfY, z);
+	if (ret)
+	{
+		snprintf(state->message, SHPLOADERMSGLEN, "Unable to reproject shape object %d from SRID %d to SRID %d: %s",
+		         obj->nShapeId, state->config->shp_sr_id, state->config->sr_id, pj_strerrno(ret));
+
+		return SHPLOADERERR;
+	}
+
+	if (pj_is_latlong(state->proj))
+	{
+		for (i = 0; i < obj->nVertices; i++)
+		{
+			obj->padfX[i] *= RAD_TO_DEG;
+			obj->padfY[i] *= RAD_TO_DEG;
+		}
+	}
+
+	return SHPLOADEROK;
+}
+
+#endif /* HAVE_LOADER_PROJ */
+
+
+/*
+ * Spatial ordering
+ *
+ * With spatial_order set the records are read in order of the Hilbert curve
+ * index of the centre of their bounding box, on a grid of 2^HILBERT_BITS
+ * cells a side over the extent of the shapefile, so that rows which are
+ * close on the ground end up close in the table without a CLUSTER after
+ * the load. The bounding boxes come from views of the .shp records rather
+ * than reading whole shapes.
+ */
+
+#define HILBERT_BITS	16
+
+typedef struct
+{
+	unsigned int key;
+	int item;
+} RECORDKEY;
+
+/* Index of cell (x, y) along the Hilbert curve filling the grid */
+static unsigned int
+hilbert_index(unsigned int x, unsigned int y)
+{
+	unsigned int n = 1 << HILBERT_BITS;
+	unsigned int rx, ry, s, t;
+	unsigned int d = 0;
+
+	for (s = n / 2; s > 0; s /= 2)
+	{
+		rx = (x & s) > 0;
+		ry = (y & s) > 0;
+		d += s * s * ((3 * rx) ^ ry);
+
+		/* Rotate the quadrant so the curve joins up */
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+
+			t = x;
+			x = y;
+			y = t;
+		}
+	}
+
+	return d;
+}
+
+/* Grid cell of a coordinate, clamping anything out of range (or NaN) to the edges */
+static unsigned int
+hilbert_cell(double v, double min, double scale)
+{
+	v = (v - min) * scale;
+
+	if (!(v > 0))
+		return 0;
+	if (v > (1 << HILBERT_BITS) - 1)
+		return (1 << HILBERT_BITS) - 1;
+
+	return (unsigned int)v;
+}
+
+static int
+compare_record_keys(const void *a, const void *b)
+{
+	const RECORDKEY *ka = (const RECORDKEY *)a;
+	const RECORDKEY *kb = (const RECORDKEY *)b;
+
+	if (ka->key != kb->key)
+		return ka->key < kb->key ? -1 : 1;
+
+	return ka->item - kb->item;
+}
+
+/* Fill in state->record_order with the records sorted by the Hilbert index of their bounding boxes */
+static void
+ComputeRecordOrder(SHPLOADERSTATE *state)
+{
+	SHPHandle hSHP = state->hSHPHandle;
+	SHPObjectView view;
+	RECORDKEY *keys;
+	double xscale = 0, yscale = 0, cx, cy;
+	int i;
+
+	if (hSHP->adBoundsMax[0] > hSHP->adBoundsMin[0])
+		xscale = ((1 << HILBERT_BITS) - 1) / (hSHP->adBoundsMax[0] - hSHP->adBoundsMin[0]);
+	if (hSHP->adBoundsMax[1] > hSHP->adBoundsMin[1])
+		yscale = ((1 << HILBERT_BITS) - 1) / (hSHP->adBoundsMax[1] - hSHP->adBoundsMin[1]);
+
+	keys = malloc(sizeof(RECORDKEY) * state->num_entities);
+
+	for (i = 0; i < state->num_entities; i++)
+	{
+		/* Order the records selected by the bounding box filter, if any */
+		keys[i].item = state->record_order ? state->record_order[i] : i;
+
+		/* NULL shapes, and any we cannot read here, go at the end in shapefile order */
+		keys[i].key = UINT_MAX;
+
+		/* The bounding box is read from the record in place, without reading the shape */
+		if (!SHPReadObjectView(hSHP, keys[i].item, &view) || view.nVertices == 0)
+			continue;
+
+		cx = (view.dfXMin + view.dfXMax) / 2;
+		cy = (view.dfYMin + view.dfYMax) / 2;
+
+		keys[i].key = hilbert_index(hilbert_cell(cx, hSHP->adBoundsMin[0], xscale),
+		                            hilbert_cell(cy, hSHP->adBoundsMin[1], yscale));
+	}
+
+	qsort(keys, state->num_entities, sizeof(RECORDKEY), compare_record_keys);
+
+	if (!state->record_order)
+		state->record_order = malloc(sizeof(int) * (state->num_entities > 0 ? state->num_entities : 1));
+	for (i = 0; i < state->num_entities; i++)
+		state->record_order[i] = keys[i].item;
+
+	free(keys);
+}
+
+
+/*
+ * Bounding box filter
+ *
+ * With bbox_filter set only the shapes whose bounding boxes intersect bbox,
+ * in the coordinates of the shapefile, are loaded. The candidates come from
+ * the shapefile's .qix quadtree index (as written by shapelib's shptree or
+ * GDAL) if it has a usable one, touching only the parts of the index and
+ * the .shp which cover the box; otherwise the bounding box of every record
+ * is checked. Either way each candidate's own bounding box is then tested,
+ * and the selected records become state->record_order.
+ */
+
+/* Deepest quadtree accepted, well beyond what shptree builds, to stop on corrupt files */
+#define QIX_MAX_DEPTH	64
+
+typedef struct
+{
+	const uchar *data;
+	size_t size;
+	int swap;
+	int num_shapes;
+	const double *bbox;
+
+	/* Candidate shape ids, which may contain duplicates */
+	int *ids;
+	int num_ids;
+	int max_ids;
+} QIXSEARCH;
+
+static int
+qix_int(QIXSEARCH *search, size_t pos)
+{
+	uchar buf[4];
+	int32_t value;
+
+	memcpy(buf, search->data + pos, 4);
+	if (search->swap)
+	{
+		uchar t;
+
+		t = buf[0]; buf[0] = buf[3]; buf[3] = t;
+		t = buf[1]; buf[1] = buf[2]; buf[2] = t;
+	}
+	memcpy(&value, buf, 4);
+
+	return value;
+}
+
+static double
+qix_double(QIXSEARCH *search, size_t pos)
+{
+	uchar buf[8];
+	double value;
+	int i;
+
+	if (search->swap)
+	{
+		for (i = 0; i < 8; i++)
+			buf[i] = search->data[pos + 7 - i];
+	}
+	else
+		memcpy(buf, search->data + pos, 8);
+	memcpy(&value, buf, 8);
+
+	return value;
+}
+
+/*
+ * Search the quadtree node at *pos, adding the ids of the shapes of the nodes
+ * intersecting the box, and leave *pos at the end of the node and its
+ * children. Each node is its offset to the end of its children, its bounds,
+ * the number of shapes and their ids, and then the number of children.
+ */
+static int
+qix_search_node(QIXSEARCH *search, size_t *pos, int depth)
+{
+	size_t end;
+	int offset, count, children, i, id;
+
+	if (depth > QIX_MAX_DEPTH || *pos + 40 > search->size)
+		return 0;
+
+	offset = qix_int(search, *pos);
+	count = qix_int(search, *pos + 36);
+	if (offset < 0 || count < 0 || (size_t)count > (search->size - *pos - 40) / 4 - 1)
+		return 0;
+
+	children = qix_int(search, *pos + 40 + 4 * (size_t)count);
+	end = *pos + 44 + 4 * (size_t)count;
+	if (children < 0 || (size_t)offset > search->size - end)
+		return 0;
+
+	/* Skip the node and all its children if it is outside the box */
+	if (qix_double(search, *pos + 20) < search->bbox[0] || qix_double(search, *pos + 4) > search->bbox[2] ||
+	        qix_double(search, *pos + 28) < search->bbox[1] || qix_double(search, *pos + 12) > search->bbox[3])
+	{
+		*pos = end + offset;
+		return 1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		id = qix_int(search, *pos + 40 + 4 * (size_t)i);
+		if (id < 0 || id >= search->num_shapes)
+			return 0;
+
+		if (search->num_ids == search->max_ids)
+		{
+			search->max_ids = search->max_ids * 2 + 64;
+			search->ids = realloc(search->ids, sizeof(int) * search->max_ids);
+		}
+		search->ids[search->num_ids++] = id;
+	}
+
+	*pos = end;
+	for (i = 0; i < children; i++)
+	{
+		if (!qix_search_node(search, pos, depth + 1))
+			return 0;
+	}
+
+	/* The children must take up exactly the space the node says they do */
+	return *pos == end + offset;
+}
+
+static int
+compare_ints(const void *a, const void *b)
+{
+	int ia = *(const int *)a;
+	int ib = *(const int *)b;
+
+	return (ia > ib) - (ia < ib);
+}
+
+/*
+ * Find the candidate records from the .qix quadtree index of the shapefile,
+ * returning the number of them in shapefile order (in *ids), -1 if there is
+ * no index, or -2 if the index is invalid or out of date
+ */
+static int
+SearchQuadTree(SHPLOADERSTATE *state, SAHooks *hooks, int **ids)
+{
+	QIXSEARCH search;
+	SAFile fp;
+	uchar *buf = NULL;
+	char *filename;
+	size_t len, pos = 16;
+	int ok = 0, i, n = 0;
+	unsigned short one = 1;
+
+	/* The index is <shapefile>.qix, whether or not the .shp extension was given */
+	len = strlen(state->config->shp_file);
+	filename = malloc(len + 5);
+	strcpy(filename, state->config->shp_file);
+	if (len > 4 && (!strcmp(filename + len - 4, ".shp") || !strcmp(filename + len - 4, ".SHP")))
+		filename[len - 4] = '\0';
+	len = strlen(filename);
+
+	strcpy(filename + len, ".qix");
+	fp = hooks->FOpen(filename, "rb");
+	if (!fp)
+	{
+		strcpy(filename + len, ".QIX");
+		fp = hooks->FOpen(filename, "rb");
+	}
+	free(filename);
+
+	if (!fp)
+		return -1;
+
+	memset(&search, 0, sizeof(QIXSEARCH));
+	search.num_shapes = state->num_entities;
+	search.bbox = state->config->bbox;
+
+	hooks->FSeek(fp, 0, SEEK_END);
+	search.size = hooks->FTell(fp);
+
+	/* Search the index in place if it is mapped, otherwise read it in */
+	search.data = hooks->FMap(fp, 0, search.size);
+	if (!search.data && search.size > 0)
+	{
+		buf = malloc(search.size);
+		hooks->FSeek(fp, 0, SEEK_SET);
+		if (hooks->FRead(buf, search.size, 1, fp) == 1)
+			search.data = buf;
+	}
+
+	/*
+	 * The header is "SQT", the byte order (1 = LSB, 2 = MSB), the version (1)
+	 * and 3 reserved bytes, then the number of shapes and the depth of the tree.
+	 * Indexes for another number of shapes are out of date and are not used.
+	 */
+	if (search.data && search.size >= 16 && !memcmp(search.data, "SQT", 3) &&
+	        (search.data[3] == 1 || search.data[3] == 2) && search.data[4] == 1)
+	{
+		search.swap = (search.data[3] == 1) != (*(uchar *)&one == 1);
+
+		if (qix_int(&search, 8) == state->num_entities)
+			ok = qix_search_node(&search, &pos, 0);
+	}
+
+	hooks->FClose(fp);
+	if (buf)
+		free(buf);
+
+	if (!ok)
+	{
+		if (search.ids)
+			free(search.ids);
+
+		return -2;
+	}
+
+	/* Shapes can be in more than one node, and are loaded in shapefile order */
+	qsort(search.ids, search.num_ids, sizeof(int), compare_ints);
+	for (i = 0; i < search.num_ids; i++)
+	{
+		if (n == 0 || search.ids[i] != search.ids[n - 1])
+			search.ids[n++] = search.ids[i];
+	}
+
+	*ids = search.ids;
+
+	return n;
+}
+
+/* Set state->record_order to the records whose bounding boxes intersect the filter box */
+static int
+SelectRecords(SHPLOADERSTATE *state, SAHooks *hooks)
+{
+	SHPObjectView view;
+	double *bbox = state->config->bbox;
+	int *candidates = NULL;
+	int num_candidates, i, item, n = 0;
+	int ret = SHPLOADEROK;
+
+	num_candidates = SearchQuadTree(state, hooks, &candidates);
+	if (num_candidates == -2)
+	{
+		snprintf(state->message, SHPLOADERMSGLEN, "%s: spatial index (.qix) is invalid or out of date, checking every record.", state->config->shp_file);
+		ret = SHPLOADERWARN;
+	}
+	if (num_candidates < 0)
+		num_candidates = state->num_entities;
+
+	state->record_order = malloc(sizeof(int) * (num_candidates > 0 ? num_candidates : 1));
+
+	for (i = 0; i < num_candidates; i++)
+	{
+		item = candidates ? candidates[i] : i;
+
+		if (!SHPReadObjectView(state->hSHPHandle, item, &view))
+		{
+			snprintf(state->message, SHPLOADERMSGLEN, "Error reading shape object %d", item);
+
+			if (candidates)
+				free(candidates);
+
+			return SHPLOADERERR;
+		}
 
-	/* Free all of the allocated items */
-	lwfree(lwg_unparser_result.wkoutput);
-	lwfree(serialized_lwgeom);
+		/* NULL shapes have no bounding box, so are never selected */
+		if (view.nVertices == 0 || view.dfXMax < bbox[0] || view.dfXMin > bbox[2] ||
+		        view.dfYMax < bbox[1] || view.dfYMin > bbox[3])
+			continue;
 
-	/* Cycle through each polygon, freeing everything we need... */
-	for (u = 0; u < polygon_total; u++)
-		lwpoly_free(lwgeom_as_lwpoly(lwpolygons[u]));
+		state->record_order[n++] = item;
+	}
 
-	/* Free the pointer arrays */
-	lwfree(pas);
-	lwfree(lwpolygons);
-	if (lwcollection)
-		lwfree(lwcollection);
+	if (candidates)
+		free(candidates);
 
-	/* Return the string - everything ok */
-	*geometry = mem;
+	state->num_entities = n;
 
-	return SHPLOADEROK;
+	return ret;
 }
 
 
@@ -955,6 +2056,7 @@ set_config_defaults(SHPLOADERCONFIG *config)
 	config->geom = strdup(GEOMETRY_DEFAULT);
 	config->shp_file = NULL;
 	config->dump_format = 0;
+	config->binary = 0;
 	config->simple_geometries = 0;
 	config->geography = 0;
 	config->quoteidentifiers = 0;
@@ -964,6 +2066,9 @@ set_config_defaults(SHPLOADERCONFIG *config)
 	config->encoding = strdup(ENCODING_DEFAULT);
 	config->null_policy = POLICY_NULL_INSERT;
 	config->sr_id = -1;
+	config->shp_sr_id = -1;
+	config->spatial_order = 0;
+	config->bbox_filter = 0;
 	config->hwgeom = 0;
 }
 
@@ -985,6 +2090,15 @@ ShpLoaderCreate(SHPLOADERCONFIG *config)
     state->widths = NULL;
     state->precisions = NULL;
     state->col_names = NULL;
+#ifdef HAVE_LOADER_PROJ
+	state->shp_proj = NULL;
+	state->proj = NULL;
+#endif
+	state->record_order = NULL;
+	state->cd = (iconv_t)-1;
+	state->ascii_passthrough = 0;
+	state->valuebuf = NULL;
+	state->valuebuflen = 0;
 
 	return state;
 }
@@ -994,7 +2108,6 @@ ShpLoaderCreate(SHPLOADERCONFIG *config)
 int
 ShpLoaderOpenShape(SHPLOADERSTATE *state)
 {
-	SHPObject *obj = NULL;
 	int j, z;
 	int ret = SHPLOADEROK;
 
@@ -1002,12 +2115,17 @@ ShpLoaderOpenShape(SHPLOADERSTATE *state)
 	char name[MAXFIELDNAMELEN];
 	char name2[MAXFIELDNAMELEN];
 	DBFFieldType type = -1;
-	char *utf8str;
+	char utf8str[MAXFIELDNAMELEN];
+	SHPObjectView view;
+	SAHooks hooks;
+
+	/* Map the files into memory where possible, so that records can be used in place */
+	SASetupMmapHooks(&hooks);
 
 	/* If we are reading the entire shapefile, open it */
 	if (state->config->readshape == 1)
 	{
-		state->hSHPHandle = SHPOpen(state->config->shp_file, "rb");
+		state->hSHPHandle = SHPOpenLL(state->config->shp_file, "rb", &hooks);
 
 		if (state->hSHPHandle == NULL)
 		{
@@ -1019,7 +2137,7 @@ ShpLoaderOpenShape(SHPLOADERSTATE *state)
 	}
 
 	/* Open the DBF (attributes) file */
-	state->hDBFHandle = DBFOpen(state->config->shp_file, "rb");
+	state->hDBFHandle = DBFOpenLL(state->config->shp_file, "rb", &hooks);
 	if ((state->hSHPHandle == NULL && state->config->readshape == 1) || state->hDBFHandle == NULL)
 	{
 		snprintf(state->message, SHPLOADERMSGLEN, "%s: dbf file (.dbf) can not be opened.", state->config->shp_file);
@@ -1032,27 +2150,23 @@ ShpLoaderOpenShape(SHPLOADERSTATE *state)
 	{
 		SHPGetInfo(state->hSHPHandle, &state->num_entities, &state->shpfiletype, NULL, NULL);
 
-		/* If null_policy is set to abort, check for NULLs */
-		if (state->config->null_policy == POLICY_NULL_ABORT)
+		/* If null_policy is set to abort, check for NULLs (which the bounding box filter never loads) */
+		if (state->config->null_policy == POLICY_NULL_ABORT && !state->config->bbox_filter)
 		{
 			/* If we abort on null items, scan the entire file for NULLs */
 			for (j = 0; j < state->num_entities; j++)
 			{
-				obj = SHPReadObject(state->hSHPHandle, j);
-
-				if (!obj)
+				if (!SHPReadObjectView(state->hSHPHandle, j, &view))
 				{
 					snprintf(state->message, SHPLOADERMSGLEN, "Error reading shape object %d", j);
 					return SHPLOADERERR;
 				}
 
-				if (obj->nVertices == 0)
+				if (view.nVertices == 0)
 				{
 					snprintf(state->message, SHPLOADERMSGLEN, "Empty geometries found, aborted.");
 					return SHPLOADERERR;
 				}
-
-				SHPDestroyObject(obj);
 			}
 		}
 
@@ -1243,6 +2357,13 @@ ShpLoaderOpenShape(SHPLOADERSTATE *state)
 	state->precisions = malloc(state->num_fields * sizeof(int));
 	state->col_names = malloc((state->num_fields + 2) * sizeof(char) * MAXFIELDNAMELEN);
 
+	/* Open the descriptor used to convert the field names and values to UTF8 */
+	if (state->config->encoding && state->num_fields > 0)
+	{
+		if (OpenEncoding(state) != SHPLOADEROK)
+			return SHPLOADERERR;
+	}
+
 	/* Generate a string of comma separated column names of the form "(col1, col2 ... colN)" for the SQL
 	   insertion string */
 	strcpy(state->col_names, "(" );
@@ -1255,12 +2376,14 @@ ShpLoaderOpenShape(SHPLOADERSTATE *state)
 		state->widths[j] = field_width;
 		state->precisions[j] = field_precision;
 
+		/* Leave room in the value buffer for this field converted to UTF8 and terminated */
+		state->valuebuflen += field_width * 3 + 1;
+
 		if (state->config->encoding)
 		{
-            static char *encoding_msg = "Try \"LATIN1\" (Western European), or one of the values described at http://www.postgresql.org/docs/current/static/multibyte.html.";
+			/* DBF field names are at most 11 bytes, so always fit here */
+			int rv = utf8(state->cd, name, strlen(name), utf8str, MAXFIELDNAMELEN);
 
-            int rv = utf8(state->config->encoding, name, &utf8str);
-						
 			if (rv != UTF8_GOOD_RESULT)
 			{
                 if( rv == UTF8_BAD_RESULT )
@@ -1270,14 +2393,10 @@ ShpLoaderOpenShape(SHPLOADERSTATE *state)
 				else 
 				    snprintf(state->message, SHPLOADERMSGLEN, "Unexpected return value from utf8()");
 
-                if( rv == UTF8_BAD_RESULT )
-			        free(utf8str);
-
 				return SHPLOADERERR;
 			}
 
-			strncpy(name, utf8str, MAXFIELDNAMELEN);
-			free(utf8str);
+			strcpy(name, utf8str);
 		}
 
 		/*
@@ -1298,9 +2417,7 @@ ShpLoaderOpenShape(SHPLOADERSTATE *state)
 		        ! strcmp(name, "cmin") || ! strcmp(name, "primary") ||
 		        ! strcmp(name, "oid") || ! strcmp(name, "ctid"))
 		{
-			strncpy(name2 + 2, name, MAXFIELDNAMELEN - 2);
-			name2[0] = '_';
-			name2[1] = '_';
+			snprintf(name2, MAXFIELDNAMELEN, "__%s", name);
 			strcpy(name, name2);
 		}
 
@@ -1309,8 +2426,9 @@ ShpLoaderOpenShape(SHPLOADERSTATE *state)
 		{
 			if (strcmp(state->field_names[z], name) == 0)
 			{
-				strncat(name, "__", MAXFIELDNAMELEN);
-				snprintf(name + strlen(name), MAXFIELDNAMELEN, "%i", j);
+				size_t namelen = strlen(name);
+
+				snprintf(name + namelen, MAXFIELDNAMELEN - namelen, "__%i", j);
 				break;
 			}
 		}
@@ -1338,6 +2456,47 @@ ShpLoaderOpenShape(SHPLOADERSTATE *state)
 
 	strcat(state->col_names, ")");
 
+	state->valuebuf = malloc(state->valuebuflen);
+
+	/* Set up reprojection if the shapefile is in another SRID */
+	if (state->config->readshape == 1 && state->config->shp_sr_id != -1 &&
+	        state->config->shp_sr_id != state->config->sr_id)
+	{
+#ifdef HAVE_LOADER_PROJ
+		state->shp_proj = GetProjection(state, state->config->shp_sr_id);
+		if (!state->shp_proj)
+			return SHPLOADERERR;
+
+		state->proj = GetProjection(state, state->config->sr_id);
+		if (!state->proj)
+			return SHPLOADERERR;
+#else
+		snprintf(state->message, SHPLOADERMSGLEN, "Unable to reproject from SRID %d to SRID %d: this loader was built without PROJ.4 support. "
+		         "Load with -s %d and use ST_Transform() in the database instead.",
+		         state->config->shp_sr_id, state->config->sr_id, state->config->shp_sr_id);
+
+		return SHPLOADERERR;
+#endif
+	}
+
+	/* Pick out the records inside the filter box, if there is one */
+	if (state->config->readshape == 1 && state->config->bbox_filter)
+	{
+		switch (SelectRecords(state, &hooks))
+		{
+		case SHPLOADERERR:
+			return SHPLOADERERR;
+
+		case SHPLOADERWARN:
+			ret = SHPLOADERWARN;
+			break;
+		}
+	}
+
+	/* Work out the spatial order to load the records in, if asked to */
+	if (state->config->readshape == 1 && state->config->spatial_order)
+		ComputeRecordOrder(state);
+
 
 	/* Return status */
 	return ret;
@@ -1542,16 +2701,18 @@ ShpLoaderGetSQLCopyStatement(SHPLOADERSTATE *state, char **strheader)
 		if (state->config->schema)
 		{
 			copystr = malloc(strlen(state->config->schema) + strlen(state->config->table) +
-			                 strlen(state->col_names) + 40);
+			                 strlen(state->col_names) + 52);
 
-			sprintf(copystr, "COPY \"%s\".\"%s\" %s FROM stdin;\n",
-			        state->config->schema, state->config->table, state->col_names);
+			sprintf(copystr, "COPY \"%s\".\"%s\" %s FROM stdin%s;\n",
+			        state->config->schema, state->config->table, state->col_names,
+			        state->config->binary ? " WITH BINARY" : "");
 		}
 		else
 		{
-			copystr = malloc(strlen(state->config->table) + strlen(state->col_names) + 40);
+			copystr = malloc(strlen(state->config->table) + strlen(state->col_names) + 52);
 
-			sprintf(copystr, "COPY \"%s\" %s FROM stdin;\n", state->config->table, state->col_names);
+			sprintf(copystr, "COPY \"%s\" %s FROM stdin%s;\n", state->config->table, state->col_names,
+			        state->config->binary ? " WITH BINARY" : "");
 		}
 
 		*strheader = copystr;
@@ -1575,53 +2736,94 @@ ShpLoaderGetRecordCount(SHPLOADERSTATE *state)
 }
 
 
-/* Return an allocated string representation of a specified record item */
+/*
+ * Read a record item from the shapefile into record, ready to be passed
+ * to ShpLoaderFormatRecord(). This is the only part of generating a row
+ * which touches the shapefile handles, so must be called from one thread.
+ */
 int
-ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strrecord)
+ShpLoaderReadRecord(SHPLOADERSTATE *state, int item, SHPLOADERRECORD *record)
 {
-	SHPObject *obj = NULL;
-	stringbuffer_t *sb;
-	stringbuffer_t *sbwarn;
-	char val[MAXVALUELEN];
-	char *escval;
-	char *geometry=NULL, *ret;
-	char *utf8str;
-	int res, i;
-	int rv;
+	/* Map the item to a record when loading in spatial order */
+	if (state->record_order)
+		item = state->record_order[item];
 
-	/* Clear the stringbuffers */
-	sbwarn = stringbuffer_create();
-	stringbuffer_clear(sbwarn);
-	sb = stringbuffer_create();
-	stringbuffer_clear(sb);
+	record->item = item;
+	record->obj = NULL;
+	record->values = NULL;
+	record->data = NULL;
 
 	/* If we are reading the DBF only and the record has been marked deleted, return deleted record status */
 	if (state->config->readshape == 0 && DBFReadDeleted(state->hDBFHandle, item))
-	{
-		*strrecord = NULL;
 		return SHPLOADERRECDELETED;
-	}
 
 	/* If we are reading the shapefile, open the specified record */
 	if (state->config->readshape == 1)
 	{
-		obj = SHPReadObject(state->hSHPHandle, item);
-		if (!obj)
+		record->obj = SHPReadObject(state->hSHPHandle, item);
+		if (!record->obj)
 		{
 			snprintf(state->message, SHPLOADERMSGLEN, "Error reading shape object %d", item);
 			return SHPLOADERERR;
 		}
 
 		/* If we are set to skip NULLs, return a NULL record status */
-		if (state->config->null_policy == POLICY_NULL_SKIP && obj->nVertices == 0 )
+		if (state->config->null_policy == POLICY_NULL_SKIP && record->obj->nVertices == 0 )
 		{
-			SHPDestroyObject(obj);
+			SHPDestroyObject(record->obj);
+			record->obj = NULL;
 
-			*strrecord = NULL;
 			return SHPLOADERRECISNULL;
 		}
+
+#ifdef HAVE_LOADER_PROJ
+		/* Reproject the shape here rather than in ShpLoaderFormatRecord(), which may run in several threads */
+		if (state->shp_proj && record->obj->nVertices > 0 && ReprojectShape(state, record->obj) != SHPLOADEROK)
+		{
+			SHPDestroyObject(record->obj);
+			record->obj = NULL;
+
+			return SHPLOADERERR;
+		}
+#endif
+	}
+
+	/* Read all of the attributes from the DBF file for this item, leaving NULL for NULL attributes */
+	if (ReadRecordValues(state, item, record) != SHPLOADEROK)
+	{
+		if (record->obj)
+			SHPDestroyObject(record->obj);
+		record->obj = NULL;
+
+		return SHPLOADERERR;
 	}
 
+	return SHPLOADEROK;
+}
+
+
+/*
+ * Return an allocated string representation of a record read by ShpLoaderReadRecord().
+ * Errors and warnings are written to message (SHPLOADERMSGLEN bytes) rather than the
+ * state, and the state is only read, so several records may be formatted at once from
+ * different threads.
+ */
+int
+ShpLoaderFormatRecord(SHPLOADERSTATE *state, SHPLOADERRECORD *record, char **strrecord, char *message)
+{
+	stringbuffer_t *sb;
+	stringbuffer_t *sbwarn;
+	char val[MAXVALUELEN];
+	char *escval;
+	char *geometry=NULL, *ret;
+	int res, i, size;
+
+	/* Clear the stringbuffers */
+	sbwarn = stringbuffer_create();
+	stringbuffer_clear(sbwarn);
+	sb = stringbuffer_create();
+	stringbuffer_clear(sb);
+
 	/* If not in dump format, generate the INSERT string */
 	if (!state->config->dump_format)
 	{
@@ -1638,11 +2840,11 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 	}
 
 
-	/* Read all of the attributes from the DBF file for this item */
-	for (i = 0; i < DBFGetFieldCount(state->hDBFHandle); i++)
+	/* Format all of the attributes read from the DBF file for this item */
+	for (i = 0; i < state->num_fields; i++)
 	{
 		/* Special case for NULL attributes */
-		if (DBFIsAttributeNULL(state->hDBFHandle, item, i))
+		if (record->values[i] == NULL)
 		{
 			if (state->config->dump_format)
 				vasbappend(sb, "\\N");
@@ -1652,85 +2854,14 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 		else
 		{
 			/* Attribute NOT NULL */
-			switch (state->types[i])
+			if (ConvertAttribute(state, record->values[i], i, val, sbwarn, message) != SHPLOADEROK)
 			{
-			case FTInteger:
-			case FTDouble:
-				rv = snprintf(val, MAXVALUELEN, "%s", DBFReadStringAttribute(state->hDBFHandle, item, i));
-				if (rv >= MAXVALUELEN || rv == -1)
-				{
-					vasbappend(sbwarn, "Warning: field %d name truncated\n", i);
-					val[MAXVALUELEN - 1] = '\0';
-				}
-
-				/* If the value is an empty string, change to 0 */
-				if (val[0] == '\0')
-				{
-					val[0] = '0';
-					val[1] = '\0';
-				}
-
-				/* If the value ends with just ".", remove the dot */
-				if (val[strlen(val) - 1] == '.')
-					val[strlen(val) - 1] = '\0';
-				break;
-
-			case FTString:
-			case FTLogical:
-			case FTDate:
-				rv = snprintf(val, MAXVALUELEN, "%s", DBFReadStringAttribute(state->hDBFHandle, item, i));
-				if (rv >= MAXVALUELEN || rv == -1)
-				{
-					vasbappend(sbwarn, "Warning: field %d name truncated\n", i);
-					val[MAXVALUELEN - 1] = '\0';
-				}
-				break;
-
-			default:
-				snprintf(state->message, SHPLOADERMSGLEN, "Error: field %d has invalid or unknown field type (%d)", i, state->types[i]);
-
-				SHPDestroyObject(obj);
 				stringbuffer_destroy(sbwarn);
 				stringbuffer_destroy(sb);
 
 				return SHPLOADERERR;
 			}
 
-			if (state->config->encoding)
-			{
-                static char *encoding_msg = "Try \"LATIN1\" (Western European), or one of the values described at http://www.postgresql.org/docs/current/static/multibyte.html.";
-				/* If we are converting from another encoding to UTF8, convert the field value to UTF8 */
-				int rv = utf8(state->config->encoding, val, &utf8str);
-                if ( !UTF8_DROP_BAD_CHARACTERS && rv != UTF8_GOOD_RESULT )
-                {
-                    if( rv == UTF8_BAD_RESULT )
-					    snprintf(state->message, SHPLOADERMSGLEN, "Unable to convert data value \"%s\" to UTF-8 (iconv reports \"%s\"). Current encoding is \"%s\". %s", utf8str, strerror(errno), state->config->encoding, encoding_msg);
-				    else if( rv == UTF8_NO_RESULT )
-					    snprintf(state->message, SHPLOADERMSGLEN, "Unable to convert data value to UTF-8 (iconv reports \"%s\"). Current encoding is \"%s\". %s", strerror(errno), state->config->encoding, encoding_msg);
-					else 
-					    snprintf(state->message, SHPLOADERMSGLEN, "Unexpected return value from utf8()");
-
-                    if( rv == UTF8_BAD_RESULT )
-				        free(utf8str);
-        		    
-                	return SHPLOADERERR;
-                }
-				/* Optionally (compile-time) suppress bad UTF8 values */
-				if ( UTF8_DROP_BAD_CHARACTERS && rv != UTF8_GOOD_RESULT )
-				{
-					val[0] = '.';
-					val[1] = '\0';
-				}
-
-				
-				/* The utf8str buffer is only alloc'ed if the UTF8 conversion works */
-				if ( rv == UTF8_GOOD_RESULT )
-				{
-					strncpy(val, utf8str, MAXVALUELEN);
-					free(utf8str);
-				}
-			}
-
 			/* Escape attribute correctly according to dump format */
 			if (state->config->dump_format)
 			{
@@ -1749,7 +2880,7 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 		}
 
 		/* Only put in delimeter if not last field or a shape will follow */
-		if (state->config->readshape == 1 || i < DBFGetFieldCount(state->hDBFHandle) - 1)
+		if (state->config->readshape == 1 || i < state->num_fields - 1)
 		{
 			if (state->config->dump_format)
 				vasbappend(sb, "\t");
@@ -1765,7 +2896,7 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 	if (state->config->readshape == 1)
 	{
 		/* Handle the case of a NULL shape */
-		if (obj->nVertices == 0)
+		if (record->obj->nVertices == 0)
 		{
 			if (state->config->dump_format)
 				vasbappend(sb, "\\N");
@@ -1775,60 +2906,11 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 		else
 		{
 			/* Handle all other shape attributes */
-			switch (obj->nSHPType)
-			{
-			case SHPT_POLYGON:
-			case SHPT_POLYGONM:
-			case SHPT_POLYGONZ:
-				res = GeneratePolygonGeometry(state, obj, &geometry);
-				if (res != SHPLOADEROK)
-				{
-					/* Error message has already been set */
-					SHPDestroyObject(obj);
-					stringbuffer_destroy(sbwarn);
-					stringbuffer_destroy(sb);
+			res = GenerateGeometry(state, record->obj, &geometry, &size, message);
 
-					return SHPLOADERERR;
-				}
-				break;
-
-			case SHPT_POINT:
-			case SHPT_POINTM:
-			case SHPT_POINTZ:
-			case SHPT_MULTIPOINT:
-			case SHPT_MULTIPOINTM:
-			case SHPT_MULTIPOINTZ:
-				res = GeneratePointGeometry(state, obj, &geometry);
-				if (res != SHPLOADEROK)
-				{
-					/* Error message has already been set */
-					SHPDestroyObject(obj);
-					stringbuffer_destroy(sbwarn);
-					stringbuffer_destroy(sb);
-
-					return SHPLOADERERR;
-				}
-				break;
-
-			case SHPT_ARC:
-			case SHPT_ARCM:
-			case SHPT_ARCZ:
-				res = GenerateLineStringGeometry(state, obj, &geometry);
-				if (res != SHPLOADEROK)
-				{
-					/* Error message has already been set */
-					SHPDestroyObject(obj);
-					stringbuffer_destroy(sbwarn);
-					stringbuffer_destroy(sb);
-
-					return SHPLOADERERR;
-				}
-				break;
-
-			default:
-				snprintf(state->message, SHPLOADERMSGLEN, "Shape type is NOT SUPPORTED, type id = %d", obj->nSHPType);
-
-				SHPDestroyObject(obj);
+			if (res != SHPLOADEROK)
+			{
+				/* Error message has already been set */
 				stringbuffer_destroy(sbwarn);
 				stringbuffer_destroy(sb);
 
@@ -1876,9 +2958,6 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 
 			free(geometry);
 		}
-
-		/* Tidy up everything */
-		SHPDestroyObject(obj);
 	}
 
 	/* Close the line correctly for dump/insert format */
@@ -1896,7 +2975,7 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 	/* If any warnings occurred, set the returned message string and warning status */
 	if (strlen((char *)stringbuffer_getstring(sbwarn)) > 0)
 	{
-		snprintf(state->message, SHPLOADERMSGLEN, "%s", stringbuffer_getstring(sbwarn));
+		snprintf(message, SHPLOADERMSGLEN, "%s", stringbuffer_getstring(sbwarn));
 		stringbuffer_destroy(sbwarn);
 
 		return SHPLOADERWARN;
@@ -1911,6 +2990,198 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 }
 
 
+/* Free the contents of a record filled in by ShpLoaderReadRecord() */
+void
+ShpLoaderFreeRecord(SHPLOADERSTATE *state, SHPLOADERRECORD *record)
+{
+	if (record->obj)
+		SHPDestroyObject(record->obj);
+
+	if (record->values)
+		free(record->values);
+
+	if (record->data)
+		free(record->data);
+
+	record->obj = NULL;
+	record->values = NULL;
+	record->data = NULL;
+}
+
+
+/* Return an allocated string representation of a specified record item */
+int
+ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strrecord)
+{
+	SHPLOADERRECORD record;
+	int ret;
+
+	ret = ShpLoaderReadRecord(state, item, &record);
+	if (ret != SHPLOADEROK)
+	{
+		ShpLoaderFreeRecord(state, &record);
+		*strrecord = NULL;
+
+		return ret;
+	}
+
+	ret = ShpLoaderFormatRecord(state, &record, strrecord, state->message);
+	ShpLoaderFreeRecord(state, &record);
+
+	return ret;
+}
+
+
+/* Return an allocated buffer containing the binary COPY header, of len bytes */
+int
+ShpLoaderGetBinaryCopyHeader(SHPLOADERSTATE *state, char **binheader, int *len)
+{
+	bytebuffer_t bb;
+
+	bb.size = 32;
+	bb.len = 0;
+	bb.data = malloc(bb.size);
+
+	/* Signature, then no flags and no header extension */
+	bytebuffer_append(&bb, binary_copy_signature, sizeof(binary_copy_signature));
+	bytebuffer_append_int32(&bb, 0);
+	bytebuffer_append_int32(&bb, 0);
+
+	*binheader = (char *)bb.data;
+	*len = bb.len;
+
+	return SHPLOADEROK;
+}
+
+
+/*
+ * Return an allocated binary COPY tuple of len bytes for a record read by
+ * ShpLoaderReadRecord(). As ShpLoaderFormatRecord(), errors and warnings go
+ * to message and the state is only read.
+ */
+int
+ShpLoaderFormatRecordBinary(SHPLOADERSTATE *state, SHPLOADERRECORD *record, char **binrecord, int *len, char *message)
+{
+	bytebuffer_t bb;
+	stringbuffer_t *sbwarn;
+	char val[MAXVALUELEN];
+	char *geometry;
+	int i, size;
+
+	sbwarn = stringbuffer_create();
+	stringbuffer_clear(sbwarn);
+
+	bb.size = 256;
+	bb.len = 0;
+	bb.data = malloc(bb.size);
+
+	/* Field count */
+	bytebuffer_append_int16(&bb, state->num_fields + (state->config->readshape == 1 ? 1 : 0));
+
+	/* Encode all of the attributes read from the DBF file for this item */
+	for (i = 0; i < state->num_fields; i++)
+	{
+		if (record->values[i] == NULL)
+		{
+			bytebuffer_append_int32(&bb, -1);
+			continue;
+		}
+
+		if (ConvertAttribute(state, record->values[i], i, val, sbwarn, message) != SHPLOADEROK ||
+		        bytebuffer_append_attribute(state, &bb, i, val, message) != SHPLOADEROK)
+		{
+			stringbuffer_destroy(sbwarn);
+			free(bb.data);
+
+			return SHPLOADERERR;
+		}
+	}
+
+	/* Add the shape as raw EWKB if we are reading it */
+	if (state->config->readshape == 1)
+	{
+		if (record->obj->nVertices == 0)
+		{
+			bytebuffer_append_int32(&bb, -1);
+		}
+		else
+		{
+			if (GenerateGeometry(state, record->obj, &geometry, &size, message) != SHPLOADEROK)
+			{
+				stringbuffer_destroy(sbwarn);
+				free(bb.data);
+
+				return SHPLOADERERR;
+			}
+
+			bytebuffer_append_int32(&bb, size);
+			bytebuffer_append(&bb, geometry, size);
+			free(geometry);
+		}
+	}
+
+	*binrecord = (char *)bb.data;
+	*len = bb.len;
+
+	/* If any warnings occurred, set the returned message string and warning status */
+	if (strlen((char *)stringbuffer_getstring(sbwarn)) > 0)
+	{
+		snprintf(message, SHPLOADERMSGLEN, "%s", stringbuffer_getstring(sbwarn));
+		stringbuffer_destroy(sbwarn);
+
+		return SHPLOADERWARN;
+	}
+
+	stringbuffer_destroy(sbwarn);
+
+	return SHPLOADEROK;
+}
+
+
+/* Return an allocated binary COPY tuple of len bytes for the specified record item */
+int
+ShpLoaderGenerateBinaryRow(SHPLOADERSTATE *state, int item, char **binrecord, int *len)
+{
+	SHPLOADERRECORD record;
+	int ret;
+
+	ret = ShpLoaderReadRecord(state, item, &record);
+	if (ret != SHPLOADEROK)
+	{
+		ShpLoaderFreeRecord(state, &record);
+		*binrecord = NULL;
+		*len = 0;
+
+		return ret;
+	}
+
+	ret = ShpLoaderFormatRecordBinary(state, &record, binrecord, len, state->message);
+	ShpLoaderFreeRecord(state, &record);
+
+	return ret;
+}
+
+
+/* Return an allocated buffer containing the binary COPY trailer, of len bytes */
+int
+ShpLoaderGetBinaryCopyTrailer(SHPLOADERSTATE *state, char **bintrailer, int *len)
+{
+	bytebuffer_t bb;
+
+	bb.size = 2;
+	bb.len = 0;
+	bb.data = malloc(bb.size);
+
+	/* A field count of -1 ends the data */
+	bytebuffer_append_int16(&bb, -1);
+
+	*bintrailer = (char *)bb.data;
+	*len = bb.len;
+
+	return SHPLOADEROK;
+}
+
+
 /* Return a pointer to an allocated string containing the header for the specified loader state */
 int
 ShpLoaderGetSQLFooter(SHPLOADERSTATE *state, char **strfooter)
@@ -1984,6 +3255,18 @@ ShpLoaderDestroy(SHPLOADERSTATE *state)
 			free(state->precisions);
 		if (state->col_names)
 			free(state->col_names);
+#ifdef HAVE_LOADER_PROJ
+		if (state->shp_proj)
+			pj_free(state->shp_proj);
+		if (state->proj)
+			pj_free(state->proj);
+#endif
+		if (state->record_order)
+			free(state->record_order);
+		if (state->cd != (iconv_t)-1)
+			iconv_close(state->cd);
+		if (state->valuebuf)
+			free(state->valuebuf);
 
 		/* Free the state itself */
 		free(state);
@@ -21,6 +21,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <iconv.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include "../postgis_config.h"
+
+#ifdef HAVE_LOADER_PROJ
+#include "proj_api.h"
+#endif
 
 #include "shapefil.h"
 #include "getopt.h"
@@ -96,6 +104,9 @@ typedef struct shp_loader_config
 	/* 0 = SQL inserts, 1 = dump */
 	int dump_format;
 
+	/* 0 = text COPY rows, 1 = binary COPY tuples (dump format only) */
+	int binary;
+
 	/* 0 = MULTIPOLYGON/MULTILINESTRING, 1 = force to POLYGON/LINESTRING */
 	int simple_geometries;
 	
@@ -123,6 +134,16 @@ typedef struct shp_loader_config
 	/* SRID specified */
 	int sr_id;
 
+	/* SRID of the shapefile coordinates if they are to be reprojected to sr_id, otherwise -1 */
+	int shp_sr_id;
+
+	/* 0 = shapefile order, 1 = load the records in Hilbert curve order of their bounding boxes */
+	int spatial_order;
+
+	/* 1 = only load the shapes whose bounding boxes intersect bbox (xmin, ymin, xmax, ymax) */
+	int bbox_filter;
+	double bbox[4];
+
 	/* 0 = new style (PostGIS 1.x) geometries, 1 = old style (PostGIS 0.9.x) geometries */
 	int hwgeom;
 
@@ -181,12 +202,54 @@ typedef struct shp_loader_state
 	/* 0 = simple geometry, 1 = multi geometry */
 	int istypeM;
 
+#ifdef HAVE_LOADER_PROJ
+	/* PROJ.4 projections of shp_sr_id and sr_id when reprojecting, otherwise NULL */
+	projPJ shp_proj;
+	projPJ proj;
+#endif
+
+	/* Order in which to read the records, or NULL for shapefile order */
+	int *record_order;
+
+	/* iconv descriptor converting from the configured encoding to UTF-8, opened once per load */
+	iconv_t cd;
+
+	/* Set if the encoding leaves ASCII unchanged, so that ASCII values need no conversion */
+	int ascii_passthrough;
+
+	/* Buffer the attribute values of a record are converted into, big enough for any record */
+	char *valuebuf;
+	size_t valuebuflen;
+
 	/* Last (error) message */
 	char message[SHPLOADERMSGLEN];
 
 } SHPLOADERSTATE;
 
 
+/*
+ * A shapefile record read by ShpLoaderReadRecord(), holding everything
+ * ShpLoaderFormatRecord() needs so that formatting does not touch the
+ * shapefile handles
+ */
+
+typedef struct shp_loader_record
+{
+	/* Record number within the shapefile */
+	int item;
+
+	/* Shape object, or NULL if only the DBF file is being loaded */
+	SHPObject *obj;
+
+	/* Attribute values as read from the DBF file, NULL for NULL attributes */
+	char **values;
+
+	/* Block holding the (UTF-8) attribute values, which values points into */
+	char *data;
+
+} SHPLOADERRECORD;
+
+
 typedef struct shp_connection_state
 {
 	/* PgSQL username to log in with */
@@ -218,5 +281,12 @@ int ShpLoaderGetSQLHeader(SHPLOADERSTATE *state, char **strheader);
 int ShpLoaderGetSQLCopyStatement(SHPLOADERSTATE *state, char **strheader);
 int ShpLoaderGetRecordCount(SHPLOADERSTATE *state);
 int ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strrecord);
+int ShpLoaderReadRecord(SHPLOADERSTATE *state, int item, SHPLOADERRECORD *record);
+int ShpLoaderFormatRecord(SHPLOADERSTATE *state, SHPLOADERRECORD *record, char **strrecord, char *message);
+int ShpLoaderGetBinaryCopyHeader(SHPLOADERSTATE *state, char **binheader, int *len);
+int ShpLoaderGenerateBinaryRow(SHPLOADERSTATE *state, int item, char **binrecord, int *len);
+int ShpLoaderFormatRecordBinary(SHPLOADERSTATE *state, SHPLOADERRECORD *record, char **binrecord, int *len, char *message);
+int ShpLoaderGetBinaryCopyTrailer(SHPLOADERSTATE *state, char **bintrailer, int *len);
+void ShpLoaderFreeRecord(SHPLOADERSTATE *state, SHPLOADERRECORD *record);
 int ShpLoaderGetSQLFooter(SHPLOADERSTATE *state, char **strfooter);
 void ShpLoaderDestroy(SHPLOADERSTATE *state);
@@ -1539,30 +1539,61 @@ SHPWriteObject(SHPHandle psSHP, int nShapeId, SHPObject * psObject )
 }
 
 /************************************************************************/
-/*                          SHPReadObject()                             */
+/*                           SHPViewGetInt()                            */
 /*                                                                      */
-/*      Read the vertices, parts, and other non-attribute information	*/
-/*	for one shape.							*/
+/*      Read a little endian, possibly unaligned, int32 of a view.      */
 /************************************************************************/
 
-SHPObject SHPAPI_CALL1(*)
-SHPReadObject( SHPHandle psSHP, int hEntity )
+static int SHPViewGetInt( const uchar *pabyValue )
 
 {
-    int                  nEntitySize, nRequiredSize;
-    SHPObject           *psShape;
-    char                 szErrorMsg[128];
+    int32	nValue;
 
-/* -------------------------------------------------------------------- */
-/*      Validate the record/entity number.                              */
-/* -------------------------------------------------------------------- */
-    if( hEntity < 0 || hEntity >= psSHP->nRecords )
-        return( NULL );
+    memcpy( &nValue, pabyValue, 4 );
+    if( bBigEndian ) SwapWord( 4, &nValue );
+
+    return nValue;
+}
+
+/************************************************************************/
+/*                          SHPViewGetDouble()                          */
+/*                                                                      */
+/*      Read a little endian, possibly unaligned, double of a view.     */
+/************************************************************************/
+
+double SHPAPI_CALL
+SHPViewGetDouble( const uchar *pabyValue )
+
+{
+    double	dfValue;
+
+    memcpy( &dfValue, pabyValue, 8 );
+    if( bBigEndian ) SwapWord( 8, &dfValue );
+
+    return dfValue;
+}
+
+/************************************************************************/
+/*                           SHPReadRecord()                            */
+/*                                                                      */
+/*      Return the nEntitySize bytes of record hEntity, in place if     */
+/*      the .shp file is mapped, otherwise read into pabyRec.           */
+/************************************************************************/
+
+static const uchar *SHPReadRecord( SHPHandle psSHP, int hEntity, int nEntitySize )
+
+{
+    const uchar         *pabyRec;
+
+    pabyRec = (const uchar *) psSHP->sHooks.FMap( psSHP->fpSHP,
+                                                  psSHP->panRecOffset[hEntity],
+                                                  nEntitySize );
+    if( pabyRec != NULL )
+        return pabyRec;
 
 /* -------------------------------------------------------------------- */
 /*      Ensure our record buffer is large enough.                       */
 /* -------------------------------------------------------------------- */
-    nEntitySize = psSHP->panRecSize[hEntity]+8;
     if( nEntitySize > psSHP->nBufSize )
     {
         psSHP->pabyRec = (uchar *) SfRealloc(psSHP->pabyRec,nEntitySize);
@@ -1623,12 +1654,39 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
         return NULL;
     }
 
+    return psSHP->pabyRec;
+}
+
+/************************************************************************/
+/*                         SHPReadObjectView()                          */
+/*                                                                      */
+/*      Validate one shape and return a view of its parts and           */
+/*      vertices as they are stored in the file, without copying or     */
+/*      allocating anything.  Returns FALSE if the shape cannot be      */
+/*      read.                                                           */
+/************************************************************************/
+
+int SHPAPI_CALL
+SHPReadObjectView( SHPHandle psSHP, int hEntity, SHPObjectView *psView )
+
+{
+    const uchar         *pabyRec;
+    int                  nEntitySize, nRequiredSize;
+    char                 szErrorMsg[128];
+
 /* -------------------------------------------------------------------- */
-/*	Allocate and minimally initialize the object.			*/
+/*      Validate the record/entity number.                              */
 /* -------------------------------------------------------------------- */
-    psShape = (SHPObject *) calloc(1,sizeof(SHPObject));
-    psShape->nShapeId = hEntity;
-    psShape->bMeasureIsUsed = FALSE;
+    if( hEntity < 0 || hEntity >= psSHP->nRecords )
+        return FALSE;
+
+    nEntitySize = psSHP->panRecSize[hEntity]+8;
+    pabyRec = SHPReadRecord( psSHP, hEntity, nEntitySize );
+    if( pabyRec == NULL )
+        return FALSE;
+
+    memset( psView, 0, sizeof(SHPObjectView) );
+    psView->nShapeId = hEntity;
 
     if ( 8 + 4 > nEntitySize )
     {
@@ -1636,25 +1694,22 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
                  "Corrupted .shp file : shape %d : nEntitySize = %d",
                  hEntity, nEntitySize); 
         psSHP->sHooks.Error( szErrorMsg );
-        SHPDestroyObject(psShape);
-        return NULL;
+        return FALSE;
     }
-    memcpy( &psShape->nSHPType, psSHP->pabyRec + 8, 4 );
-
-    if( bBigEndian ) SwapWord( 4, &(psShape->nSHPType) );
+    psView->nSHPType = SHPViewGetInt( pabyRec + 8 );
 
 /* ==================================================================== */
 /*  Extract vertices for a Polygon or Arc.				*/
 /* ==================================================================== */
-    if( psShape->nSHPType == SHPT_POLYGON || psShape->nSHPType == SHPT_ARC
-        || psShape->nSHPType == SHPT_POLYGONZ
-        || psShape->nSHPType == SHPT_POLYGONM
-        || psShape->nSHPType == SHPT_ARCZ
-        || psShape->nSHPType == SHPT_ARCM
-        || psShape->nSHPType == SHPT_MULTIPATCH )
+    if( psView->nSHPType == SHPT_POLYGON || psView->nSHPType == SHPT_ARC
+        || psView->nSHPType == SHPT_POLYGONZ
+        || psView->nSHPType == SHPT_POLYGONM
+        || psView->nSHPType == SHPT_ARCZ
+        || psView->nSHPType == SHPT_ARCM
+        || psView->nSHPType == SHPT_MULTIPATCH )
     {
         int32		nPoints, nParts;
-        int    		i, nOffset;
+        int    		i, nOffset, nStart, nLastStart = 0;
 
         if ( 40 + 8 + 4 > nEntitySize )
         {
@@ -1662,31 +1717,22 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
                      "Corrupted .shp file : shape %d : nEntitySize = %d",
                      hEntity, nEntitySize); 
             psSHP->sHooks.Error( szErrorMsg );
-            SHPDestroyObject(psShape);
-            return NULL;
+            return FALSE;
         }
 /* -------------------------------------------------------------------- */
 /*	Get the X/Y bounds.						*/
 /* -------------------------------------------------------------------- */
-        memcpy( &(psShape->dfXMin), psSHP->pabyRec + 8 +  4, 8 );
-        memcpy( &(psShape->dfYMin), psSHP->pabyRec + 8 + 12, 8 );
-        memcpy( &(psShape->dfXMax), psSHP->pabyRec + 8 + 20, 8 );
-        memcpy( &(psShape->dfYMax), psSHP->pabyRec + 8 + 28, 8 );
-
-        if( bBigEndian ) SwapWord( 8, &(psShape->dfXMin) );
-        if( bBigEndian ) SwapWord( 8, &(psShape->dfYMin) );
-        if( bBigEndian ) SwapWord( 8, &(psShape->dfXMax) );
-        if( bBigEndian ) SwapWord( 8, &(psShape->dfYMax) );
+        psView->dfXMin = SHPViewGetDouble( pabyRec + 8 +  4 );
+        psView->dfYMin = SHPViewGetDouble( pabyRec + 8 + 12 );
+        psView->dfXMax = SHPViewGetDouble( pabyRec + 8 + 20 );
+        psView->dfYMax = SHPViewGetDouble( pabyRec + 8 + 28 );
 
 /* -------------------------------------------------------------------- */
-/*      Extract part/point count, and build vertex and part arrays      */
-/*      to proper size.                                                 */
+/*      Extract part/point count, and check the record is big enough    */
+/*      for them.                                                       */
 /* -------------------------------------------------------------------- */
-        memcpy( &nPoints, psSHP->pabyRec + 40 + 8, 4 );
-        memcpy( &nParts, psSHP->pabyRec + 36 + 8, 4 );
-
-        if( bBigEndian ) SwapWord( 4, &nPoints );
-        if( bBigEndian ) SwapWord( 4, &nParts );
+        nPoints = SHPViewGetInt( pabyRec + 40 + 8 );
+        nParts = SHPViewGetInt( pabyRec + 36 + 8 );
 
         if (nPoints < 0 || nParts < 0 ||
             nPoints > 50 * 1000 * 1000 || nParts > 10 * 1000 * 1000)
@@ -1695,21 +1741,20 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
                      "Corrupted .shp file : shape %d, nPoints=%d, nParts=%d.",
                      hEntity, nPoints, nParts);
             psSHP->sHooks.Error( szErrorMsg );
-            SHPDestroyObject(psShape);
-            return NULL;
+            return FALSE;
         }
         
         /* With the previous checks on nPoints and nParts, */
         /* we should not overflow here and after */
         /* since 50 M * (16 + 8 + 8) = 1 600 MB */
         nRequiredSize = 44 + 8 + 4 * nParts + 16 * nPoints;
-        if ( psShape->nSHPType == SHPT_POLYGONZ
-             || psShape->nSHPType == SHPT_ARCZ
-             || psShape->nSHPType == SHPT_MULTIPATCH )
+        if ( psView->nSHPType == SHPT_POLYGONZ
+             || psView->nSHPType == SHPT_ARCZ
+             || psView->nSHPType == SHPT_MULTIPATCH )
         {
             nRequiredSize += 16 + 8 * nPoints;
         }
-        if( psShape->nSHPType == SHPT_MULTIPATCH )
+        if( psView->nSHPType == SHPT_MULTIPATCH )
         {
             nRequiredSize += 4 * nParts;
         }
@@ -1719,67 +1764,40 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
                      "Corrupted .shp file : shape %d, nPoints=%d, nParts=%d, nEntitySize=%d.",
                      hEntity, nPoints, nParts, nEntitySize);
             psSHP->sHooks.Error( szErrorMsg );
-            SHPDestroyObject(psShape);
-            return NULL;
-        }
-
-        psShape->nVertices = nPoints;
-        psShape->padfX = (double *) calloc(nPoints,sizeof(double));
-        psShape->padfY = (double *) calloc(nPoints,sizeof(double));
-        psShape->padfZ = (double *) calloc(nPoints,sizeof(double));
-        psShape->padfM = (double *) calloc(nPoints,sizeof(double));
-
-        psShape->nParts = nParts;
-        psShape->panPartStart = (int *) calloc(nParts,sizeof(int));
-        psShape->panPartType = (int *) calloc(nParts,sizeof(int));
-        
-        if (psShape->padfX == NULL ||
-            psShape->padfY == NULL ||
-            psShape->padfZ == NULL ||
-            psShape->padfM == NULL ||
-            psShape->panPartStart == NULL ||
-            psShape->panPartType == NULL)
-        {
-            snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Not enough memory to allocate requested memory (nPoints=%d, nParts=%d) for shape %d. "
-                     "Probably broken SHP file", hEntity, nPoints, nParts );
-            psSHP->sHooks.Error( szErrorMsg );
-            SHPDestroyObject(psShape);
-            return NULL;
+            return FALSE;
         }
 
-        for( i = 0; i < nParts; i++ )
-            psShape->panPartType[i] = SHPP_RING;
+        psView->nVertices = nPoints;
+        psView->nParts = nParts;
 
 /* -------------------------------------------------------------------- */
-/*      Copy out the part array from the record.                        */
+/*      Check the part array.                                           */
 /* -------------------------------------------------------------------- */
-        memcpy( psShape->panPartStart, psSHP->pabyRec + 44 + 8, 4 * nParts );
+        psView->pabyPartStart = pabyRec + 44 + 8;
         for( i = 0; i < nParts; i++ )
         {
-            if( bBigEndian ) SwapWord( 4, psShape->panPartStart+i );
+            nStart = SHPViewGetInt( psView->pabyPartStart + 4*i );
 
             /* We check that the offset is inside the vertex array */
-            if (psShape->panPartStart[i] < 0
-                || (psShape->panPartStart[i] >= psShape->nVertices
-                    && psShape->nVertices > 0) )
+            if (nStart < 0
+                || (nStart >= nPoints
+                    && nPoints > 0) )
             {
                 snprintf(szErrorMsg, sizeof(szErrorMsg),
                          "Corrupted .shp file : shape %d : panPartStart[%d] = %d, nVertices = %d",
-                         hEntity, i, psShape->panPartStart[i], psShape->nVertices); 
+                         hEntity, i, nStart, nPoints); 
                 psSHP->sHooks.Error( szErrorMsg );
-                SHPDestroyObject(psShape);
-                return NULL;
+                return FALSE;
             }
-            if (i > 0 && psShape->panPartStart[i] <= psShape->panPartStart[i-1])
+            if (i > 0 && nStart <= nLastStart)
             {
                 snprintf(szErrorMsg, sizeof(szErrorMsg),
                          "Corrupted .shp file : shape %d : panPartStart[%d] = %d, panPartStart[%d] = %d",
-                         hEntity, i, psShape->panPartStart[i], i - 1, psShape->panPartStart[i - 1]); 
+                         hEntity, i, nStart, i - 1, nLastStart); 
                 psSHP->sHooks.Error( szErrorMsg );
-                SHPDestroyObject(psShape);
-                return NULL;
+                return FALSE;
             }
+            nLastStart = nStart;
         }
 
         nOffset = 44 + 8 + 4*nParts;
@@ -1787,55 +1805,25 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
 /* -------------------------------------------------------------------- */
 /*      If this is a multipatch, we will also have parts types.         */
 /* -------------------------------------------------------------------- */
-        if( psShape->nSHPType == SHPT_MULTIPATCH )
+        if( psView->nSHPType == SHPT_MULTIPATCH )
         {
-            memcpy( psShape->panPartType, psSHP->pabyRec + nOffset, 4*nParts );
-            for( i = 0; i < nParts; i++ )
-            {
-                if( bBigEndian ) SwapWord( 4, psShape->panPartType+i );
-            }
-
+            psView->pabyPartType = pabyRec + nOffset;
             nOffset += 4*nParts;
         }
-        
-/* -------------------------------------------------------------------- */
-/*      Copy out the vertices from the record.                          */
-/* -------------------------------------------------------------------- */
-        for( i = 0; i < nPoints; i++ )
-        {
-            memcpy(psShape->padfX + i,
-                   psSHP->pabyRec + nOffset + i * 16,
-                   8 );
-
-            memcpy(psShape->padfY + i,
-                   psSHP->pabyRec + nOffset + i * 16 + 8,
-                   8 );
-
-            if( bBigEndian ) SwapWord( 8, psShape->padfX + i );
-            if( bBigEndian ) SwapWord( 8, psShape->padfY + i );
-        }
 
+        psView->pabyXY = pabyRec + nOffset;
         nOffset += 16*nPoints;
         
 /* -------------------------------------------------------------------- */
 /*      If we have a Z coordinate, collect that now.                    */
 /* -------------------------------------------------------------------- */
-        if( psShape->nSHPType == SHPT_POLYGONZ
-            || psShape->nSHPType == SHPT_ARCZ
-            || psShape->nSHPType == SHPT_MULTIPATCH )
+        if( psView->nSHPType == SHPT_POLYGONZ
+            || psView->nSHPType == SHPT_ARCZ
+            || psView->nSHPType == SHPT_MULTIPATCH )
         {
-            memcpy( &(psShape->dfZMin), psSHP->pabyRec + nOffset, 8 );
-            memcpy( &(psShape->dfZMax), psSHP->pabyRec + nOffset + 8, 8 );
-            
-            if( bBigEndian ) SwapWord( 8, &(psShape->dfZMin) );
-            if( bBigEndian ) SwapWord( 8, &(psShape->dfZMax) );
-            
-            for( i = 0; i < nPoints; i++ )
-            {
-                memcpy( psShape->padfZ + i,
-                        psSHP->pabyRec + nOffset + 16 + i*8, 8 );
-                if( bBigEndian ) SwapWord( 8, psShape->padfZ + i );
-            }
+            psView->dfZMin = SHPViewGetDouble( pabyRec + nOffset );
+            psView->dfZMax = SHPViewGetDouble( pabyRec + nOffset + 8 );
+            psView->pabyZ = pabyRec + nOffset + 16;
 
             nOffset += 16 + 8*nPoints;
         }
@@ -1848,31 +1836,21 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
 /* -------------------------------------------------------------------- */
         if( nEntitySize >= nOffset + 16 + 8*nPoints )
         {
-            memcpy( &(psShape->dfMMin), psSHP->pabyRec + nOffset, 8 );
-            memcpy( &(psShape->dfMMax), psSHP->pabyRec + nOffset + 8, 8 );
-            
-            if( bBigEndian ) SwapWord( 8, &(psShape->dfMMin) );
-            if( bBigEndian ) SwapWord( 8, &(psShape->dfMMax) );
-            
-            for( i = 0; i < nPoints; i++ )
-            {
-                memcpy( psShape->padfM + i,
-                        psSHP->pabyRec + nOffset + 16 + i*8, 8 );
-                if( bBigEndian ) SwapWord( 8, psShape->padfM + i );
-            }
-            psShape->bMeasureIsUsed = TRUE;
+            psView->dfMMin = SHPViewGetDouble( pabyRec + nOffset );
+            psView->dfMMax = SHPViewGetDouble( pabyRec + nOffset + 8 );
+            psView->pabyM = pabyRec + nOffset + 16;
         }
     }
 
 /* ==================================================================== */
 /*  Extract vertices for a MultiPoint.					*/
 /* ==================================================================== */
-    else if( psShape->nSHPType == SHPT_MULTIPOINT
-             || psShape->nSHPType == SHPT_MULTIPOINTM
-             || psShape->nSHPType == SHPT_MULTIPOINTZ )
+    else if( psView->nSHPType == SHPT_MULTIPOINT
+             || psView->nSHPType == SHPT_MULTIPOINTM
+             || psView->nSHPType == SHPT_MULTIPOINTZ )
     {
         int32		nPoints;
-        int    		i, nOffset;
+        int    		nOffset;
 
         if ( 44 + 4 > nEntitySize )
         {
@@ -1880,12 +1858,9 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
                      "Corrupted .shp file : shape %d : nEntitySize = %d",
                      hEntity, nEntitySize); 
             psSHP->sHooks.Error( szErrorMsg );
-            SHPDestroyObject(psShape);
-            return NULL;
+            return FALSE;
         }
-        memcpy( &nPoints, psSHP->pabyRec + 44, 4 );
-
-        if( bBigEndian ) SwapWord( 4, &nPoints );
+        nPoints = SHPViewGetInt( pabyRec + 44 );
 
         if (nPoints < 0 || nPoints > 50 * 1000 * 1000)
         {
@@ -1893,12 +1868,11 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
                      "Corrupted .shp file : shape %d : nPoints = %d",
                      hEntity, nPoints); 
             psSHP->sHooks.Error( szErrorMsg );
-            SHPDestroyObject(psShape);
-            return NULL;
+            return FALSE;
         }
 
         nRequiredSize = 48 + nPoints * 16;
-        if( psShape->nSHPType == SHPT_MULTIPOINTZ )
+        if( psView->nSHPType == SHPT_MULTIPOINTZ )
         {
             nRequiredSize += 16 + nPoints * 8;
         }
@@ -1908,70 +1882,30 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
                      "Corrupted .shp file : shape %d : nPoints = %d, nEntitySize = %d",
                      hEntity, nPoints, nEntitySize); 
             psSHP->sHooks.Error( szErrorMsg );
-            SHPDestroyObject(psShape);
-            return NULL;
+            return FALSE;
         }
         
-        psShape->nVertices = nPoints;
-        psShape->padfX = (double *) calloc(nPoints,sizeof(double));
-        psShape->padfY = (double *) calloc(nPoints,sizeof(double));
-        psShape->padfZ = (double *) calloc(nPoints,sizeof(double));
-        psShape->padfM = (double *) calloc(nPoints,sizeof(double));
-
-        if (psShape->padfX == NULL ||
-            psShape->padfY == NULL ||
-            psShape->padfZ == NULL ||
-            psShape->padfM == NULL)
-        {
-            snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Not enough memory to allocate requested memory (nPoints=%d) for shape %d. "
-                     "Probably broken SHP file", hEntity, nPoints );
-            psSHP->sHooks.Error( szErrorMsg );
-            SHPDestroyObject(psShape);
-            return NULL;
-        }
-
-        for( i = 0; i < nPoints; i++ )
-        {
-            memcpy(psShape->padfX+i, psSHP->pabyRec + 48 + 16 * i, 8 );
-            memcpy(psShape->padfY+i, psSHP->pabyRec + 48 + 16 * i + 8, 8 );
-
-            if( bBigEndian ) SwapWord( 8, psShape->padfX + i );
-            if( bBigEndian ) SwapWord( 8, psShape->padfY + i );
-        }
+        psView->nVertices = nPoints;
+        psView->pabyXY = pabyRec + 48;
 
         nOffset = 48 + 16*nPoints;
         
 /* -------------------------------------------------------------------- */
 /*	Get the X/Y bounds.						*/
 /* -------------------------------------------------------------------- */
-        memcpy( &(psShape->dfXMin), psSHP->pabyRec + 8 +  4, 8 );
-        memcpy( &(psShape->dfYMin), psSHP->pabyRec + 8 + 12, 8 );
-        memcpy( &(psShape->dfXMax), psSHP->pabyRec + 8 + 20, 8 );
-        memcpy( &(psShape->dfYMax), psSHP->pabyRec + 8 + 28, 8 );
-
-        if( bBigEndian ) SwapWord( 8, &(psShape->dfXMin) );
-        if( bBigEndian ) SwapWord( 8, &(psShape->dfYMin) );
-        if( bBigEndian ) SwapWord( 8, &(psShape->dfXMax) );
-        if( bBigEndian ) SwapWord( 8, &(psShape->dfYMax) );
+        psView->dfXMin = SHPViewGetDouble( pabyRec + 8 +  4 );
+        psView->dfYMin = SHPViewGetDouble( pabyRec + 8 + 12 );
+        psView->dfXMax = SHPViewGetDouble( pabyRec + 8 + 20 );
+        psView->dfYMax = SHPViewGetDouble( pabyRec + 8 + 28 );
 
 /* -------------------------------------------------------------------- */
 /*      If we have a Z coordinate, collect that now.                    */
 /* -------------------------------------------------------------------- */
-        if( psShape->nSHPType == SHPT_MULTIPOINTZ )
+        if( psView->nSHPType == SHPT_MULTIPOINTZ )
         {
-            memcpy( &(psShape->dfZMin), psSHP->pabyRec + nOffset, 8 );
-            memcpy( &(psShape->dfZMax), psSHP->pabyRec + nOffset + 8, 8 );
-            
-            if( bBigEndian ) SwapWord( 8, &(psShape->dfZMin) );
-            if( bBigEndian ) SwapWord( 8, &(psShape->dfZMax) );
-            
-            for( i = 0; i < nPoints; i++ )
-            {
-                memcpy( psShape->padfZ + i,
-                        psSHP->pabyRec + nOffset + 16 + i*8, 8 );
-                if( bBigEndian ) SwapWord( 8, psShape->padfZ + i );
-            }
+            psView->dfZMin = SHPViewGetDouble( pabyRec + nOffset );
+            psView->dfZMax = SHPViewGetDouble( pabyRec + nOffset + 8 );
+            psView->pabyZ = pabyRec + nOffset + 16;
 
             nOffset += 16 + 8*nPoints;
         }
@@ -1984,62 +1918,42 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
 /* -------------------------------------------------------------------- */
         if( nEntitySize >= nOffset + 16 + 8*nPoints )
         {
-            memcpy( &(psShape->dfMMin), psSHP->pabyRec + nOffset, 8 );
-            memcpy( &(psShape->dfMMax), psSHP->pabyRec + nOffset + 8, 8 );
-            
-            if( bBigEndian ) SwapWord( 8, &(psShape->dfMMin) );
-            if( bBigEndian ) SwapWord( 8, &(psShape->dfMMax) );
-            
-            for( i = 0; i < nPoints; i++ )
-            {
-                memcpy( psShape->padfM + i,
-                        psSHP->pabyRec + nOffset + 16 + i*8, 8 );
-                if( bBigEndian ) SwapWord( 8, psShape->padfM + i );
-            }
-            psShape->bMeasureIsUsed = TRUE;
+            psView->dfMMin = SHPViewGetDouble( pabyRec + nOffset );
+            psView->dfMMax = SHPViewGetDouble( pabyRec + nOffset + 8 );
+            psView->pabyM = pabyRec + nOffset + 16;
         }
     }
 
 /* ==================================================================== */
 /*      Extract vertices for a point.                                   */
 /* ==================================================================== */
-    else if( psShape->nSHPType == SHPT_POINT
-             || psShape->nSHPType == SHPT_POINTM
-             || psShape->nSHPType == SHPT_POINTZ )
+    else if( psView->nSHPType == SHPT_POINT
+             || psView->nSHPType == SHPT_POINTM
+             || psView->nSHPType == SHPT_POINTZ )
     {
         int	nOffset;
         
-        psShape->nVertices = 1;
-        psShape->padfX = (double *) calloc(1,sizeof(double));
-        psShape->padfY = (double *) calloc(1,sizeof(double));
-        psShape->padfZ = (double *) calloc(1,sizeof(double));
-        psShape->padfM = (double *) calloc(1,sizeof(double));
-
-        if (20 + 8 + (( psShape->nSHPType == SHPT_POINTZ ) ? 8 : 0)> nEntitySize)
+        if (20 + 8 + (( psView->nSHPType == SHPT_POINTZ ) ? 8 : 0)> nEntitySize)
         {
             snprintf(szErrorMsg, sizeof(szErrorMsg),
                      "Corrupted .shp file : shape %d : nEntitySize = %d",
                      hEntity, nEntitySize); 
             psSHP->sHooks.Error( szErrorMsg );
-            SHPDestroyObject(psShape);
-            return NULL;
+            return FALSE;
         }
-        memcpy( psShape->padfX, psSHP->pabyRec + 12, 8 );
-        memcpy( psShape->padfY, psSHP->pabyRec + 20, 8 );
 
-        if( bBigEndian ) SwapWord( 8, psShape->padfX );
-        if( bBigEndian ) SwapWord( 8, psShape->padfY );
+        psView->nVertices = 1;
+        psView->pabyXY = pabyRec + 12;
 
         nOffset = 20 + 8;
         
 /* -------------------------------------------------------------------- */
 /*      If we have a Z coordinate, collect that now.                    */
 /* -------------------------------------------------------------------- */
-        if( psShape->nSHPType == SHPT_POINTZ )
+        if( psView->nSHPType == SHPT_POINTZ )
         {
-            memcpy( psShape->padfZ, psSHP->pabyRec + nOffset, 8 );
-        
-            if( bBigEndian ) SwapWord( 8, psShape->padfZ );
+            psView->pabyZ = pabyRec + nOffset;
+            psView->dfZMin = psView->dfZMax = SHPViewGetDouble( psView->pabyZ );
             
             nOffset += 8;
         }
@@ -2052,20 +1966,129 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
 /* -------------------------------------------------------------------- */
         if( nEntitySize >= nOffset + 8 )
         {
-            memcpy( psShape->padfM, psSHP->pabyRec + nOffset, 8 );
-        
-            if( bBigEndian ) SwapWord( 8, psShape->padfM );
-            psShape->bMeasureIsUsed = TRUE;
+            psView->pabyM = pabyRec + nOffset;
+            psView->dfMMin = psView->dfMMax = SHPViewGetDouble( psView->pabyM );
         }
 
 /* -------------------------------------------------------------------- */
 /*      Since no extents are supplied in the record, we will apply      */
 /*      them from the single vertex.                                    */
 /* -------------------------------------------------------------------- */
-        psShape->dfXMin = psShape->dfXMax = psShape->padfX[0];
-        psShape->dfYMin = psShape->dfYMax = psShape->padfY[0];
-        psShape->dfZMin = psShape->dfZMax = psShape->padfZ[0];
-        psShape->dfMMin = psShape->dfMMax = psShape->padfM[0];
+        psView->dfXMin = psView->dfXMax = SHPViewGetDouble( psView->pabyXY );
+        psView->dfYMin = psView->dfYMax = SHPViewGetDouble( psView->pabyXY + 8 );
+    }
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                          SHPReadObject()                             */
+/*                                                                      */
+/*      Read the vertices, parts, and other non-attribute information	*/
+/*	for one shape.	The arrays are allocated in one block with the	*/
+/*	object.								*/
+/************************************************************************/
+
+SHPObject SHPAPI_CALL1(*)
+SHPReadObject( SHPHandle psSHP, int hEntity )
+
+{
+    SHPObjectView        sView;
+    SHPObject           *psShape;
+    size_t               nSize;
+    int                  i;
+
+    if( !SHPReadObjectView( psSHP, hEntity, &sView ) )
+        return NULL;
+
+/* -------------------------------------------------------------------- */
+/*	Allocate the object with room for its arrays after it.		*/
+/* -------------------------------------------------------------------- */
+    nSize = sizeof(SHPObject);
+    if( sView.pabyXY != NULL )
+        nSize += 4 * sizeof(double) * (size_t) sView.nVertices;
+    if( sView.pabyPartStart != NULL )
+        nSize += 2 * sizeof(int) * (size_t) sView.nParts;
+
+    psShape = (SHPObject *) malloc( nSize );
+    if( psShape == NULL )
+    {
+        char szErrorMsg[128];
+
+        snprintf(szErrorMsg, sizeof(szErrorMsg),
+                 "Not enough memory to allocate requested memory (nPoints=%d, nParts=%d) for shape %d. "
+                 "Probably broken SHP file", sView.nVertices, sView.nParts, hEntity );
+        psSHP->sHooks.Error( szErrorMsg );
+        return NULL;
+    }
+
+    memset( psShape, 0, sizeof(SHPObject) );
+    psShape->nSHPType = sView.nSHPType;
+    psShape->nShapeId = hEntity;
+    psShape->bArraysInObject = TRUE;
+
+    psShape->dfXMin = sView.dfXMin;
+    psShape->dfYMin = sView.dfYMin;
+    psShape->dfZMin = sView.dfZMin;
+    psShape->dfMMin = sView.dfMMin;
+    psShape->dfXMax = sView.dfXMax;
+    psShape->dfYMax = sView.dfYMax;
+    psShape->dfZMax = sView.dfZMax;
+    psShape->dfMMax = sView.dfMMax;
+
+/* -------------------------------------------------------------------- */
+/*      Copy out the vertices, with zero Z and M if they are absent.    */
+/* -------------------------------------------------------------------- */
+    if( sView.pabyXY != NULL )
+    {
+        psShape->nVertices = sView.nVertices;
+        psShape->padfX = (double *) (psShape + 1);
+        psShape->padfY = psShape->padfX + sView.nVertices;
+        psShape->padfZ = psShape->padfY + sView.nVertices;
+        psShape->padfM = psShape->padfZ + sView.nVertices;
+
+        for( i = 0; i < sView.nVertices; i++ )
+        {
+            psShape->padfX[i] = SHPViewGetDouble( sView.pabyXY + i * 16 );
+            psShape->padfY[i] = SHPViewGetDouble( sView.pabyXY + i * 16 + 8 );
+        }
+
+        if( sView.pabyZ != NULL )
+        {
+            for( i = 0; i < sView.nVertices; i++ )
+                psShape->padfZ[i] = SHPViewGetDouble( sView.pabyZ + i * 8 );
+        }
+        else
+            memset( psShape->padfZ, 0, sizeof(double) * sView.nVertices );
+
+        if( sView.pabyM != NULL )
+        {
+            for( i = 0; i < sView.nVertices; i++ )
+                psShape->padfM[i] = SHPViewGetDouble( sView.pabyM + i * 8 );
+            psShape->bMeasureIsUsed = TRUE;
+        }
+        else
+            memset( psShape->padfM, 0, sizeof(double) * sView.nVertices );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Copy out the part arrays.                                       */
+/* -------------------------------------------------------------------- */
+    if( sView.pabyPartStart != NULL )
+    {
+        psShape->nParts = sView.nParts;
+        psShape->panPartStart = (int *) (psShape->padfM + sView.nVertices);
+        psShape->panPartType = psShape->panPartStart + sView.nParts;
+
+        for( i = 0; i < sView.nParts; i++ )
+        {
+            psShape->panPartStart[i] = SHPViewGetInt( sView.pabyPartStart + 4*i );
+
+            if( sView.pabyPartType != NULL )
+                psShape->panPartType[i] = SHPViewGetInt( sView.pabyPartType + 4*i );
+            else
+                psShape->panPartType[i] = SHPP_RING;
+        }
     }
 
     return( psShape );
@@ -2171,6 +2194,13 @@ SHPDestroyObject( SHPObject * psShape )
 {
     if( psShape == NULL )
         return;
+
+    /* The arrays of shapes from SHPReadObject() go with the object */
+    if( psShape->bArraysInObject )
+    {
+        free( psShape );
+        return;
+    }
     
     if( psShape->padfX != NULL )
         free( psShape->padfX );
@@ -94,6 +94,10 @@ GIDX* gidx_new(int ndims);
 int geography_datum_gidx(Datum geography_datum, GIDX *gidx);
 /* Pull out the gidx bounding box from an already de-toasted geography */
 int geography_gidx(GSERIALIZED *g, GIDX *gidx);
+/* Pull out the n-D gidx bounding box of a geometry, Z and M included */
+int geometry_datum_gidx(Datum geometry_datum, GIDX *gidx);
+/* Calculate the n-D gidx bounding box of an already de-toasted geometry */
+int geometry_gidx(PG_LWGEOM *geom, GIDX *gidx);
 /* Convert a gidx to a gbox */
 void gbox_from_gidx(GIDX *gidx, GBOX *gbox);
 /* Convert a gbox to a new gidx */
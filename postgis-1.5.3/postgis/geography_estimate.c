@@ -13,6 +13,8 @@
 
 
 #include "postgres.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type.h"
 #include "commands/vacuum.h"
 #include "nodes/relation.h"
 #include "parser/parsetree.h"
@@ -21,6 +23,7 @@
 
 #include "libgeom.h"
 #include "lwgeom_pg.h"
+#include "geography.h"
 
 /* Prototypes */
 Datum geography_gist_selectivity(PG_FUNCTION_ARGS);
@@ -57,6 +60,16 @@ Datum geography_analyze(PG_FUNCTION_ARGS);
 #define USE_STANDARD_DEVIATION 1
 #define SDFACTOR 3.25
 
+/*
+ * Define this to build the histogram of columns covering a small
+ * region on the plane tangent to the sphere at the region center,
+ * rather than on a geocentric grid. Columns whose geocentric extent
+ * is below TANGENT_PLANE_MAX_EXTENT on every axis qualify (units of
+ * the unit sphere, 0.1 is about 640km).
+ */
+#define USE_TANGENT_PLANE 1
+#define TANGENT_PLANE_MAX_EXTENT 0.1
+
 
 /* Information about the dimensions stored in the sample */
 struct dimensions
@@ -101,6 +114,208 @@ typedef struct GEOG_STATS_T
 }
 GEOG_STATS;
 
+/* Number of float4 in the GEOG_STATS header, before the cell values */
+#define GEOG_STATS_HEADER_SIZE ((int)(offsetof(GEOG_STATS, value) / sizeof(float4)))
+
+/**
+ * Tangent plane histograms store the unit normal of their plane after
+ * the cell values. Their X and Y axes are the east and north directions
+ * on the plane and Z is unused. GEOG_FRAME maps geocentric boxes into
+ * the coordinates of either kind of histogram.
+ */
+typedef struct GEOG_FRAME_T
+{
+	bool plane;
+	double normal[3];
+	double east[3];
+	double north[3];
+}
+GEOG_FRAME;
+
+
+static void
+geog_frame_set_normal(GEOG_FRAME *frame, double nx, double ny, double nz)
+{
+	double len = sqrt(nx * nx + ny * ny + nz * nz);
+	double elen = sqrt(nx * nx + ny * ny);
+
+	frame->plane = true;
+	frame->normal[0] = nx / len;
+	frame->normal[1] = ny / len;
+	frame->normal[2] = nz / len;
+
+	/* East is along the parallel, anything will do at the poles */
+	if ( elen / len < 1e-9 )
+	{
+		frame->east[0] = 1.0;
+		frame->east[1] = 0.0;
+		frame->east[2] = 0.0;
+	}
+	else
+	{
+		frame->east[0] = -ny / elen;
+		frame->east[1] = nx / elen;
+		frame->east[2] = 0.0;
+	}
+
+	/* North = normal x east */
+	frame->north[0] = frame->normal[1] * frame->east[2] - frame->normal[2] * frame->east[1];
+	frame->north[1] = frame->normal[2] * frame->east[0] - frame->normal[0] * frame->east[2];
+	frame->north[2] = frame->normal[0] * frame->east[1] - frame->normal[1] * frame->east[0];
+}
+
+static void
+geog_frame_init(GEOG_FRAME *frame, GEOG_STATS *geogstats, int nvalues)
+{
+	int cells = (int)geogstats->unitsx * (int)geogstats->unitsy * (int)geogstats->unitsz;
+	float4 *normal = geogstats->value + cells;
+
+	frame->plane = false;
+
+	/* Older stats carry no normal, the length check rules out a chance size match */
+	if ( nvalues == GEOG_STATS_HEADER_SIZE + cells + 3 &&
+	     fabs(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2] - 1.0) < 1e-3 )
+		geog_frame_set_normal(frame, normal[0], normal[1], normal[2]);
+}
+
+/**
+ * Box of in (geocentric) in the frame coordinates, in and out may be
+ * the same. Data lies on the sphere, so rather than all the corners we
+ * project the section of the box by the plane parallel to the tangent
+ * plane through the box center: a tilted box projects a lot larger
+ * than the patch of sphere inside it.
+ */
+static void
+geog_frame_project(GEOG_FRAME *frame, GBOX *in, GBOX *out)
+{
+	GBOX box;
+	double corners[8][3], h[8];
+	double h0 = 0.0;
+	int i, j, k, m, npoints = 0;
+
+	if ( ! frame->plane )
+	{
+		if ( out != in ) memcpy(out, in, sizeof(GBOX));
+		return;
+	}
+
+	memcpy(&box, in, sizeof(GBOX));
+
+	for ( i = 0; i < 8; i++ )
+	{
+		corners[i][0] = (i & 1) ? in->xmax : in->xmin;
+		corners[i][1] = (i & 2) ? in->ymax : in->ymin;
+		corners[i][2] = (i & 4) ? in->zmax : in->zmin;
+		h[i] = corners[i][0] * frame->normal[0] + corners[i][1] * frame->normal[1] +
+		       corners[i][2] * frame->normal[2];
+		h0 += h[i] / 8.0;
+	}
+
+	/* Section points on the box edges */
+	for ( i = 0; i < 8; i++ )
+	{
+		for ( k = 0; k < 3; k++ )
+		{
+			double a, b, t, p[3], e, n;
+
+			j = i | (1 << k);
+			if ( j == i ) continue;
+
+			a = h[i] - h0;
+			b = h[j] - h0;
+			if ( a == b || (a > 0 && b > 0) || (a < 0 && b < 0) ) continue;
+
+			t = a / (a - b);
+			for ( m = 0; m < 3; m++ )
+				p[m] = corners[i][m] + t * (corners[j][m] - corners[i][m]);
+
+			e = p[0] * frame->east[0] + p[1] * frame->east[1] + p[2] * frame->east[2];
+			n = p[0] * frame->north[0] + p[1] * frame->north[1] + p[2] * frame->north[2];
+
+			if ( npoints == 0 || e < box.xmin ) box.xmin = e;
+			if ( npoints == 0 || e > box.xmax ) box.xmax = e;
+			if ( npoints == 0 || n < box.ymin ) box.ymin = n;
+			if ( npoints == 0 || n > box.ymax ) box.ymax = n;
+			npoints++;
+		}
+	}
+
+	/* Flat boxes (points, mostly) have no section, take the corners */
+	if ( npoints < 3 )
+	{
+		for ( i = 0; i < 8; i++ )
+		{
+			double e = corners[i][0] * frame->east[0] + corners[i][1] * frame->east[1] +
+			           corners[i][2] * frame->east[2];
+			double n = corners[i][0] * frame->north[0] + corners[i][1] * frame->north[1] +
+			           corners[i][2] * frame->north[2];
+
+			if ( i == 0 || e < box.xmin ) box.xmin = e;
+			if ( i == 0 || e > box.xmax ) box.xmax = e;
+			if ( i == 0 || n < box.ymin ) box.ymin = n;
+			if ( i == 0 || n > box.ymax ) box.ymax = n;
+		}
+	}
+	box.zmin = box.zmax = 0.0;
+
+	memcpy(out, &box, sizeof(GBOX));
+}
+
+/* Geocentric box of in (frame coordinates), in and out may be the same */
+static void
+geog_frame_unproject(GEOG_FRAME *frame, GBOX *in, GBOX *out)
+{
+	GBOX box;
+	int i, j;
+
+	if ( ! frame->plane )
+	{
+		if ( out != in ) memcpy(out, in, sizeof(GBOX));
+		return;
+	}
+
+	memcpy(&box, in, sizeof(GBOX));
+	for ( i = 0; i < 5; i++ )
+	{
+		/* The corners, then the point nearest the tangent point */
+		double e = (i == 4) ? LW_MIN(LW_MAX(0.0, in->xmin), in->xmax) : ((i & 1) ? in->xmax : in->xmin);
+		double n = (i == 4) ? LW_MIN(LW_MAX(0.0, in->ymin), in->ymax) : ((i & 2) ? in->ymax : in->ymin);
+		/* Back on the sphere */
+		double h = sqrt(LW_MAX(0.0, 1.0 - e * e - n * n));
+		double p[3];
+
+		for ( j = 0; j < 3; j++ )
+			p[j] = h * frame->normal[j] + e * frame->east[j] + n * frame->north[j];
+
+		if ( i == 0 || p[0] < box.xmin ) box.xmin = p[0];
+		if ( i == 0 || p[0] > box.xmax ) box.xmax = p[0];
+		if ( i == 0 || p[1] < box.ymin ) box.ymin = p[1];
+		if ( i == 0 || p[1] > box.ymax ) box.ymax = p[1];
+		if ( i == 0 || p[2] < box.zmin ) box.zmin = p[2];
+		if ( i == 0 || p[2] > box.zmax ) box.zmax = p[2];
+	}
+
+	memcpy(out, &box, sizeof(GBOX));
+}
+
+/* Histogram unit holding v, clamped to the grid */
+static int
+geog_histo_index(double v, double min, double size, int units)
+{
+	int i;
+
+	if ( size <= 0 ) return 0;
+
+	i = (int)floor((v - min) / size * units);
+	if ( i < 0 ) return 0;
+	if ( i >= units ) return units - 1;
+	return i;
+}
+
+
+/* geography expand() function the planner inlines radius searches into (in meters) */
+static const char *geography_expand_names[] = { "_st_expand", NULL };
+
 
 /**
  * This function returns an estimate of the selectivity
@@ -185,101 +400,22 @@ estimate_selectivity(GBOX *box, GEOG_STATS *geogstats)
 
 	case 3:
 		/* Work in volumes for 3 dimensions */
-		cell_coverage = (sizex * sizey * sizey) / (unitsx * unitsy * unitsz);
+		cell_coverage = (sizex * sizey * sizez) / (unitsx * unitsy * unitsz);
 		break;
 	}
 
 	value = 0;
 
-	/* Find first overlapping x unit */
-	x_idx_min = (box->xmin-geogstats->xmin) / sizex * unitsx;
-	if (x_idx_min < 0)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d x units outside (low) of histogram grid", -x_idx_min);
-
-		/* should increment the value somehow */
-		x_idx_min = 0;
-	}
-	if (x_idx_min >= unitsx)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d x units outside (high) of histogram grid", x_idx_min-unitsx+1);
-
-		/* should increment the value somehow */
-		x_idx_min = unitsx-1;
-	}
-
-	/* Find first overlapping y unit */
-	y_idx_min = (box->ymin-geogstats->ymin) / sizey * unitsy;
-	if (y_idx_min <0)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d y units outside (low) of histogram grid", -y_idx_min);
-
-		/* should increment the value somehow */
-		y_idx_min = 0;
-	}
-	if (y_idx_min >= unitsy)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d y units outside (high) of histogram grid", y_idx_min-unitsy+1);
-
-		/* should increment the value somehow */
-		y_idx_min = unitsy-1;
-	}
-
-	/* Find first overlapping z unit */
-	z_idx_min = (box->zmin-geogstats->zmin) / sizez * unitsz;
-	if (z_idx_min <0)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d z units outside (low) of histogram grid", -z_idx_min);
-
-		/* should increment the value somehow */
-		z_idx_min = 0;
-	}
-	if (z_idx_min >= unitsz)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d z units outside (high) of histogram grid", z_idx_min-unitsz+1);
-
-		/* should increment the value somehow */
-		z_idx_min = unitsz-1;
-	}
-
-	/* Find last overlapping x unit */
-	x_idx_max = (box->xmax-geogstats->xmin) / sizex * unitsx;
-	if (x_idx_max <0)
-	{
-		/* should increment the value somehow */
-		x_idx_max = 0;
-	}
-	if (x_idx_max >= unitsx )
-	{
-		/* should increment the value somehow */
-		x_idx_max = unitsx-1;
-	}
-
-	/* Find last overlapping y unit */
-	y_idx_max = (box->ymax-geogstats->ymin) / sizey * unitsy;
-	if (y_idx_max <0)
-	{
-		/* should increment the value somehow */
-		y_idx_max = 0;
-	}
-	if (y_idx_max >= unitsy)
-	{
-		/* should increment the value somehow */
-		y_idx_max = unitsy-1;
-	}
-
-	/* Find last overlapping z unit */
-	z_idx_max = (box->zmax-geogstats->zmin) / sizez * unitsz;
-	if (z_idx_max <0)
-	{
-		/* should increment the value somehow */
-		z_idx_max = 0;
-	}
-	if (z_idx_max >= unitsz)
-	{
-		/* should increment the value somehow */
-		z_idx_max = unitsz-1;
-	}
+	/*
+	 * Find first and last overlapping units, clamped to
+	 * the histogram grid (collapsed axes have a single unit)
+	 */
+	x_idx_min = geog_histo_index(box->xmin, geogstats->xmin, sizex, unitsx);
+	y_idx_min = geog_histo_index(box->ymin, geogstats->ymin, sizey, unitsy);
+	z_idx_min = geog_histo_index(box->zmin, geogstats->zmin, sizez, unitsz);
+	x_idx_max = geog_histo_index(box->xmax, geogstats->xmin, sizex, unitsx);
+	y_idx_max = geog_histo_index(box->ymax, geogstats->ymin, sizey, unitsy);
+	z_idx_max = geog_histo_index(box->zmax, geogstats->zmin, sizez, unitsz);
 
 	/*
 	 * the {x,y,z}_idx_{min,max}
@@ -419,6 +555,45 @@ estimate_selectivity(GBOX *box, GEOG_STATS *geogstats)
 }
 
 
+/* Extent of the histogram as a geocentric box */
+static void
+geog_stats_extent(GEOG_STATS *geogstats, GEOG_FRAME *frame, GBOX *box)
+{
+	box->flags = 0;
+	FLAGS_SET_GEODETIC(box->flags, 1);
+	box->xmin = geogstats->xmin;
+	box->ymin = geogstats->ymin;
+	box->zmin = geogstats->zmin;
+	box->xmax = geogstats->xmax;
+	box->ymax = geogstats->ymax;
+	box->zmax = geogstats->zmax;
+
+	geog_frame_unproject(frame, box, box);
+}
+
+/**
+ * Selectivity of the geocentric box in the histogram. Boxes are tested
+ * against the geocentric extent first: projected on a tangent plane,
+ * boxes on the far side of the sphere would land on the histogram.
+ */
+static float8
+estimate_frame_selectivity(GBOX *box, GEOG_STATS *geogstats, GEOG_FRAME *frame)
+{
+	GBOX extent, projected;
+
+	if ( frame->plane )
+	{
+		geog_stats_extent(geogstats, frame, &extent);
+		if ( box->xmax < extent.xmin || box->xmin > extent.xmax ||
+		     box->ymax < extent.ymin || box->ymin > extent.ymax ||
+		     box->zmax < extent.zmin || box->zmin > extent.zmax )
+			return 0.0;
+	}
+
+	geog_frame_project(frame, box, &projected);
+	return estimate_selectivity(&projected, geogstats);
+}
+
 /**
  * This function should return an estimation of the number of
  * rows returned by a query involving an overlap check
@@ -455,6 +630,8 @@ Datum geography_gist_selectivity(PG_FUNCTION_ARGS)
 	GSERIALIZED *serialized;
 	LWGEOM *geometry;
 	GBOX search_box;
+	GEOG_FRAME frame;
+	double distance = 0.0;
 	float8 selectivity = 0;
 
 	POSTGIS_DEBUG(2, "geography_gist_selectivity called");
@@ -492,6 +669,12 @@ Datum geography_gist_selectivity(PG_FUNCTION_ARGS)
 		PG_RETURN_FLOAT8(DEFAULT_GEOGRAPHY_SEL);
 	}
 
+	/*
+	 * Radius searches expand the column rather than
+	 * the constant, see estimate_expanded_var()
+	 */
+	estimate_expanded_var((Node *)self, geography_expand_names, &self, &distance);
+
 	/*
 	 * We are working on two constants..
 	 * TODO: check if expression is true,
@@ -520,6 +703,21 @@ Datum geography_gist_selectivity(PG_FUNCTION_ARGS)
 		PG_RETURN_FLOAT8(0.0);
 	}
 
+	/*
+	 * Buffer the search box by the expansion distance, normalized
+	 * to the unit sphere as geography_expand() does
+	 */
+	if ( distance != 0.0 )
+	{
+		distance /= WGS84_RADIUS;
+		search_box.xmin -= distance;
+		search_box.ymin -= distance;
+		search_box.zmin -= distance;
+		search_box.xmax += distance;
+		search_box.ymax += distance;
+		search_box.zmax += distance;
+	}
+
 	POSTGIS_DEBUGF(4, " requested search box is : %.15g %.15g %.15g, %.15g %.15g %.15g",
 	               search_box.xmin, search_box.ymin, search_box.zmin,
 	               search_box.xmax, search_box.ymax, search_box.zmax);
@@ -561,9 +759,10 @@ Datum geography_gist_selectivity(PG_FUNCTION_ARGS)
 	POSTGIS_DEBUGF(4, " histo: avgFeatureCells: %f", geogstats->avgFeatureCells);
 
 	/*
-	 * Do the estimation
+	 * Do the estimation, in the histogram coordinates
 	 */
-	selectivity = estimate_selectivity(&search_box, geogstats);
+	geog_frame_init(&frame, geogstats, geogstats_nvalues);
+	selectivity = estimate_frame_selectivity(&search_box, geogstats, &frame);
 
 	POSTGIS_DEBUGF(3, " returning computed value: %f", selectivity);
 
@@ -573,6 +772,102 @@ Datum geography_gist_selectivity(PG_FUNCTION_ARGS)
 }
 
 
+/**
+ * Estimate the fraction of the cross product of two columns whose
+ * bounding boxes overlap, using both histograms.
+ *
+ * Each cell of the first histogram holding features is mapped into
+ * the coordinates of the second one, which gives the share of the
+ * second column around those features. A feature of the first column
+ * touching the cell overlaps a feature of the second one there in
+ * about the ratio of the area (volume for geocentric grids) swept by
+ * the two average features to the area of the cells the first feature
+ * touches, capped at 1 for features larger than the cells.
+ *
+ * Radius joins have one column expanded by distance (on the unit
+ * sphere), which grows the mapped cells and the swept area.
+ *
+ * Returns a negative value if either histogram is degenerate and the
+ * caller should use another estimate.
+ */
+static float8
+estimate_join_selectivity(GEOG_STATS *geogstats1, GEOG_FRAME *frame1,
+                          GEOG_STATS *geogstats2, GEOG_FRAME *frame2, double distance)
+{
+	int x, y, z;
+	int unitsx = geogstats1->unitsx;
+	int unitsy = geogstats1->unitsy;
+	int unitsz = geogstats1->unitsz;
+	int dims1 = geogstats1->dims;
+	int dims2 = geogstats2->dims;
+	double sizex = geogstats1->xmax - geogstats1->xmin;
+	double sizey = geogstats1->ymax - geogstats1->ymin;
+	double sizez = geogstats1->zmax - geogstats1->zmin;
+	double feat_size, cell_coverage = 1.0, ratio;
+	double value = 0.0;
+
+	/* Feature coverage is only an area or a volume from 2 dimensions */
+	if ( dims1 < 2 || dims2 < 2 || geogstats1->avgFeatureCells <= 0 )
+	{
+		POSTGIS_DEBUG(3, " degenerate histogram, no cell by cell estimate");
+		return -1.0;
+	}
+
+	feat_size = pow(geogstats1->avgFeatureCoverage, 1.0 / dims1) +
+	            pow(geogstats2->avgFeatureCoverage, 1.0 / dims2) + 2 * distance;
+
+	if ( sizex > 0 ) cell_coverage *= sizex / unitsx;
+	if ( sizey > 0 ) cell_coverage *= sizey / unitsy;
+	if ( sizez > 0 ) cell_coverage *= sizez / unitsz;
+
+	ratio = LW_MIN(1.0, pow(feat_size, dims1) / (cell_coverage * geogstats1->avgFeatureCells));
+
+	POSTGIS_DEBUGF(3, " feature size %g, cell coverage %g, ratio %g", feat_size, cell_coverage, ratio);
+
+	for (z = 0; z < unitsz; z++)
+	{
+		for (y = 0; y < unitsy; y++)
+		{
+			for (x = 0; x < unitsx; x++)
+			{
+				double val = geogstats1->value[x + y * unitsx + z * unitsx * unitsy];
+				GBOX cell;
+
+				if ( val <= 0 ) continue;
+
+				cell.flags = 0;
+				cell.xmin = geogstats1->xmin + x * sizex / unitsx;
+				cell.xmax = geogstats1->xmin + (x+1) * sizex / unitsx;
+				cell.ymin = geogstats1->ymin + y * sizey / unitsy;
+				cell.ymax = geogstats1->ymin + (y+1) * sizey / unitsy;
+				cell.zmin = geogstats1->zmin + z * sizez / unitsz;
+				cell.zmax = geogstats1->zmin + (z+1) * sizez / unitsz;
+
+				/* Into the second histogram coordinates */
+				geog_frame_unproject(frame1, &cell, &cell);
+				cell.xmin -= distance;
+				cell.ymin -= distance;
+				cell.zmin -= distance;
+				cell.xmax += distance;
+				cell.ymax += distance;
+				cell.zmax += distance;
+
+				value += val * estimate_frame_selectivity(&cell, geogstats2, frame2);
+			}
+		}
+	}
+
+	value *= ratio;
+
+	POSTGIS_DEBUGF(3, " cell by cell join selectivity: %.15g", value);
+
+	if ( value > 1.0 ) value = 1.0;
+	else if ( value < 0.0 ) value = 0.0;
+
+	return value;
+}
+
+
 /**
 * JOIN selectivity in the GiST && operator
 * for all PG versions
@@ -602,13 +897,17 @@ Datum geography_gist_join_selectivity(PG_FUNCTION_ARGS)
 	float8 selectivity1 = 0.0, selectivity2 = 0.0;
 	float4 num1_tuples = 0.0, num2_tuples = 0.0;
 	float4 total_tuples = 0.0, rows_returned = 0.0;
-	GBOX search_box;
+	float8 join_selectivity;
+	GEOG_FRAME frame1, frame2;
+	GBOX extent1, extent2, search_box;
+	double distance = 0.0;
 
 
 	/**
-	* Join selectivity algorithm. To calculation the selectivity we
-	* calculate the intersection of the two column sample extents,
-	* sum the results, and then multiply by two since for each
+	* Join selectivity algorithm. The two histograms are combined cell
+	* by cell, see estimate_join_selectivity(). If either histogram is
+	* degenerate we calculate the intersection of the two column sample
+	* extents, sum the results, and then multiply by two since for each
 	* geometry in col 1 that intersects a geometry in col 2, the same
 	* will also be true.
 	*/
@@ -630,6 +929,15 @@ Datum geography_gist_join_selectivity(PG_FUNCTION_ARGS)
 	arg1 = (Node *) linitial(args);
 	arg2 = (Node *) lsecond(args);
 
+	/* Radius joins expand one of the columns */
+	if ( IsA(arg1, Var) && estimate_expanded_var(arg2, geography_expand_names, &var2, &distance) )
+		arg2 = (Node *) var2;
+	else if ( IsA(arg2, Var) && estimate_expanded_var(arg1, geography_expand_names, &var1, &distance) )
+		arg1 = (Node *) var1;
+
+	/* Normalized to the unit sphere as geography_expand() does */
+	distance /= WGS84_RADIUS;
+
 	if (!IsA(arg1, Var) || !IsA(arg2, Var))
 	{
 		elog(DEBUG1, "geography_gist_join_selectivity called with arguments that are not column references");
@@ -692,30 +1000,61 @@ Datum geography_gist_join_selectivity(PG_FUNCTION_ARGS)
 	}
 
 
+	geog_frame_init(&frame1, geogstats1, geogstats1_nvalues);
+	geog_frame_init(&frame2, geogstats2, geogstats2_nvalues);
+
+	join_selectivity = estimate_join_selectivity(geogstats1, &frame1, geogstats2, &frame2, distance);
+	if ( join_selectivity >= 0.0 )
+	{
+		/* Null geographies never match */
+		join_selectivity *= 1.0 - ((Form_pg_statistic) GETSTRUCT(stats1_tuple))->stanullfrac;
+		join_selectivity *= 1.0 - ((Form_pg_statistic) GETSTRUCT(stats2_tuple))->stanullfrac;
+
+		free_attstatsslot(0, NULL, 0, (float *)geogstats1, geogstats1_nvalues);
+		ReleaseSysCache(stats1_tuple);
+		free_attstatsslot(0, NULL, 0, (float *)geogstats2, geogstats2_nvalues);
+		ReleaseSysCache(stats2_tuple);
+
+		POSTGIS_DEBUGF(3, "Estimated join selectivity: %.15g", join_selectivity);
+
+		PG_RETURN_FLOAT8(join_selectivity);
+	}
+
 	/**
 	* Setup the search box - this is the intersection of the two column
-	* extents.
+	* extents (geocentric), the first one expanded by the radius join
+	* distance.
 	*/
-	search_box.xmin = LW_MAX(geogstats1->xmin, geogstats2->xmin);
-	search_box.ymin = LW_MAX(geogstats1->ymin, geogstats2->ymin);
-	search_box.zmin = LW_MAX(geogstats1->zmin, geogstats2->zmin);
-	search_box.xmax = LW_MIN(geogstats1->xmax, geogstats2->xmax);
-	search_box.ymax = LW_MIN(geogstats1->ymax, geogstats2->ymax);
-	search_box.zmax = LW_MIN(geogstats1->zmax, geogstats2->zmax);
+	geog_stats_extent(geogstats1, &frame1, &extent1);
+	geog_stats_extent(geogstats2, &frame2, &extent2);
+
+	search_box.flags = extent1.flags;
+	search_box.xmin = LW_MAX(extent1.xmin - distance, extent2.xmin);
+	search_box.ymin = LW_MAX(extent1.ymin - distance, extent2.ymin);
+	search_box.zmin = LW_MAX(extent1.zmin - distance, extent2.zmin);
+	search_box.xmax = LW_MIN(extent1.xmax + distance, extent2.xmax);
+	search_box.ymax = LW_MIN(extent1.ymax + distance, extent2.ymax);
+	search_box.zmax = LW_MIN(extent1.zmax + distance, extent2.zmax);
 
 	/* If the extents of the two columns don't intersect, return zero */
 	if (search_box.xmin > search_box.xmax || search_box.ymin > search_box.ymax ||
 	        search_box.zmin > search_box.zmax)
+	{
+		free_attstatsslot(0, NULL, 0, (float *)geogstats1, geogstats1_nvalues);
+		ReleaseSysCache(stats1_tuple);
+		free_attstatsslot(0, NULL, 0, (float *)geogstats2, geogstats2_nvalues);
+		ReleaseSysCache(stats2_tuple);
 		PG_RETURN_FLOAT8(0.0);
+	}
 
-	POSTGIS_DEBUGF(3, " -- geomstats1 box: %.15g %.15g %.15g, %.15g %.15g %.15g", geogstats1->xmin, geogstats1->ymin, geogstats1->zmin, geogstats1->xmax, geogstats1->ymax, geogstats1->zmax);
-	POSTGIS_DEBUGF(3, " -- geomstats2 box: %.15g %.15g %.15g, %.15g %.15g %.15g", geogstats2->xmin, geogstats2->ymin, geogstats2->zmin, geogstats2->xmax, geogstats2->ymax, geogstats2->zmax);
+	POSTGIS_DEBUGF(3, " -- geomstats1 box: %.15g %.15g %.15g, %.15g %.15g %.15g", extent1.xmin, extent1.ymin, extent1.zmin, extent1.xmax, extent1.ymax, extent1.zmax);
+	POSTGIS_DEBUGF(3, " -- geomstats2 box: %.15g %.15g %.15g, %.15g %.15g %.15g", extent2.xmin, extent2.ymin, extent2.zmin, extent2.xmax, extent2.ymax, extent2.zmax);
 	POSTGIS_DEBUGF(3, " -- calculated intersection box is : %.15g %.15g %.15g, %.15g %.15g %.15g", search_box.xmin, search_box.ymin, search_box.zmin, search_box.xmax, search_box.ymax, search_box.zmax);
 
 
 	/* Do the selectivity */
-	selectivity1 = estimate_selectivity(&search_box, geogstats1);
-	selectivity2 = estimate_selectivity(&search_box, geogstats2);
+	selectivity1 = estimate_frame_selectivity(&search_box, geogstats1, &frame1);
+	selectivity2 = estimate_frame_selectivity(&search_box, geogstats2, &frame2);
 
 	POSTGIS_DEBUGF(3, "selectivity1: %.15g   selectivity2: %.15g", selectivity1, selectivity2);
 
@@ -809,9 +1148,12 @@ compute_geography_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 	int geog_stats_size;
 	struct dimensions histodims[3];
 	int ndims;
+	GEOG_FRAME frame;
+	float4 normal[3];
 
 	double total_width = 0;
-	int notnull_cnt = 0, examinedsamples = 0, total_count_cells=0, total_cells_coverage = 0;
+	double total_cells_coverage = 0;
+	int notnull_cnt = 0, examinedsamples = 0, total_count_cells=0;
 
 #if USE_STANDARD_DEVIATION
 	/* for standard deviation */
@@ -1094,6 +1436,61 @@ compute_geography_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 	sizey = histobox.ymax - histobox.ymin;
 	sizez = histobox.zmax - histobox.zmin;
 
+	frame.plane = false;
+
+#if USE_TANGENT_PLANE
+	/*
+	 * A geocentric grid around a small region is mostly empty: the
+	 * features lie on a patch of sphere crossing the grid diagonally.
+	 * Build the histogram on the plane tangent at the region center
+	 * instead, so that the cells follow the data.
+	 */
+	if ( (sizex > 0 || sizey > 0 || sizez > 0) &&
+	     sizex < TANGENT_PLANE_MAX_EXTENT && sizey < TANGENT_PLANE_MAX_EXTENT &&
+	     sizez < TANGENT_PLANE_MAX_EXTENT )
+	{
+		bool first = true;
+
+		/* Round the normal as it will be stored */
+		normal[0] = (histobox.xmin + histobox.xmax) / 2.0;
+		normal[1] = (histobox.ymin + histobox.ymax) / 2.0;
+		normal[2] = (histobox.zmin + histobox.zmax) / 2.0;
+		geog_frame_set_normal(&frame, normal[0], normal[1], normal[2]);
+		normal[0] = frame.normal[0];
+		normal[1] = frame.normal[1];
+		normal[2] = frame.normal[2];
+		geog_frame_set_normal(&frame, normal[0], normal[1], normal[2]);
+
+		/* Features and histogram extent in plane coordinates */
+		for (i = 0; i < notnull_cnt; i++)
+		{
+			GBOX *box = (GBOX *)sampleboxes[i];
+			if ( ! box ) continue; /* hard deviant.. */
+
+			geog_frame_project(&frame, box, box);
+			if ( first )
+			{
+				memcpy(&histobox, box, sizeof(GBOX));
+				first = false;
+				continue;
+			}
+			histobox.xmin = LW_MIN(histobox.xmin, box->xmin);
+			histobox.ymin = LW_MIN(histobox.ymin, box->ymin);
+			histobox.xmax = LW_MAX(histobox.xmax, box->xmax);
+			histobox.ymax = LW_MAX(histobox.ymax, box->ymax);
+		}
+		histobox.zmin = histobox.zmax = 0.0;
+
+		sizex = histobox.xmax - histobox.xmin;
+		sizey = histobox.ymax - histobox.ymin;
+		sizez = 0;
+
+		POSTGIS_DEBUGF(3, " tangent plane normal: %f, %f, %f", normal[0], normal[1], normal[2]);
+		POSTGIS_DEBUGF(3, " tangent plane extent: %f, %f, %f, %f",
+		               histobox.xmin, histobox.ymin, histobox.xmax, histobox.ymax);
+	}
+#endif
+
 	/* In order to calculate a suitable aspect ratio for the histogram, we need
 	   to work out how many dimensions exist within our sample data (which we
 	   assume is representative of the whole data) */
@@ -1249,13 +1646,24 @@ compute_geography_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 		break;
 	}
 
+	/* Very flat extents may round a side down to nothing */
+	if (unitsx < 1) unitsx = 1;
+	if (unitsy < 1) unitsy = 1;
+	if (unitsz < 1) unitsz = 1;
+
 	POSTGIS_DEBUGF(3, " computed histogram grid size (X,Y,Z): %d x %d x %d (%d out of %d cells)", unitsx, unitsy, unitsz, unitsx * unitsy * unitsz, histocells);
 
+	/* Only store the cells in use */
+	histocells = unitsx * unitsy * unitsz;
+
 	/*
 	 * Create the histogram (GEOG_STATS)
 	 */
 	old_context = MemoryContextSwitchTo(stats->anl_context);
 	geog_stats_size = sizeof(GEOG_STATS) + (histocells - 1) * sizeof(float4);
+	/* Tangent plane normal goes after the values */
+	if ( frame.plane )
+		geog_stats_size += 3 * sizeof(float4);
 	geogstats = palloc(geog_stats_size);
 	MemoryContextSwitchTo(old_context);
 
@@ -1275,6 +1683,9 @@ compute_geography_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 	for (i = 0; i < histocells; i++)
 		geogstats->value[i] = 0;
 
+	if ( frame.plane )
+		memcpy(geogstats->value + histocells, normal, 3 * sizeof(float4));
+
 
 	/*
 	 * Fourth scan:
@@ -1308,35 +1719,13 @@ compute_geography_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 		POSTGIS_DEBUGF(4, " feat %d box is %f %f %f, %f %f %f",
 		               i, box->xmax, box->ymax, box->zmax, box->xmin, box->ymin, box->zmin);
 
-		/* Find first overlapping unitsx cell */
-		x_idx_min = (box->xmin - geogstats->xmin) / sizex * unitsx;
-		if (x_idx_min <0) x_idx_min = 0;
-		if (x_idx_min >= unitsx) x_idx_min = unitsx - 1;
-
-		/* Find first overlapping unitsy cell */
-		y_idx_min = (box->ymin - geogstats->ymin) / sizey * unitsy;
-		if (y_idx_min <0) y_idx_min = 0;
-		if (y_idx_min >= unitsy) y_idx_min = unitsy - 1;
-
-		/* Find first overlapping unitsz cell */
-		z_idx_min = (box->zmin - geogstats->zmin) / sizez * unitsz;
-		if (z_idx_min <0) z_idx_min = 0;
-		if (z_idx_min >= unitsz) z_idx_min = unitsz - 1;
-
-		/* Find last overlapping unitsx cell */
-		x_idx_max = (box->xmax - geogstats->xmin) / sizex * unitsx;
-		if (x_idx_max <0) x_idx_max = 0;
-		if (x_idx_max >= unitsx ) x_idx_max = unitsx - 1;
-
-		/* Find last overlapping unitsy cell */
-		y_idx_max = (box->ymax - geogstats->ymin) / sizey * unitsy;
-		if (y_idx_max <0) y_idx_max = 0;
-		if (y_idx_max >= unitsy) y_idx_max = unitsy - 1;
-
-		/* Find last overlapping unitsz cell */
-		z_idx_max = (box->zmax - geogstats->zmin) / sizez * unitsz;
-		if (z_idx_max <0) z_idx_max = 0;
-		if (z_idx_max >= unitsz) z_idx_max = unitsz - 1;
+		/* Find first and last overlapping cells */
+		x_idx_min = geog_histo_index(box->xmin, geogstats->xmin, sizex, unitsx);
+		y_idx_min = geog_histo_index(box->ymin, geogstats->ymin, sizey, unitsy);
+		z_idx_min = geog_histo_index(box->zmin, geogstats->zmin, sizez, unitsz);
+		x_idx_max = geog_histo_index(box->xmax, geogstats->xmin, sizex, unitsx);
+		y_idx_max = geog_histo_index(box->ymax, geogstats->ymin, sizey, unitsy);
+		z_idx_max = geog_histo_index(box->zmax, geogstats->zmin, sizez, unitsz);
 
 		POSTGIS_DEBUGF(4, " feat %d overlaps unitsx %d-%d, unitsy %d-%d, unitsz %d-%d",
 		               i, x_idx_min, x_idx_max, y_idx_min, y_idx_max, z_idx_min, z_idx_max);
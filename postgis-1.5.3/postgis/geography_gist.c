@@ -59,6 +59,8 @@ Datum geography_gist_penalty(PG_FUNCTION_ARGS);
 Datum geography_gist_picksplit(PG_FUNCTION_ARGS);
 Datum geography_gist_union(PG_FUNCTION_ARGS);
 Datum geography_gist_same(PG_FUNCTION_ARGS);
+Datum geometry_gist_compress_nd(PG_FUNCTION_ARGS);
+Datum geometry_gist_consistent_nd(PG_FUNCTION_ARGS);
 
 /*
 ** Index key type stub prototypes
@@ -70,6 +72,13 @@ Datum gidx_in(PG_FUNCTION_ARGS);
 ** Operator prototypes
 */
 Datum geography_overlaps(PG_FUNCTION_ARGS);
+Datum geometry_overlaps_nd(PG_FUNCTION_ARGS);
+
+/*
+** Key extraction callback, so the compress and consistent machinery
+** can be shared between geography and n-D geometry keys.
+*/
+typedef int (*gidx_datum_func)(Datum datum, GIDX *gidx);
 
 
 /*********************************************************************************
@@ -181,6 +190,12 @@ static void gidx_merge(GIDX **b_union, GIDX *b_new)
 		POSTGIS_DEBUGF(5, "reallocating b_union from %d dims to %d dims", dims_union, dims_new);
 		*b_union = (GIDX*)repalloc(*b_union, GIDX_SIZE(dims_new));
 		SET_VARSIZE(*b_union, VARSIZE(b_new));
+		/* Missing dimensions are treated as zero, as in gidx_overlaps */
+		for ( i = dims_union; i < dims_new; i++ )
+		{
+			GIDX_SET_MIN(*b_union, i, 0.0);
+			GIDX_SET_MAX(*b_union, i, 0.0);
+		}
 		dims_union = dims_new;
 	}
 
@@ -626,6 +641,73 @@ int geography_gidx(GSERIALIZED *g, GIDX *gidx)
 	return result;
 }
 
+/*
+** Peak into a geometry datum to find the n-dimensional bounding box. For
+** plain 2D geometries with a cached box, only the header and the box are
+** detoasted. Otherwise calculate the box (including Z and M ranges) from
+** the full geometry. Return G_FAILURE for empty geometries, otherwise
+** G_SUCCESS.
+*/
+int geometry_datum_gidx(Datum geometry_datum, GIDX *gidx)
+{
+	PG_LWGEOM *gpart;
+
+	POSTGIS_DEBUG(4, "entered function");
+
+	/* Varlena header, type byte and a BOX2DFLOAT4 is all we need. */
+	gpart = (PG_LWGEOM*)PG_DETOAST_DATUM_SLICE(geometry_datum, 0, VARHDRSZ + 1 + sizeof(BOX2DFLOAT4));
+
+	POSTGIS_DEBUGF(4, "got type %d", gpart->type);
+
+	if ( TYPE_HASBBOX(gpart->type) && ! TYPE_HASZ(gpart->type) && ! TYPE_HASM(gpart->type) )
+	{
+		BOX2DFLOAT4 box;
+		POSTGIS_DEBUG(4, "copying box out of serialization");
+		memcpy(&box, gpart->data, sizeof(BOX2DFLOAT4));
+		SET_VARSIZE(gidx, VARHDRSZ + 2 * 2 * sizeof(float));
+		GIDX_SET_MIN(gidx, 0, box.xmin);
+		GIDX_SET_MAX(gidx, 0, box.xmax);
+		GIDX_SET_MIN(gidx, 1, box.ymin);
+		GIDX_SET_MAX(gidx, 1, box.ymax);
+		return G_SUCCESS;
+	}
+
+	return geometry_gidx((PG_LWGEOM*)PG_DETOAST_DATUM(geometry_datum), gidx);
+}
+
+/*
+** Calculate the n-dimensional bounding box of an already de-toasted
+** geometry. The box has 2, 3 or 4 dimensions depending on the Z and M
+** flags of the geometry. Return G_FAILURE for empty geometries.
+*/
+int geometry_gidx(PG_LWGEOM *geom, GIDX *gidx)
+{
+	LWGEOM *lwgeom;
+	GBOX gbox;
+	int result;
+
+	POSTGIS_DEBUG(4, "calculating new box from scratch");
+
+	lwgeom = pglwgeom_deserialize(geom);
+	gbox.flags = gflags(TYPE_HASZ(geom->type), TYPE_HASM(geom->type), 0);
+	result = lwgeom_calculate_gbox(lwgeom, &gbox);
+	lwgeom_release(lwgeom);
+
+	if ( result == G_FAILURE )
+	{
+		POSTGIS_DEBUG(4, "calculated null bbox, returning null");
+		return G_FAILURE;
+	}
+
+	result = gidx_from_gbox_p(gbox, gidx);
+	if ( result == G_SUCCESS )
+	{
+		POSTGIS_DEBUGF(4, "got gidx %s", gidx_to_string(gidx));
+	}
+
+	return result;
+}
+
 /***********************************************************************
 * GiST Support Functions
 */
@@ -656,15 +738,33 @@ Datum geography_overlaps(PG_FUNCTION_ARGS)
 }
 
 /*
-** GiST support function. Given a geography, return a "compressed"
-** version. In this case, we convert the geography into a geocentric
-** bounding box. If the geography already has the box embedded in it
-** we pull that out and hand it back.
+** Operator function for the n-D geometry overlap (&&&). Compares the
+** boxes in all shared dimensions, so Z and M ranges are honoured.
 */
-PG_FUNCTION_INFO_V1(geography_gist_compress);
-Datum geography_gist_compress(PG_FUNCTION_ARGS)
+PG_FUNCTION_INFO_V1(geometry_overlaps_nd);
+Datum geometry_overlaps_nd(PG_FUNCTION_ARGS)
+{
+	char gboxmem1[GIDX_MAX_SIZE];
+	char gboxmem2[GIDX_MAX_SIZE];
+	GIDX *gbox1 = (GIDX*)gboxmem1;
+	GIDX *gbox2 = (GIDX*)gboxmem2;
+
+	if ( geometry_datum_gidx(PG_GETARG_DATUM(0), gbox1) &&
+	     geometry_datum_gidx(PG_GETARG_DATUM(1), gbox2) &&
+	     gidx_overlaps(gbox1, gbox2) )
+	{
+		PG_RETURN_BOOL(TRUE);
+	}
+
+	PG_RETURN_BOOL(FALSE);
+}
+
+/*
+** Shared body of the compress functions. Convert a leaf entry into a GIDX
+** key using the supplied extraction function.
+*/
+static GISTENTRY* gidx_gist_compress(GISTENTRY *entry_in, gidx_datum_func datum_gidx)
 {
-	GISTENTRY *entry_in = (GISTENTRY*)PG_GETARG_POINTER(0);
 	GISTENTRY *entry_out = NULL;
 	char gidxmem[GIDX_MAX_SIZE];
 	GIDX *bbox_out = (GIDX*)gidxmem;
@@ -681,7 +781,7 @@ Datum geography_gist_compress(PG_FUNCTION_ARGS)
 	if ( ! entry_in->leafkey )
 	{
 		POSTGIS_DEBUG(4, "[GIST] non-leafkey entry, returning input unaltered");
-		PG_RETURN_POINTER(entry_in);
+		return entry_in;
 	}
 
 	POSTGIS_DEBUG(4, "[GIST] processing leafkey input");
@@ -697,17 +797,17 @@ Datum geography_gist_compress(PG_FUNCTION_ARGS)
 		gistentryinit(*entry_out, (Datum) 0, entry_in->rel,
 		              entry_in->page, entry_in->offset, FALSE);
 		POSTGIS_DEBUG(4, "[GIST] returning copy of input");
-		PG_RETURN_POINTER(entry_out);
+		return entry_out;
 	}
 
 	/* Extract our index key from the GiST entry. */
-	result = geography_datum_gidx(entry_in->key, bbox_out);
+	result = datum_gidx(entry_in->key, bbox_out);
 
 	/* Is the bounding box valid (non-empty, non-infinite)? If not, return input uncompressed. */
 	if ( result == G_FAILURE )
 	{
 		POSTGIS_DEBUG(4, "[GIST] empty geometry!");
-		PG_RETURN_POINTER(entry_in);
+		return entry_in;
 	}
 
 	POSTGIS_DEBUGF(4, "[GIST] got entry_in->key: %s", gidx_to_string(bbox_out));
@@ -718,7 +818,7 @@ Datum geography_gist_compress(PG_FUNCTION_ARGS)
 		if ( ! finite(GIDX_GET_MAX(bbox_out, i)) || ! finite(GIDX_GET_MIN(bbox_out, i)) )
 		{
 			POSTGIS_DEBUG(4, "[GIST] infinite geometry!");
-			PG_RETURN_POINTER(entry_in);
+			return entry_in;
 		}
 	}
 
@@ -731,7 +831,33 @@ Datum geography_gist_compress(PG_FUNCTION_ARGS)
 
 	/* Return GISTENTRY. */
 	POSTGIS_DEBUG(4, "[GIST] 'compress' function complete");
-	PG_RETURN_POINTER(entry_out);
+	return entry_out;
+}
+
+/*
+** GiST support function. Given a geography, return a "compressed"
+** version. In this case, we convert the geography into a geocentric
+** bounding box. If the geography already has the box embedded in it
+** we pull that out and hand it back.
+*/
+PG_FUNCTION_INFO_V1(geography_gist_compress);
+Datum geography_gist_compress(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry_in = (GISTENTRY*)PG_GETARG_POINTER(0);
+	PG_RETURN_POINTER(gidx_gist_compress(entry_in, geography_datum_gidx));
+}
+
+/*
+** GiST support function. Given a geometry, return an n-dimensional
+** bounding box key. The key carries the Z and M ranges of the geometry
+** when it has them, so the rest of the GIDX machinery (penalty, union,
+** picksplit, same) can be shared with geography.
+*/
+PG_FUNCTION_INFO_V1(geometry_gist_compress_nd);
+Datum geometry_gist_compress_nd(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry_in = (GISTENTRY*)PG_GETARG_POINTER(0);
+	PG_RETURN_POINTER(gidx_gist_compress(entry_in, geometry_datum_gidx));
 }
 
 
@@ -814,67 +940,91 @@ static inline bool geography_gist_consistent_internal(GIDX *key, GIDX *query, St
 }
 
 /*
-** GiST support function. Take in a query and an entry and see what the
-** relationship is, based on the query strategy.
+** Shared body of the consistent functions. Extract the query box with the
+** supplied function and test it against the entry key.
 */
-PG_FUNCTION_INFO_V1(geography_gist_consistent);
-Datum geography_gist_consistent(PG_FUNCTION_ARGS)
+static bool gidx_gist_consistent(GISTENTRY *entry, Datum query, StrategyNumber strategy, gidx_datum_func datum_gidx)
 {
-	GISTENTRY *entry = (GISTENTRY*) PG_GETARG_POINTER(0);
-	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
-	bool result;
 	char gidxmem[GIDX_MAX_SIZE];
 	GIDX *query_gbox_index = (GIDX*)gidxmem;
 
-#if POSTGIS_PGSQL_VERSION >= 84
-	/* PostgreSQL 8.4 and later require the RECHECK flag to be set here,
-	   rather than being supplied as part of the operator class definition */
-	bool *recheck = (bool *) PG_GETARG_POINTER(4);
-
-	/* We set recheck to false to avoid repeatedly pulling every "possibly matched" geometry
-	   out during index scans. For cases when the geometries are large, rechecking
-	   can make things twice as slow. */
-	*recheck = false;
-#endif
-
 	POSTGIS_DEBUG(4, "[GIST] 'consistent' function called");
 
 	/* Quick sanity check on query argument. */
-	if ( DatumGetPointer(PG_GETARG_DATUM(1)) == NULL )
+	if ( DatumGetPointer(query) == NULL )
 	{
 		POSTGIS_DEBUG(4, "[GIST] null query pointer (!?!), returning false");
-		PG_RETURN_BOOL(FALSE); /* NULL query! This is screwy! */
+		return FALSE; /* NULL query! This is screwy! */
 	}
 
 	/* Quick sanity check on entry key. */
 	if ( DatumGetPointer(entry->key) == NULL )
 	{
 		POSTGIS_DEBUG(4, "[GIST] null index entry, returning false");
-		PG_RETURN_BOOL(FALSE); /* NULL entry! */
+		return FALSE; /* NULL entry! */
 	}
 
 	/* Null box should never make this far. */
-	if ( geography_datum_gidx(PG_GETARG_DATUM(1), query_gbox_index) == G_FAILURE )
+	if ( datum_gidx(query, query_gbox_index) == G_FAILURE )
 	{
 		POSTGIS_DEBUG(4, "[GIST] null query_gbox_index!");
-		PG_RETURN_BOOL(FALSE);
+		return FALSE;
 	}
 
 	/* Treat leaf node tests different from internal nodes */
 	if (GIST_LEAF(entry))
 	{
-		result = geography_gist_consistent_leaf(
-		             (GIDX*)DatumGetPointer(entry->key),
-		             query_gbox_index, strategy);
-	}
-	else
-	{
-		result = geography_gist_consistent_internal(
-		             (GIDX*)DatumGetPointer(entry->key),
-		             query_gbox_index, strategy);
+		return geography_gist_consistent_leaf(
+		           (GIDX*)DatumGetPointer(entry->key),
+		           query_gbox_index, strategy);
 	}
 
-	PG_RETURN_BOOL(result);
+	return geography_gist_consistent_internal(
+	           (GIDX*)DatumGetPointer(entry->key),
+	           query_gbox_index, strategy);
+}
+
+/*
+** GiST support function. Take in a query and an entry and see what the
+** relationship is, based on the query strategy.
+*/
+PG_FUNCTION_INFO_V1(geography_gist_consistent);
+Datum geography_gist_consistent(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY*) PG_GETARG_POINTER(0);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+
+#if POSTGIS_PGSQL_VERSION >= 84
+	/* PostgreSQL 8.4 and later require the RECHECK flag to be set here,
+	   rather than being supplied as part of the operator class definition */
+	bool *recheck = (bool *) PG_GETARG_POINTER(4);
+
+	/* We set recheck to false to avoid repeatedly pulling every "possibly matched" geometry
+	   out during index scans. For cases when the geometries are large, rechecking
+	   can make things twice as slow. */
+	*recheck = false;
+#endif
+
+	PG_RETURN_BOOL(gidx_gist_consistent(entry, PG_GETARG_DATUM(1), strategy, geography_datum_gidx));
+}
+
+/*
+** GiST support function for the n-D geometry opclass. Same as above, but
+** the query box is built from a geometry, including its Z and M ranges.
+*/
+PG_FUNCTION_INFO_V1(geometry_gist_consistent_nd);
+Datum geometry_gist_consistent_nd(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY*) PG_GETARG_POINTER(0);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+
+#if POSTGIS_PGSQL_VERSION >= 84
+	/* The index keys are exact boxes, no recheck needed (see above) */
+	bool *recheck = (bool *) PG_GETARG_POINTER(4);
+	*recheck = false;
+#endif
+
+	PG_RETURN_BOOL(gidx_gist_consistent(entry, PG_GETARG_DATUM(1), strategy, geometry_datum_gidx));
 }
 
 
@@ -28,6 +28,11 @@ Datum pgis_geometry_union_finalfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_collect_finalfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_polygonize_finalfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_makeline_finalfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_accum_combinefn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_accum_serialfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_accum_deserialfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_extent_transfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_extent_combinefn(PG_FUNCTION_ARGS);
 Datum pgis_abs_in(PG_FUNCTION_ARGS);
 Datum pgis_abs_out(PG_FUNCTION_ARGS);
 
@@ -83,6 +88,52 @@ pgis_abs_out(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(NULL);
 }
 
+/**
+** Return true if called as an aggregate transition or combine
+** function, setting aggcontext to the memory context holding the
+** aggregate state. Only then may the state be modified in place.
+*/
+static bool
+pgis_in_aggregate(FunctionCallInfo fcinfo, MemoryContext *aggcontext)
+{
+#if POSTGIS_PGSQL_VERSION >= 90
+	return AggCheckCallContext(fcinfo, aggcontext) != 0;
+#else
+	if (fcinfo->context && IsA(fcinfo->context, AggState))
+	{
+		*aggcontext = ((AggState *) fcinfo->context)->aggcontext;
+		return true;
+	}
+#if POSTGIS_PGSQL_VERSION == 84
+	if (fcinfo->context && IsA(fcinfo->context, WindowAggState))
+	{
+		*aggcontext = ((WindowAggState *) fcinfo->context)->wincontext;
+		return true;
+	}
+#endif
+	return false;
+#endif
+}
+
+/**
+** Return the memory context holding the aggregate state, which is
+** where anything that has to survive between calls must be allocated.
+*/
+static MemoryContext
+pgis_aggcontext(FunctionCallInfo fcinfo, const char *fname)
+{
+	MemoryContext aggcontext;
+
+	if ( ! pgis_in_aggregate(fcinfo, &aggcontext) )
+	{
+		/* cannot be called directly because of internal-type argument */
+		elog(ERROR, "%s called in non-aggregate context", fname);
+		aggcontext = NULL;		/* keep compiler quiet */
+	}
+
+	return aggcontext;
+}
+
 /**
 ** The transfer function hooks into the PostgreSQL accumArrayResult()
 ** function (present since 8.0) to build an array in a side memory
@@ -103,26 +154,12 @@ pgis_geometry_accum_transfn(PG_FUNCTION_ARGS)
 		        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 		         errmsg("could not determine input data type")));
 
-	if (fcinfo->context && IsA(fcinfo->context, AggState))
-		aggcontext = ((AggState *) fcinfo->context)->aggcontext;
-#if POSTGIS_PGSQL_VERSION == 84
-	else if (fcinfo->context && IsA(fcinfo->context, WindowAggState))
-		aggcontext = ((WindowAggState *) fcinfo->context)->wincontext;
-#endif
-#if POSTGIS_PGSQL_VERSION > 84
-	else if (fcinfo->context && IsA(fcinfo->context, WindowAggState))
-		aggcontext = ((WindowAggState *) fcinfo->context)->aggcontext;
-#endif
-	else
-	{
-		/* cannot be called directly because of dummy-type argument */
-		elog(ERROR, "array_agg_transfn called in non-aggregate context");
-		aggcontext = NULL;		/* keep compiler quiet */
-	}
+	aggcontext = pgis_aggcontext(fcinfo, "pgis_geometry_accum_transfn");
 
 	if ( PG_ARGISNULL(0) )
 	{
-		p = (pgis_abs*) palloc(sizeof(pgis_abs));
+		/* Must outlive the call when the state type is internal */
+		p = (pgis_abs*) MemoryContextAlloc(aggcontext, sizeof(pgis_abs));
 		p->a = NULL;
 	}
 	else
@@ -293,6 +330,190 @@ pgis_geometry_makeline_finalfn(PG_FUNCTION_ARGS)
 	PG_RETURN_DATUM(result);
 }
 
+/**
+** Append every element accumulated in one state to another, copying
+** the values into the aggregate memory context.
+*/
+static ArrayBuildState *
+pgis_accum_append(ArrayBuildState *state, ArrayBuildState *from, MemoryContext aggcontext)
+{
+	int i;
+
+	for ( i = 0; i < from->nelems; i++ )
+	{
+		state = accumArrayResult(state,
+		                         from->dvalues[i],
+		                         from->dnulls[i],
+		                         from->element_type,
+		                         aggcontext);
+	}
+	return state;
+}
+
+/**
+** The combine function merges the partial states built by parallel
+** workers. The second state is appended to the first one, which is
+** reused whenever it exists.
+*/
+PG_FUNCTION_INFO_V1(pgis_geometry_accum_combinefn);
+Datum
+pgis_geometry_accum_combinefn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext = pgis_aggcontext(fcinfo, "pgis_geometry_accum_combinefn");
+	pgis_abs *p1 = PG_ARGISNULL(0) ? NULL : (pgis_abs*) PG_GETARG_POINTER(0);
+	pgis_abs *p2 = PG_ARGISNULL(1) ? NULL : (pgis_abs*) PG_GETARG_POINTER(1);
+
+	if ( ! p2 || ! p2->a )
+	{
+		if ( ! p1 )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(p1);
+	}
+
+	if ( ! p1 )
+	{
+		p1 = (pgis_abs*) MemoryContextAlloc(aggcontext, sizeof(pgis_abs));
+		p1->a = NULL;
+	}
+
+	p1->a = pgis_accum_append(p1->a, p2->a, aggcontext);
+
+	PG_RETURN_POINTER(p1);
+}
+
+/**
+** The serialize function flattens the state into a geometry[] so it can
+** be sent from a parallel worker to the leader. The array is returned
+** as is, arrays being varlenas just like bytea.
+*/
+PG_FUNCTION_INFO_V1(pgis_geometry_accum_serialfn);
+Datum
+pgis_geometry_accum_serialfn(PG_FUNCTION_ARGS)
+{
+	pgis_abs *p = (pgis_abs*) PG_GETARG_POINTER(0);
+	Datum result;
+
+	if ( ! p->a )
+		PG_RETURN_NULL();
+
+	result = pgis_accum_finalfn(p, CurrentMemoryContext, fcinfo);
+
+	PG_RETURN_BYTEA_P((bytea *) DatumGetPointer(result));
+}
+
+/**
+** The deserialize function rebuilds a state from the geometry[]
+** produced by pgis_geometry_accum_serialfn.
+*/
+PG_FUNCTION_INFO_V1(pgis_geometry_accum_deserialfn);
+Datum
+pgis_geometry_accum_deserialfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext = pgis_aggcontext(fcinfo, "pgis_geometry_accum_deserialfn");
+	ArrayType *array = DatumGetArrayTypeP(PG_GETARG_DATUM(0));
+	Oid elemtype = ARR_ELEMTYPE(array);
+	int16 elemlen;
+	bool elembyval;
+	char elemalign;
+	Datum *elems;
+	bool *nulls;
+	int nelems;
+	int i;
+	pgis_abs *p;
+
+	get_typlenbyvalalign(elemtype, &elemlen, &elembyval, &elemalign);
+	deconstruct_array(array, elemtype, elemlen, elembyval, elemalign,
+	                  &elems, &nulls, &nelems);
+
+	p = (pgis_abs*) MemoryContextAlloc(aggcontext, sizeof(pgis_abs));
+	p->a = NULL;
+	for ( i = 0; i < nelems; i++ )
+		p->a = accumArrayResult(p->a, elems[i], nulls[i], elemtype, aggcontext);
+
+	PG_RETURN_POINTER(p);
+}
+
+/**
+** The ST_Extent transfer function. The box is allocated once in the
+** aggregate memory context and then grown in place, instead of
+** allocating a new box3d for every row like BOX3D_combine does.
+** Called directly from SQL the first argument may be a table value,
+** so outside an aggregate a new box is returned instead.
+*/
+PG_FUNCTION_INFO_V1(pgis_geometry_extent_transfn);
+Datum
+pgis_geometry_extent_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	PG_LWGEOM *geom;
+	BOX3D *state;
+	BOX3D box;
+	int found;
+
+	if ( PG_ARGISNULL(1) )
+	{
+		if ( PG_ARGISNULL(0) )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	geom = (PG_LWGEOM *)PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
+	found = compute_serialized_box3d_p(SERIALIZED_FORM(geom), &box);
+	PG_FREE_IF_COPY(geom, 1);
+
+	/* EMPTY geometries leave the extent untouched */
+	if ( ! found )
+	{
+		if ( PG_ARGISNULL(0) )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	if ( ! pgis_in_aggregate(fcinfo, &aggcontext) )
+	{
+		state = (BOX3D *) palloc(sizeof(BOX3D));
+		memcpy(state, &box, sizeof(BOX3D));
+		if ( ! PG_ARGISNULL(0) )
+			box3d_union_p((BOX3D *) PG_GETARG_POINTER(0), &box, state);
+		PG_RETURN_POINTER(state);
+	}
+
+	if ( PG_ARGISNULL(0) )
+	{
+		state = (BOX3D *) MemoryContextAlloc(aggcontext, sizeof(BOX3D));
+		memcpy(state, &box, sizeof(BOX3D));
+		PG_RETURN_POINTER(state);
+	}
+
+	state = (BOX3D *) PG_GETARG_POINTER(0);
+	box3d_union_p(state, &box, state);
+
+	PG_RETURN_POINTER(state);
+}
+
+/**
+** The ST_Extent combine function. It is strict, so the executor hands
+** over the first non NULL partial box already copied in the aggregate
+** memory context and the second one can be merged into it in place.
+** Outside an aggregate a new box is returned instead.
+*/
+PG_FUNCTION_INFO_V1(pgis_geometry_extent_combinefn);
+Datum
+pgis_geometry_extent_combinefn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	BOX3D *state = (BOX3D *) PG_GETARG_POINTER(0);
+	BOX3D *box = (BOX3D *) PG_GETARG_POINTER(1);
+	BOX3D *result = state;
+
+	if ( ! pgis_in_aggregate(fcinfo, &aggcontext) )
+		result = (BOX3D *) palloc(sizeof(BOX3D));
+
+	box3d_union_p(state, box, result);
+
+	PG_RETURN_POINTER(result);
+}
+
 /**
 * A modified version of PostgreSQL's DirectFunctionCall1 which allows NULL results; this
 * is required for aggregates that return NULL.
@@ -9,11 +9,19 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "access/hash.h"
 #include "utils/geo_decls.h"
 
 #include "liblwgeom.h"
 #include "lwgeom_pg.h"
 
+#if POSTGIS_PGSQL_VERSION >= 92
+#include "utils/sortsupport.h"
+#endif
+#if POSTGIS_PGSQL_VERSION >= 95
+#include "lib/hyperloglog.h"
+#endif
+
 #include <math.h>
 #include <float.h>
 #include <string.h>
@@ -26,431 +34,455 @@ Datum lwgeom_eq(PG_FUNCTION_ARGS);
 Datum lwgeom_ge(PG_FUNCTION_ARGS);
 Datum lwgeom_gt(PG_FUNCTION_ARGS);
 Datum lwgeom_cmp(PG_FUNCTION_ARGS);
+Datum lwgeom_hash(PG_FUNCTION_ARGS);
+Datum lwgeom_sortsupport(PG_FUNCTION_ARGS);
 
 
 #define BTREE_SRID_MISMATCH_SEVERITY ERROR
 
-PG_FUNCTION_INFO_V1(lwgeom_lt);
-Datum lwgeom_lt(PG_FUNCTION_ARGS)
+/**
+ * Locate the canonical serialized form of a geometry: the type
+ * byte without the bbox flag, followed by everything after the
+ * cached bbox (SRID and coordinates). Two geometries are equal
+ * for btree and hash purposes iff their canonical forms match,
+ * regardless of whether either one carries a cached bbox.
+ */
+static const uchar *
+pgis_btree_canonical(const PG_LWGEOM *geom, uchar *type, size_t *size)
 {
-	PG_LWGEOM *geom1 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	PG_LWGEOM *geom2 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
-	BOX2DFLOAT4 box1;
-	BOX2DFLOAT4 box2;
+	const uchar *body = geom->data;
+	size_t skip = 0;
 
-	POSTGIS_DEBUG(2, "lwgeom_lt called");
+	if ( lwgeom_hasBBOX(geom->type) )
+		skip = sizeof(BOX2DFLOAT4);
 
-	if (pglwgeom_getSRID(geom1) != pglwgeom_getSRID(geom2))
-	{
-		elog(BTREE_SRID_MISMATCH_SEVERITY,
-		     "Operation on two GEOMETRIES with different SRIDs\n");
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 )
-			pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 )
-			pfree(geom2);
-		PG_RETURN_NULL();
-	}
+	*type = geom->type & 0x7F;
+	*size = VARSIZE(geom) - VARHDRSZ - 1 - skip;
 
-	POSTGIS_DEBUG(3, "lwgeom_lt passed getSRID test");
+	return body + skip;
+}
 
-	getbox2d_p(SERIALIZED_FORM(geom1), &box1);
-	getbox2d_p(SERIALIZED_FORM(geom2), &box2);
+/*
+ * Total order on the canonical forms, used to break ties between
+ * geometries with the same bbox.
+ */
+static int
+pgis_btree_canonical_cmp(const PG_LWGEOM *geom1, const PG_LWGEOM *geom2)
+{
+	const uchar *body1, *body2;
+	uchar type1, type2;
+	size_t size1, size2;
+	int cmp;
 
-	POSTGIS_DEBUG(3, "lwgeom_lt getbox2d_p passed");
+	body1 = pgis_btree_canonical(geom1, &type1, &size1);
+	body2 = pgis_btree_canonical(geom2, &type2, &size2);
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
-	{
-		if  (box1.xmin < box2.xmin)
-			PG_RETURN_BOOL(TRUE);
-	}
+	if ( type1 != type2 )
+		return (type1 < type2) ? -1 : 1;
 
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
-	{
-		if  (box1.ymin < box2.ymin)
-			PG_RETURN_BOOL(TRUE);
-	}
+	cmp = memcmp(body1, body2, (size1 < size2) ? size1 : size2);
+	if ( cmp != 0 )
+		return (cmp < 0) ? -1 : 1;
 
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
-	{
-		if  (box1.xmax < box2.xmax)
-			PG_RETURN_BOOL(TRUE);
-	}
+	if ( size1 != size2 )
+		return (size1 < size2) ? -1 : 1;
 
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
-	{
-		if  (box1.ymax < box2.ymax)
-			PG_RETURN_BOOL(TRUE);
-	}
+	return 0;
+}
+
+/*
+ * Compare two bboxes in xmin, ymin, xmax, ymax order. Empty
+ * geometries (no bbox) sort before everything else. The edges
+ * are compared exactly: an FPeq() tolerance would not be
+ * transitive, and neither btree nor abbreviated keys cope with that.
+ */
+static int
+pgis_btree_box_cmp(const BOX2DFLOAT4 *box1, int empty1, const BOX2DFLOAT4 *box2, int empty2)
+{
+	if ( empty1 || empty2 )
+		return empty2 - empty1;
+
+	if ( box1->xmin != box2->xmin )
+		return (box1->xmin < box2->xmin) ? -1 : 1;
+
+	if ( box1->ymin != box2->ymin )
+		return (box1->ymin < box2->ymin) ? -1 : 1;
 
-	PG_RETURN_BOOL(FALSE);
+	if ( box1->xmax != box2->xmax )
+		return (box1->xmax < box2->xmax) ? -1 : 1;
+
+	if ( box1->ymax != box2->ymax )
+		return (box1->ymax < box2->ymax) ? -1 : 1;
+
+	return 0;
 }
 
-PG_FUNCTION_INFO_V1(lwgeom_le);
-Datum lwgeom_le(PG_FUNCTION_ARGS)
+/**
+ * Btree ordering of two geometries: by bbox, then by canonical
+ * serialized form so that only identical geometries compare equal.
+ */
+static int
+pgis_btree_cmp(PG_LWGEOM *geom1, PG_LWGEOM *geom2)
 {
-	PG_LWGEOM *geom1 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	PG_LWGEOM *geom2 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
 	BOX2DFLOAT4 box1;
 	BOX2DFLOAT4 box2;
-
-	POSTGIS_DEBUG(2, "lwgeom_le called");
+	int empty1, empty2;
+	int cmp;
 
 	if (pglwgeom_getSRID(geom1) != pglwgeom_getSRID(geom2))
 	{
 		elog(BTREE_SRID_MISMATCH_SEVERITY,
 		     "Operation on two GEOMETRIES with different SRIDs\n");
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 )
-			pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 )
-			pfree(geom2);
-		PG_RETURN_NULL();
 	}
 
-	getbox2d_p(SERIALIZED_FORM(geom1), &box1);
-	getbox2d_p(SERIALIZED_FORM(geom2), &box2);
+	empty1 = ! getbox2d_p(SERIALIZED_FORM(geom1), &box1);
+	empty2 = ! getbox2d_p(SERIALIZED_FORM(geom2), &box2);
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
-	{
-		if  (box1.xmin < box2.xmin)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_BOOL(FALSE);
-	}
+	cmp = pgis_btree_box_cmp(&box1, empty1, &box2, empty2);
+	if ( cmp != 0 )
+		return cmp;
 
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
-	{
-		if  (box1.ymin < box2.ymin)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_BOOL(FALSE);
-	}
+	return pgis_btree_canonical_cmp(geom1, geom2);
+}
 
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
-	{
-		if  (box1.xmax < box2.xmax)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_BOOL(FALSE);
-	}
+/*
+ * Detoast both arguments, compare them and release any copies.
+ */
+static int
+pgis_btree_cmp_args(FunctionCallInfo fcinfo)
+{
+	PG_LWGEOM *geom1 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+	PG_LWGEOM *geom2 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
+	int cmp;
 
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
-	{
-		if  (box1.ymax < box2.ymax)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_BOOL(FALSE);
-	}
+	cmp = pgis_btree_cmp(geom1, geom2);
 
 	if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
 	if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
 
-	PG_RETURN_BOOL(TRUE);
+	return cmp;
+}
+
+PG_FUNCTION_INFO_V1(lwgeom_lt);
+Datum lwgeom_lt(PG_FUNCTION_ARGS)
+{
+	POSTGIS_DEBUG(2, "lwgeom_lt called");
+
+	PG_RETURN_BOOL(pgis_btree_cmp_args(fcinfo) < 0);
+}
+
+PG_FUNCTION_INFO_V1(lwgeom_le);
+Datum lwgeom_le(PG_FUNCTION_ARGS)
+{
+	POSTGIS_DEBUG(2, "lwgeom_le called");
+
+	PG_RETURN_BOOL(pgis_btree_cmp_args(fcinfo) <= 0);
 }
 
 PG_FUNCTION_INFO_V1(lwgeom_eq);
 Datum lwgeom_eq(PG_FUNCTION_ARGS)
 {
-	PG_LWGEOM *geom1 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	PG_LWGEOM *geom2 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
-	BOX2DFLOAT4 box1;
-	BOX2DFLOAT4 box2;
-
 	POSTGIS_DEBUG(2, "lwgeom_eq called");
 
-	if (pglwgeom_getSRID(geom1) != pglwgeom_getSRID(geom2))
-	{
-		elog(BTREE_SRID_MISMATCH_SEVERITY,
-		     "Operation on two GEOMETRIES with different SRIDs\n");
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 )
-			pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 )
-			pfree(geom2);
-		PG_RETURN_NULL();
-	}
-
-	getbox2d_p(SERIALIZED_FORM(geom1), &box1);
-	getbox2d_p(SERIALIZED_FORM(geom2), &box2);
+	PG_RETURN_BOOL(pgis_btree_cmp_args(fcinfo) == 0);
+}
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
-	{
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_BOOL(FALSE);
-	}
+PG_FUNCTION_INFO_V1(lwgeom_ge);
+Datum lwgeom_ge(PG_FUNCTION_ARGS)
+{
+	POSTGIS_DEBUG(2, "lwgeom_ge called");
 
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
-	{
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_BOOL(FALSE);
-	}
+	PG_RETURN_BOOL(pgis_btree_cmp_args(fcinfo) >= 0);
+}
 
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
-	{
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_BOOL(FALSE);
-	}
+PG_FUNCTION_INFO_V1(lwgeom_gt);
+Datum lwgeom_gt(PG_FUNCTION_ARGS)
+{
+	POSTGIS_DEBUG(2, "lwgeom_gt called");
 
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
-	{
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_BOOL(FALSE);
-	}
+	PG_RETURN_BOOL(pgis_btree_cmp_args(fcinfo) > 0);
+}
 
-	if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-	if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
+PG_FUNCTION_INFO_V1(lwgeom_cmp);
+Datum lwgeom_cmp(PG_FUNCTION_ARGS)
+{
+	POSTGIS_DEBUG(2, "lwgeom_cmp called");
 
-	PG_RETURN_BOOL(TRUE);
+	PG_RETURN_INT32(pgis_btree_cmp_args(fcinfo));
 }
 
-PG_FUNCTION_INFO_V1(lwgeom_ge);
-Datum lwgeom_ge(PG_FUNCTION_ARGS)
+/**
+ * Hash support for the hash opclass: hashes the canonical
+ * serialized form, so it agrees with lwgeom_eq() whether or not
+ * a bbox is cached.
+ */
+PG_FUNCTION_INFO_V1(lwgeom_hash);
+Datum lwgeom_hash(PG_FUNCTION_ARGS)
 {
-	PG_LWGEOM *geom1 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	PG_LWGEOM *geom2 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
-	BOX2DFLOAT4 box1;
-	BOX2DFLOAT4 box2;
+	PG_LWGEOM *geom = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+	const uchar *body;
+	uchar type;
+	size_t size;
+	uint32 hash;
 
-	POSTGIS_DEBUG(2, "lwgeom_ge called");
+	body = pgis_btree_canonical(geom, &type, &size);
 
-	if (pglwgeom_getSRID(geom1) != pglwgeom_getSRID(geom2))
-	{
-		elog(BTREE_SRID_MISMATCH_SEVERITY,
-		     "Operation on two GEOMETRIES with different SRIDs\n");
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 )
-			pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 )
-			pfree(geom2);
-		PG_RETURN_NULL();
-	}
+	hash = DatumGetUInt32(hash_any(body, size));
+	hash ^= DatumGetUInt32(hash_uint32((uint32) type));
 
-	getbox2d_p(SERIALIZED_FORM(geom1), &box1);
-	getbox2d_p(SERIALIZED_FORM(geom2), &box2);
+	PG_FREE_IF_COPY(geom, 0);
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
-	{
-		if  (box1.xmin > box2.xmin)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
-	}
+	PG_RETURN_INT32((int32) hash);
+}
+
+#if POSTGIS_PGSQL_VERSION >= 92
+
+/*
+ * Number of bytes of a serialized geometry needed to read its
+ * cached bbox and SRID: the type byte, the box and the SRID.
+ * This also covers the type byte, SRID and coordinates of a 2d
+ * point, which carries no cached bbox.
+ */
+#define BTREE_SORTKEY_SLICE (1 + sizeof(BOX2DFLOAT4) + sizeof(int32))
+
+/**
+ * Fetch the 2d bounding box and SRID of a geometry datum for sorting.
+ *
+ * When the geometry carries a cached bbox, or is a point, only the
+ * leading slice of the datum is detoasted, otherwise we fall back to
+ * a full detoast and compute the box. Returns 0 for geometries
+ * without a box (empty collections), which sort first.
+ */
+static int
+pgis_btree_datum_box(Datum datum, BOX2DFLOAT4 *box, int *srid)
+{
+	PG_LWGEOM *geom;
+	int result = 1;
+	size_t ptoff;
+
+	geom = (PG_LWGEOM *) PG_DETOAST_DATUM_SLICE(datum, 0, BTREE_SORTKEY_SLICE);
+	ptoff = lwgeom_hasSRID(geom->type) ? sizeof(int32) : 0;
 
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
+	if ( ! lwgeom_hasBBOX(geom->type) &&
+	        lwgeom_getType(geom->type) == POINTTYPE &&
+	        VARSIZE(geom) - VARHDRSZ >= 1 + ptoff + sizeof(POINT2D) )
 	{
-		if  (box1.ymin > box2.ymin)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
+		/* Same box as getbox2d_p() computes for the point */
+		POINT2D pt;
+		BOX3D box3d;
+
+		memcpy(&pt, geom->data + ptoff, sizeof(POINT2D));
+		box3d.xmin = box3d.xmax = pt.x;
+		box3d.ymin = box3d.ymax = pt.y;
+		box3d.zmin = box3d.zmax = 0.0;
+		result = box3d_to_box2df_p(&box3d, box);
 	}
-
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
+	else if ( ! lwgeom_hasBBOX(geom->type) )
 	{
-		if  (box1.xmax > box2.xmax)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
+		if ( (Pointer) geom != DatumGetPointer(datum) ) pfree(geom);
+		geom = (PG_LWGEOM *) PG_DETOAST_DATUM(datum);
+		result = getbox2d_p(SERIALIZED_FORM(geom), box);
 	}
-
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
+	else
 	{
-		if  (box1.ymax > box2.ymax)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
+		memcpy(box, geom->data, sizeof(BOX2DFLOAT4));
 	}
 
-	if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-	if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
+	*srid = pglwgeom_getSRID(geom);
+
+	if ( (Pointer) geom != DatumGetPointer(datum) ) pfree(geom);
 
-	PG_RETURN_BOOL(TRUE);
+	return result;
 }
 
-PG_FUNCTION_INFO_V1(lwgeom_gt);
-Datum lwgeom_gt(PG_FUNCTION_ARGS)
+/*
+ * Full comparison with the same semantics as lwgeom_cmp(), but
+ * without going through the fmgr. Only the bbox slice is read
+ * unless the boxes tie and the canonical forms must be compared.
+ */
+static int
+lwgeom_sortsupport_cmp(Datum a, Datum b, SortSupport ssup)
 {
-	PG_LWGEOM *geom1 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	PG_LWGEOM *geom2 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
 	BOX2DFLOAT4 box1;
 	BOX2DFLOAT4 box2;
+	PG_LWGEOM *geom1, *geom2;
+	int srid1, srid2;
+	int empty1, empty2;
+	int cmp;
 
-	POSTGIS_DEBUG(2, "lwgeom_gt called");
+	empty1 = ! pgis_btree_datum_box(a, &box1, &srid1);
+	empty2 = ! pgis_btree_datum_box(b, &box2, &srid2);
 
-	if (pglwgeom_getSRID(geom1) != pglwgeom_getSRID(geom2))
+	if ( srid1 != srid2 )
 	{
 		elog(BTREE_SRID_MISMATCH_SEVERITY,
 		     "Operation on two GEOMETRIES with different SRIDs\n");
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 )
-			pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 )
-			pfree(geom2);
-		PG_RETURN_NULL();
 	}
 
-	getbox2d_p(SERIALIZED_FORM(geom1), &box1);
-	getbox2d_p(SERIALIZED_FORM(geom2), &box2);
+	cmp = pgis_btree_box_cmp(&box1, empty1, &box2, empty2);
+	if ( cmp != 0 )
+		return cmp;
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
-	{
-		if  (box1.xmin > box2.xmin)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
-	}
+	geom1 = (PG_LWGEOM *) PG_DETOAST_DATUM(a);
+	geom2 = (PG_LWGEOM *) PG_DETOAST_DATUM(b);
+
+	cmp = pgis_btree_canonical_cmp(geom1, geom2);
+
+	if ( (Pointer) geom1 != DatumGetPointer(a) ) pfree(geom1);
+	if ( (Pointer) geom2 != DatumGetPointer(b) ) pfree(geom2);
+
+	return cmp;
+}
+
+#if POSTGIS_PGSQL_VERSION >= 95 && SIZEOF_DATUM >= 8
+
+/*
+ * Sort state kept in ssup_extra. Abbreviated comparisons that differ
+ * never reach the full comparator, so the SRID of the first geometry
+ * is kept to do the SRID mismatch check here instead, as every datum
+ * in the sort passes through the converter. The key cardinality
+ * estimate drives lwgeom_abbrev_abort().
+ */
+typedef struct
+{
+	bool have_srid;
+	int srid;
+	int input_count;
+	bool estimating;
+	hyperLogLogState abbr_card;
+} lwgeom_abbrev_state;
+
+/*
+ * Abbreviated key: the bbox xmin, a float, mapped to an unsigned
+ * integer with the same order, plus one. Empty geometries get key
+ * 0 so that they still sort first. As the box comparison starts
+ * with an exact xmin comparison, keys that differ always agree with
+ * the full comparator, and equal keys are left to it.
+ */
+static Datum
+lwgeom_abbrev_convert(Datum original, SortSupport ssup)
+{
+	lwgeom_abbrev_state *state = (lwgeom_abbrev_state *) ssup->ssup_extra;
+	BOX2DFLOAT4 box;
+	int srid;
+	int nonempty;
+	float xmin;
+	uint32 bits;
+	int64 key = 0;
 
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
+	nonempty = pgis_btree_datum_box(original, &box, &srid);
+
+	if ( ! state->have_srid )
 	{
-		if  (box1.ymin > box2.ymin)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
+		state->srid = srid;
+		state->have_srid = true;
 	}
-
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
+	else if ( state->srid != srid )
 	{
-		if  (box1.xmax > box2.xmax)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
+		elog(BTREE_SRID_MISMATCH_SEVERITY,
+		     "Operation on two GEOMETRIES with different SRIDs\n");
 	}
 
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
+	if ( nonempty )
 	{
-		if  (box1.ymax > box2.ymax)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_BOOL(TRUE);
-		}
+		/* -0 and 0 compare equal, so they must get the same key */
+		xmin = (box.xmin == 0.0) ? 0.0 : box.xmin;
+		memcpy(&bits, &xmin, sizeof(uint32));
+		bits = (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
+		key = (int64) bits + 1;
 	}
 
-	if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-	if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
+	state->input_count++;
+	if ( state->estimating )
+		addHyperLogLog(&state->abbr_card, DatumGetUInt32(hash_uint32((uint32) key)));
 
-	PG_RETURN_BOOL(FALSE);
+	return (Datum) key;
 }
 
-PG_FUNCTION_INFO_V1(lwgeom_cmp);
-Datum lwgeom_cmp(PG_FUNCTION_ARGS)
+static int
+lwgeom_abbrev_cmp(Datum a, Datum b, SortSupport ssup)
 {
-	PG_LWGEOM *geom1 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	PG_LWGEOM *geom2 = (PG_LWGEOM *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
-	BOX2DFLOAT4 box1;
-	BOX2DFLOAT4 box2;
+	int64 ka = (int64) a;
+	int64 kb = (int64) b;
 
-	POSTGIS_DEBUG(2, "lwgeom_cmp called");
+	if ( ka < kb ) return -1;
+	if ( ka > kb ) return 1;
+	return 0;
+}
 
-	if (pglwgeom_getSRID(geom1) != pglwgeom_getSRID(geom2))
-	{
-		elog(BTREE_SRID_MISMATCH_SEVERITY,
-		     "Operation on two GEOMETRIES with different SRIDs\n");
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 )
-			pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 )
-			pfree(geom2);
-		PG_RETURN_NULL();
-	}
+/*
+ * Give up on abbreviation when the keys are mostly duplicates, such as
+ * a column of lines sharing a start point, in the same way as the
+ * uuid opclass does: past 10000 rows, abort if there are fewer than
+ * one distinct key per 2000 rows, and stop checking once there are
+ * clearly plenty.
+ */
+static bool
+lwgeom_abbrev_abort(int memtupcount, SortSupport ssup)
+{
+	lwgeom_abbrev_state *state = (lwgeom_abbrev_state *) ssup->ssup_extra;
+	double abbr_card;
 
-	getbox2d_p(SERIALIZED_FORM(geom1), &box1);
-	getbox2d_p(SERIALIZED_FORM(geom2), &box2);
+	if ( memtupcount < 10000 || state->input_count < 10000 || ! state->estimating )
+		return false;
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
-	{
-		if  (box1.xmin < box2.xmin)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_INT32(-1);
-		}
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_INT32(1);
-	}
+	abbr_card = estimateHyperLogLog(&state->abbr_card);
 
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
+	if ( abbr_card > 100000.0 )
 	{
-		if  (box1.ymin < box2.ymin)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_INT32(-1);
-		}
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_INT32(1);
+		state->estimating = false;
+		return false;
 	}
 
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
+	if ( abbr_card < state->input_count / 2000.0 + 0.5 )
 	{
-		if  (box1.xmax < box2.xmax)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_INT32(-1);
-		}
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_INT32(1);
+		POSTGIS_DEBUGF(3, "lwgeom_abbrev_abort: %f distinct keys in %d rows, aborting",
+		               abbr_card, state->input_count);
+		return true;
 	}
 
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
+	return false;
+}
+
+#endif /* POSTGIS_PGSQL_VERSION >= 95 */
+
+/**
+ * Sort support for the btree opclass. Comparisons read only the
+ * leading slice of each datum (the cached bbox, or the coordinates
+ * of a point), and on PostgreSQL 9.5+ the
+ * bbox xmin is used as an abbreviated key so that most comparisons
+ * in a sort never touch the geometry again.
+ */
+PG_FUNCTION_INFO_V1(lwgeom_sortsupport);
+Datum lwgeom_sortsupport(PG_FUNCTION_ARGS)
+{
+	SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+	ssup->comparator = lwgeom_sortsupport_cmp;
+
+#if POSTGIS_PGSQL_VERSION >= 95 && SIZEOF_DATUM >= 8
+	if ( ssup->abbreviate )
 	{
-		if  (box1.ymax < box2.ymax)
-		{
-			if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-			if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-			PG_RETURN_INT32(-1);
-		}
-		if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-		if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-		PG_RETURN_INT32(1);
+		MemoryContext oldcontext = MemoryContextSwitchTo(ssup->ssup_cxt);
+		lwgeom_abbrev_state *state = palloc0(sizeof(lwgeom_abbrev_state));
+
+		state->estimating = true;
+		initHyperLogLog(&state->abbr_card, 10);
+		MemoryContextSwitchTo(oldcontext);
+
+		ssup->ssup_extra = state;
+		ssup->comparator = lwgeom_abbrev_cmp;
+		ssup->abbrev_converter = lwgeom_abbrev_convert;
+		ssup->abbrev_abort = lwgeom_abbrev_abort;
+		ssup->abbrev_full_comparator = lwgeom_sortsupport_cmp;
 	}
+#endif
 
-	if ( (Pointer *)PG_GETARG_DATUM(0) != (Pointer *)geom1 ) pfree(geom1);
-	if ( (Pointer *)PG_GETARG_DATUM(1) != (Pointer *)geom2 ) pfree(geom2);
-
-	PG_RETURN_INT32(0);
+	PG_RETURN_VOID();
 }
 
+#endif /* POSTGIS_PGSQL_VERSION >= 92 */
+
 /***********************************************************
  *
  * $Log$
@@ -11,13 +11,20 @@
  **********************************************************************/
 
 #include "postgres.h"
+#include "access/genam.h"
+#include "access/gist.h"
+#include "access/itup.h"
 #include "executor/spi.h"
 #include "fmgr.h"
 #include "commands/vacuum.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type.h"
 #include "nodes/relation.h"
 #include "parser/parsetree.h"
+#include "storage/bufmgr.h"
 #include "utils/array.h"
 #include "utils/lsyscache.h"
+#include "utils/rel.h"
 #include "utils/syscache.h"
 
 #include "liblwgeom.h"
@@ -55,6 +62,20 @@
 #define USE_STANDARD_DEVIATION 1
 #define SDFACTOR 3.25
 
+/*
+ * Define this to build adaptive histograms: the cell edges are
+ * quantiles of the sample feature centers on each axis, so dense
+ * areas get small cells and sparse ones large cells. The histogram
+ * then covers the whole sample extent and the standard deviation
+ * based trimming is not used.
+ */
+#define USE_ADAPTIVE_HISTOGRAM 1
+
+#if USE_ADAPTIVE_HISTOGRAM
+#undef USE_STANDARD_DEVIATION
+#define USE_STANDARD_DEVIATION 0
+#endif
+
 typedef struct GEOM_STATS_T
 {
 	/* cols * rows = total boxes in grid */
@@ -80,7 +101,30 @@ typedef struct GEOM_STATS_T
 }
 GEOM_STATS;
 
-static float8 estimate_selectivity(BOX2DFLOAT4 *box, GEOM_STATS *geomstats);
+/**
+ * Adaptive histograms store their cell edges after the cell values in
+ * the same stats slot: cols+1 X edges, then rows+1 Y edges. Histograms
+ * without edges have a uniform grid over the xmin/ymin/xmax/ymax box.
+ * GEOM_HISTO wraps either kind for the estimators.
+ */
+typedef struct GEOM_HISTO_T
+{
+	GEOM_STATS *stats;
+	int cols;
+	int rows;
+	float4 *xedges; /* NULL for uniform grids */
+	float4 *yedges;
+}
+GEOM_HISTO;
+
+/* Number of float4 in the GEOM_STATS header, before the cell values */
+#define GEOM_STATS_HEADER_SIZE ((int)(offsetof(GEOM_STATS, value) / sizeof(float4)))
+
+static void geom_histo_init(GEOM_HISTO *histo, GEOM_STATS *geomstats, int nvalues);
+static float8 estimate_selectivity(BOX2DFLOAT4 *box, GEOM_HISTO *histo);
+
+/* geometry expand() functions the planner inlines radius searches into */
+static const char *geometry_expand_names[] = { "st_expand", "expand", NULL };
 
 
 #define SHOW_DIGS_DOUBLE 15
@@ -104,12 +148,142 @@ static float8 estimate_selectivity(BOX2DFLOAT4 *box, GEOM_STATS *geomstats);
  */
 #define REALLY_DO_JOINSEL 1
 
+/**
+ * Block number of the GiST root page, which is only exported
+ * by the backend private GiST header.
+ */
+#ifndef GIST_ROOT_BLKNO
+#define GIST_ROOT_BLKNO 0
+#endif
+
 Datum LWGEOM_gist_sel(PG_FUNCTION_ARGS);
 Datum LWGEOM_gist_joinsel(PG_FUNCTION_ARGS);
 Datum LWGEOM_estimated_extent(PG_FUNCTION_ARGS);
+Datum LWGEOM_index_extent(PG_FUNCTION_ARGS);
 Datum LWGEOM_analyze(PG_FUNCTION_ARGS);
 
 
+static void
+geom_histo_init(GEOM_HISTO *histo, GEOM_STATS *geomstats, int nvalues)
+{
+	histo->stats = geomstats;
+	histo->cols = geomstats->cols;
+	histo->rows = geomstats->rows;
+	histo->xedges = NULL;
+	histo->yedges = NULL;
+
+	if ( nvalues == GEOM_STATS_HEADER_SIZE + histo->cols * histo->rows +
+	     histo->cols + 1 + histo->rows + 1 )
+	{
+		histo->xedges = geomstats->value + histo->cols * histo->rows;
+		histo->yedges = histo->xedges + histo->cols + 1;
+	}
+}
+
+/* Lower edge of column i, upper edge of column i-1 */
+static inline double
+geom_histo_xedge(GEOM_HISTO *histo, int i)
+{
+	if ( histo->xedges )
+		return histo->xedges[i];
+	return histo->stats->xmin +
+	       i * ((double)histo->stats->xmax - histo->stats->xmin) / histo->cols;
+}
+
+/* Lower edge of row i, upper edge of row i-1 */
+static inline double
+geom_histo_yedge(GEOM_HISTO *histo, int i)
+{
+	if ( histo->yedges )
+		return histo->yedges[i];
+	return histo->stats->ymin +
+	       i * ((double)histo->stats->ymax - histo->stats->ymin) / histo->rows;
+}
+
+/* Index of the cell holding v, given n cells and their n+1 edges */
+static int
+geom_histo_find(float4 *edges, int n, double lo, double hi, double v)
+{
+	int low, high;
+
+	if ( ! edges )
+	{
+		int i = (int)floor((v - lo) / (hi - lo) * n);
+		if ( i < 0 ) return 0;
+		if ( i >= n ) return n - 1;
+		return i;
+	}
+
+	/* Largest i with edges[i] <= v */
+	low = 0;
+	high = n - 1;
+	while ( low < high )
+	{
+		int mid = (low + high + 1) / 2;
+		if ( edges[mid] <= v )
+			low = mid;
+		else
+			high = mid - 1;
+	}
+	return low;
+}
+
+/* Column holding x, clamped to the grid */
+static inline int
+geom_histo_col(GEOM_HISTO *histo, double x)
+{
+	return geom_histo_find(histo->xedges, histo->cols,
+	                       histo->stats->xmin, histo->stats->xmax, x);
+}
+
+/* Row holding y, clamped to the grid */
+static inline int
+geom_histo_row(GEOM_HISTO *histo, double y)
+{
+	return geom_histo_find(histo->yedges, histo->rows,
+	                       histo->stats->ymin, histo->stats->ymax, y);
+}
+
+#if USE_ADAPTIVE_HISTOGRAM
+static int
+geom_histo_double_cmp(const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+
+	if ( da < db ) return -1;
+	if ( da > db ) return 1;
+	return 0;
+}
+
+/**
+ * Fill edges with up to n+1 cell edges from lo to hi, placed at the
+ * quantiles of the ncoords sample coordinates. Quantiles falling on
+ * an edge already taken (many features with the same coordinate)
+ * are dropped, so fewer cells may come out.
+ * Returns the number of cells.
+ */
+static int
+geom_histo_quantile_edges(float4 *edges, int n, double *coords, int ncoords,
+                          float4 lo, float4 hi)
+{
+	int i, ncells = 0;
+
+	qsort(coords, ncoords, sizeof(double), geom_histo_double_cmp);
+
+	edges[0] = lo;
+	for (i=1; i<n; i++)
+	{
+		float4 edge = coords[(int)((double)i * ncoords / n)];
+		if ( edge > edges[ncells] && edge < hi )
+			edges[++ncells] = edge;
+	}
+	edges[++ncells] = hi;
+
+	return ncells;
+}
+#endif /* USE_ADAPTIVE_HISTOGRAM */
+
 #if ! REALLY_DO_JOINSEL
 /**
  * JOIN selectivity in the GiST && operator
@@ -126,20 +300,21 @@ Datum LWGEOM_gist_joinsel(PG_FUNCTION_ARGS)
 
 #else /* REALLY_DO_JOINSEL */
 
-int calculate_column_intersection(BOX2DFLOAT4 *search_box, GEOM_STATS *geomstats1, GEOM_STATS *geomstats2);
+int calculate_column_intersection(BOX2DFLOAT4 *search_box, GEOM_STATS *geomstats1, GEOM_STATS *geomstats2, double distance);
 
 int
-calculate_column_intersection(BOX2DFLOAT4 *search_box, GEOM_STATS *geomstats1, GEOM_STATS *geomstats2)
+calculate_column_intersection(BOX2DFLOAT4 *search_box, GEOM_STATS *geomstats1, GEOM_STATS *geomstats2, double distance)
 {
 	/**
 	* Calculate the intersection of two columns from their geomstats extents - return true
-	* if a valid intersection was found, false if there is no overlap
+	* if a valid intersection was found, false if there is no overlap.
+	* The first extent is expanded by distance, for radius joins.
 	*/
 
-	float8 i_xmin = LW_MAX(geomstats1->xmin, geomstats2->xmin);
-	float8 i_ymin = LW_MAX(geomstats1->ymin, geomstats2->ymin);
-	float8 i_xmax = LW_MIN(geomstats1->xmax, geomstats2->xmax);
-	float8 i_ymax = LW_MIN(geomstats1->ymax, geomstats2->ymax);
+	float8 i_xmin = LW_MAX(geomstats1->xmin - distance, geomstats2->xmin);
+	float8 i_ymin = LW_MAX(geomstats1->ymin - distance, geomstats2->ymin);
+	float8 i_xmax = LW_MIN(geomstats1->xmax + distance, geomstats2->xmax);
+	float8 i_ymax = LW_MIN(geomstats1->ymax + distance, geomstats2->ymax);
 
 	/* If the rectangles don't intersect, return false */
 	if (i_xmin > i_xmax || i_ymin > i_ymax)
@@ -154,6 +329,123 @@ calculate_column_intersection(BOX2DFLOAT4 *search_box, GEOM_STATS *geomstats1, G
 	return -1;
 }
 
+/**
+ * Estimate the fraction of the cross product of two columns whose
+ * bounding boxes overlap, by combining the two histograms cell by cell.
+ *
+ * Dividing each histogram by its avgFeatureCells turns it into the
+ * share of features per cell, so that every feature counts once however
+ * many cells it touches. For every cell of the first histogram we then
+ * collect the share of the second column falling in the same area
+ * (pro rata of the cell overlap), and the product of the two shares,
+ * divided by the cell area, is the density of co-located pairs there.
+ *
+ * Two boxes overlap when their centers are closer than the sum of their
+ * half widths and half heights, so the feature size correction is the
+ * area of that Minkowski sum, (w1 + w2) * (h1 + h2), using the average
+ * feature sizes of the two columns.
+ *
+ * Radius joins have one column expanded by distance, which adds
+ * twice the distance to the feature size.
+ *
+ * Returns a negative value if the histograms are degenerate (collapsed
+ * on one axis) and the caller should use another estimate.
+ */
+static float8
+estimate_join_selectivity(GEOM_HISTO *histo1, GEOM_HISTO *histo2, double distance)
+{
+	GEOM_STATS *geomstats1 = histo1->stats;
+	GEOM_STATS *geomstats2 = histo2->stats;
+	BOX2DFLOAT4 search_box;
+	int x1, y1, x2, y2;
+	int x1_min, x1_max, y1_min, y1_max;
+	int x2_min, x2_max, y2_min, y2_max;
+	double feat_size, minkowski_area;
+	double value = 0.0;
+
+	if ( geomstats1->xmax <= geomstats1->xmin || geomstats1->ymax <= geomstats1->ymin ||
+	     geomstats2->xmax <= geomstats2->xmin || geomstats2->ymax <= geomstats2->ymin ||
+	     geomstats1->avgFeatureCells <= 0 || geomstats2->avgFeatureCells <= 0 )
+	{
+		POSTGIS_DEBUG(3, " degenerate histogram, no cell by cell estimate");
+		return -1.0;
+	}
+
+	/* Nothing outside the common extent can match */
+	if ( ! calculate_column_intersection(&search_box, geomstats1, geomstats2, distance) )
+	{
+		POSTGIS_DEBUG(3, " histogram extents do not overlap");
+		return 0.0;
+	}
+
+	/* Features are taken as squares of the average box area */
+	feat_size = sqrt(geomstats1->avgFeatureArea) + sqrt(geomstats2->avgFeatureArea) + 2 * distance;
+	minkowski_area = feat_size * feat_size;
+
+	x1_min = geom_histo_col(histo1, search_box.xmin);
+	x1_max = geom_histo_col(histo1, search_box.xmax);
+	y1_min = geom_histo_row(histo1, search_box.ymin);
+	y1_max = geom_histo_row(histo1, search_box.ymax);
+
+	POSTGIS_DEBUGF(3, " first histogram cells %d-%d, %d-%d of the common extent", x1_min, x1_max, y1_min, y1_max);
+
+	for (y1 = y1_min; y1 <= y1_max; y1++)
+	{
+		double cy_min = geom_histo_yedge(histo1, y1);
+		double cy_max = geom_histo_yedge(histo1, y1 + 1);
+
+		y2_min = geom_histo_row(histo2, cy_min);
+		y2_max = geom_histo_row(histo2, cy_max);
+
+		for (x1 = x1_min; x1 <= x1_max; x1++)
+		{
+			double cx_min = geom_histo_xedge(histo1, x1);
+			double cx_max = geom_histo_xedge(histo1, x1 + 1);
+			double val1 = geomstats1->value[x1 + y1 * histo1->cols];
+			double val2 = 0.0;
+
+			if ( val1 <= 0 ) continue;
+
+			x2_min = geom_histo_col(histo2, cx_min);
+			x2_max = geom_histo_col(histo2, cx_max);
+
+			/* Share of the second column inside this cell */
+			for (y2 = y2_min; y2 <= y2_max; y2++)
+			{
+				double c2y_min = geom_histo_yedge(histo2, y2);
+				double c2y_max = geom_histo_yedge(histo2, y2 + 1);
+				double oy = LW_MIN(cy_max, c2y_max) - LW_MAX(cy_min, c2y_min);
+				if ( oy <= 0 ) continue;
+
+				for (x2 = x2_min; x2 <= x2_max; x2++)
+				{
+					double c2x_min = geom_histo_xedge(histo2, x2);
+					double c2x_max = geom_histo_xedge(histo2, x2 + 1);
+					double ox = LW_MIN(cx_max, c2x_max) - LW_MAX(cx_min, c2x_min);
+					if ( ox <= 0 ) continue;
+
+					val2 += geomstats2->value[x2 + y2 * histo2->cols] *
+					        (ox * oy) / ((c2x_max - c2x_min) * (c2y_max - c2y_min));
+				}
+			}
+
+			/* Density of co-located pairs over the cell area */
+			value += val1 * val2 / ((cx_max - cx_min) * (cy_max - cy_min));
+		}
+	}
+
+	/* Shares rather than cell touches, then the feature size correction */
+	value /= geomstats1->avgFeatureCells * geomstats2->avgFeatureCells;
+	value *= minkowski_area;
+
+	POSTGIS_DEBUGF(3, " cell by cell join selectivity: %.15g", value);
+
+	if ( value > 1.0 ) value = 1.0;
+	else if ( value < 0.0 ) value = 0.0;
+
+	return value;
+}
+
 /**
 * JOIN selectivity in the GiST && operator
 * for all PG versions
@@ -183,13 +475,17 @@ Datum LWGEOM_gist_joinsel(PG_FUNCTION_ARGS)
 	float8 selectivity1 = 0.0, selectivity2 = 0.0;
 	float4 num1_tuples = 0.0, num2_tuples = 0.0;
 	float4 total_tuples = 0.0, rows_returned = 0.0;
+	float8 join_selectivity;
+	GEOM_HISTO histo1, histo2;
 	BOX2DFLOAT4 search_box;
+	double distance = 0.0;
 
 
 	/**
-	* Join selectivity algorithm. To calculation the selectivity we
-	* calculate the intersection of the two column sample extents,
-	* sum the results, and then multiply by two since for each
+	* Join selectivity algorithm. The two histograms are combined cell
+	* by cell, see estimate_join_selectivity(). If either histogram is
+	* degenerate we calculate the intersection of the two column sample
+	* extents, sum the results, and then multiply by two since for each
 	* geometry in col 1 that intersects a geometry in col 2, the same
 	* will also be true.
 	*/
@@ -212,6 +508,12 @@ Datum LWGEOM_gist_joinsel(PG_FUNCTION_ARGS)
 	arg1 = (Node *) linitial(args);
 	arg2 = (Node *) lsecond(args);
 
+	/* Radius joins expand one of the columns */
+	if ( IsA(arg1, Var) && estimate_expanded_var(arg2, geometry_expand_names, &var2, &distance) )
+		arg2 = (Node *) var2;
+	else if ( IsA(arg2, Var) && estimate_expanded_var(arg1, geometry_expand_names, &var1, &distance) )
+		arg1 = (Node *) var1;
+
 	if (!IsA(arg1, Var) || !IsA(arg2, Var))
 	{
 		elog(DEBUG1, "LWGEOM_gist_joinsel called with arguments that are not column references");
@@ -279,11 +581,31 @@ Datum LWGEOM_gist_joinsel(PG_FUNCTION_ARGS)
 	}
 
 
+	geom_histo_init(&histo1, geomstats1, geomstats1_nvalues);
+	geom_histo_init(&histo2, geomstats2, geomstats2_nvalues);
+
+	join_selectivity = estimate_join_selectivity(&histo1, &histo2, distance);
+	if ( join_selectivity >= 0.0 )
+	{
+		/* Null geometries never match */
+		join_selectivity *= 1.0 - ((Form_pg_statistic) GETSTRUCT(stats1_tuple))->stanullfrac;
+		join_selectivity *= 1.0 - ((Form_pg_statistic) GETSTRUCT(stats2_tuple))->stanullfrac;
+
+		free_attstatsslot(0, NULL, 0, (float *)geomstats1, geomstats1_nvalues);
+		ReleaseSysCache(stats1_tuple);
+		free_attstatsslot(0, NULL, 0, (float *)geomstats2, geomstats2_nvalues);
+		ReleaseSysCache(stats2_tuple);
+
+		POSTGIS_DEBUGF(3, "Estimated join selectivity: %.15g", join_selectivity);
+
+		PG_RETURN_FLOAT8(join_selectivity);
+	}
+
 	/**
 	* Setup the search box - this is the intersection of the two column
 	* extents.
 	*/
-	calculate_column_intersection(&search_box, geomstats1, geomstats2);
+	calculate_column_intersection(&search_box, geomstats1, geomstats2, distance);
 
 	POSTGIS_DEBUGF(3, " -- geomstats1 box: %.15g %.15g, %.15g %.15g",geomstats1->xmin,geomstats1->ymin,geomstats1->xmax,geomstats1->ymax);
 	POSTGIS_DEBUGF(3, " -- geomstats2 box: %.15g %.15g, %.15g %.15g",geomstats2->xmin,geomstats2->ymin,geomstats2->xmax,geomstats2->ymax);
@@ -291,8 +613,8 @@ Datum LWGEOM_gist_joinsel(PG_FUNCTION_ARGS)
 
 
 	/* Do the selectivity */
-	selectivity1 = estimate_selectivity(&search_box, geomstats1);
-	selectivity2 = estimate_selectivity(&search_box, geomstats2);
+	selectivity1 = estimate_selectivity(&search_box, &histo1);
+	selectivity2 = estimate_selectivity(&search_box, &histo2);
 
 	POSTGIS_DEBUGF(3, "selectivity1: %.15g   selectivity2: %.15g", selectivity1, selectivity2);
 
@@ -389,13 +711,13 @@ Datum LWGEOM_gist_joinsel(PG_FUNCTION_ARGS)
 * dimensions)
 */
 static float8
-estimate_selectivity(BOX2DFLOAT4 *box, GEOM_STATS *geomstats)
+estimate_selectivity(BOX2DFLOAT4 *box, GEOM_HISTO *histo)
 {
+	GEOM_STATS *geomstats = histo->stats;
 	int x, y;
 	int x_idx_min, x_idx_max, y_idx_min, y_idx_max;
 	double intersect_x, intersect_y, AOI;
-	double cell_area, box_area;
-	double geow, geoh; /* width and height of histogram */
+	double cell_area;
 	int histocols, historows; /* histogram grid size */
 	double value;
 	float overlapping_cells;
@@ -430,78 +752,24 @@ estimate_selectivity(BOX2DFLOAT4 *box, GEOM_STATS *geomstats)
 		return 1.0;
 	}
 
-	geow = geomstats->xmax-geomstats->xmin;
-	geoh = geomstats->ymax-geomstats->ymin;
-
-	histocols = geomstats->cols;
-	historows = geomstats->rows;
+	histocols = histo->cols;
+	historows = histo->rows;
 
-	POSTGIS_DEBUGF(3, " histogram has %d cols, %d rows", histocols, historows);
-	POSTGIS_DEBUGF(3, " histogram geosize is %fx%f", geow, geoh);
+	POSTGIS_DEBUGF(3, " histogram has %d cols, %d rows%s", histocols, historows,
+	               histo->xedges ? " (adaptive)" : "");
+	POSTGIS_DEBUGF(3, " histogram geosize is %fx%f",
+	               geomstats->xmax-geomstats->xmin, geomstats->ymax-geomstats->ymin);
 
-	cell_area = (geow*geoh) / (histocols*historows);
-	box_area = (box->xmax-box->xmin)*(box->ymax-box->ymin);
 	value = 0;
 
-	/* Find first overlapping column */
-	x_idx_min = (box->xmin-geomstats->xmin) / geow * histocols;
-	if (x_idx_min < 0)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d columns on the left of histogram grid", -x_idx_min);
-
-		/* should increment the value somehow */
-		x_idx_min = 0;
-	}
-	if (x_idx_min >= histocols)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d columns on the right of histogram grid", x_idx_min-histocols+1);
-
-		/* should increment the value somehow */
-		x_idx_min = histocols-1;
-	}
-
-	/* Find first overlapping row */
-	y_idx_min = (box->ymin-geomstats->ymin) / geoh * historows;
-	if (y_idx_min <0)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d columns on the bottom of histogram grid", -y_idx_min);
-
-		/* should increment the value somehow */
-		y_idx_min = 0;
-	}
-	if (y_idx_min >= historows)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d columns on the top of histogram grid", y_idx_min-historows+1);
-
-		/* should increment the value somehow */
-		y_idx_min = historows-1;
-	}
-
-	/* Find last overlapping column */
-	x_idx_max = (box->xmax-geomstats->xmin) / geow * histocols;
-	if (x_idx_max <0)
-	{
-		/* should increment the value somehow */
-		x_idx_max = 0;
-	}
-	if (x_idx_max >= histocols )
-	{
-		/* should increment the value somehow */
-		x_idx_max = histocols-1;
-	}
-
-	/* Find last overlapping row */
-	y_idx_max = (box->ymax-geomstats->ymin) / geoh * historows;
-	if (y_idx_max <0)
-	{
-		/* should increment the value somehow */
-		y_idx_max = 0;
-	}
-	if (y_idx_max >= historows)
-	{
-		/* should increment the value somehow */
-		y_idx_max = historows-1;
-	}
+	/*
+	 * Find first and last overlapping columns and rows,
+	 * clamped to the histogram grid
+	 */
+	x_idx_min = geom_histo_col(histo, box->xmin);
+	x_idx_max = geom_histo_col(histo, box->xmax);
+	y_idx_min = geom_histo_row(histo, box->ymin);
+	y_idx_max = geom_histo_row(histo, box->ymax);
 
 	/*
 	 * the {x,y}_idx_{min,max}
@@ -509,8 +777,13 @@ estimate_selectivity(BOX2DFLOAT4 *box, GEOM_STATS *geomstats)
 	 */
 	for (y=y_idx_min; y<=y_idx_max; y++)
 	{
+		double cy_min = geom_histo_yedge(histo, y);
+		double cy_max = geom_histo_yedge(histo, y+1);
+
 		for (x=x_idx_min; x<=x_idx_max; x++)
 		{
+			double cx_min = geom_histo_xedge(histo, x);
+			double cx_max = geom_histo_xedge(histo, x+1);
 			double val;
 			double gain;
 
@@ -519,13 +792,16 @@ estimate_selectivity(BOX2DFLOAT4 *box, GEOM_STATS *geomstats)
 			/*
 			 * Of the cell value we get
 			 * only the overlap fraction.
+			 * Cells of adaptive histograms
+			 * differ in size.
 			 */
 
-			intersect_x = LW_MIN(box->xmax, geomstats->xmin + (x+1) * geow / histocols) - LW_MAX(box->xmin, geomstats->xmin + x * geow / histocols );
-			intersect_y = LW_MIN(box->ymax, geomstats->ymin + (y+1) * geoh / historows) - LW_MAX(box->ymin, geomstats->ymin+ y * geoh / historows) ;
+			intersect_x = LW_MIN(box->xmax, cx_max) - LW_MAX(box->xmin, cx_min);
+			intersect_y = LW_MIN(box->ymax, cy_max) - LW_MAX(box->ymin, cy_min);
+			cell_area = (cx_max - cx_min) * (cy_max - cy_min);
 
 			AOI = intersect_x*intersect_y;
-			gain = AOI/cell_area;
+			gain = cell_area > 0 ? AOI/cell_area : 1.0;
 
 			POSTGIS_DEBUGF(4, " [%d,%d] cell val %.15f",
 			               x, y, val);
@@ -638,10 +914,12 @@ Datum LWGEOM_gist_sel(PG_FUNCTION_ARGS)
 	 */
 	GEOM_STATS **gsptr=&geomstats;
 	int geomstats_nvalues=0;
+	GEOM_HISTO histo;
 	Node *other;
 	Var *self;
 	uchar *in;
 	BOX2DFLOAT4 search_box;
+	double distance = 0.0;
 	float8 selectivity=0;
 
 	POSTGIS_DEBUG(2, "LWGEOM_gist_sel called");
@@ -676,6 +954,12 @@ Datum LWGEOM_gist_sel(PG_FUNCTION_ARGS)
 		PG_RETURN_FLOAT8(DEFAULT_GEOMETRY_SEL);
 	}
 
+	/*
+	 * Radius searches expand the column rather than
+	 * the constant, see estimate_expanded_var()
+	 */
+	estimate_expanded_var((Node *)self, geometry_expand_names, &self, &distance);
+
 	/*
 	 * We are working on two constants..
 	 * TODO: check if expression is true,
@@ -701,6 +985,12 @@ Datum LWGEOM_gist_sel(PG_FUNCTION_ARGS)
 		PG_RETURN_FLOAT8(0.0);
 	}
 
+	/* Buffer the search box by the expansion distance */
+	search_box.xmin -= distance;
+	search_box.ymin -= distance;
+	search_box.xmax += distance;
+	search_box.ymax += distance;
+
 	POSTGIS_DEBUGF(4, " requested search box is : %.15g %.15g, %.15g %.15g",search_box.xmin,search_box.ymin,search_box.xmax,search_box.ymax);
 
 	/*
@@ -744,7 +1034,8 @@ Datum LWGEOM_gist_sel(PG_FUNCTION_ARGS)
 	/*
 	 * Do the estimation
 	 */
-	selectivity = estimate_selectivity(&search_box, geomstats);
+	geom_histo_init(&histo, geomstats, geomstats_nvalues);
+	selectivity = estimate_selectivity(&search_box, &histo);
 
 
 	POSTGIS_DEBUGF(3, " returning computed value: %f", selectivity);
@@ -802,6 +1093,11 @@ compute_geometry_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 	int histocells;
 	int cols, rows; /* histogram grid size */
 	BOX2DFLOAT4 histobox;
+	GEOM_HISTO histo;
+#if USE_ADAPTIVE_HISTOGRAM
+	double *centers;
+	float4 *xedges, *yedges;
+#endif
 
 	/*
 	 * This is where geometry_analyze
@@ -1078,6 +1374,14 @@ compute_geometry_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 	}
 	else
 	{
+#if USE_ADAPTIVE_HISTOGRAM
+		/*
+		 * Cell sizes follow the data, so the extent
+		 * aspect ratio tells nothing about the grid
+		 */
+		cols = ceil(sqrt((double)histocells));
+		rows = cols;
+#else
 		if ( geow<geoh)
 		{
 			cols = ceil(sqrt((double)histocells*(geow/geoh)));
@@ -1088,9 +1392,33 @@ compute_geometry_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 			rows = ceil(sqrt((double)histocells*(geoh/geow)));
 			cols = ceil((double)histocells/rows);
 		}
+#endif
 		histocells = cols*rows;
 	}
 
+#if USE_ADAPTIVE_HISTOGRAM
+	/*
+	 * Place the cell edges at the quantiles
+	 * of the sample feature centers
+	 */
+	centers = palloc(sizeof(double)*notnull_cnt);
+	xedges = palloc(sizeof(float4)*(cols+1));
+	yedges = palloc(sizeof(float4)*(rows+1));
+
+	for (i=0; i<notnull_cnt; i++)
+		centers[i] = ((double)sampleboxes[i]->xmin + sampleboxes[i]->xmax) / 2.0;
+	cols = geom_histo_quantile_edges(xedges, cols, centers, notnull_cnt,
+	                                 histobox.xmin, histobox.xmax);
+
+	for (i=0; i<notnull_cnt; i++)
+		centers[i] = ((double)sampleboxes[i]->ymin + sampleboxes[i]->ymax) / 2.0;
+	rows = geom_histo_quantile_edges(yedges, rows, centers, notnull_cnt,
+	                                 histobox.ymin, histobox.ymax);
+
+	pfree(centers);
+	histocells = cols*rows;
+#endif
+
 	POSTGIS_DEBUGF(3, " computed histogram grid size (CxR): %dx%d (%d cells)", cols, rows, histocells);
 
 
@@ -1099,6 +1427,10 @@ compute_geometry_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 	 */
 	old_context = MemoryContextSwitchTo(stats->anl_context);
 	geom_stats_size=sizeof(GEOM_STATS)+(histocells-1)*sizeof(float4);
+#if USE_ADAPTIVE_HISTOGRAM
+	/* Cell edges go after the values */
+	geom_stats_size += (cols+1+rows+1)*sizeof(float4);
+#endif
 	geomstats = palloc(geom_stats_size);
 	MemoryContextSwitchTo(old_context);
 
@@ -1113,6 +1445,15 @@ compute_geometry_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 	/* Initialize all values to 0 */
 	for (i=0; i<histocells; i++) geomstats->value[i] = 0;
 
+#if USE_ADAPTIVE_HISTOGRAM
+	memcpy(geomstats->value + histocells, xedges, sizeof(float4)*(cols+1));
+	memcpy(geomstats->value + histocells + cols+1, yedges, sizeof(float4)*(rows+1));
+	pfree(xedges);
+	pfree(yedges);
+#endif
+
+	geom_histo_init(&histo, geomstats, geom_stats_size/sizeof(float4));
+
 	cell_width = geow/cols;
 	cell_height = geoh/rows;
 	cell_area = cell_width*cell_height;
@@ -1148,25 +1489,11 @@ compute_geometry_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 		               i, box->xmax, box->ymax,
 		               box->xmin, box->ymin);
 
-		/* Find first overlapping column */
-		x_idx_min = (box->xmin-geomstats->xmin) / geow * cols;
-		if (x_idx_min <0) x_idx_min = 0;
-		if (x_idx_min >= cols) x_idx_min = cols-1;
-
-		/* Find first overlapping row */
-		y_idx_min = (box->ymin-geomstats->ymin) / geoh * rows;
-		if (y_idx_min <0) y_idx_min = 0;
-		if (y_idx_min >= rows) y_idx_min = rows-1;
-
-		/* Find last overlapping column */
-		x_idx_max = (box->xmax-geomstats->xmin) / geow * cols;
-		if (x_idx_max <0) x_idx_max = 0;
-		if (x_idx_max >= cols ) x_idx_max = cols-1;
-
-		/* Find last overlapping row */
-		y_idx_max = (box->ymax-geomstats->ymin) / geoh * rows;
-		if (y_idx_max <0) y_idx_max = 0;
-		if (y_idx_max >= rows) y_idx_max = rows-1;
+		/* Find first and last overlapping columns and rows */
+		x_idx_min = geom_histo_col(&histo, box->xmin);
+		y_idx_min = geom_histo_row(&histo, box->ymin);
+		x_idx_max = geom_histo_col(&histo, box->xmax);
+		y_idx_max = geom_histo_row(&histo, box->ymax);
 
 		POSTGIS_DEBUGF(4, " feat %d overlaps columns %d-%d, rows %d-%d",
 		               i, x_idx_min, x_idx_max, y_idx_min, y_idx_max);
@@ -1517,6 +1844,218 @@ Datum LWGEOM_estimated_extent(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(box);
 }
 
+/**
+ * Return the extent of the given geometry column by unioning the keys
+ * found on the root page of a GiST index (gist_geometry_ops) built on
+ * it. No heap pages and no statistics are read, so the cost does not
+ * depend on the table size and the result is never stale.
+ *
+ * Every key on the root page covers the whole subtree beneath it, so
+ * the union covers all the indexed rows. GiST keys are rounded
+ * outwards to float4 and are not shrunk when rows are deleted, so the
+ * result can be slightly larger than ST_Extent until the index is
+ * rebuilt. Partial indexes are ignored as they do not cover every row.
+ *
+ * Returns NULL if the index is empty and errors out if the column has
+ * no usable index.
+ */
+PG_FUNCTION_INFO_V1(LWGEOM_index_extent);
+Datum LWGEOM_index_extent(PG_FUNCTION_ARGS)
+{
+	text *txnsp = NULL;
+	text *txtbl = NULL;
+	text *txcol = NULL;
+	char *nsp = NULL;
+	char *tbl = NULL;
+	char *col = NULL;
+	char *query;
+	int SPIcode;
+	SPITupleTable *tuptable;
+	TupleDesc tupdesc ;
+	HeapTuple tuple ;
+	bool isnull;
+	size_t querysize;
+	Oid idxoid;
+	Relation idxrel;
+	Buffer buffer;
+	Page page;
+	OffsetNumber offset, maxoffset;
+	BOX2DFLOAT4 *box = NULL;
+
+	if ( PG_NARGS() == 3 )
+	{
+		txnsp = PG_GETARG_TEXT_P(0);
+		txtbl = PG_GETARG_TEXT_P(1);
+		txcol = PG_GETARG_TEXT_P(2);
+	}
+	else if ( PG_NARGS() == 2 )
+	{
+		txtbl = PG_GETARG_TEXT_P(0);
+		txcol = PG_GETARG_TEXT_P(1);
+	}
+	else
+	{
+		elog(ERROR, "index_extent() called with wrong number of arguments");
+		PG_RETURN_NULL();
+	}
+
+	POSTGIS_DEBUG(2, "LWGEOM_index_extent called");
+
+	/* Connect to SPI manager */
+	SPIcode = SPI_connect();
+	if (SPIcode != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "LWGEOM_index_extent: couldnt open a connection to SPI");
+		PG_RETURN_NULL() ;
+	}
+
+	querysize = VARSIZE(txtbl)+VARSIZE(txcol)+640;
+
+	if ( txnsp )
+	{
+		nsp = palloc(VARSIZE(txnsp)+1);
+		memcpy(nsp, VARDATA(txnsp), VARSIZE(txnsp)-VARHDRSZ);
+		nsp[VARSIZE(txnsp)-VARHDRSZ]='\0';
+		querysize += VARSIZE(txnsp);
+	}
+	else
+	{
+		querysize += 32; /* current_schema() */
+	}
+
+	tbl = palloc(VARSIZE(txtbl)+1);
+	memcpy(tbl, VARDATA(txtbl), VARSIZE(txtbl)-VARHDRSZ);
+	tbl[VARSIZE(txtbl)-VARHDRSZ]='\0';
+
+	col = palloc(VARSIZE(txcol)+1);
+	memcpy(col, VARDATA(txcol), VARSIZE(txcol)-VARHDRSZ);
+	col[VARSIZE(txcol)-VARHDRSZ]='\0';
+
+	query = palloc(querysize);
+
+	/* The index keys give away the extent of the data: check the caller may read the table */
+	if ( txnsp )
+	{
+		sprintf(query, "SELECT has_table_privilege((SELECT usesysid FROM pg_user WHERE usename = session_user), '%s.%s', 'select')", nsp, tbl);
+	}
+	else
+	{
+		sprintf(query, "SELECT has_table_privilege((SELECT usesysid FROM pg_user WHERE usename = session_user), '%s', 'select')", tbl);
+	}
+
+	POSTGIS_DEBUGF(4, "permission check sql query is: %s", query);
+
+	SPIcode = SPI_exec(query, 1);
+	if (SPIcode != SPI_OK_SELECT)
+	{
+		SPI_finish();
+		elog(ERROR, "LWGEOM_index_extent: couldn't execute permission check sql via SPI");
+		PG_RETURN_NULL();
+	}
+
+	tuptable = SPI_tuptable;
+	tupdesc = SPI_tuptable->tupdesc;
+	tuple = tuptable->vals[0];
+
+	if (!DatumGetBool(SPI_getbinval(tuple, tupdesc, 1, &isnull)))
+	{
+		SPI_finish();
+		elog(ERROR, "LWGEOM_index_extent: permission denied for relation %s", tbl);
+		PG_RETURN_NULL();
+	}
+
+	/* Look for a valid, non partial, single column box2d keyed GiST index on the column */
+	sprintf(query, "SELECT i.indexrelid FROM pg_index i, pg_class c, pg_attribute a, pg_namespace n, pg_opclass o WHERE c.relname = '%s' AND a.attrelid = c.oid AND a.attname = '%s' AND n.nspname = %s%s%s AND c.relnamespace = n.oid AND i.indrelid = c.oid AND i.indnatts = 1 AND i.indkey[0] = a.attnum AND i.indisvalid AND i.indpred IS NULL AND o.oid = i.indclass[0] AND o.opcname = 'gist_geometry_ops' ORDER BY i.indexrelid LIMIT 1",
+	        tbl, col, txnsp ? "'" : "", txnsp ? nsp : "current_schema()", txnsp ? "'" : "");
+
+	POSTGIS_DEBUGF(4, " query: %s", query);
+
+	SPIcode = SPI_exec(query, 1);
+	if (SPIcode != SPI_OK_SELECT )
+	{
+		SPI_finish();
+		elog(ERROR,"LWGEOM_index_extent: couldnt execute sql via SPI");
+		PG_RETURN_NULL();
+	}
+	if (SPI_processed != 1)
+	{
+		SPI_finish();
+		elog(ERROR, "LWGEOM_index_extent: couldn't locate a gist_geometry_ops index on %s.%s", tbl, col);
+		PG_RETURN_NULL() ;
+	}
+
+	tuptable = SPI_tuptable;
+	tupdesc = SPI_tuptable->tupdesc;
+	tuple = tuptable->vals[0];
+	idxoid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+
+	SPIcode = SPI_finish();
+	if (SPIcode != SPI_OK_FINISH )
+	{
+		elog(ERROR, "LWGEOM_index_extent: couldnt disconnect from SPI");
+	}
+
+	POSTGIS_DEBUGF(3, " reading root page of index %u", idxoid);
+
+	idxrel = index_open(idxoid, AccessShareLock);
+	buffer = ReadBuffer(idxrel, GIST_ROOT_BLKNO);
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buffer);
+
+	maxoffset = PageGetMaxOffsetNumber(page);
+	for (offset = FirstOffsetNumber; offset <= maxoffset; offset = OffsetNumberNext(offset))
+	{
+		ItemId iid = PageGetItemId(page, offset);
+		IndexTuple itup;
+		BOX2DFLOAT4 *key;
+		Datum datum;
+
+		/* A leaf root can still hold killed tuples */
+		if ( ItemIdIsDead(iid) )
+			continue;
+
+		itup = (IndexTuple) PageGetItem(page, iid);
+		datum = index_getattr(itup, 1, RelationGetDescr(idxrel), &isnull);
+		if ( isnull || ! DatumGetPointer(datum) )
+			continue;
+
+		key = (BOX2DFLOAT4 *) DatumGetPointer(datum);
+		if ( ! finite(key->xmin) || ! finite(key->ymin) ||
+		        ! finite(key->xmax) || ! finite(key->ymax) )
+			continue;
+
+		POSTGIS_DEBUGF(4, " root key %d: %g %g, %g %g", offset, key->xmin,
+		               key->ymin, key->xmax, key->ymax);
+
+		if ( ! box )
+		{
+			box = palloc(sizeof(BOX2DFLOAT4));
+			memcpy(box, key, sizeof(BOX2DFLOAT4));
+		}
+		else
+		{
+			box->xmin = LW_MIN(box->xmin, key->xmin);
+			box->ymin = LW_MIN(box->ymin, key->ymin);
+			box->xmax = LW_MAX(box->xmax, key->xmax);
+			box->ymax = LW_MAX(box->ymax, key->ymax);
+		}
+	}
+
+	UnlockReleaseBuffer(buffer);
+	index_close(idxrel, AccessShareLock);
+
+	if ( ! box )
+	{
+		POSTGIS_DEBUG(3, " index is empty");
+		PG_RETURN_NULL();
+	}
+
+	POSTGIS_DEBUGF(3, " index extent = %g %g, %g %g", box->xmin,
+	               box->ymin, box->xmax, box->ymax);
+
+	PG_RETURN_POINTER(box);
+}
+
 
 
 
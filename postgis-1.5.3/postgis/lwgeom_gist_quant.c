@@ -0,0 +1,486 @@
+/**********************************************************************
+ * $Id$
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+/**
+ * @file GiST opclass for geometry with quantized 2D keys.
+ *
+ * Each key is the float bounding box snapped onto a 65535 x 65535 grid
+ * laid over an extent given as opclass options, and packed into a
+ * single int8. That is half the size of a BOX2DFLOAT4 key, which is
+ * what the index tuples are made of for point-heavy tables.
+ *
+ * Minimums are rounded down and maximums up, and anything beyond the
+ * extent is clamped onto its edge cells. Since this mapping is monotone
+ * the query box is quantized the same way and all the tests run on the
+ * grid codes: whenever the real boxes satisfy a predicate, so do the
+ * codes. The index is therefore lossy, never wrong, and the consistent
+ * function asks for a recheck.
+ *
+ * Opclass options need PostgreSQL 13 or later.
+ */
+
+#include "postgres.h"
+#include "access/gist.h"
+#include "access/itup.h"
+#include "access/skey.h"
+#include "fmgr.h"
+
+#include "../postgis_config.h"
+#include "liblwgeom.h"
+#include "lwgeom_pg.h"
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+
+#if POSTGIS_PGSQL_VERSION >= 130
+
+#include "access/reloptions.h"
+
+Datum LWGEOM_gist_q_options(PG_FUNCTION_ARGS);
+Datum LWGEOM_gist_q_compress(PG_FUNCTION_ARGS);
+Datum LWGEOM_gist_q_consistent(PG_FUNCTION_ARGS);
+Datum LWGEOM_gist_q_union(PG_FUNCTION_ARGS);
+Datum LWGEOM_gist_q_penalty(PG_FUNCTION_ARGS);
+Datum LWGEOM_gist_q_picksplit(PG_FUNCTION_ARGS);
+Datum LWGEOM_gist_q_same(PG_FUNCTION_ARGS);
+
+/* Split planning is borrowed from the BOX2DFLOAT4 opclass */
+Datum LWGEOM_gist_picksplit(PG_FUNCTION_ARGS);
+
+/** GiST strategies (see lwgeom_gist.c) */
+#define RTOverlapStrategyNumber			3
+#define RTSameStrategyNumber			6
+#define RTContainsStrategyNumber		7
+#define RTContainedByStrategyNumber		8
+
+/** Highest grid code, the grid has GIST_Q_MAXCODE cells per axis */
+#define GIST_Q_MAXCODE 65535
+
+/**
+ * Opclass options: the extent the grid is laid over. Geometries outside
+ * it are still indexed correctly, but all end up in the edge cells.
+ */
+typedef struct
+{
+	int32 vl_len_;
+	double xmin;
+	double ymin;
+	double xmax;
+	double ymax;
+}
+GistQOptions;
+
+/**
+ * A quantized key. An empty geometry gets the inverted box
+ * (GIST_Q_MAXCODE, GIST_Q_MAXCODE, 0, 0), which never overlaps a
+ * real query box and leaves unions unchanged.
+ */
+typedef struct
+{
+	uint16 xmin;
+	uint16 ymin;
+	uint16 xmax;
+	uint16 ymax;
+}
+BOX2DQ;
+
+static inline Datum
+box2dq_to_datum(const BOX2DQ *b)
+{
+	uint64 v = (uint64)b->xmin |
+	           ((uint64)b->ymin << 16) |
+	           ((uint64)b->xmax << 32) |
+	           ((uint64)b->ymax << 48);
+	return Int64GetDatum((int64)v);
+}
+
+static inline void
+box2dq_from_datum(Datum d, BOX2DQ *b)
+{
+	uint64 v = (uint64)DatumGetInt64(d);
+	b->xmin = (uint16)(v & 0xFFFF);
+	b->ymin = (uint16)((v >> 16) & 0xFFFF);
+	b->xmax = (uint16)((v >> 32) & 0xFFFF);
+	b->ymax = (uint16)((v >> 48) & 0xFFFF);
+}
+
+static inline void
+box2dq_set_empty(BOX2DQ *b)
+{
+	b->xmin = b->ymin = GIST_Q_MAXCODE;
+	b->xmax = b->ymax = 0;
+}
+
+static inline bool
+box2dq_is_empty(const BOX2DQ *b)
+{
+	return b->xmin > b->xmax || b->ymin > b->ymax;
+}
+
+/*
+ * Position of v on the grid, in cells from lo. Both ends of a box use
+ * the same expression so that rounding is monotone across them.
+ */
+static inline double
+gist_q_position(double v, double lo, double hi)
+{
+	return (v - lo) * GIST_Q_MAXCODE / (hi - lo);
+}
+
+static inline uint16
+gist_q_code_down(double v, double lo, double hi)
+{
+	double t = gist_q_position(v, lo, hi);
+	if ( t <= 0.0 ) return 0;
+	if ( t >= GIST_Q_MAXCODE ) return GIST_Q_MAXCODE;
+	return (uint16)floor(t);
+}
+
+static inline uint16
+gist_q_code_up(double v, double lo, double hi)
+{
+	double t = gist_q_position(v, lo, hi);
+	if ( t <= 0.0 ) return 0;
+	if ( t >= GIST_Q_MAXCODE ) return GIST_Q_MAXCODE;
+	return (uint16)ceil(t);
+}
+
+/*
+ * Fetch the extent from the opclass options, falling back to the
+ * longitude/latitude world when the index was built without any.
+ */
+static void
+gist_q_extent(FunctionCallInfo fcinfo, GistQOptions *ext)
+{
+	if ( PG_HAS_OPCLASS_OPTIONS() )
+	{
+		memcpy(ext, PG_GET_OPCLASS_OPTIONS(), sizeof(GistQOptions));
+	}
+	else
+	{
+		ext->xmin = -180.0;
+		ext->ymin = -90.0;
+		ext->xmax = 180.0;
+		ext->ymax = 90.0;
+	}
+
+	if ( ! (ext->xmax > ext->xmin && ext->ymax > ext->ymin) )
+		elog(ERROR, "quantized GiST index extent must have xmax > xmin and ymax > ymin");
+}
+
+static void
+gist_q_quantize(BOX2DFLOAT4 *box, GistQOptions *ext, BOX2DQ *q)
+{
+	q->xmin = gist_q_code_down(box->xmin, ext->xmin, ext->xmax);
+	q->ymin = gist_q_code_down(box->ymin, ext->ymin, ext->ymax);
+	q->xmax = gist_q_code_up(box->xmax, ext->xmin, ext->xmax);
+	q->ymax = gist_q_code_up(box->ymax, ext->ymin, ext->ymax);
+}
+
+/*
+ * Read the float box of a geometry datum, detoasting only the header
+ * when the box is cached. Returns false for empty or non-finite boxes.
+ */
+static bool
+gist_q_datum_box(Datum d, BOX2DFLOAT4 *box)
+{
+	PG_LWGEOM *geom;
+	uchar *serialized;
+
+	geom = (PG_LWGEOM*)PG_DETOAST_DATUM_SLICE(d, 0, VARHDRSZ + 1 + sizeof(BOX2DFLOAT4));
+	serialized = SERIALIZED_FORM(geom);
+
+	if ( lwgeom_hasBBOX(serialized[0]) )
+	{
+		memcpy(box, serialized + 1, sizeof(BOX2DFLOAT4));
+	}
+	else
+	{
+		geom = (PG_LWGEOM*)PG_DETOAST_DATUM(d);
+		if ( ! getbox2d_p(SERIALIZED_FORM(geom), box) )
+			return false;
+	}
+
+	return finite(box->xmin) && finite(box->ymin) &&
+	       finite(box->xmax) && finite(box->ymax);
+}
+
+static inline bool
+box2dq_overlaps(const BOX2DQ *a, const BOX2DQ *b)
+{
+	return a->xmin <= b->xmax && b->xmin <= a->xmax &&
+	       a->ymin <= b->ymax && b->ymin <= a->ymax;
+}
+
+static inline bool
+box2dq_contains(const BOX2DQ *a, const BOX2DQ *b)
+{
+	return a->xmin <= b->xmin && a->xmax >= b->xmax &&
+	       a->ymin <= b->ymin && a->ymax >= b->ymax;
+}
+
+static inline bool
+box2dq_equals(const BOX2DQ *a, const BOX2DQ *b)
+{
+	return a->xmin == b->xmin && a->xmax == b->xmax &&
+	       a->ymin == b->ymin && a->ymax == b->ymax;
+}
+
+/* Area in grid cells, counting degenerate boxes as one cell wide */
+static double
+box2dq_area(const BOX2DQ *b)
+{
+	if ( box2dq_is_empty(b) )
+		return 0.0;
+	return ((double)b->xmax - b->xmin + 1.0) * ((double)b->ymax - b->ymin + 1.0);
+}
+
+static void
+box2dq_merge(BOX2DQ *b_union, const BOX2DQ *b_new)
+{
+	b_union->xmin = Min(b_union->xmin, b_new->xmin);
+	b_union->ymin = Min(b_union->ymin, b_new->ymin);
+	b_union->xmax = Max(b_union->xmax, b_new->xmax);
+	b_union->ymax = Max(b_union->ymax, b_new->ymax);
+}
+
+/**
+ * Opclass options function: declares the grid extent,
+ * e.g. USING gist (geom gist_geometry_ops_q (xmin=0, ymin=0, xmax=1e6, ymax=1e6))
+ */
+PG_FUNCTION_INFO_V1(LWGEOM_gist_q_options);
+Datum LWGEOM_gist_q_options(PG_FUNCTION_ARGS)
+{
+	local_relopts *relopts = (local_relopts *) PG_GETARG_POINTER(0);
+
+	init_local_reloptions(relopts, sizeof(GistQOptions));
+	add_local_real_reloption(relopts, "xmin", "minimum X of the quantization grid",
+	                         -180.0, -DBL_MAX, DBL_MAX, offsetof(GistQOptions, xmin));
+	add_local_real_reloption(relopts, "ymin", "minimum Y of the quantization grid",
+	                         -90.0, -DBL_MAX, DBL_MAX, offsetof(GistQOptions, ymin));
+	add_local_real_reloption(relopts, "xmax", "maximum X of the quantization grid",
+	                         180.0, -DBL_MAX, DBL_MAX, offsetof(GistQOptions, xmax));
+	add_local_real_reloption(relopts, "ymax", "maximum Y of the quantization grid",
+	                         90.0, -DBL_MAX, DBL_MAX, offsetof(GistQOptions, ymax));
+
+	PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_gist_q_compress);
+Datum LWGEOM_gist_q_compress(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY*)PG_GETARG_POINTER(0);
+	GISTENTRY *retval;
+	GistQOptions ext;
+	BOX2DFLOAT4 box;
+	BOX2DQ q;
+
+	POSTGIS_DEBUG(2, "GIST: LWGEOM_gist_q_compress called");
+
+	/* Internal keys are already quantized */
+	if ( ! entry->leafkey )
+		PG_RETURN_POINTER(entry);
+
+	retval = palloc(sizeof(GISTENTRY));
+
+	if ( DatumGetPointer(entry->key) == NULL )
+	{
+		gistentryinit(*retval, (Datum) 0, entry->rel,
+		              entry->page, entry->offset, FALSE);
+		PG_RETURN_POINTER(retval);
+	}
+
+	gist_q_extent(fcinfo, &ext);
+
+	if ( gist_q_datum_box(entry->key, &box) )
+		gist_q_quantize(&box, &ext, &q);
+	else
+		box2dq_set_empty(&q);
+
+	POSTGIS_DEBUGF(3, "GIST: quantized key <%d %d,%d %d>", q.xmin, q.ymin, q.xmax, q.ymax);
+
+	gistentryinit(*retval, box2dq_to_datum(&q), entry->rel,
+	              entry->page, entry->offset, FALSE);
+
+	PG_RETURN_POINTER(retval);
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_gist_q_consistent);
+Datum LWGEOM_gist_q_consistent(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY*) PG_GETARG_POINTER(0);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	bool *recheck = (bool *) PG_GETARG_POINTER(4);
+	GistQOptions ext;
+	BOX2DFLOAT4 box;
+	BOX2DQ key, query;
+	bool result;
+
+	/* Keys are coarser than the geometry boxes, let the operator decide */
+	*recheck = true;
+
+	if ( DatumGetPointer(PG_GETARG_DATUM(1)) == NULL )
+		PG_RETURN_BOOL(FALSE);
+
+	if ( ! gist_q_datum_box(PG_GETARG_DATUM(1), &box) )
+		PG_RETURN_BOOL(FALSE);
+
+	gist_q_extent(fcinfo, &ext);
+	gist_q_quantize(&box, &ext, &query);
+	box2dq_from_datum(entry->key, &key);
+
+	if ( GIST_LEAF(entry) )
+	{
+		switch (strategy)
+		{
+		case RTOverlapStrategyNumber:
+			result = box2dq_overlaps(&key, &query);
+			break;
+		case RTSameStrategyNumber:
+			result = box2dq_equals(&key, &query);
+			break;
+		case RTContainsStrategyNumber:
+			result = box2dq_contains(&key, &query);
+			break;
+		case RTContainedByStrategyNumber:
+			result = box2dq_contains(&query, &key);
+			break;
+		default:
+			result = FALSE;
+		}
+	}
+	else
+	{
+		switch (strategy)
+		{
+		case RTOverlapStrategyNumber:
+		case RTContainedByStrategyNumber:
+			result = box2dq_overlaps(&key, &query);
+			break;
+		case RTSameStrategyNumber:
+		case RTContainsStrategyNumber:
+			result = box2dq_contains(&key, &query);
+			break;
+		default:
+			result = FALSE;
+		}
+	}
+
+	PG_RETURN_BOOL(result);
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_gist_q_union);
+Datum LWGEOM_gist_q_union(PG_FUNCTION_ARGS)
+{
+	GistEntryVector	*entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+	int *sizep = (int *) PG_GETARG_POINTER(1);
+	BOX2DQ box_union, box_cur;
+	int i;
+
+	box2dq_set_empty(&box_union);
+	for ( i = 0; i < entryvec->n; i++ )
+	{
+		box2dq_from_datum(entryvec->vector[i].key, &box_cur);
+		box2dq_merge(&box_union, &box_cur);
+	}
+
+	*sizep = sizeof(int64);
+
+	PG_RETURN_DATUM(box2dq_to_datum(&box_union));
+}
+
+/*
+ * Growth in grid cells of the original key once the new one is added.
+ */
+PG_FUNCTION_INFO_V1(LWGEOM_gist_q_penalty);
+Datum LWGEOM_gist_q_penalty(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *origentry = (GISTENTRY*) PG_GETARG_POINTER(0);
+	GISTENTRY *newentry = (GISTENTRY*) PG_GETARG_POINTER(1);
+	float *result = (float*) PG_GETARG_POINTER(2);
+	BOX2DQ orig, ud;
+
+	box2dq_from_datum(origentry->key, &orig);
+	box2dq_from_datum(newentry->key, &ud);
+	box2dq_merge(&ud, &orig);
+
+	*result = (float)(box2dq_area(&ud) - box2dq_area(&orig));
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Grid codes are exact in single precision, so hand the keys to the
+ * BOX2DFLOAT4 picksplit as float boxes in grid units and convert the
+ * two resulting unions back.
+ */
+PG_FUNCTION_INFO_V1(LWGEOM_gist_q_picksplit);
+Datum LWGEOM_gist_q_picksplit(PG_FUNCTION_ARGS)
+{
+	GistEntryVector	*entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+	GIST_SPLITVEC *v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
+	GistEntryVector *boxvec;
+	BOX2DFLOAT4 *boxes, *box;
+	BOX2DQ q;
+	int i;
+
+	boxvec = palloc(GEVHDRSZ + entryvec->n * sizeof(GISTENTRY));
+	boxvec->n = entryvec->n;
+	boxes = palloc(entryvec->n * sizeof(BOX2DFLOAT4));
+
+	for ( i = 0; i < entryvec->n; i++ )
+	{
+		box2dq_from_datum(entryvec->vector[i].key, &q);
+		/* Empty keys contribute nothing, place them on the grid origin */
+		if ( box2dq_is_empty(&q) )
+			q.xmin = q.ymin = q.xmax = q.ymax = 0;
+		boxes[i].xmin = q.xmin;
+		boxes[i].ymin = q.ymin;
+		boxes[i].xmax = q.xmax;
+		boxes[i].ymax = q.ymax;
+		boxvec->vector[i] = entryvec->vector[i];
+		boxvec->vector[i].key = PointerGetDatum(&boxes[i]);
+	}
+
+	DirectFunctionCall2(LWGEOM_gist_picksplit, PointerGetDatum(boxvec), PointerGetDatum(v));
+
+	box = (BOX2DFLOAT4 *) DatumGetPointer(v->spl_ldatum);
+	q.xmin = (uint16)box->xmin;
+	q.ymin = (uint16)box->ymin;
+	q.xmax = (uint16)box->xmax;
+	q.ymax = (uint16)box->ymax;
+	v->spl_ldatum = box2dq_to_datum(&q);
+
+	box = (BOX2DFLOAT4 *) DatumGetPointer(v->spl_rdatum);
+	q.xmin = (uint16)box->xmin;
+	q.ymin = (uint16)box->ymin;
+	q.xmax = (uint16)box->xmax;
+	q.ymax = (uint16)box->ymax;
+	v->spl_rdatum = box2dq_to_datum(&q);
+
+	pfree(boxes);
+	pfree(boxvec);
+
+	PG_RETURN_POINTER(v);
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_gist_q_same);
+Datum LWGEOM_gist_q_same(PG_FUNCTION_ARGS)
+{
+	bool *result = (bool *) PG_GETARG_POINTER(2);
+
+	*result = (DatumGetInt64(PG_GETARG_DATUM(0)) == DatumGetInt64(PG_GETARG_DATUM(1)));
+
+	PG_RETURN_POINTER(result);
+}
+
+#endif /* POSTGIS_PGSQL_VERSION >= 130 */
@@ -105,6 +105,9 @@ Datum geom_from_gml(PG_FUNCTION_ARGS)
 		lwerror("invalid GML representation");
 	}
 
+	/* Empty the projection cache if spatial_ref_sys has changed */
+	PROJ4SRSCacheCheckValid(fcinfo);
+
 	lwgeom = parse_gml(xmlroot, &hasz, &root_srid);
 	lwgeom->bbox = lwgeom_compute_box2d(lwgeom);
 	geom = pglwgeom_serialize(lwgeom);
@@ -329,32 +332,15 @@ static POINTARRAY* gml_reverse_axis_pa(POINTARRAY *pa)
  */
 static POINTARRAY* gml_reproject_pa(POINTARRAY *pa, int srid_in, int srid_out)
 {
-	int i;
-	POINT4D p;
 	projPJ in_pj, out_pj;
-	char *text_in, *text_out;
 
 	if (srid_in == -1 || srid_out == -1)
 		lwerror("invalid GML representation");
 
-	text_in = GetProj4StringSPI(srid_in);
-	text_out = GetProj4StringSPI(srid_out);
-
-	in_pj = make_project(text_in);
-	out_pj = make_project(text_out);
-
-	lwfree(text_in);
-	lwfree(text_out);
-
-	for (i=0 ; i < pa->npoints ; i++)
-	{
-		getPoint4d_p(pa, i, &p);
-		transform_point(&p, in_pj, out_pj);
-		setPoint4d(pa, i, &p);
-	}
+	out_pj = GetProjectionFromPROJ4SRSCache(srid_out, srid_in);
+	in_pj = GetProjectionFromPROJ4SRSCache(srid_in, srid_out);
 
-	pj_free(in_pj);
-	pj_free(out_pj);
+	transform_pointarray(pa, in_pj, out_pj);
 
 	return pa;
 }
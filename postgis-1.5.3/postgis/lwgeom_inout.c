@@ -7,16 +7,22 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <ctype.h>
 
 #include "access/gist.h"
 #include "access/itup.h"
 
 #include "fmgr.h"
 #include "utils/elog.h"
+#include "utils/array.h"
+#include "utils/builtins.h"  /* for pg_atoi */
 # include "lib/stringinfo.h" /* for binary input */
+#include "catalog/pg_type.h" /* for CSTRINGOID */
+#include "utils/lsyscache.h" /* for get_typlenbyvalalign */
 
 
 #include "liblwgeom.h"
+#include "libgeom.h"         /* for the TYPMOD_* macros */
 
 
 
@@ -36,6 +42,12 @@ Datum parse_WKT_lwgeom(PG_FUNCTION_ARGS);
 Datum LWGEOM_recv(PG_FUNCTION_ARGS);
 Datum LWGEOM_send(PG_FUNCTION_ARGS);
 Datum BOOL_to_text(PG_FUNCTION_ARGS);
+Datum geometry_typmod_in(PG_FUNCTION_ARGS);
+Datum geometry_typmod_out(PG_FUNCTION_ARGS);
+Datum geometry_enforce_typmod(PG_FUNCTION_ARGS);
+Datum geometry_typmod_srid(PG_FUNCTION_ARGS);
+Datum geometry_typmod_type(PG_FUNCTION_ARGS);
+Datum LWGEOM_collect_garray(PG_FUNCTION_ARGS);
 
 
 /*
@@ -51,7 +63,363 @@ WellKnownBinary;
 
 
 /*
- * LWGEOM_in(cstring)
+ * Names of the types a geometry typmod can hold, indexed by type
+ * number, type 0 standing for any geometry. The three unused slots
+ * are the old POINTTYPEI, LINETYPEI and POLYTYPEI.
+ */
+static const char *geometry_typmod_names[] =
+{
+	"Geometry",
+	"Point",
+	"LineString",
+	"Polygon",
+	"MultiPoint",
+	"MultiLineString",
+	"MultiPolygon",
+	"GeometryCollection",
+	"CircularString",
+	"CompoundCurve",
+	NULL,
+	NULL,
+	NULL,
+	"CurvePolygon",
+	"MultiCurve",
+	"MultiSurface"
+};
+
+#define GEOMETRY_TYPMOD_NTYPES 16
+
+/*
+ * Bytes of a serialized geometry needed to check it against a typmod:
+ * the type byte, the optional cached box and the optional SRID.
+ */
+#define GEOMETRY_TYPMOD_HEADER_SIZE (1 + sizeof(BOX2DFLOAT4) + sizeof(int32))
+
+static const char *
+geometry_typmod_typename(int type)
+{
+	if ( type < 0 || type >= GEOMETRY_TYPMOD_NTYPES || ! geometry_typmod_names[type] )
+		return "Invalid type";
+	return geometry_typmod_names[type];
+}
+
+/*
+ * Parse a type modifier such as 'Point', 'MULTIPOLYGONZ' or
+ * 'CircularStringM', case insensitively. Returns 0 on failure.
+ */
+static int
+geometry_typmod_type_from_string(const char *str, int *type, int *z, int *m)
+{
+	int i;
+
+	for (i = 0; i < GEOMETRY_TYPMOD_NTYPES; i++)
+	{
+		const char *name = geometry_typmod_names[i];
+		const char *suffix;
+
+		if ( ! name || pg_strncasecmp(str, name, strlen(name)) )
+			continue;
+
+		suffix = str + strlen(name);
+		if ( ! pg_strcasecmp(suffix, "") )
+			*z = 0, *m = 0;
+		else if ( ! pg_strcasecmp(suffix, "Z") )
+			*z = 1, *m = 0;
+		else if ( ! pg_strcasecmp(suffix, "M") )
+			*z = 0, *m = 1;
+		else if ( ! pg_strcasecmp(suffix, "ZM") )
+			*z = 1, *m = 1;
+		else
+			continue;
+
+		*type = i;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Check the SRID, type and dimensionality found in the header of a
+ * serialized geometry against a column typmod, and shut down the query
+ * if they don't match. Nothing past the SRID is looked at, so the
+ * geometry needs to be detoasted no further than
+ * GEOMETRY_TYPMOD_HEADER_SIZE bytes.
+ */
+static void
+geometry_valid_typmod(PG_LWGEOM *geom, int32 typmod)
+{
+	int32 geom_srid = pglwgeom_getSRID(geom);
+	int32 geom_type = TYPE_GETTYPE(geom->type);
+	int32 geom_z = TYPE_HASZ(geom->type);
+	int32 geom_m = TYPE_HASM(geom->type);
+	int32 typmod_srid = TYPMOD_GET_SRID(typmod);
+	int32 typmod_type = TYPMOD_GET_TYPE(typmod);
+	int32 typmod_z = TYPMOD_GET_Z(typmod);
+	int32 typmod_m = TYPMOD_GET_M(typmod);
+
+	/* No typmod (-1) => no preferences */
+	if (typmod < 0) return;
+
+	POSTGIS_DEBUGF(3, "Got geometry(type = %d, srid = %d, hasz = %d, hasm = %d)", geom_type, geom_srid, geom_z, geom_m);
+	POSTGIS_DEBUGF(3, "Got typmod(type = %d, srid = %d, hasz = %d, hasm = %d)", typmod_type, typmod_srid, typmod_z, typmod_m);
+
+	/* Typmod has a preference for SRID? They had better match. */
+	if ( typmod_srid > 0 && typmod_srid != geom_srid )
+	{
+		ereport(ERROR, (
+		            errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+		            errmsg("Geometry SRID (%d) does not match column SRID (%d)", geom_srid, typmod_srid) ));
+	}
+
+	/* Typmod has a preference for geometry type. */
+	if ( typmod_type > 0 &&
+	        /* GEOMETRYCOLLECTION column can hold any kind of collection */
+	        ((typmod_type == COLLECTIONTYPE && ! (geom_type == COLLECTIONTYPE ||
+	                                              geom_type == MULTIPOLYGONTYPE ||
+	                                              geom_type == MULTIPOINTTYPE ||
+	                                              geom_type == MULTILINETYPE )) ||
+	         /* Other types must be strictly equal. */
+	         (typmod_type != COLLECTIONTYPE && typmod_type != geom_type)) )
+	{
+		ereport(ERROR, (
+		            errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+		            errmsg("Geometry type (%s) does not match column type (%s)", geometry_typmod_typename(geom_type), geometry_typmod_typename(typmod_type)) ));
+	}
+
+	/* Mismatched Z dimensionality. */
+	if ( typmod_z && ! geom_z )
+	{
+		ereport(ERROR, (
+		            errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+		            errmsg("Column has Z dimension but geometry does not" )));
+	}
+
+	/* Mismatched Z dimensionality (other way). */
+	if ( geom_z && ! typmod_z )
+	{
+		ereport(ERROR, (
+		            errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+		            errmsg("Geometry has Z dimension but column does not" )));
+	}
+
+	/* Mismatched M dimensionality. */
+	if ( typmod_m && ! geom_m )
+	{
+		ereport(ERROR, (
+		            errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+		            errmsg("Column has M dimension but geometry does not" )));
+	}
+
+	/* Mismatched M dimensionality (other way). */
+	if ( geom_m && ! typmod_m )
+	{
+		ereport(ERROR, (
+		            errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+		            errmsg("Geometry has M dimension but column does not" )));
+	}
+}
+
+/*
+ * geometry_typmod_in(cstring[]) returns int32
+ *
+ * Accepts geometry(Type) and geometry(Type,SRID), using the same
+ * encoding as the geography typmod. Unlike geography any SRID is
+ * allowed; an SRID of -1 or 0 leaves the SRID unconstrained.
+ */
+PG_FUNCTION_INFO_V1(geometry_typmod_in);
+Datum geometry_typmod_in(PG_FUNCTION_ARGS)
+{
+	ArrayType *arr = (ArrayType *) DatumGetPointer(PG_GETARG_DATUM(0));
+	int32 typmod = 0;
+	Datum *elem_values;
+	int n = 0;
+	int i = 0;
+
+	if (ARR_ELEMTYPE(arr) != CSTRINGOID)
+		ereport(ERROR,
+		        (errcode(ERRCODE_ARRAY_ELEMENT_ERROR),
+		         errmsg("typmod array must be type cstring[]")));
+
+	if (ARR_NDIM(arr) != 1)
+		ereport(ERROR,
+		        (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+		         errmsg("typmod array must be one-dimensional")));
+
+	if (ARR_HASNULL(arr))
+		ereport(ERROR,
+		        (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+		         errmsg("typmod array must not contain nulls")));
+
+	deconstruct_array(arr,
+	                  CSTRINGOID, -2, false, 'c', /* hardwire cstring representation details */
+	                  &elem_values, NULL, &n);
+
+	if ( n > 2 )
+		ereport(ERROR,
+		        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+		         errmsg("Invalid geometry type modifier: at most a type and an SRID are accepted")));
+
+	for (i = 0; i < n; i++)
+	{
+		if ( i == 0 ) /* TYPE */
+		{
+			char *s = DatumGetCString(elem_values[i]);
+			int type = 0;
+			int z = 0;
+			int m = 0;
+
+			if ( ! geometry_typmod_type_from_string(s, &type, &z, &m) )
+			{
+				ereport(ERROR,
+				        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				         errmsg("Invalid geometry type modifier: %s", s)));
+			}
+
+			TYPMOD_SET_TYPE(typmod, type);
+			if ( z )
+				TYPMOD_SET_Z(typmod);
+			if ( m )
+				TYPMOD_SET_M(typmod);
+		}
+		if ( i == 1 ) /* SRID */
+		{
+			int srid = pg_atoi(DatumGetCString(elem_values[i]), sizeof(int32), '\0');
+
+			POSTGIS_DEBUGF(3, "srid: %d", srid);
+
+			if ( srid > SRID_MAXIMUM )
+			{
+				ereport(ERROR,
+				        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				         errmsg("SRID value may not exceed %d",
+				                SRID_MAXIMUM)));
+			}
+			if ( srid > 0 )
+				TYPMOD_SET_SRID(typmod, srid);
+		}
+	}
+
+	pfree(elem_values);
+
+	PG_RETURN_INT32(typmod);
+}
+
+/*
+ * geometry_typmod_out(int) returns cstring
+ */
+PG_FUNCTION_INFO_V1(geometry_typmod_out);
+Datum geometry_typmod_out(PG_FUNCTION_ARGS)
+{
+	char *s = (char*)palloc(64);
+	char *str = s;
+	int32 typmod = PG_GETARG_INT32(0);
+	int32 srid = TYPMOD_GET_SRID(typmod);
+	int32 type = TYPMOD_GET_TYPE(typmod);
+	int32 hasz = TYPMOD_GET_Z(typmod);
+	int32 hasm = TYPMOD_GET_M(typmod);
+
+	/*
+	 * No typmod at all? Return empty string. A typmod of 0 is
+	 * geometry(Geometry), which still only accepts 2D geometries,
+	 * so it must be printed for dump and restore to keep it.
+	 */
+	if ( typmod < 0 )
+	{
+		*str = '\0';
+		PG_RETURN_CSTRING(str);
+	}
+
+	str += sprintf(str, "(%s", geometry_typmod_typename(type));
+	if ( hasz )
+		str += sprintf(str, "Z");
+	if ( hasm )
+		str += sprintf(str, "M");
+	if ( srid )
+		str += sprintf(str, ",%d", srid);
+	str += sprintf(str, ")");
+
+	PG_RETURN_CSTRING(s);
+}
+
+/*
+ * geometry_typmod_srid(int) returns int
+ *
+ * The SRID required by a typmod, -1 if any SRID is accepted.
+ */
+PG_FUNCTION_INFO_V1(geometry_typmod_srid);
+Datum geometry_typmod_srid(PG_FUNCTION_ARGS)
+{
+	int32 typmod = PG_GETARG_INT32(0);
+
+	if ( typmod < 0 || ! TYPMOD_GET_SRID(typmod) )
+		PG_RETURN_INT32(-1);
+	PG_RETURN_INT32(TYPMOD_GET_SRID(typmod));
+}
+
+/*
+ * geometry_typmod_type(int) returns text
+ *
+ * The type required by a typmod, spelled the way geometry_columns
+ * and GeometryType() do: upper case, with a trailing M for measured
+ * types that have no Z.
+ */
+PG_FUNCTION_INFO_V1(geometry_typmod_type);
+Datum geometry_typmod_type(PG_FUNCTION_ARGS)
+{
+	int32 typmod = PG_GETARG_INT32(0);
+	char s[64];
+	char *str = s;
+	const char *name = "Geometry";
+	text *result;
+	size_t len;
+
+	if ( typmod >= 0 )
+		name = geometry_typmod_typename(TYPMOD_GET_TYPE(typmod));
+
+	while ( *name )
+		*str++ = toupper(*name++);
+	if ( typmod >= 0 && TYPMOD_GET_M(typmod) && ! TYPMOD_GET_Z(typmod) )
+		*str++ = 'M';
+	*str = '\0';
+
+	len = strlen(s);
+	result = palloc(len + VARHDRSZ);
+	SET_VARSIZE(result, len + VARHDRSZ);
+	memcpy(VARDATA(result), s, len);
+
+	PG_RETURN_TEXT_P(result);
+}
+
+/*
+ * geometry_enforce_typmod(geometry, int32, bool) returns geometry
+ *
+ * Length coercion cast applied when storing into a geometry(Type,SRID)
+ * column. Only the header of the geometry is detoasted and the input
+ * is returned untouched.
+ */
+PG_FUNCTION_INFO_V1(geometry_enforce_typmod);
+Datum geometry_enforce_typmod(PG_FUNCTION_ARGS)
+{
+	int32 typmod = PG_GETARG_INT32(1);
+	PG_LWGEOM *geom;
+
+	if ( typmod >= 0 )
+	{
+		geom = (PG_LWGEOM *) PG_DETOAST_DATUM_SLICE(PG_GETARG_DATUM(0), 0,
+		        GEOMETRY_TYPMOD_HEADER_SIZE);
+		geometry_valid_typmod(geom, typmod);
+
+		/* The header slice is a palloc'd copy, not the input itself */
+		PG_FREE_IF_COPY(geom, 0);
+	}
+
+	PG_RETURN_DATUM(PG_GETARG_DATUM(0));
+}
+
+
+/*
+ * LWGEOM_in(cstring [, oid, typmod])
  * format is '[SRID=#;]wkt|wkb'
  *  LWGEOM_in( 'SRID=99;POINT(0 0)')
  *  LWGEOM_in( 'POINT(0 0)')            --> assumes SRID=-1
@@ -83,6 +451,10 @@ Datum LWGEOM_in(PG_FUNCTION_ARGS)
 		                                       LWGEOM_addBBOX, PointerGetDatum(ret)));
 	}
 
+	/* COPY hands the column typmod to the input function */
+	if ( PG_NARGS() > 2 && ! PG_ARGISNULL(2) )
+		geometry_valid_typmod(ret, PG_GETARG_INT32(2));
+
 	PG_RETURN_POINTER(ret);
 }
 
@@ -327,6 +699,161 @@ Datum WKBFromLWGEOM(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(lwgeom_result);
 }
 
+/* Wrap a TWKB unparser result into a bytea */
+static bytea *
+twkb_to_bytea(LWGEOM_UNPARSER_RESULT *lwg_unparser_result)
+{
+	bytea *result;
+	int size_result = lwg_unparser_result->size + VARHDRSZ;
+
+	result = palloc(size_result);
+	SET_VARSIZE(result, size_result);
+	memcpy(VARDATA(result), lwg_unparser_result->wkoutput, lwg_unparser_result->size);
+	pfree(lwg_unparser_result->wkoutput);
+
+	return result;
+}
+
+/* Check the precision and read the optional size and bbox flags */
+static uchar
+twkb_variant_from_args(FunctionCallInfo fcinfo, int argno, int precision)
+{
+	uchar variant = 0;
+
+	if ( precision < -8 || precision > 7 )
+		elog(ERROR, "ST_AsTWKB: precision must be between -8 and 7, got %d", precision);
+
+	if ( PG_NARGS() > argno && PG_GETARG_BOOL(argno) )
+		variant |= TWKB_SIZE;
+	if ( PG_NARGS() > argno + 1 && PG_GETARG_BOOL(argno + 1) )
+		variant |= TWKB_BBOX;
+
+	return variant;
+}
+
+/*
+ * TWKBFromLWGEOM(lwgeom, precision, [include_size, include_bbox]) --> twkb
+ * Ordinates are rounded to <precision> decimal digits (negative
+ * values round to tens, hundreds...) and delta encoded as varints.
+ * The SRID and the cached bbox are not written.
+ */
+PG_FUNCTION_INFO_V1(TWKBFromLWGEOM);
+Datum TWKBFromLWGEOM(PG_FUNCTION_ARGS)
+{
+	LWGEOM_UNPARSER_RESULT lwg_unparser_result;
+	PG_LWGEOM *lwgeom_input;
+	int precision = PG_GETARG_INT32(1);
+	uchar variant = twkb_variant_from_args(fcinfo, 2, precision);
+	bytea *result;
+
+	lwgeom_input = (PG_LWGEOM *)PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+
+	if ( serialized_lwgeom_to_twkb(&lwg_unparser_result, SERIALIZED_FORM(lwgeom_input), PARSER_CHECK_NONE, precision, variant, NULL) )
+		PG_UNPARSER_ERROR(lwg_unparser_result);
+
+	result = twkb_to_bytea(&lwg_unparser_result);
+
+	PG_FREE_IF_COPY(lwgeom_input, 0);
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+/*
+ * TWKBFromLWGEOMArray(lwgeom[], id[], precision, [include_size, include_bbox])
+ * Collects the geometries the way ST_Collect(geometry[]) does and writes
+ * them as one TWKB MULTI* or collection, with the ids as its id list.
+ * Feed it from array_agg() to ship a whole result set in one value.
+ */
+PG_FUNCTION_INFO_V1(TWKBFromLWGEOMArray);
+Datum TWKBFromLWGEOMArray(PG_FUNCTION_ARGS)
+{
+	LWGEOM_UNPARSER_RESULT lwg_unparser_result;
+	ArrayType *geoms = PG_GETARG_ARRAYTYPE_P(0);
+	ArrayType *idarr = PG_GETARG_ARRAYTYPE_P(1);
+	int precision = PG_GETARG_INT32(2);
+	uchar variant = twkb_variant_from_args(fcinfo, 3, precision);
+	PG_LWGEOM *collected;
+	Datum *iddatums;
+	bool *idnulls;
+	int64_t *ids;
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	int ngeoms, nids, i;
+
+	ngeoms = ArrayGetNItems(ARR_NDIM(geoms), ARR_DIMS(geoms));
+	if ( ngeoms == 0 )
+		PG_RETURN_NULL();
+
+	/* Every part needs its id, so no NULLs on either side */
+	if ( ARR_HASNULL(geoms) )
+		elog(ERROR, "ST_AsTWKB: geometry array must not contain NULLs");
+
+	get_typlenbyvalalign(INT8OID, &typlen, &typbyval, &typalign);
+	deconstruct_array(idarr, INT8OID, typlen, typbyval, typalign, &iddatums, &idnulls, &nids);
+
+	if ( nids != ngeoms )
+		elog(ERROR, "ST_AsTWKB: got %d geometries but %d ids", ngeoms, nids);
+
+	ids = palloc(sizeof(int64_t) * nids);
+	for ( i = 0; i < nids; i++ )
+	{
+		if ( idnulls[i] )
+			elog(ERROR, "ST_AsTWKB: id array must not contain NULLs");
+		ids[i] = DatumGetInt64(iddatums[i]);
+	}
+
+	collected = (PG_LWGEOM *)DatumGetPointer(DirectFunctionCall1(
+	                LWGEOM_collect_garray, PointerGetDatum(geoms)));
+
+	if ( serialized_lwgeom_to_twkb(&lwg_unparser_result, SERIALIZED_FORM(collected), PARSER_CHECK_NONE, precision, variant, ids) )
+		PG_UNPARSER_ERROR(lwg_unparser_result);
+
+	pfree(ids);
+	pfree(collected);
+
+	PG_RETURN_BYTEA_P(twkb_to_bytea(&lwg_unparser_result));
+}
+
+/*
+ * LWGEOMFromTWKB(twkb, [SRID])
+ * TWKB has no SRID of its own, the optional argument sets it.
+ */
+PG_FUNCTION_INFO_V1(LWGEOMFromTWKB);
+Datum LWGEOMFromTWKB(PG_FUNCTION_ARGS)
+{
+	bytea *twkb_input = PG_GETARG_BYTEA_P(0);
+	LWGEOM_PARSER_RESULT lwg_parser_result;
+	PG_LWGEOM *lwgeom, *lwgeom2;
+
+	if ( serialized_lwgeom_from_twkb(&lwg_parser_result, (uchar *)VARDATA(twkb_input),
+	                                 VARSIZE(twkb_input) - VARHDRSZ, PARSER_CHECK_ALL) )
+	{
+		elog(ERROR, "ST_GeomFromTWKB: %s", lwg_parser_result.message);
+		PG_RETURN_NULL();
+	}
+
+	lwgeom2 = (PG_LWGEOM *)palloc(lwg_parser_result.size + VARHDRSZ);
+	SET_VARSIZE(lwgeom2, lwg_parser_result.size + VARHDRSZ);
+	memcpy(VARDATA(lwgeom2), lwg_parser_result.serialized_lwgeom, lwg_parser_result.size);
+	lwfree(lwg_parser_result.serialized_lwgeom);
+
+	if (  ( PG_NARGS()>1) && ( ! PG_ARGISNULL(1) ))
+	{
+		lwgeom = pglwgeom_setSRID(lwgeom2, PG_GETARG_INT32(1));
+		lwfree(lwgeom2);
+	}
+	else lwgeom = lwgeom2;
+
+	if ( is_worth_caching_pglwgeom_bbox(lwgeom) )
+	{
+		lwgeom = (PG_LWGEOM *)DatumGetPointer(DirectFunctionCall1(
+		                                          LWGEOM_addBBOX, PointerGetDatum(lwgeom)));
+	}
+
+	PG_RETURN_POINTER(lwgeom);
+}
+
 /* puts a bbox inside the geometry */
 PG_FUNCTION_INFO_V1(LWGEOM_addBBOX);
 Datum LWGEOM_addBBOX(PG_FUNCTION_ARGS)
@@ -554,6 +1081,10 @@ Datum LWGEOM_recv(PG_FUNCTION_ARGS)
 	/* Set cursor to the end of buffer (so the backend is happy) */
 	buf->cursor = buf->len;
 
+	/* Binary COPY hands the column typmod to the receive function */
+	if ( PG_NARGS() > 2 && ! PG_ARGISNULL(2) )
+		geometry_valid_typmod(lwgeom_result, PG_GETARG_INT32(2));
+
 	POSTGIS_DEBUG(3, "LWGEOM_recv returning");
 
 	PG_RETURN_POINTER(lwgeom_result);
@@ -1,6 +1,8 @@
 #include <postgres.h>
 #include <fmgr.h>
 #include <executor/spi.h>
+#include <catalog/pg_type.h>
+#include <utils/lsyscache.h>
 
 #include "../postgis_config.h"
 #include "liblwgeom.h"
@@ -19,6 +21,17 @@
 PG_MODULE_MAGIC;
 #endif
 
+void _PG_init(void);
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+	lwgeom_transform_init();
+}
+
 
 /*
  * Error message parsing functions
@@ -459,3 +472,51 @@ pglwgeom_getSRID(PG_LWGEOM *lwgeom)
 	return lw_get_int32(loc);
 }
 
+/**
+ * Radius searches such as ST_DWithin are inlined by the planner
+ * into <column> && expand(<column>, <distance>). If node is a call
+ * of one of the expand_names functions (a NULL terminated list) on
+ * a column with a constant distance, set var and distance and
+ * return true. Overlap of the expanded column box is then the same
+ * as overlap of the column box with the other side expanded by
+ * distance. Used by both the geometry and geography estimators.
+ */
+bool
+estimate_expanded_var(Node *node, const char **expand_names, Var **var, double *distance)
+{
+	FuncExpr *func;
+	Node *arg1, *arg2;
+	char *funcname;
+	bool is_expand = false;
+	int i;
+
+	if ( ! IsA(node, FuncExpr) ) return false;
+
+	func = (FuncExpr *)node;
+	if ( list_length(func->args) != 2 ) return false;
+
+	arg1 = (Node *) linitial(func->args);
+	arg2 = (Node *) lsecond(func->args);
+
+	/* expand(<column type>, float8) only, not the box variants */
+	if ( ! IsA(arg1, Var) || ((Var *)arg1)->vartype != func->funcresulttype )
+		return false;
+	if ( ! IsA(arg2, Const) || ((Const *)arg2)->constisnull ||
+	        ((Const *)arg2)->consttype != FLOAT8OID )
+		return false;
+
+	funcname = get_func_name(func->funcid);
+	if ( ! funcname ) return false;
+	for ( i = 0; expand_names[i] && ! is_expand; i++ )
+		is_expand = ( pg_strcasecmp(funcname, expand_names[i]) == 0 );
+	pfree(funcname);
+
+	if ( ! is_expand ) return false;
+
+	*var = (Var *)arg1;
+	*distance = DatumGetFloat8(((Const *)arg2)->constvalue);
+
+	POSTGIS_DEBUGF(3, " column expanded by a constant distance %g", *distance);
+
+	return true;
+}
@@ -4,6 +4,7 @@
 #include "postgres.h"
 #include "utils/geo_decls.h"
 #include "fmgr.h"
+#include "nodes/primnodes.h"
 
 #include "../postgis_config.h"
 
@@ -103,6 +104,12 @@ extern Oid getGeometryOID(void);
 extern void box_to_box3d_p(BOX *box, BOX3D *out);
 extern void box3d_to_box_p(BOX3D *box, BOX *out);
 
+/* Match a column expanded by a constant distance, for the selectivity estimators */
+extern bool estimate_expanded_var(Node *node, const char **expand_names, Var **var, double *distance);
+
+/* Set up the backend PROJ4 SRS cache, see lwgeom_transform.c */
+extern void lwgeom_transform_init(void);
+
 /* PG-exposed */
 Datum BOX2D_same(PG_FUNCTION_ARGS);
 Datum BOX2D_overlap(PG_FUNCTION_ARGS);
@@ -132,6 +139,9 @@ Datum LWGEOM_force_multi(PG_FUNCTION_ARGS);
 
 Datum LWGEOMFromWKB(PG_FUNCTION_ARGS);
 Datum WKBFromLWGEOM(PG_FUNCTION_ARGS);
+Datum LWGEOMFromTWKB(PG_FUNCTION_ARGS);
+Datum TWKBFromLWGEOM(PG_FUNCTION_ARGS);
+Datum TWKBFromLWGEOMArray(PG_FUNCTION_ARGS);
 
 Datum LWGEOM_getBBOX(PG_FUNCTION_ARGS);
 Datum LWGEOM_addBBOX(PG_FUNCTION_ARGS);
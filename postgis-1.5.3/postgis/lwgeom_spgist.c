@@ -0,0 +1,707 @@
+/**********************************************************************
+ * $Id$
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+/**
+ * @file SP-GiST quadtree and k-d tree support for point geometries.
+ *
+ * Leaf tuples hold the point geometry itself, inner tuples hold a
+ * centroid (quadtree) or a split coordinate (k-d tree). Navigation
+ * uses the double precision point coordinates, while the leaf tests
+ * use the same float bounding boxes as the && / @ / ~ operators so
+ * index and sequential scans always return the same rows.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "utils/geo_decls.h"
+
+#include "../postgis_config.h"
+#include "liblwgeom.h"
+#include "lwgeom_pg.h"
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+
+Datum LWGEOM_distance_centroid(PG_FUNCTION_ARGS);
+
+/*
+ * Distance between the centers of two float bounding boxes.
+ */
+static double
+pgis_box2df_center_distance(BOX2DFLOAT4 *box1, BOX2DFLOAT4 *box2)
+{
+	double dx = ((double)box1->xmin + box1->xmax - box2->xmin - box2->xmax) / 2.0;
+	double dy = ((double)box1->ymin + box1->ymax - box2->ymin - box2->ymax) / 2.0;
+
+	return sqrt(dx * dx + dy * dy);
+}
+
+/**
+ * The <-> operator: distance between the centers of the bounding
+ * boxes. For points this is the point to point distance, and it is
+ * what the SP-GiST opclasses use for nearest neighbour ordering.
+ */
+PG_FUNCTION_INFO_V1(LWGEOM_distance_centroid);
+Datum LWGEOM_distance_centroid(PG_FUNCTION_ARGS)
+{
+	PG_LWGEOM *geom1 = (PG_LWGEOM *)PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+	PG_LWGEOM *geom2 = (PG_LWGEOM *)PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
+	BOX2DFLOAT4 box1;
+	BOX2DFLOAT4 box2;
+	double distance;
+
+	errorIfSRIDMismatch(pglwgeom_getSRID(geom1), pglwgeom_getSRID(geom2));
+
+	if ( ! (getbox2d_p(SERIALIZED_FORM(geom1), &box1) && getbox2d_p(SERIALIZED_FORM(geom2), &box2)) )
+	{
+		PG_FREE_IF_COPY(geom1, 0);
+		PG_FREE_IF_COPY(geom2, 1);
+		PG_RETURN_NULL();
+	}
+
+	distance = pgis_box2df_center_distance(&box1, &box2);
+
+	PG_FREE_IF_COPY(geom1, 0);
+	PG_FREE_IF_COPY(geom2, 1);
+
+	PG_RETURN_FLOAT8(distance);
+}
+
+
+#if POSTGIS_PGSQL_VERSION >= 92
+
+#include "access/spgist.h"
+#include "access/skey.h"
+#include "catalog/pg_type.h"
+
+Datum LWGEOM_spgist_quad_config(PG_FUNCTION_ARGS);
+Datum LWGEOM_spgist_quad_choose(PG_FUNCTION_ARGS);
+Datum LWGEOM_spgist_quad_picksplit(PG_FUNCTION_ARGS);
+Datum LWGEOM_spgist_quad_inner_consistent(PG_FUNCTION_ARGS);
+Datum LWGEOM_spgist_kd_config(PG_FUNCTION_ARGS);
+Datum LWGEOM_spgist_kd_choose(PG_FUNCTION_ARGS);
+Datum LWGEOM_spgist_kd_picksplit(PG_FUNCTION_ARGS);
+Datum LWGEOM_spgist_kd_inner_consistent(PG_FUNCTION_ARGS);
+Datum LWGEOM_spgist_leaf_consistent(PG_FUNCTION_ARGS);
+
+/** Strategies shared with gist_geometry_ops */
+#define SPGOverlapStrategyNumber		3
+#define SPGContainsStrategyNumber		7
+#define SPGContainedByStrategyNumber	8
+#define SPGDistanceStrategyNumber		13
+
+/* Nearest neighbour ordering arrived with PostgreSQL 12 */
+#if POSTGIS_PGSQL_VERSION >= 120
+#define SPGIST_KNN 1
+#else
+#define SPGIST_KNN 0
+#endif
+
+
+/**
+ * Read the coordinates of a point geometry. Errors out for any
+ * other geometry type, since these opclasses index points only.
+ */
+static void
+pgis_spgist_point(Datum datum, POINT2D *pt)
+{
+	PG_LWGEOM *geom = (PG_LWGEOM *)PG_DETOAST_DATUM(datum);
+	uchar *loc = SERIALIZED_FORM(geom);
+	uchar type = loc[0];
+
+	if ( lwgeom_getType(type) != POINTTYPE )
+	{
+		elog(ERROR, "SP-GiST geometry opclasses only support POINT geometries, got %s",
+		     lwgeom_typename(lwgeom_getType(type)));
+	}
+
+	loc++;
+	if ( lwgeom_hasBBOX(type) ) loc += sizeof(BOX2DFLOAT4);
+	if ( lwgeom_hasSRID(type) ) loc += 4;
+
+	memcpy(pt, loc, sizeof(POINT2D));
+
+	if ( (Pointer) geom != DatumGetPointer(datum) ) pfree(geom);
+}
+
+/**
+ * Float bounding box of a scan key argument, as used by the
+ * operators. Returns false for empty geometries.
+ */
+static bool
+pgis_spgist_query_box(ScanKey key, BOX2DFLOAT4 *box)
+{
+	PG_LWGEOM *query = (PG_LWGEOM *)PG_DETOAST_DATUM(key->sk_argument);
+	bool result = getbox2d_p(SERIALIZED_FORM(query), box);
+
+	if ( (Pointer) query != DatumGetPointer(key->sk_argument) ) pfree(query);
+
+	return result;
+}
+
+/*
+ * A point p is stored with a float box that rounds outward, so it
+ * can satisfy a float box test against the query box when p lies
+ * up to a couple of float ulps outside it. Inner nodes are pruned
+ * against the query box widened by that much.
+ */
+static void
+pgis_spgist_widen(const BOX2DFLOAT4 *in, BOX *out)
+{
+	out->low.x = nextafterf(nextafterf(in->xmin, -FLT_MAX), -FLT_MAX);
+	out->low.y = nextafterf(nextafterf(in->ymin, -FLT_MAX), -FLT_MAX);
+	out->high.x = nextafterf(nextafterf(in->xmax, FLT_MAX), FLT_MAX);
+	out->high.y = nextafterf(nextafterf(in->ymax, FLT_MAX), FLT_MAX);
+}
+
+/**
+ * Collect the widened boxes of all the usable scan keys. For all
+ * three strategies a matching point must lie inside the query box,
+ * so they prune the same way. Returns false if some key can never
+ * match (empty query geometry).
+ */
+static bool
+pgis_spgist_scan_boxes(ScanKey scankeys, int nkeys, BOX *boxes)
+{
+	int i;
+
+	for ( i = 0; i < nkeys; i++ )
+	{
+		BOX2DFLOAT4 query;
+
+		if ( ! pgis_spgist_query_box(&scankeys[i], &query) )
+			return false;
+
+		pgis_spgist_widen(&query, &boxes[i]);
+	}
+
+	return true;
+}
+
+#if SPGIST_KNN
+
+/* Bounds of the whole plane, the region of the root node */
+static BOX *
+pgis_spgist_infinite_box(void)
+{
+	BOX *box = palloc(sizeof(BOX));
+
+	box->low.x = box->low.y = -HUGE_VAL;
+	box->high.x = box->high.y = HUGE_VAL;
+
+	return box;
+}
+
+/*
+ * Lower bound for the <-> distance between the query and any
+ * point inside a node region. The region is widened by a float
+ * ulp since <-> works on the float box center of the point.
+ */
+static double
+pgis_spgist_region_distance(const BOX *region, const BOX2DFLOAT4 *query)
+{
+	double qx = ((double)query->xmin + query->xmax) / 2.0;
+	double qy = ((double)query->ymin + query->ymax) / 2.0;
+	double dx = 0.0, dy = 0.0;
+	double lowx = region->low.x - fabs(region->low.x) * FLT_EPSILON;
+	double lowy = region->low.y - fabs(region->low.y) * FLT_EPSILON;
+	double highx = region->high.x + fabs(region->high.x) * FLT_EPSILON;
+	double highy = region->high.y + fabs(region->high.y) * FLT_EPSILON;
+
+	if ( qx < lowx ) dx = lowx - qx;
+	else if ( qx > highx ) dx = qx - highx;
+
+	if ( qy < lowy ) dy = lowy - qy;
+	else if ( qy > highy ) dy = qy - highy;
+
+	return sqrt(dx * dx + dy * dy);
+}
+
+/*
+ * Fill in the ordering distances of an inner node's children.
+ * Empty query geometries sort last.
+ */
+static double *
+pgis_spgist_node_distances(ScanKey orderbys, int norderbys, const BOX *region)
+{
+	double *distances = palloc(sizeof(double) * norderbys);
+	int i;
+
+	for ( i = 0; i < norderbys; i++ )
+	{
+		BOX2DFLOAT4 query;
+
+		if ( pgis_spgist_query_box(&orderbys[i], &query) )
+			distances[i] = pgis_spgist_region_distance(region, &query);
+		else
+			distances[i] = HUGE_VAL;
+	}
+
+	return distances;
+}
+
+#endif /* SPGIST_KNN */
+
+
+/*
+ * Quadtree. Quadrant numbers put the "high" half along X in bit 0
+ * and along Y in bit 1, points on a split line go to the high side.
+ */
+static int
+pgis_spgist_quadrant(const Point *centroid, const POINT2D *pt)
+{
+	int quadrant = 0;
+
+	if ( pt->x >= centroid->x ) quadrant |= 1;
+	if ( pt->y >= centroid->y ) quadrant |= 2;
+
+	return quadrant;
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_spgist_quad_config);
+Datum LWGEOM_spgist_quad_config(PG_FUNCTION_ARGS)
+{
+#if POSTGIS_PGSQL_VERSION >= 140
+	spgConfigIn *in = (spgConfigIn *) PG_GETARG_POINTER(0);
+#endif
+	spgConfigOut *cfg = (spgConfigOut *) PG_GETARG_POINTER(1);
+
+	cfg->prefixType = POINTOID;
+	cfg->labelType = VOIDOID;
+#if POSTGIS_PGSQL_VERSION >= 140
+	cfg->leafType = in->attType;
+#endif
+	cfg->canReturnData = true;
+	cfg->longValuesOK = false;
+
+	PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_spgist_quad_choose);
+Datum LWGEOM_spgist_quad_choose(PG_FUNCTION_ARGS)
+{
+	spgChooseIn *in = (spgChooseIn *) PG_GETARG_POINTER(0);
+	spgChooseOut *out = (spgChooseOut *) PG_GETARG_POINTER(1);
+	POINT2D pt;
+
+	pgis_spgist_point(in->datum, &pt);
+
+	out->resultType = spgMatchNode;
+	out->result.matchNode.levelAdd = 0;
+	out->result.matchNode.restDatum = in->datum;
+
+	/* nodeN will be set by the core for allTheSame tuples */
+	if ( ! in->allTheSame )
+	{
+		Assert(in->hasPrefix && in->nNodes == 4);
+		out->result.matchNode.nodeN =
+		    pgis_spgist_quadrant(DatumGetPointP(in->prefixDatum), &pt);
+	}
+
+	PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_spgist_quad_picksplit);
+Datum LWGEOM_spgist_quad_picksplit(PG_FUNCTION_ARGS)
+{
+	spgPickSplitIn *in = (spgPickSplitIn *) PG_GETARG_POINTER(0);
+	spgPickSplitOut *out = (spgPickSplitOut *) PG_GETARG_POINTER(1);
+	POINT2D *points = palloc(sizeof(POINT2D) * in->nTuples);
+	Point *centroid = palloc0(sizeof(Point));
+	int i;
+
+	/* Split around the mean of the points */
+	for ( i = 0; i < in->nTuples; i++ )
+	{
+		pgis_spgist_point(in->datums[i], &points[i]);
+		centroid->x += points[i].x;
+		centroid->y += points[i].y;
+	}
+	centroid->x /= in->nTuples;
+	centroid->y /= in->nTuples;
+
+	out->hasPrefix = true;
+	out->prefixDatum = PointPGetDatum(centroid);
+	out->nNodes = 4;
+	out->nodeLabels = NULL;
+	out->mapTuplesToNodes = palloc(sizeof(int) * in->nTuples);
+	out->leafTupleDatums = palloc(sizeof(Datum) * in->nTuples);
+
+	for ( i = 0; i < in->nTuples; i++ )
+	{
+		out->mapTuplesToNodes[i] = pgis_spgist_quadrant(centroid, &points[i]);
+		out->leafTupleDatums[i] = in->datums[i];
+	}
+
+	pfree(points);
+
+	PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_spgist_quad_inner_consistent);
+Datum LWGEOM_spgist_quad_inner_consistent(PG_FUNCTION_ARGS)
+{
+	spgInnerConsistentIn *in = (spgInnerConsistentIn *) PG_GETARG_POINTER(0);
+	spgInnerConsistentOut *out = (spgInnerConsistentOut *) PG_GETARG_POINTER(1);
+	Point *centroid;
+	BOX *boxes;
+	int quadrant, i;
+#if SPGIST_KNN
+	BOX *region = in->traversalValue ? (BOX *) in->traversalValue : pgis_spgist_infinite_box();
+	MemoryContext oldcxt;
+#endif
+
+	Assert(in->hasPrefix);
+	centroid = DatumGetPointP(in->prefixDatum);
+
+	out->nNodes = 0;
+	out->nodeNumbers = palloc(sizeof(int) * in->nNodes);
+#if SPGIST_KNN
+	out->traversalValues = palloc(sizeof(void *) * in->nNodes);
+	if ( in->norderbys > 0 )
+		out->distances = palloc(sizeof(double *) * in->nNodes);
+#endif
+
+	boxes = palloc(sizeof(BOX) * Max(in->nkeys, 1));
+	if ( ! pgis_spgist_scan_boxes(in->scankeys, in->nkeys, boxes) )
+	{
+		pfree(boxes);
+		PG_RETURN_VOID();
+	}
+
+	for ( quadrant = 0; quadrant < in->nNodes; quadrant++ )
+	{
+		bool match = true;
+
+		/* All the children of an allTheSame tuple hold the same points */
+		for ( i = 0; i < in->nkeys && match && ! in->allTheSame; i++ )
+		{
+			if ( quadrant & 1 )
+				match = (boxes[i].high.x >= centroid->x);
+			else
+				match = (boxes[i].low.x < centroid->x);
+
+			if ( match && (quadrant & 2) )
+				match = (boxes[i].high.y >= centroid->y);
+			else if ( match )
+				match = (boxes[i].low.y < centroid->y);
+		}
+
+		if ( ! match )
+			continue;
+
+#if SPGIST_KNN
+		{
+			BOX *child;
+
+			oldcxt = MemoryContextSwitchTo(in->traversalMemoryContext);
+			child = palloc(sizeof(BOX));
+			*child = *region;
+			if ( ! in->allTheSame )
+			{
+				if ( quadrant & 1 ) child->low.x = centroid->x;
+				else child->high.x = centroid->x;
+				if ( quadrant & 2 ) child->low.y = centroid->y;
+				else child->high.y = centroid->y;
+			}
+			MemoryContextSwitchTo(oldcxt);
+
+			out->traversalValues[out->nNodes] = child;
+			if ( in->norderbys > 0 )
+				out->distances[out->nNodes] =
+				    pgis_spgist_node_distances(in->orderbys, in->norderbys, child);
+		}
+#endif
+
+		out->nodeNumbers[out->nNodes++] = quadrant;
+	}
+
+	pfree(boxes);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * K-d tree. Even levels split on X, odd levels on Y. Node 0 holds
+ * points at or below the split coordinate, node 1 points at or
+ * above it, so searches treat the split line as belonging to both.
+ */
+static double
+pgis_spgist_kd_coord(const POINT2D *pt, int level)
+{
+	return (level % 2) ? pt->y : pt->x;
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_spgist_kd_config);
+Datum LWGEOM_spgist_kd_config(PG_FUNCTION_ARGS)
+{
+#if POSTGIS_PGSQL_VERSION >= 140
+	spgConfigIn *in = (spgConfigIn *) PG_GETARG_POINTER(0);
+#endif
+	spgConfigOut *cfg = (spgConfigOut *) PG_GETARG_POINTER(1);
+
+	cfg->prefixType = FLOAT8OID;
+	cfg->labelType = VOIDOID;
+#if POSTGIS_PGSQL_VERSION >= 140
+	cfg->leafType = in->attType;
+#endif
+	cfg->canReturnData = true;
+	cfg->longValuesOK = false;
+
+	PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_spgist_kd_choose);
+Datum LWGEOM_spgist_kd_choose(PG_FUNCTION_ARGS)
+{
+	spgChooseIn *in = (spgChooseIn *) PG_GETARG_POINTER(0);
+	spgChooseOut *out = (spgChooseOut *) PG_GETARG_POINTER(1);
+	POINT2D pt;
+	double coord;
+
+	Assert(in->hasPrefix);
+
+	pgis_spgist_point(in->datum, &pt);
+	coord = DatumGetFloat8(in->prefixDatum);
+
+	out->resultType = spgMatchNode;
+	out->result.matchNode.levelAdd = 1;
+	out->result.matchNode.restDatum = in->datum;
+
+	/* nodeN will be set by the core for allTheSame tuples */
+	if ( ! in->allTheSame )
+	{
+		Assert(in->nNodes == 2);
+		out->result.matchNode.nodeN = (pgis_spgist_kd_coord(&pt, in->level) > coord) ? 1 : 0;
+	}
+
+	PG_RETURN_VOID();
+}
+
+typedef struct
+{
+	double coord;
+	int index;
+}
+SPGIST_KD_SORT;
+
+static int
+pgis_spgist_kd_sort_cmp(const void *a, const void *b)
+{
+	double ca = ((const SPGIST_KD_SORT *) a)->coord;
+	double cb = ((const SPGIST_KD_SORT *) b)->coord;
+
+	if ( ca == cb ) return 0;
+	return (ca < cb) ? -1 : 1;
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_spgist_kd_picksplit);
+Datum LWGEOM_spgist_kd_picksplit(PG_FUNCTION_ARGS)
+{
+	spgPickSplitIn *in = (spgPickSplitIn *) PG_GETARG_POINTER(0);
+	spgPickSplitOut *out = (spgPickSplitOut *) PG_GETARG_POINTER(1);
+	SPGIST_KD_SORT *sorted = palloc(sizeof(SPGIST_KD_SORT) * in->nTuples);
+	int middle = in->nTuples / 2;
+	double coord;
+	int i;
+
+	for ( i = 0; i < in->nTuples; i++ )
+	{
+		POINT2D pt;
+
+		pgis_spgist_point(in->datums[i], &pt);
+		sorted[i].coord = pgis_spgist_kd_coord(&pt, in->level);
+		sorted[i].index = i;
+	}
+
+	qsort(sorted, in->nTuples, sizeof(SPGIST_KD_SORT), pgis_spgist_kd_sort_cmp);
+	coord = sorted[middle].coord;
+
+	out->hasPrefix = true;
+	out->prefixDatum = Float8GetDatum(coord);
+	out->nNodes = 2;
+	out->nodeLabels = NULL;
+	out->mapTuplesToNodes = palloc(sizeof(int) * in->nTuples);
+	out->leafTupleDatums = palloc(sizeof(Datum) * in->nTuples);
+
+	/* Split at the median, points equal to it may land on either side */
+	for ( i = 0; i < in->nTuples; i++ )
+	{
+		int n = sorted[i].index;
+
+		out->mapTuplesToNodes[n] = (i < middle) ? 0 : 1;
+		out->leafTupleDatums[n] = in->datums[n];
+	}
+
+	pfree(sorted);
+
+	PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(LWGEOM_spgist_kd_inner_consistent);
+Datum LWGEOM_spgist_kd_inner_consistent(PG_FUNCTION_ARGS)
+{
+	spgInnerConsistentIn *in = (spgInnerConsistentIn *) PG_GETARG_POINTER(0);
+	spgInnerConsistentOut *out = (spgInnerConsistentOut *) PG_GETARG_POINTER(1);
+	double coord;
+	BOX *boxes;
+	int node, i;
+#if SPGIST_KNN
+	BOX *region = in->traversalValue ? (BOX *) in->traversalValue : pgis_spgist_infinite_box();
+	MemoryContext oldcxt;
+#endif
+
+	Assert(in->hasPrefix);
+	coord = DatumGetFloat8(in->prefixDatum);
+
+	out->nNodes = 0;
+	out->nodeNumbers = palloc(sizeof(int) * in->nNodes);
+	out->levelAdds = palloc(sizeof(int) * in->nNodes);
+#if SPGIST_KNN
+	out->traversalValues = palloc(sizeof(void *) * in->nNodes);
+	if ( in->norderbys > 0 )
+		out->distances = palloc(sizeof(double *) * in->nNodes);
+#endif
+
+	boxes = palloc(sizeof(BOX) * Max(in->nkeys, 1));
+	if ( ! pgis_spgist_scan_boxes(in->scankeys, in->nkeys, boxes) )
+	{
+		pfree(boxes);
+		PG_RETURN_VOID();
+	}
+
+	for ( node = 0; node < in->nNodes; node++ )
+	{
+		bool match = true;
+
+		/* All the children of an allTheSame tuple hold the same points */
+		for ( i = 0; i < in->nkeys && match && ! in->allTheSame; i++ )
+		{
+			double low = (in->level % 2) ? boxes[i].low.y : boxes[i].low.x;
+			double high = (in->level % 2) ? boxes[i].high.y : boxes[i].high.x;
+
+			match = node ? (high >= coord) : (low <= coord);
+		}
+
+		if ( ! match )
+			continue;
+
+#if SPGIST_KNN
+		{
+			BOX *child;
+
+			oldcxt = MemoryContextSwitchTo(in->traversalMemoryContext);
+			child = palloc(sizeof(BOX));
+			*child = *region;
+			if ( in->allTheSame )
+				;
+			else if ( in->level % 2 )
+			{
+				if ( node ) child->low.y = coord;
+				else child->high.y = coord;
+			}
+			else
+			{
+				if ( node ) child->low.x = coord;
+				else child->high.x = coord;
+			}
+			MemoryContextSwitchTo(oldcxt);
+
+			out->traversalValues[out->nNodes] = child;
+			if ( in->norderbys > 0 )
+				out->distances[out->nNodes] =
+				    pgis_spgist_node_distances(in->orderbys, in->norderbys, child);
+		}
+#endif
+
+		out->levelAdds[out->nNodes] = 1;
+		out->nodeNumbers[out->nNodes++] = node;
+	}
+
+	pfree(boxes);
+
+	PG_RETURN_VOID();
+}
+
+
+/**
+ * Leaf test shared by both opclasses: the same float box tests as
+ * the operators themselves, so no recheck is needed.
+ */
+PG_FUNCTION_INFO_V1(LWGEOM_spgist_leaf_consistent);
+Datum LWGEOM_spgist_leaf_consistent(PG_FUNCTION_ARGS)
+{
+	spgLeafConsistentIn *in = (spgLeafConsistentIn *) PG_GETARG_POINTER(0);
+	spgLeafConsistentOut *out = (spgLeafConsistentOut *) PG_GETARG_POINTER(1);
+	PG_LWGEOM *leaf = (PG_LWGEOM *)PG_DETOAST_DATUM(in->leafDatum);
+	BOX2DFLOAT4 key;
+	bool result = true;
+	int i;
+
+	out->leafValue = in->leafDatum;
+	out->recheck = false;
+
+	/* Empty leaves and queries match nothing */
+	if ( ! getbox2d_p(SERIALIZED_FORM(leaf), &key) )
+		result = false;
+
+	for ( i = 0; i < in->nkeys && result; i++ )
+	{
+		BOX2DFLOAT4 query;
+
+		if ( ! pgis_spgist_query_box(&in->scankeys[i], &query) )
+		{
+			result = false;
+			break;
+		}
+
+		switch (in->scankeys[i].sk_strategy)
+		{
+		case SPGOverlapStrategyNumber:
+			result = DatumGetBool(DirectFunctionCall2(BOX2D_overlap, PointerGetDatum(&key), PointerGetDatum(&query)));
+			break;
+		case SPGContainsStrategyNumber:
+			result = DatumGetBool(DirectFunctionCall2(BOX2D_contain, PointerGetDatum(&key), PointerGetDatum(&query)));
+			break;
+		case SPGContainedByStrategyNumber:
+			result = DatumGetBool(DirectFunctionCall2(BOX2D_contained, PointerGetDatum(&key), PointerGetDatum(&query)));
+			break;
+		default:
+			elog(ERROR, "unrecognized strategy number: %d", in->scankeys[i].sk_strategy);
+		}
+	}
+
+#if SPGIST_KNN
+	if ( result && in->norderbys > 0 )
+	{
+		out->recheckDistances = false;
+		out->distances = palloc(sizeof(double) * in->norderbys);
+
+		for ( i = 0; i < in->norderbys; i++ )
+		{
+			BOX2DFLOAT4 query;
+
+			if ( pgis_spgist_query_box(&in->orderbys[i], &query) )
+				out->distances[i] = pgis_box2df_center_distance(&key, &query);
+			else
+				out->distances[i] = HUGE_VAL;
+		}
+	}
+#endif
+
+	if ( (Pointer) leaf != DatumGetPointer(in->leafDatum) ) pfree(leaf);
+
+	PG_RETURN_BOOL(result);
+}
+
+#endif /* POSTGIS_PGSQL_VERSION >= 92 */
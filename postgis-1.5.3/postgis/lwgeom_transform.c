@@ -13,6 +13,13 @@
 #include "postgres.h"
 #include "fmgr.h"
 #include "miscadmin.h"
+#include "catalog/pg_proc.h"
+#include "commands/trigger.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/syscache.h"
 
 #include "liblwgeom.h"
 #include "lwgeom_pg.h"
@@ -22,11 +29,14 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
 
 
 Datum transform(PG_FUNCTION_ARGS);
 Datum transform_geom(PG_FUNCTION_ARGS);
 Datum postgis_proj_version(PG_FUNCTION_ARGS);
+Datum postgis_proj_cache_invalidate(PG_FUNCTION_ARGS);
+Datum postgis_proj_cache_stats(PG_FUNCTION_ARGS);
 
 
 #include "proj_api.h"
@@ -41,310 +51,354 @@ void to_rad(POINT4D *pt);
 void to_dec(POINT4D *pt);
 int pj_transform_nodatum(projPJ srcdefn, projPJ dstdefn, long point_count, int point_offset, double *x, double *y, double *z );
 int transform_point(POINT4D *pt, projPJ srcdefn, projPJ dstdefn);
-static int lwgeom_transform_recursive(uchar *geom, projPJ inpj, projPJ outpj);
+int transform_pointarray(POINTARRAY *pa, projPJ srcpj, projPJ dstpj);
 
 
 
-/* PROJ 4 lookup transaction cache methods */
-#define PROJ4_CACHE_ITEMS	8
+/* Default number of projections kept by each backend */
+#define PROJ4_CACHE_SIZE	64
 
-/*
- * PROJ 4 backend hash table initial hash size
- * (since 16 is the default portal hash table size, and we would
- * typically have 2 entries per portal
- * then we shall use a default size of 32)
- */
+/* PROJ 4 backend hash table initial hash size */
 #define PROJ4_BACKEND_HASH_SIZE	32
 
+/* Number of points handed to pj_transform() at once */
+#define PROJ4_TRANSFORM_BLOCK	256
 
-/* An entry in the PROJ4 SRS cache */
-typedef struct struct_PROJ4SRSCacheItem
+
+/* Systems transform_pointarray_fast() can handle without PROJ.4 */
+typedef enum
 {
-	int srid;
-	projPJ projection;
-	MemoryContext projection_mcxt;
+	PROJ4_FAST_NONE = 0,
+	PROJ4_FAST_LONGLAT,	/* WGS84 longitude/latitude */
+	PROJ4_FAST_MERC,	/* spherical Mercator on the WGS84 semi-major axis */
+	PROJ4_FAST_UTM		/* WGS84 UTM */
 }
-PROJ4SRSCacheItem;
+PROJ4FastKind;
 
-/** The portal cache: it's contents and cache context
- */
-typedef struct struct_PROJ4PortalCache
+typedef struct struct_PROJ4FastDef
 {
-	PROJ4SRSCacheItem PROJ4SRSCache[PROJ4_CACHE_ITEMS];
-	int PROJ4SRSCacheCount;
-	MemoryContext PROJ4SRSCacheContext;
+	PROJ4FastKind kind;
+	int zone;	/* UTM zone, negative in the southern hemisphere */
 }
-PROJ4PortalCache;
+PROJ4FastDef;
+
+void proj4_fast_classify(const char *proj_str, PROJ4FastDef *def);
+int transform_pointarray_fast(POINTARRAY *pa, const PROJ4FastDef *src, const PROJ4FastDef *dst, projPJ srcpj, projPJ dstpj);
+static int lwgeom_transform_recursive(uchar *geom, projPJ inpj, projPJ outpj, const PROJ4FastDef *infast, const PROJ4FastDef *outfast);
 
 /**
- * Backend projPJ hash table
+ * Backend PROJ4 SRS cache
  *
- * This hash table stores a key/value pair of MemoryContext/projPJ objects.
- * Whenever we create a projPJ object using pj_init(), we create a separate
- * MemoryContext as a child context of the current executor context.
- * The MemoryContext/projPJ object is stored in this hash table so
- * that when PROJ4SRSCacheDelete() is called during query cleanup, we can
- * lookup the projPJ object based upon the MemoryContext parameter and hence
- * pj_free() it.
+ * Parsed projPJ objects live for the lifetime of the backend in a hash
+ * table keyed by SRID, shared by every caller. The table holds at most
+ * postgis.proj4_cache_size entries; once full, the least recently used
+ * projection is freed to make room. Changing spatial_ref_sys fires
+ * postgis_proj_cache_invalidate(), which sends a relcache invalidation
+ * for the table to every backend. The callback only marks the cache
+ * invalid, since it may run in the middle of a lookup while projections
+ * are in use; the cache is emptied by PROJ4SRSCacheCheckValid() at the
+ * start of the next transform. The spatial_ref_sys read and watched is
+ * the one in the schema of the calling PostGIS function, whatever the
+ * search_path.
  */
-static HTAB *PJHash = NULL;
-
-typedef struct struct_PJHashEntry
+typedef struct struct_PROJ4SRSCacheEntry
 {
-	MemoryContext ProjectionContext;
+	int srid;	/* hash key */
 	projPJ projection;
+	PROJ4FastDef fastdef;
+	uint64 last_used;
 }
-PJHashEntry;
+PROJ4SRSCacheEntry;
 
+static HTAB *PROJ4SRSHash = NULL;
+static uint64 PROJ4SRSCacheClock = 0;
+static Oid PROJ4SRSCacheNamespace = InvalidOid;
+static Oid PROJ4SRSCacheRelid = InvalidOid;
+static bool PROJ4SRSCacheInvalid = false;
 
-/* PJ Hash API */
-uint32 mcxt_ptr_hash(const void *key, Size keysize);
+/* Counters reported by postgis_proj_cache_stats() */
+static int64 PROJ4SRSCacheHits = 0;
+static int64 PROJ4SRSCacheMisses = 0;
+static int64 PROJ4SRSCacheEvictions = 0;
+static int64 PROJ4SRSCacheInvalidations = 0;
 
-static HTAB *CreatePJHash(void);
-static void AddPJHashEntry(MemoryContext mcxt, projPJ projection);
-static projPJ GetPJHashEntry(MemoryContext mcxt);
-static void DeletePJHashEntry(MemoryContext mcxt);
+/* postgis.proj4_cache_size */
+static int PROJ4SRSCacheSize = PROJ4_CACHE_SIZE;
 
-/* Cache API */
-bool IsInPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid);
-projPJ GetProjectionFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid);
-void AddToPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid, int other_srid);
-void DeleteFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid);
+/* PROJ4 SRS Hash API */
+uint32 srid_hash(const void *key, Size keysize);
+
+static HTAB *CreatePROJ4SRSHash(void);
+static char *GetProj4String(int srid);
+static PROJ4SRSCacheEntry *GetPROJ4SRSCacheEntry(int srid, int other_srid);
+static bool EvictFromPROJ4SRSCache(int keep_srid);
+static void FlushPROJ4SRSCache(void);
+static void PROJ4SRSCacheRelcacheCallback(Datum arg, Oid relid);
 
 /* Search path for PROJ.4 library */
 static bool IsPROJ4LibPathSet = false;
 void SetPROJ4LibPath(void);
 
-/* Memory context cache functions */
-static void PROJ4SRSCacheInit(MemoryContext context);
-static void PROJ4SRSCacheDelete(MemoryContext context);
-static void PROJ4SRSCacheReset(MemoryContext context);
-static bool PROJ4SRSCacheIsEmpty(MemoryContext context);
-static void PROJ4SRSCacheStats(MemoryContext context, int level);
-#ifdef MEMORY_CONTEXT_CHECKING
-static void PROJ4SRSCacheCheck(MemoryContext context);
-#endif
-
+/*
+ * PROJ4 SRS Hash Table functions
+ */
 
-/* Memory context definition must match the current version of PostgreSQL */
-static MemoryContextMethods PROJ4SRSCacheContextMethods =
-{
-	NULL,
-	NULL,
-	NULL,
-	PROJ4SRSCacheInit,
-	PROJ4SRSCacheReset,
-	PROJ4SRSCacheDelete,
-	NULL,
-	PROJ4SRSCacheIsEmpty,
-	PROJ4SRSCacheStats
-#ifdef MEMORY_CONTEXT_CHECKING
-	,PROJ4SRSCacheCheck
-#endif
-};
 
+/**
+ * A version of tag_hash - we specify this here as the implementation
+ * has changed over the years....
+ */
 
-static void
-PROJ4SRSCacheInit(MemoryContext context)
+uint32 srid_hash(const void *key, Size keysize)
 {
-	/*
-	 * Do nothing as the cache is initialised when the transform()
-	 * function is first called
-	 */
-}
+	uint32 hashval;
 
-static void
-PROJ4SRSCacheDelete(MemoryContext context)
-{
-	projPJ projection;
+	hashval = DatumGetUInt32(hash_any(key, keysize));
 
-	/* Lookup the projPJ pointer in the global hash table so we can free it */
-	projection = GetPJHashEntry(context);
+	return hashval;
+}
 
-	if (!projection)
-		elog(ERROR, "PROJ4SRSCacheDelete: Trying to delete non-existant projection object with MemoryContext key (%p)", (void *)context);
 
-	LWDEBUGF(3, "deleting projection object (%p) with MemoryContext key (%p)", projection, context);
+static HTAB *CreatePROJ4SRSHash(void)
+{
+	HASHCTL ctl;
 
-	/* Free it */
-	pj_free(projection);
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(int);
+	ctl.entrysize = sizeof(PROJ4SRSCacheEntry);
+	ctl.hash = srid_hash;
 
-	/* Remove the hash entry as it is no longer needed */
-	DeletePJHashEntry(context);
+	return hash_create("PostGIS PROJ4 Backend SRS Hash", PROJ4_BACKEND_HASH_SIZE, &ctl, (HASH_ELEM | HASH_FUNCTION));
 }
 
-static void
-PROJ4SRSCacheReset(MemoryContext context)
-{
-	/*
-	 * Do nothing, but we must supply a function since this call is mandatory according to tgl
-	 * (see postgis-devel archives July 2007)
-	 */
-}
 
+/**
+ * Free the least recently used projection, other than keep_srid which
+ * is the other half of the transformation being set up. Returns false
+ * if there was nothing to evict.
+ */
 static bool
-PROJ4SRSCacheIsEmpty(MemoryContext context)
+EvictFromPROJ4SRSCache(int keep_srid)
 {
-	/*
-	 * Always return false since this call is mandatory according to tgl
-	 * (see postgis-devel archives July 2007)
-	 */
-	return FALSE;
-}
+	HASH_SEQ_STATUS status;
+	PROJ4SRSCacheEntry *he, *victim = NULL;
 
-static void
-PROJ4SRSCacheStats(MemoryContext context, int level)
-{
-	/*
-	 * Simple stats display function - we must supply a function since this call is mandatory according to tgl
-	 * (see postgis-devel archives July 2007)
-	 */
+	hash_seq_init(&status, PROJ4SRSHash);
+	while ((he = (PROJ4SRSCacheEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (he->srid != keep_srid && (!victim || he->last_used < victim->last_used))
+			victim = he;
+	}
+
+	if (!victim)
+		return false;
+
+	LWDEBUGF(3, "evicting SRID %d from backend cache", victim->srid);
 
-	fprintf(stderr, "%s: PROJ4 context\n", context->name);
+	pj_free(victim->projection);
+	hash_search(PROJ4SRSHash, (void *)&victim->srid, HASH_REMOVE, NULL);
+	PROJ4SRSCacheEvictions++;
+
+	return true;
 }
 
-#ifdef MEMORY_CONTEXT_CHECKING
+
 static void
-PROJ4SRSCacheCheck(MemoryContext context)
+FlushPROJ4SRSCache(void)
 {
-	/*
-	 * Do nothing - stub required for when PostgreSQL is compiled
-	 * with MEMORY_CONTEXT_CHECKING defined
-	 */
-}
-#endif
+	HASH_SEQ_STATUS status;
+	PROJ4SRSCacheEntry *he;
 
+	if (!PROJ4SRSHash)
+		return;
 
-/*
- * PROJ4 projPJ Hash Table functions
- */
+	/* Removing the element just returned is allowed during a scan */
+	hash_seq_init(&status, PROJ4SRSHash);
+	while ((he = (PROJ4SRSCacheEntry *) hash_seq_search(&status)) != NULL)
+	{
+		pj_free(he->projection);
+		hash_search(PROJ4SRSHash, (void *)&he->srid, HASH_REMOVE, NULL);
+	}
+}
 
 
 /**
- * A version of tag_hash - we specify this here as the implementation
- * has changed over the years....
+ * Return the cache entry for srid, reading spatial_ref_sys and parsing
+ * the definition on a miss. If the cache is full we make sure the entry
+ * we evict is not other_srid, which is the definition for the other half
+ * of the transformation.
  */
-
-uint32 mcxt_ptr_hash(const void *key, Size keysize)
+static PROJ4SRSCacheEntry *
+GetPROJ4SRSCacheEntry(int srid, int other_srid)
 {
-	uint32 hashval;
-
-	hashval = DatumGetUInt32(hash_any(key, keysize));
+	PROJ4SRSCacheEntry *he;
+	projPJ projection;
+	char *proj_str;
+	int* pj_errno_ref;
+	bool found;
 
-	return hashval;
-}
+	/* Create the backend hash if it doesn't already exist */
+	if (!PROJ4SRSHash)
+		PROJ4SRSHash = CreatePROJ4SRSHash();
 
+	he = (PROJ4SRSCacheEntry *) hash_search(PROJ4SRSHash, (void *)&srid, HASH_FIND, NULL);
+	if (he)
+	{
+		PROJ4SRSCacheHits++;
+		he->last_used = ++PROJ4SRSCacheClock;
+		return he;
+	}
 
-static HTAB *CreatePJHash(void)
-{
-	HASHCTL ctl;
+	PROJ4SRSCacheMisses++;
 
-	ctl.keysize = sizeof(MemoryContext);
-	ctl.entrysize = sizeof(PJHashEntry);
-	ctl.hash = mcxt_ptr_hash;
+	/*
+	** Turn the SRID number into a proj4 string, by reading from spatial_ref_sys
+	** or instantiating a magical value from a negative srid.
+	*/
+	proj_str = GetProj4String(srid);
+	if ( ! proj_str )
+	{
+		elog(ERROR, "GetProj4String returned NULL for SRID (%d)", srid);
+	}
 
-	return hash_create("PostGIS PROJ4 Backend projPJ MemoryContext Hash", PROJ4_BACKEND_HASH_SIZE, &ctl, (HASH_ELEM | HASH_FUNCTION));
-}
+	projection = make_project(proj_str);
 
-static void AddPJHashEntry(MemoryContext mcxt, projPJ projection)
-{
-	bool found;
-	void **key;
-	PJHashEntry *he;
+	pj_errno_ref = pj_get_errno_ref();
+	if ( (projection == NULL) || (*pj_errno_ref))
+	{
+		int pj_err = *pj_errno_ref;
 
-	/* The hash key is the MemoryContext pointer */
-	key = (void *)&mcxt;
+		/* Nothing else will ever free it */
+		if (projection)
+			pj_free(projection);
 
-	he = (PJHashEntry *) hash_search(PJHash, key, HASH_ENTER, &found);
-	if (!found)
-	{
-		/* Insert the entry into the new hash element */
-		he->ProjectionContext = mcxt;
-		he->projection = projection;
+		elog(ERROR, "GetPROJ4SRSCacheEntry: couldn't parse proj4 string: '%s': %s", proj_str, pj_strerrno(pj_err));
 	}
-	else
+
+	/* The limit may have been lowered since the last miss */
+	while (hash_get_num_entries(PROJ4SRSHash) >= PROJ4SRSCacheSize)
 	{
-		elog(ERROR, "AddPJHashEntry: PROJ4 projection object already exists for this MemoryContext (%p)",
-		     (void *)mcxt);
+		if (!EvictFromPROJ4SRSCache(other_srid))
+			break;
 	}
-}
 
-static projPJ GetPJHashEntry(MemoryContext mcxt)
-{
-	void **key;
-	PJHashEntry *he;
+	LWDEBUGF(3, "adding SRID %d with proj4text \"%s\" to backend cache", srid, proj_str);
 
-	/* The hash key is the MemoryContext pointer */
-	key = (void *)&mcxt;
+	he = (PROJ4SRSCacheEntry *) hash_search(PROJ4SRSHash, (void *)&srid, HASH_ENTER, &found);
+	he->srid = srid;
+	he->projection = projection;
+	proj4_fast_classify(proj_str, &he->fastdef);
+	he->last_used = ++PROJ4SRSCacheClock;
 
-	/* Return the projection object from the hash */
-	he = (PJHashEntry *) hash_search(PJHash, key, HASH_FIND, NULL);
+	/* Free the projection string */
+	pfree(proj_str);
 
-	return he->projection;
+	return he;
 }
 
 
-static void DeletePJHashEntry(MemoryContext mcxt)
+/**
+ * Return the projection for srid from the backend cache, adding it if
+ * needed. The result stays valid until the next lookup, so callers
+ * needing two projections must pass the first one's SRID as other_srid.
+ */
+projPJ
+GetProjectionFromPROJ4SRSCache(int srid, int other_srid)
 {
-	void **key;
-	PJHashEntry *he;
+	return GetPROJ4SRSCacheEntry(srid, other_srid)->projection;
+}
 
-	/* The hash key is the MemoryContext pointer */
-	key = (void *)&mcxt;
 
-	/* Delete the projection object from the hash */
-	he = (PJHashEntry *) hash_search(PJHash, key, HASH_REMOVE, NULL);
+/**
+ * Find the spatial_ref_sys installed alongside the PostGIS function being
+ * called, to read projections from and to watch for invalidations
+ */
+static void
+PROJ4SRSCacheFindRelation(FunctionCallInfo fcinfo)
+{
+	HeapTuple tuple;
 
-	he->projection = NULL;
+	if (!fcinfo->flinfo || !OidIsValid(fcinfo->flinfo->fn_oid))
+		return;
 
-	if (!he)
-		elog(ERROR, "DeletePJHashEntry: There was an error removing the PROJ4 projection object from this MemoryContext (%p)", (void *)mcxt);
+	tuple = SearchSysCache(PROCOID, ObjectIdGetDatum(fcinfo->flinfo->fn_oid), 0, 0, 0);
+	if (!HeapTupleIsValid(tuple))
+		return;
+
+	PROJ4SRSCacheNamespace = ((Form_pg_proc) GETSTRUCT(tuple))->pronamespace;
+	ReleaseSysCache(tuple);
+
+	PROJ4SRSCacheRelid = get_relname_relid("spatial_ref_sys", PROJ4SRSCacheNamespace);
 }
 
 
-/*
- * Per-cache management functions
+/**
+ * Empty the backend cache if spatial_ref_sys has changed since it was
+ * filled. Call with the fcinfo of the PostGIS function being run before
+ * looking up the projections for a transform.
  */
+void
+PROJ4SRSCacheCheckValid(FunctionCallInfo fcinfo)
+{
+	if (!OidIsValid(PROJ4SRSCacheRelid))
+		PROJ4SRSCacheFindRelation(fcinfo);
+
+	if (!PROJ4SRSCacheInvalid)
+		return;
+
+	LWDEBUG(3, "spatial_ref_sys changed, emptying backend cache");
+
+	FlushPROJ4SRSCache();
+	PROJ4SRSCacheInvalidations++;
+	PROJ4SRSCacheInvalid = false;
+}
+
 
-bool
-IsInPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid)
+static void
+PROJ4SRSCacheRelcacheCallback(Datum arg, Oid relid)
 {
 	/*
-	 * Return true/false depending upon whether the item
-	 * is in the SRS cache.
+	 * InvalidOid means every relation. Forget which spatial_ref_sys we
+	 * watch too, in case it was dropped and recreated; the next
+	 * PROJ4SRSCacheCheckValid() looks it up again.
 	 */
-
-	int i;
-
-	for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
+	if (relid == InvalidOid || relid == PROJ4SRSCacheRelid)
 	{
-		if (PROJ4Cache->PROJ4SRSCache[i].srid == srid)
-			return true;
+		PROJ4SRSCacheInvalid = true;
+		PROJ4SRSCacheRelid = InvalidOid;
+		PROJ4SRSCacheNamespace = InvalidOid;
 	}
-
-	/* Otherwise not found */
-	return false;
 }
 
 
 /**
- * Return the projection object from the cache (we should
- * already have checked it exists using IsInPROJ4SRSCache first)
+ * Set up postgis.proj4_cache_size and register for spatial_ref_sys
+ * invalidations. Called once from _PG_init().
  */
-projPJ
-GetProjectionFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid)
+void
+lwgeom_transform_init(void)
 {
-	int i;
-
-	for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
-	{
-		if (PROJ4Cache->PROJ4SRSCache[i].srid == srid)
-			return PROJ4Cache->PROJ4SRSCache[i].projection;
-	}
+	DefineCustomIntVariable("postgis.proj4_cache_size",
+	                        "Sets the number of PROJ.4 projections kept by each backend.",
+	                        NULL,
+	                        &PROJ4SRSCacheSize,
+#if POSTGIS_PGSQL_VERSION >= 84
+	                        PROJ4_CACHE_SIZE,
+#endif
+	                        2, INT_MAX,
+	                        PGC_USERSET,
+#if POSTGIS_PGSQL_VERSION >= 84
+	                        0,
+#endif
+#if POSTGIS_PGSQL_VERSION >= 91
+	                        NULL,
+#endif
+	                        NULL, NULL);
 
-	return NULL;
+	CacheRegisterRelcacheCallback(PROJ4SRSCacheRelcacheCallback, (Datum) 0);
 }
 
+
 char* GetProj4StringSPI(int srid)
 {
 	static int maxproj4len = 512;
@@ -359,8 +413,12 @@ char* GetProj4StringSPI(int srid)
 		elog(ERROR, "GetProj4StringSPI: Could not connect to database using SPI");
 	}
 
-	/* Execute the lookup query */
-	snprintf(proj4_spi_buffer, 255, "SELECT proj4text FROM spatial_ref_sys WHERE srid = %d LIMIT 1", srid);
+	/* Execute the lookup query, on the spatial_ref_sys of the PostGIS schema once it is known */
+	if (OidIsValid(PROJ4SRSCacheNamespace))
+		snprintf(proj4_spi_buffer, 255, "SELECT proj4text FROM %s.spatial_ref_sys WHERE srid = %d LIMIT 1",
+		         quote_identifier(get_namespace_name(PROJ4SRSCacheNamespace)), srid);
+	else
+		snprintf(proj4_spi_buffer, 255, "SELECT proj4text FROM spatial_ref_sys WHERE srid = %d LIMIT 1", srid);
 	spi_result = SPI_exec(proj4_spi_buffer, 1);
 
 	/* Read back the PROJ4 text */
@@ -456,124 +514,6 @@ static char* GetProj4String(int srid)
 }
 
 
-/**
- * Add an entry to the local PROJ4 SRS cache. If we need to wrap around then
- * we must make sure the entry we choose to delete does not contain other_srid
- * which is the definition for the other half of the transformation.
- */
-void
-AddToPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid, int other_srid)
-{
-	MemoryContext PJMemoryContext;
-	projPJ projection = NULL;
-	char *proj_str;
-	int* pj_errno_ref;
-
-	/*
-	** Turn the SRID number into a proj4 string, by reading from spatial_ref_sys
-	** or instantiating a magical value from a negative srid.
-	*/
-	proj_str = GetProj4String(srid);
-	if ( ! proj_str )
-	{
-		elog(ERROR, "GetProj4String returned NULL for SRID (%d)", srid);
-	}
-
-	projection = make_project(proj_str);
-
-	pj_errno_ref = pj_get_errno_ref();
-	if ( (projection == NULL) || (*pj_errno_ref))
-	{
-		/* we need this for error reporting */
-		/*pfree(projection); */
-		elog(ERROR, "AddToPROJ4SRSCache: couldn't parse proj4 string: '%s': %s", proj_str, pj_strerrno(*pj_errno_ref));
-	}
-
-	/*
-	 * If the cache is already full then find the first entry
-	 * that doesn't contain other_srid and use this as the
-	 * subsequent value of PROJ4SRSCacheCount
-	 */
-	if (PROJ4Cache->PROJ4SRSCacheCount == PROJ4_CACHE_ITEMS)
-	{
-		bool found = false;
-		int i;
-
-		for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
-		{
-			if (PROJ4Cache->PROJ4SRSCache[i].srid != other_srid && found == false)
-			{
-				LWDEBUGF(3, "choosing to remove item from query cache with SRID %d and index %d", PROJ4Cache->PROJ4SRSCache[i].srid, i);
-
-				DeleteFromPROJ4SRSCache(PROJ4Cache, PROJ4Cache->PROJ4SRSCache[i].srid);
-				PROJ4Cache->PROJ4SRSCacheCount = i;
-
-				found = true;
-			}
-		}
-	}
-
-	/*
-	 * Now create a memory context for this projection and
-	 * store it in the backend hash
-	 */
-	LWDEBUGF(3, "adding SRID %d with proj4text \"%s\" to query cache at index %d", srid, proj_str, PROJ4Cache->PROJ4SRSCacheCount);
-
-	PJMemoryContext = MemoryContextCreate(T_AllocSetContext, 8192,
-	                                      &PROJ4SRSCacheContextMethods,
-	                                      PROJ4Cache->PROJ4SRSCacheContext,
-	                                      "PostGIS PROJ4 PJ Memory Context");
-
-	/* Create the backend hash if it doesn't already exist */
-	if (!PJHash)
-		PJHash = CreatePJHash();
-
-	/*
-	 * Add the MemoryContext to the backend hash so we can
-	 * clean up upon portal shutdown
-	 */
-	LWDEBUGF(3, "adding projection object (%p) to hash table with MemoryContext key (%p)", projection, PJMemoryContext);
-
-	AddPJHashEntry(PJMemoryContext, projection);
-
-	PROJ4Cache->PROJ4SRSCache[PROJ4Cache->PROJ4SRSCacheCount].srid = srid;
-	PROJ4Cache->PROJ4SRSCache[PROJ4Cache->PROJ4SRSCacheCount].projection = projection;
-	PROJ4Cache->PROJ4SRSCache[PROJ4Cache->PROJ4SRSCacheCount].projection_mcxt = PJMemoryContext;
-	PROJ4Cache->PROJ4SRSCacheCount++;
-
-	/* Free the projection string */
-	pfree(proj_str);
-
-}
-
-
-void DeleteFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid)
-{
-	/*
-	 * Delete the SRID entry from the cache
-	 */
-
-	int i;
-
-	for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
-	{
-		if (PROJ4Cache->PROJ4SRSCache[i].srid == srid)
-		{
-			LWDEBUGF(3, "removing query cache entry with SRID %d at index %d", srid, i);
-
-			/*
-			 * Zero out the entries and free the PROJ4 handle
-			 * by deleting the memory context
-			 */
-			MemoryContextDelete(PROJ4Cache->PROJ4SRSCache[i].projection_mcxt);
-			PROJ4Cache->PROJ4SRSCache[i].projection = NULL;
-			PROJ4Cache->PROJ4SRSCache[i].projection_mcxt = NULL;
-			PROJ4Cache->PROJ4SRSCache[i].srid = -1;
-		}
-	}
-}
-
-
 /**
  * Specify an alternate directory for the PROJ.4 grid files
  * (this should augment the PROJ.4 compile-time path)
@@ -678,7 +618,7 @@ make_project(char *str1)
  * from inpj projection to outpj projection
  */
 static int
-lwgeom_transform_recursive(uchar *geom, projPJ inpj, projPJ outpj)
+lwgeom_transform_recursive(uchar *geom, projPJ inpj, projPJ outpj, const PROJ4FastDef *infast, const PROJ4FastDef *outfast)
 {
 	LWGEOM_INSPECTED *inspected = lwgeom_inspect(geom);
 	int j, i;
@@ -689,15 +629,12 @@ lwgeom_transform_recursive(uchar *geom, projPJ inpj, projPJ outpj)
 		LWPOINT *point=NULL;
 		LWPOLY *poly=NULL;
 		LWCIRCSTRING *curve=NULL;
-		POINT4D p;
 		uchar *subgeom=NULL;
 
 		point = lwgeom_getpoint_inspected(inspected,j);
 		if (point != NULL)
 		{
-			getPoint4d_p(point->point, 0, &p);
-			transform_point(&p, inpj, outpj);
-			setPoint4d(point->point, 0, &p);
+			transform_pointarray_fast(point->point, infast, outfast, inpj, outpj);
 			lwgeom_release((LWGEOM *)point);
 			continue;
 		}
@@ -705,13 +642,7 @@ lwgeom_transform_recursive(uchar *geom, projPJ inpj, projPJ outpj)
 		line = lwgeom_getline_inspected(inspected, j);
 		if (line != NULL)
 		{
-			POINTARRAY *pts = line->points;
-			for (i=0; i<pts->npoints; i++)
-			{
-				getPoint4d_p(pts, i, &p);
-				transform_point(&p, inpj, outpj);
-				setPoint4d(pts, i, &p);
-			}
+			transform_pointarray_fast(line->points, infast, outfast, inpj, outpj);
 			lwgeom_release((LWGEOM *)line);
 			continue;
 		}
@@ -721,14 +652,7 @@ lwgeom_transform_recursive(uchar *geom, projPJ inpj, projPJ outpj)
 		{
 			for (i=0; i<poly->nrings; i++)
 			{
-				int pi;
-				POINTARRAY *pts = poly->rings[i];
-				for (pi=0; pi<pts->npoints; pi++)
-				{
-					getPoint4d_p(pts, pi, &p);
-					transform_point(&p, inpj, outpj);
-					setPoint4d(pts, pi, &p);
-				}
+				transform_pointarray_fast(poly->rings[i], infast, outfast, inpj, outpj);
 			}
 			lwgeom_release((LWGEOM *)poly);
 			continue;
@@ -737,13 +661,7 @@ lwgeom_transform_recursive(uchar *geom, projPJ inpj, projPJ outpj)
 		curve = lwgeom_getcircstring_inspected(inspected, j);
 		if (curve != NULL)
 		{
-			POINTARRAY *pts = curve->points;
-			for (i=0; i<pts->npoints; i++)
-			{
-				getPoint4d_p(pts, i, &p);
-				transform_point(&p, inpj, outpj);
-				setPoint4d(pts, i, &p);
-			}
+			transform_pointarray_fast(curve->points, infast, outfast, inpj, outpj);
 			lwgeom_release((LWGEOM *)curve);
 			continue;
 		}
@@ -751,7 +669,7 @@ lwgeom_transform_recursive(uchar *geom, projPJ inpj, projPJ outpj)
 		subgeom = lwgeom_getsubgeometry_inspected(inspected, j);
 		if ( subgeom != NULL )
 		{
-			if (!lwgeom_transform_recursive(subgeom, inpj, outpj))
+			if (!lwgeom_transform_recursive(subgeom, inpj, outpj, infast, outfast))
 			{
 				lwinspected_release(inspected);
 				return 0;
@@ -785,12 +703,10 @@ Datum transform(PG_FUNCTION_ARGS)
 	PG_LWGEOM *geom;
 	PG_LWGEOM *result=NULL;
 	LWGEOM *lwgeom;
-	projPJ input_pj, output_pj;
+	PROJ4SRSCacheEntry *input, *output;
 	int32 result_srid ;
 	uchar *srl;
 
-	PROJ4PortalCache *PROJ4Cache = NULL;
-
 
 	result_srid = PG_GETARG_INT32(1);
 	if (result_srid == -1)
@@ -821,61 +737,20 @@ Datum transform(PG_FUNCTION_ARGS)
 		PG_RETURN_POINTER(PG_GETARG_DATUM(0));
 	}
 
+	/* Empty the cache if spatial_ref_sys has changed */
+	PROJ4SRSCacheCheckValid(fcinfo);
+
 	/*
-	 * If we have not already created PROJ4 cache for this portal
-	 * then create it
+	 * Look up the output projection first, then the input one
+	 * making sure the output entry is not evicted to make room
 	 */
-	if (fcinfo->flinfo->fn_extra == NULL)
-	{
-		MemoryContext old_context;
-
-		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
-		PROJ4Cache = palloc(sizeof(PROJ4PortalCache));
-		MemoryContextSwitchTo(old_context);
-
-		if (PROJ4Cache)
-		{
-			int i;
-
-			POSTGIS_DEBUGF(3, "Allocating PROJ4Cache for portal with transform() MemoryContext %p", fcinfo->flinfo->fn_mcxt);
-			/* Put in any required defaults */
-			for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
-			{
-				PROJ4Cache->PROJ4SRSCache[i].srid = -1;
-				PROJ4Cache->PROJ4SRSCache[i].projection = NULL;
-				PROJ4Cache->PROJ4SRSCache[i].projection_mcxt = NULL;
-			}
-			PROJ4Cache->PROJ4SRSCacheCount = 0;
-			PROJ4Cache->PROJ4SRSCacheContext = fcinfo->flinfo->fn_mcxt;
-
-			/* Store the pointer in fcinfo->flinfo->fn_extra */
-			fcinfo->flinfo->fn_extra = PROJ4Cache;
-		}
-	}
-	else
-	{
-		/* Use the existing cache */
-		PROJ4Cache = fcinfo->flinfo->fn_extra;
-	}
-
-	/* Add the output srid to the cache if it's not already there */
-	if (!IsInPROJ4SRSCache(PROJ4Cache, result_srid))
-		AddToPROJ4SRSCache(PROJ4Cache, result_srid, pglwgeom_getSRID(geom));
-
-	/* Get the output projection */
-	output_pj = GetProjectionFromPROJ4SRSCache(PROJ4Cache, result_srid);
-
-	/* Add the input srid to the cache if it's not already there */
-	if (!IsInPROJ4SRSCache(PROJ4Cache, pglwgeom_getSRID(geom)))
-		AddToPROJ4SRSCache(PROJ4Cache, pglwgeom_getSRID(geom), result_srid);
-
-	/* Get the input projection	 */
-	input_pj = GetProjectionFromPROJ4SRSCache(PROJ4Cache, pglwgeom_getSRID(geom));
-
+	output = GetPROJ4SRSCacheEntry(result_srid, pglwgeom_getSRID(geom));
+	input = GetPROJ4SRSCacheEntry(pglwgeom_getSRID(geom), result_srid);
 
 	/* now we have a geometry, and input/output PJ structs. */
 	lwgeom_transform_recursive(SERIALIZED_FORM(geom),
-	                           input_pj, output_pj);
+	                           input->projection, output->projection,
+	                           &input->fastdef, &output->fastdef);
 
 	srl = SERIALIZED_FORM(geom);
 
@@ -921,6 +796,7 @@ Datum transform_geom(PG_FUNCTION_ARGS)
 	int32 result_srid ;
 	uchar *srl;
 	int* pj_errno_ref;
+	PROJ4FastDef input_fast, output_fast;
 
 
 	result_srid = PG_GETARG_INT32(3);
@@ -969,6 +845,7 @@ Datum transform_geom(PG_FUNCTION_ARGS)
 		elog(ERROR, "transform: couldn't parse proj4 input string: '%s': %s", input_proj4, pj_strerrno(*pj_errno_ref));
 		PG_RETURN_NULL();
 	}
+	proj4_fast_classify(input_proj4, &input_fast);
 	pfree(input_proj4);
 
 	output_pj = make_project(output_proj4);
@@ -983,11 +860,13 @@ Datum transform_geom(PG_FUNCTION_ARGS)
 		elog(ERROR, "transform: couldn't parse proj4 output string: '%s': %s", output_proj4, pj_strerrno(*pj_errno_ref));
 		PG_RETURN_NULL();
 	}
+	proj4_fast_classify(output_proj4, &output_fast);
 	pfree(output_proj4);
 
 	/* now we have a geometry, and input/output PJ structs. */
 	lwgeom_transform_recursive(SERIALIZED_FORM(geom),
-	                           input_pj, output_pj);
+	                           input_pj, output_pj,
+	                           &input_fast, &output_fast);
 
 	/* clean up */
 	pj_free(input_pj);
@@ -1028,6 +907,47 @@ Datum postgis_proj_version(PG_FUNCTION_ARGS)
 }
 
 
+/**
+ * Trigger on spatial_ref_sys: tell every backend to drop its cached
+ * projections once the change is committed.
+ */
+PG_FUNCTION_INFO_V1(postgis_proj_cache_invalidate);
+Datum postgis_proj_cache_invalidate(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "postgis_proj_cache_invalidate: not called by trigger manager");
+
+	PROJ4SRSCacheNamespace = RelationGetNamespace(trigdata->tg_relation);
+	PROJ4SRSCacheRelid = RelationGetRelid(trigdata->tg_relation);
+	CacheInvalidateRelcache(trigdata->tg_relation);
+
+	return PointerGetDatum(NULL);
+}
+
+
+PG_FUNCTION_INFO_V1(postgis_proj_cache_stats);
+Datum postgis_proj_cache_stats(PG_FUNCTION_ARGS)
+{
+	char buf[256];
+	text *result;
+
+	snprintf(buf, sizeof(buf),
+	         "size=%d entries=%ld hits=" INT64_FORMAT " misses=" INT64_FORMAT
+	         " evictions=" INT64_FORMAT " invalidations=" INT64_FORMAT,
+	         PROJ4SRSCacheSize,
+	         PROJ4SRSHash ? hash_get_num_entries(PROJ4SRSHash) : 0L,
+	         PROJ4SRSCacheHits, PROJ4SRSCacheMisses,
+	         PROJ4SRSCacheEvictions, PROJ4SRSCacheInvalidations);
+
+	result = (text *) palloc(VARHDRSZ + strlen(buf));
+	SET_VARSIZE(result, VARHDRSZ + strlen(buf));
+	memcpy(VARDATA(result), buf, strlen(buf));
+	PG_RETURN_POINTER(result);
+}
+
+
 int
 transform_point(POINT4D *pt, projPJ srcpj, projPJ dstpj)
 {
@@ -1070,5 +990,471 @@ transform_point(POINT4D *pt, projPJ srcpj, projPJ dstpj)
 	return 1;
 }
 
+/**
+ * Transform a POINTARRAY in place, handing PROJ.4 up to
+ * PROJ4_TRANSFORM_BLOCK points per pj_transform() call rather than one.
+ * The ordinates are copied out into aligned x, y and z arrays since the
+ * serialized point list makes no alignment promise. If PROJ.4 reports
+ * any trouble the block is redone through transform_point(), so errors
+ * name the failing point exactly as before.
+ */
+int
+transform_pointarray(POINTARRAY *pa, projPJ srcpj, projPJ dstpj)
+{
+	double x[PROJ4_TRANSFORM_BLOCK];
+	double y[PROJ4_TRANSFORM_BLOCK];
+	double z[PROJ4_TRANSFORM_BLOCK];
+	int hasz = TYPE_HASZ(pa->dims);
+	int src_latlong = pj_is_latlong(srcpj);
+	int dst_latlong = pj_is_latlong(dstpj);
+	int ptsize = pointArray_ptsize(pa);
+	int *pj_errno_ref = pj_get_errno_ref();
+	int start, n, i, failed;
+	POINT4D p;
+	uchar *ptr;
+
+	for (start = 0; start < pa->npoints; start += n)
+	{
+		n = LW_MIN(pa->npoints - start, PROJ4_TRANSFORM_BLOCK);
+
+		ptr = getPoint_internal(pa, start);
+		for (i = 0; i < n; i++, ptr += ptsize)
+		{
+			memcpy(&x[i], ptr, sizeof(double));
+			memcpy(&y[i], ptr + sizeof(double), sizeof(double));
+			if (hasz)
+				memcpy(&z[i], ptr + 2 * sizeof(double), sizeof(double));
+			else
+				z[i] = 0.0;
+		}
+
+		if (src_latlong)
+		{
+			for (i = 0; i < n; i++)
+			{
+				x[i] *= M_PI/180.0;
+				y[i] *= M_PI/180.0;
+			}
+		}
+
+		*pj_errno_ref = 0;
+		failed = pj_transform(srcpj, dstpj, n, 1, x, y, z) || *pj_errno_ref;
+
+		/* Points PROJ.4 could not project come back as HUGE_VAL */
+		for (i = 0; !failed && i < n; i++)
+			failed = (x[i] == HUGE_VAL || y[i] == HUGE_VAL);
+
+		if (failed)
+		{
+			for (i = start; i < start + n; i++)
+			{
+				*pj_errno_ref = 0;
+				getPoint4d_p(pa, i, &p);
+				transform_point(&p, srcpj, dstpj);
+				setPoint4d(pa, i, &p);
+			}
+			continue;
+		}
+
+		if (dst_latlong)
+		{
+			for (i = 0; i < n; i++)
+			{
+				x[i] *= 180.0/M_PI;
+				y[i] *= 180.0/M_PI;
+			}
+		}
+
+		ptr = getPoint_internal(pa, start);
+		for (i = 0; i < n; i++, ptr += ptsize)
+		{
+			memcpy(ptr, &x[i], sizeof(double));
+			memcpy(ptr + sizeof(double), &y[i], sizeof(double));
+			if (hasz)
+				memcpy(ptr + 2 * sizeof(double), &z[i], sizeof(double));
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Closed form transforms between WGS84 longitude/latitude, spherical
+ * ("web") Mercator and WGS84 UTM. proj4_fast_classify() recognises the
+ * proj4text of these systems, as found in spatial_ref_sys and
+ * GetProj4String(), and transform_pointarray_fast() then does the work
+ * without going through PROJ.4. The Mercator formulas and the transverse
+ * Mercator series are the ones PROJ.4 itself uses (PJ_merc.c, PJ_tmerc.c,
+ * pj_mlfn.c), so results agree with pj_transform() to rounding.
+ */
+
+#define WGS84_A		6378137.0
+#define WGS84_ES	0.0066943799901413165	/* 2f - f^2, f = 1/298.257223563 */
+#define UTM_K0		0.9996
+#define UTM_X0		500000.0
+#define UTM_Y0_SOUTH	10000000.0
+
+/* PROJ.4 gives up on latitudes this close to the poles in Mercator */
+#define PROJ4_FAST_EPS10	1.e-10
+
+static int
+proj4_fast_param_is(const char *value, double expected)
+{
+	char *end;
+	double d = strtod(value, &end);
+
+	return (end != value && *end == '\0' && d == expected);
+}
+
+/**
+ * Work out whether the given proj4 string is one of the systems
+ * transform_pointarray_fast() knows. Anything unexpected in the string
+ * (another datum, towgs84, a false origin...) leaves it to PROJ.4.
+ */
+void
+proj4_fast_classify(const char *proj_str, PROJ4FastDef *def)
+{
+	char *str, *tok, *value;
+	char *proj = NULL, *datum = NULL, *ellps = NULL, *units = NULL, *nadgrids = NULL;
+	int zone = 0, south = 0, ok = 1;
+	double a = 0.0, b = 0.0;
+
+	def->kind = PROJ4_FAST_NONE;
+	def->zone = 0;
+
+	if (proj_str == NULL)
+		return;
+
+	str = pstrdup(proj_str);
+
+	for (tok = strtok(str, " "); ok && tok != NULL; tok = strtok(NULL, " "))
+	{
+		if (*tok++ != '+')
+		{
+			ok = 0;
+			break;
+		}
+
+		value = strchr(tok, '=');
+		if (value)
+			*value++ = '\0';
+
+		if (!strcmp(tok, "proj") && value) proj = value;
+		else if (!strcmp(tok, "datum") && value) datum = value;
+		else if (!strcmp(tok, "ellps") && value) ellps = value;
+		else if (!strcmp(tok, "units") && value) units = value;
+		else if (!strcmp(tok, "nadgrids") && value) nadgrids = value;
+		else if (!strcmp(tok, "zone") && value) zone = atoi(value);
+		else if (!strcmp(tok, "south") && !value) south = 1;
+		else if (!strcmp(tok, "a") && value) a = strtod(value, NULL);
+		else if (!strcmp(tok, "b") && value) b = strtod(value, NULL);
+		else if (!strcmp(tok, "no_defs") || !strcmp(tok, "wktext")) continue;
+		/* Parameters that must be at their default */
+		else if ((!strcmp(tok, "lat_ts") || !strcmp(tok, "lon_0") ||
+		          !strcmp(tok, "x_0") || !strcmp(tok, "y_0")) && value)
+			ok = proj4_fast_param_is(value, 0.0);
+		else if ((!strcmp(tok, "k") || !strcmp(tok, "k_0")) && value)
+			ok = proj4_fast_param_is(value, 1.0);
+		else
+			ok = 0;
+	}
+
+	if (ok && proj && units == NULL && nadgrids == NULL && a == 0.0 &&
+	        (!strcmp(proj, "longlat") || !strcmp(proj, "latlong")) &&
+	        datum && !strcmp(datum, "WGS84") && (ellps == NULL || !strcmp(ellps, "WGS84")))
+	{
+		def->kind = PROJ4_FAST_LONGLAT;
+	}
+	else if (ok && proj && !strcmp(proj, "merc") && datum == NULL && ellps == NULL &&
+	         a == WGS84_A && b == WGS84_A && units && !strcmp(units, "m") &&
+	         nadgrids && !strcmp(nadgrids, "@null"))
+	{
+		def->kind = PROJ4_FAST_MERC;
+	}
+	else if (ok && proj && !strcmp(proj, "utm") && zone >= 1 && zone <= 60 &&
+	         datum && !strcmp(datum, "WGS84") && (ellps == NULL || !strcmp(ellps, "WGS84")) &&
+	         a == 0.0 && units && !strcmp(units, "m") && nadgrids == NULL)
+	{
+		def->kind = PROJ4_FAST_UTM;
+		def->zone = south ? -zone : zone;
+	}
+
+	pfree(str);
+}
+
+/* Reduce a longitude to -pi..pi, as PROJ.4's adjlon() */
+static double
+proj4_fast_adjlon(double lon)
+{
+	if (fabs(lon) <= 3.14159265359)
+		return lon;
+	lon += M_PI;
+	lon -= 2.0 * M_PI * floor(lon / (2.0 * M_PI));
+	lon -= M_PI;
+	return lon;
+}
+
+/* Coefficients of the meridian distance series, as pj_enfn() */
+static void
+proj4_fast_enfn(double es, double *en)
+{
+	double t;
+
+	en[0] = 1. - es * (.25 + es * (.046875 + es * (.01953125 + es * .01068115234375)));
+	en[1] = es * (.75 - es * (.046875 + es * (.01953125 + es * .01068115234375)));
+	en[2] = (t = es * es) * (.46875 - es * (.01302083333333333333 + es * .00712076822916666666));
+	en[3] = (t *= es) * (.36458333333333333333 - es * .00569661458333333333);
+	en[4] = t * es * .3076171875;
+}
+
+/* Meridian distance, as pj_mlfn() */
+static double
+proj4_fast_mlfn(double phi, double sphi, double cphi, const double *en)
+{
+	cphi *= sphi;
+	sphi *= sphi;
+	return en[0] * phi - cphi * (en[1] + sphi * (en[2] + sphi * (en[3] + sphi * en[4])));
+}
+
+/* Inverse meridian distance, as pj_inv_mlfn() */
+static int
+proj4_fast_inv_mlfn(double arg, double es, const double *en, double *phi)
+{
+	double s, t, k = 1. / (1. - es);
+	int i;
+
+	*phi = arg;
+	for (i = 10; i; --i)
+	{
+		s = sin(*phi);
+		t = 1. - es * s * s;
+		*phi -= t = (proj4_fast_mlfn(*phi, s, cos(*phi), en) - arg) * (t * sqrt(t)) * k;
+		if (fabs(t) < 1e-11)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Turn x/y in the source system into longitude/latitude in radians.
+ * Returns 0 for points PROJ.4 would refuse, so the caller can let
+ * PROJ.4 report them.
+ */
+static int
+proj4_fast_inverse(const PROJ4FastDef *def, const double *en, int n, double *x, double *y)
+{
+	double esp = WGS84_ES / (1. - WGS84_ES);
+	double lam0, phi, lam, sinphi, cosphi, t, nn, d, ds, con, xx, yy;
+	int i;
+
+	switch (def->kind)
+	{
+	case PROJ4_FAST_LONGLAT:
+		for (i = 0; i < n; i++)
+		{
+			x[i] *= M_PI/180.0;
+			y[i] *= M_PI/180.0;
+		}
+		return 1;
+
+	case PROJ4_FAST_MERC:
+		for (i = 0; i < n; i++)
+		{
+			xx = x[i] / WGS84_A;
+			yy = y[i] / WGS84_A;
+			y[i] = M_PI_2 - 2. * atan(exp(-yy));
+			x[i] = proj4_fast_adjlon(xx);
+		}
+		return 1;
+
+	case PROJ4_FAST_UTM:
+		lam0 = (abs(def->zone) - .5) * M_PI / 30. - M_PI;
+		for (i = 0; i < n; i++)
+		{
+			xx = (x[i] - UTM_X0) / WGS84_A;
+			yy = (y[i] - (def->zone < 0 ? UTM_Y0_SOUTH : 0.0)) / WGS84_A;
+
+			if (!proj4_fast_inv_mlfn(yy / UTM_K0, WGS84_ES, en, &phi))
+				return 0;
+
+			if (fabs(phi) >= M_PI_2)
+			{
+				phi = yy < 0. ? -M_PI_2 : M_PI_2;
+				lam = 0.;
+			}
+			else
+			{
+				sinphi = sin(phi);
+				cosphi = cos(phi);
+				t = fabs(cosphi) > 1e-10 ? sinphi/cosphi : 0.;
+				nn = esp * cosphi * cosphi;
+				d = xx * sqrt(con = 1. - WGS84_ES * sinphi * sinphi) / UTM_K0;
+				con *= t;
+				t *= t;
+				ds = d * d;
+				phi -= (con * ds / (1.-WGS84_ES)) * .5 * (1. -
+				        ds * .08333333333333333333 * (5. + t * (3. - 9. * nn) + nn * (1. - 4 * t) -
+				                ds * .03333333333333333333 * (61. + t * (90. - 252. * nn +
+				                        45. * t) + 46. * nn
+				                        - ds * .01785714285714285714 * (1385. + t * (3633. + t * (4095. + 1574. * t)))
+				                                                     )));
+				lam = d * (1. -
+				           ds * .16666666666666666666 * (1. + 2.*t + nn -
+				                   ds * .05 * (5. + t * (28. + 24.*t + 8.*nn) + 6.*nn
+				                               - ds * .02380952380952380952 * (61. + t * (662. + t * (1320. + 720.*t)))
+				                              ))) / cosphi;
+			}
+			x[i] = proj4_fast_adjlon(lam + lam0);
+			y[i] = phi;
+		}
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Turn longitude/latitude in radians into x/y in the target system.
+ * Returns 0 for points PROJ.4 would refuse.
+ */
+static int
+proj4_fast_forward(const PROJ4FastDef *def, const double *en, int n, double *x, double *y)
+{
+	double esp = WGS84_ES / (1. - WGS84_ES);
+	double lam0, lam, phi, al, als, nn, cosphi, sinphi, t;
+	int i;
+
+	/* The checks pj_fwd() makes before projecting anything */
+	if (def->kind != PROJ4_FAST_LONGLAT)
+	{
+		for (i = 0; i < n; i++)
+		{
+			if (!(fabs(y[i]) - M_PI_2 <= 1.e-12) || !(fabs(x[i]) <= 10.))
+				return 0;
+		}
+	}
+
+	switch (def->kind)
+	{
+	case PROJ4_FAST_LONGLAT:
+		for (i = 0; i < n; i++)
+		{
+			x[i] *= 180.0/M_PI;
+			y[i] *= 180.0/M_PI;
+		}
+		return 1;
+
+	case PROJ4_FAST_MERC:
+		for (i = 0; i < n; i++)
+		{
+			if (fabs(fabs(y[i]) - M_PI_2) <= PROJ4_FAST_EPS10)
+				return 0;
+		}
+		for (i = 0; i < n; i++)
+		{
+			x[i] = WGS84_A * proj4_fast_adjlon(x[i]);
+			y[i] = WGS84_A * log(tan(M_PI_4 + .5 * y[i]));
+		}
+		return 1;
+
+	case PROJ4_FAST_UTM:
+		lam0 = (abs(def->zone) - .5) * M_PI / 30. - M_PI;
+		for (i = 0; i < n; i++)
+		{
+			if (fabs(proj4_fast_adjlon(x[i] - lam0)) > M_PI_2)
+				return 0;
+		}
+		for (i = 0; i < n; i++)
+		{
+			lam = proj4_fast_adjlon(x[i] - lam0);
+			phi = y[i];
+			sinphi = sin(phi);
+			cosphi = cos(phi);
+			t = fabs(cosphi) > 1e-10 ? sinphi/cosphi : 0.;
+			t *= t;
+			al = cosphi * lam;
+			als = al * al;
+			al /= sqrt(1. - WGS84_ES * sinphi * sinphi);
+			nn = esp * cosphi * cosphi;
+			x[i] = UTM_K0 * al * (1. +
+			                      .16666666666666666666 * als * (1. - t + nn +
+			                              .05 * als * (5. + t * (t - 18.) + nn * (14. - 58. * t)
+			                                           + .02380952380952380952 * als * (61. + t * ( t * (179. - t) - 479. ) )
+			                                          )));
+			y[i] = UTM_K0 * (proj4_fast_mlfn(phi, sinphi, cosphi, en) +
+			                 sinphi * al * lam * .5 * ( 1. +
+			                         .08333333333333333333 * als * (5. - t + nn * (9. + 4. * nn) +
+			                                 .03333333333333333333 * als * (61. + t * (t - 58.) + nn * (270. - 330 * t)
+			                                         + .01785714285714285714 * als * (1385. + t * ( t * (543. - t) - 3111.) )
+			                                                               ))));
+			x[i] = WGS84_A * x[i] + UTM_X0;
+			y[i] = WGS84_A * y[i] + (def->zone < 0 ? UTM_Y0_SOUTH : 0.0);
+		}
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Transform a POINTARRAY in place between two systems classified by
+ * proj4_fast_classify(), a block at a time like transform_pointarray().
+ * Blocks holding a point PROJ.4 would refuse go through transform_point()
+ * instead, so the usual error is raised. If either side is not a known
+ * system this is just transform_pointarray().
+ */
+int
+transform_pointarray_fast(POINTARRAY *pa, const PROJ4FastDef *src, const PROJ4FastDef *dst, projPJ srcpj, projPJ dstpj)
+{
+	double x[PROJ4_TRANSFORM_BLOCK];
+	double y[PROJ4_TRANSFORM_BLOCK];
+	double en[5];
+	int ptsize = pointArray_ptsize(pa);
+	int start, n, i;
+	POINT4D p;
+	uchar *ptr;
+
+	if (src == NULL || dst == NULL ||
+	        src->kind == PROJ4_FAST_NONE || dst->kind == PROJ4_FAST_NONE)
+		return transform_pointarray(pa, srcpj, dstpj);
+
+	proj4_fast_enfn(WGS84_ES, en);
+
+	for (start = 0; start < pa->npoints; start += n)
+	{
+		n = LW_MIN(pa->npoints - start, PROJ4_TRANSFORM_BLOCK);
+
+		ptr = getPoint_internal(pa, start);
+		for (i = 0; i < n; i++, ptr += ptsize)
+		{
+			memcpy(&x[i], ptr, sizeof(double));
+			memcpy(&y[i], ptr + sizeof(double), sizeof(double));
+		}
+
+		if (!proj4_fast_inverse(src, en, n, x, y) || !proj4_fast_forward(dst, en, n, x, y))
+		{
+			for (i = start; i < start + n; i++)
+			{
+				*pj_get_errno_ref() = 0;
+				getPoint4d_p(pa, i, &p);
+				transform_point(&p, srcpj, dstpj);
+				setPoint4d(pa, i, &p);
+			}
+			continue;
+		}
+
+		ptr = getPoint_internal(pa, start);
+		for (i = 0; i < n; i++, ptr += ptsize)
+		{
+			memcpy(ptr, &x[i], sizeof(double));
+			memcpy(ptr + sizeof(double), &y[i], sizeof(double));
+		}
+	}
+
+	return 1;
+}
+
 
 
@@ -17,4 +17,7 @@
 
 projPJ make_project(char *str1);
 int transform_point(POINT4D *pt, projPJ srcdefn, projPJ dstdefn);
+int transform_pointarray(POINTARRAY *pa, projPJ srcpj, projPJ dstpj);
 char* GetProj4StringSPI(int srid);
+projPJ GetProjectionFromPROJ4SRSCache(int srid, int other_srid);
+void PROJ4SRSCacheCheckValid(FunctionCallInfo fcinfo);
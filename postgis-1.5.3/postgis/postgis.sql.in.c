@@ -94,7 +94,7 @@ CREATE OR REPLACE FUNCTION st_geometry_send(geometry)
 	AS 'MODULE_PATHNAME','LWGEOM_send'
 	LANGUAGE 'C' IMMUTABLE STRICT;
 
-CREATE OR REPLACE FUNCTION geometry_in(cstring)
+CREATE OR REPLACE FUNCTION geometry_in(cstring, oid, integer)
 	RETURNS geometry
 	AS 'MODULE_PATHNAME','LWGEOM_in'
 	LANGUAGE 'C' IMMUTABLE STRICT;
@@ -109,7 +109,7 @@ CREATE OR REPLACE FUNCTION geometry_analyze(internal)
 	AS 'MODULE_PATHNAME', 'LWGEOM_analyze'
 	LANGUAGE 'C' VOLATILE STRICT;
 
-CREATE OR REPLACE FUNCTION geometry_recv(internal)
+CREATE OR REPLACE FUNCTION geometry_recv(internal, oid, integer)
 	RETURNS geometry
 	AS 'MODULE_PATHNAME','LWGEOM_recv'
 	LANGUAGE 'C' IMMUTABLE STRICT;
@@ -119,17 +119,58 @@ CREATE OR REPLACE FUNCTION geometry_send(geometry)
 	AS 'MODULE_PATHNAME','LWGEOM_send'
 	LANGUAGE 'C' IMMUTABLE STRICT;
 
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_typmod_in(cstring[])
+	RETURNS integer
+	AS 'MODULE_PATHNAME','geometry_typmod_in'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_typmod_out(integer)
+	RETURNS cstring
+	AS 'MODULE_PATHNAME','geometry_typmod_out'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
 CREATE TYPE geometry (
 	internallength = variable,
 	input = geometry_in,
 	output = geometry_out,
 	send = geometry_send,
 	receive = geometry_recv,
+	typmod_in = geometry_typmod_in,
+	typmod_out = geometry_typmod_out,
 	delimiter = ':',
 	analyze = geometry_analyze,
 	storage = main
 );
 
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry(geometry, integer, boolean)
+	RETURNS geometry
+	AS 'MODULE_PATHNAME','geometry_enforce_typmod'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE CAST (geometry AS geometry) WITH FUNCTION geometry(geometry, integer, boolean) AS IMPLICIT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION postgis_typmod_dims(integer)
+	RETURNS integer
+	AS 'MODULE_PATHNAME','geography_typmod_dims'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION postgis_typmod_srid(integer)
+	RETURNS integer
+	AS 'MODULE_PATHNAME','geometry_typmod_srid'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION postgis_typmod_type(integer)
+	RETURNS text
+	AS 'MODULE_PATHNAME','geometry_typmod_type'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
 -------------------------------------------
 -- Affine transforms
 -------------------------------------------
@@ -572,6 +613,20 @@ CREATE OR REPLACE FUNCTION geometry_cmp(geometry, geometry)
 	AS 'MODULE_PATHNAME', 'lwgeom_cmp'
 	LANGUAGE 'C' IMMUTABLE STRICT;
 
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_hash(geometry)
+	RETURNS integer
+	AS 'MODULE_PATHNAME', 'lwgeom_hash'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+#if POSTGIS_PGSQL_VERSION >= 92
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_sortsupport(internal)
+	RETURNS void
+	AS 'MODULE_PATHNAME', 'lwgeom_sortsupport'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+#endif
+
 --
 -- Sorting operators for Btree
 --
@@ -591,7 +646,7 @@ CREATE OPERATOR <= (
 CREATE OPERATOR = (
 	LEFTARG = geometry, RIGHTARG = geometry, PROCEDURE = geometry_eq,
 	COMMUTATOR = '=', -- we might implement a faster negator here
-	RESTRICT = contsel, JOIN = contjoinsel
+	RESTRICT = contsel, JOIN = contjoinsel, HASHES
 );
 
 CREATE OPERATOR >= (
@@ -613,7 +668,18 @@ CREATE OPERATOR CLASS btree_geometry_ops
 	OPERATOR	3	= ,
 	OPERATOR	4	>= ,
 	OPERATOR	5	> ,
+#if POSTGIS_PGSQL_VERSION >= 92
+	FUNCTION	1	geometry_cmp (geometry, geometry),
+	FUNCTION	2	geometry_sortsupport (internal);
+#else
 	FUNCTION	1	geometry_cmp (geometry, geometry);
+#endif
+
+-- Availability: 1.5.4
+CREATE OPERATOR CLASS hash_geometry_ops
+	DEFAULT FOR TYPE geometry USING hash AS
+	OPERATOR	1	= ,
+	FUNCTION	1	geometry_hash (geometry);
 
 
 
@@ -932,6 +998,174 @@ CREATE OPERATOR CLASS gist_geometry_ops
 	FUNCTION        6        LWGEOM_gist_picksplit (internal, internal),
 	FUNCTION        7        LWGEOM_gist_same (box2d, box2d, internal);
 
+-------------------------------------------
+-- GiST opclass with quantized keys
+-------------------------------------------
+
+#if POSTGIS_PGSQL_VERSION >= 130
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_gist_q_options(internal)
+	RETURNS void
+	AS 'MODULE_PATHNAME' ,'LWGEOM_gist_q_options'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_gist_q_consistent(internal,geometry,int4)
+	RETURNS bool
+	AS 'MODULE_PATHNAME' ,'LWGEOM_gist_q_consistent'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_gist_q_compress(internal)
+	RETURNS internal
+	AS 'MODULE_PATHNAME','LWGEOM_gist_q_compress'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_gist_q_penalty(internal,internal,internal)
+	RETURNS internal
+	AS 'MODULE_PATHNAME' ,'LWGEOM_gist_q_penalty'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_gist_q_picksplit(internal, internal)
+	RETURNS internal
+	AS 'MODULE_PATHNAME' ,'LWGEOM_gist_q_picksplit'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_gist_q_union(internal, internal)
+	RETURNS int8
+	AS 'MODULE_PATHNAME' ,'LWGEOM_gist_q_union'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_gist_q_same(int8, int8, internal)
+	RETURNS internal
+	AS 'MODULE_PATHNAME' ,'LWGEOM_gist_q_same'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+-- Keys are 8 byte grid codes over the extent given as options,
+-- e.g. (geom gist_geometry_ops_q (xmin=0, ymin=0, xmax=1e6, ymax=1e6))
+CREATE OPERATOR CLASS gist_geometry_ops_q
+	FOR TYPE geometry USING gist AS
+	STORAGE 	int8,
+	OPERATOR        3        &&	,
+	OPERATOR        6        ~=	,
+	OPERATOR        7        ~	,
+	OPERATOR        8        @	,
+	FUNCTION        1        geometry_gist_q_consistent (internal, geometry, int4),
+	FUNCTION        2        geometry_gist_q_union (internal, internal),
+	FUNCTION        3        geometry_gist_q_compress (internal),
+	FUNCTION        5        geometry_gist_q_penalty (internal, internal, internal),
+	FUNCTION        6        geometry_gist_q_picksplit (internal, internal),
+	FUNCTION        7        geometry_gist_q_same (int8, int8, internal),
+	FUNCTION        10       geometry_gist_q_options (internal);
+#endif
+
+-------------------------------------------
+-- SP-GiST opclasses for point geometries
+-------------------------------------------
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_distance_centroid(geometry, geometry)
+	RETURNS float8
+	AS 'MODULE_PATHNAME', 'LWGEOM_distance_centroid'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OPERATOR <-> (
+	LEFTARG = geometry, RIGHTARG = geometry, PROCEDURE = geometry_distance_centroid,
+	COMMUTATOR = '<->'
+);
+
+#if POSTGIS_PGSQL_VERSION >= 92
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_spgist_quad_config(internal, internal)
+	RETURNS void
+	AS 'MODULE_PATHNAME', 'LWGEOM_spgist_quad_config'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_spgist_quad_choose(internal, internal)
+	RETURNS void
+	AS 'MODULE_PATHNAME', 'LWGEOM_spgist_quad_choose'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_spgist_quad_picksplit(internal, internal)
+	RETURNS void
+	AS 'MODULE_PATHNAME', 'LWGEOM_spgist_quad_picksplit'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_spgist_quad_inner_consistent(internal, internal)
+	RETURNS void
+	AS 'MODULE_PATHNAME', 'LWGEOM_spgist_quad_inner_consistent'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_spgist_kd_config(internal, internal)
+	RETURNS void
+	AS 'MODULE_PATHNAME', 'LWGEOM_spgist_kd_config'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_spgist_kd_choose(internal, internal)
+	RETURNS void
+	AS 'MODULE_PATHNAME', 'LWGEOM_spgist_kd_choose'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_spgist_kd_picksplit(internal, internal)
+	RETURNS void
+	AS 'MODULE_PATHNAME', 'LWGEOM_spgist_kd_picksplit'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_spgist_kd_inner_consistent(internal, internal)
+	RETURNS void
+	AS 'MODULE_PATHNAME', 'LWGEOM_spgist_kd_inner_consistent'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_spgist_leaf_consistent(internal, internal)
+	RETURNS bool
+	AS 'MODULE_PATHNAME', 'LWGEOM_spgist_leaf_consistent'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OPERATOR CLASS spgist_geometry_quad_ops
+	FOR TYPE geometry USING spgist AS
+	OPERATOR        3        &&	,
+	OPERATOR        7        ~	,
+	OPERATOR        8        @	,
+#if POSTGIS_PGSQL_VERSION >= 120
+	OPERATOR        13       <-> FOR ORDER BY pg_catalog.float_ops,
+#endif
+	FUNCTION        1        geometry_spgist_quad_config (internal, internal),
+	FUNCTION        2        geometry_spgist_quad_choose (internal, internal),
+	FUNCTION        3        geometry_spgist_quad_picksplit (internal, internal),
+	FUNCTION        4        geometry_spgist_quad_inner_consistent (internal, internal),
+	FUNCTION        5        geometry_spgist_leaf_consistent (internal, internal);
+
+-- Availability: 1.5.4
+CREATE OPERATOR CLASS spgist_geometry_kd_ops
+	FOR TYPE geometry USING spgist AS
+	OPERATOR        3        &&	,
+	OPERATOR        7        ~	,
+	OPERATOR        8        @	,
+#if POSTGIS_PGSQL_VERSION >= 120
+	OPERATOR        13       <-> FOR ORDER BY pg_catalog.float_ops,
+#endif
+	FUNCTION        1        geometry_spgist_kd_config (internal, internal),
+	FUNCTION        2        geometry_spgist_kd_choose (internal, internal),
+	FUNCTION        3        geometry_spgist_kd_picksplit (internal, internal),
+	FUNCTION        4        geometry_spgist_kd_inner_consistent (internal, internal),
+	FUNCTION        5        geometry_spgist_leaf_consistent (internal, internal);
+#endif
+
 -------------------------------------------
 -- other lwgeom functions
 -------------------------------------------
@@ -1626,6 +1860,42 @@ CREATE OR REPLACE FUNCTION ST_GeomFromEWKB(bytea)
 	AS 'MODULE_PATHNAME','LWGEOMFromWKB'
 	LANGUAGE 'C' IMMUTABLE STRICT;
 
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION ST_AsTWKB(geometry, integer)
+	RETURNS bytea
+	AS 'MODULE_PATHNAME','TWKBFromLWGEOM'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION ST_AsTWKB(geometry, integer, boolean, boolean)
+	RETURNS bytea
+	AS 'MODULE_PATHNAME','TWKBFromLWGEOM'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION ST_AsTWKB(geometry[], bigint[], integer)
+	RETURNS bytea
+	AS 'MODULE_PATHNAME','TWKBFromLWGEOMArray'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION ST_AsTWKB(geometry[], bigint[], integer, boolean, boolean)
+	RETURNS bytea
+	AS 'MODULE_PATHNAME','TWKBFromLWGEOMArray'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION ST_GeomFromTWKB(bytea)
+	RETURNS geometry
+	AS 'MODULE_PATHNAME','LWGEOMFromTWKB'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION ST_GeomFromTWKB(bytea, integer)
+	RETURNS geometry
+	AS 'MODULE_PATHNAME','LWGEOMFromTWKB'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
 -- Deprecation in 1.2.3
 CREATE OR REPLACE FUNCTION GeomFromEWKT(text)
 	RETURNS geometry
@@ -2045,17 +2315,37 @@ CREATE OR REPLACE FUNCTION ST_Combine_BBox(box3d_extent,geometry)
 	AS 'MODULE_PATHNAME', 'BOX3D_combine'
 	LANGUAGE 'C' IMMUTABLE;
 
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_extent_transfn(box3d_extent,geometry)
+	RETURNS box3d_extent
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C' IMMUTABLE;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_extent_combinefn(box3d_extent,box3d_extent)
+	RETURNS box3d_extent
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
 -- Deprecation in 1.2.3
 CREATE AGGREGATE Extent(
-	sfunc = ST_combine_bbox,
+	sfunc = pgis_geometry_extent_transfn,
 	basetype = geometry,
+#if POSTGIS_PGSQL_VERSION >= 96
+	combinefunc = pgis_geometry_extent_combinefn,
+	parallel = safe,
+#endif
 	stype = box3d_extent
 	);
 
 -- Availability: 1.2.2
 CREATE AGGREGATE ST_Extent(
-	sfunc = ST_combine_bbox,
+	sfunc = pgis_geometry_extent_transfn,
 	basetype = geometry,
+#if POSTGIS_PGSQL_VERSION >= 96
+	combinefunc = pgis_geometry_extent_combinefn,
+	parallel = safe,
+#endif
 	stype = box3d_extent
 	);
 
@@ -2071,17 +2361,37 @@ CREATE OR REPLACE FUNCTION ST_Combine_BBox(box3d,geometry)
 	AS 'MODULE_PATHNAME', 'BOX3D_combine'
 	LANGUAGE 'C' IMMUTABLE;
 
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_extent_transfn(box3d,geometry)
+	RETURNS box3d
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C' IMMUTABLE;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_extent_combinefn(box3d,box3d)
+	RETURNS box3d
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
 -- Deprecation in 1.2.3
 CREATE AGGREGATE Extent3d(
-	sfunc = combine_bbox,
+	sfunc = pgis_geometry_extent_transfn,
 	basetype = geometry,
+#if POSTGIS_PGSQL_VERSION >= 96
+	combinefunc = pgis_geometry_extent_combinefn,
+	parallel = safe,
+#endif
 	stype = box3d
 	);
 
 -- Availability: 1.2.2
 CREATE AGGREGATE ST_Extent3d(
-	sfunc = ST_combine_bbox,
+	sfunc = pgis_geometry_extent_transfn,
 	basetype = geometry,
+#if POSTGIS_PGSQL_VERSION >= 96
+	combinefunc = pgis_geometry_extent_combinefn,
+	parallel = safe,
+#endif
 	stype = box3d
 	);
 
@@ -2111,6 +2421,20 @@ CREATE OR REPLACE FUNCTION ST_estimated_extent(text,text) RETURNS box2d AS
 	'MODULE_PATHNAME', 'LWGEOM_estimated_extent'
 	LANGUAGE 'C' IMMUTABLE STRICT SECURITY DEFINER;
 
+-----------------------------------------------------------------------
+-- INDEX_EXTENT( <schema name>, <table name>, <column name> )
+-- INDEX_EXTENT( <table name>, <column name> )
+-----------------------------------------------------------------------
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION ST_Index_Extent(text,text,text) RETURNS box2d AS
+	'MODULE_PATHNAME', 'LWGEOM_index_extent'
+	LANGUAGE 'C' STABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION ST_Index_Extent(text,text) RETURNS box2d AS
+	'MODULE_PATHNAME', 'LWGEOM_index_extent'
+	LANGUAGE 'C' STABLE STRICT;
+
 -----------------------------------------------------------------------
 -- FIND_EXTENT( <schema name>, <table name>, <column name> )
 -----------------------------------------------------------------------
@@ -2442,7 +2766,7 @@ BEGIN
 
 	-- Iterate through all geometry columns in this table
 	FOR gcs IN
-	SELECT n.nspname, c.relname, a.attname
+	SELECT n.nspname, c.relname, a.attname, a.atttypmod
 		FROM pg_class c,
 			 pg_attribute a,
 			 pg_type t,
@@ -2466,8 +2790,21 @@ BEGIN
 
 	gc_is_valid := true;
 
+	-- geometry(Type,SRID) columns carry their dimensions, type and
+	-- possibly srid in the typmod, no constraint is needed for those
+	gsrid := NULL;
+	gndims := NULL;
+	gtype := NULL;
+	IF (gcs.atttypmod >= 0) THEN
+		gndims := postgis_typmod_dims(gcs.atttypmod);
+		gtype := postgis_typmod_type(gcs.atttypmod);
+		IF (postgis_typmod_srid(gcs.atttypmod) > 0) THEN
+			gsrid := postgis_typmod_srid(gcs.atttypmod);
+		END IF;
+	END IF;
+
 	-- Try to find srid check from system tables (pg_constraint)
-	gsrid :=
+	gsrid := COALESCE(gsrid,
 		(SELECT replace(replace(split_part(s.consrc, ' = ', 2), ')', ''), '(', '')
 		 FROM pg_class c, pg_namespace n, pg_attribute a, pg_constraint s
 		 WHERE n.nspname = gcs.nspname
@@ -2477,7 +2814,7 @@ BEGIN
 		 AND s.connamespace = n.oid
 		 AND s.conrelid = c.oid
 		 AND a.attnum = ANY (s.conkey)
-		 AND s.consrc LIKE '%srid(% = %');
+		 AND s.consrc LIKE '%srid(% = %'));
 	IF (gsrid IS NULL) THEN
 		-- Try to find srid from the geometry itself
 		EXECUTE 'SELECT srid(' || quote_ident(gcs.attname) || ')
@@ -2501,7 +2838,7 @@ BEGIN
 	END IF;
 
 	-- Try to find ndims check from system tables (pg_constraint)
-	gndims :=
+	gndims := COALESCE(gndims,
 		(SELECT replace(split_part(s.consrc, ' = ', 2), ')', '')
 		 FROM pg_class c, pg_namespace n, pg_attribute a, pg_constraint s
 		 WHERE n.nspname = gcs.nspname
@@ -2511,7 +2848,7 @@ BEGIN
 		 AND s.connamespace = n.oid
 		 AND s.conrelid = c.oid
 		 AND a.attnum = ANY (s.conkey)
-		 AND s.consrc LIKE '%ndims(% = %');
+		 AND s.consrc LIKE '%ndims(% = %'));
 	IF (gndims IS NULL) THEN
 		-- Try to find ndims from the geometry itself
 		EXECUTE 'SELECT ndims(' || quote_ident(gcs.attname) || ')
@@ -2535,7 +2872,7 @@ BEGIN
 	END IF;
 
 	-- Try to find geotype check from system tables (pg_constraint)
-	gtype :=
+	gtype := COALESCE(gtype,
 		(SELECT replace(split_part(s.consrc, '''', 2), ')', '')
 		 FROM pg_class c, pg_namespace n, pg_attribute a, pg_constraint s
 		 WHERE n.nspname = gcs.nspname
@@ -2545,7 +2882,7 @@ BEGIN
 		 AND s.connamespace = n.oid
 		 AND s.conrelid = c.oid
 		 AND a.attnum = ANY (s.conkey)
-		 AND s.consrc LIKE '%geometrytype(% = %');
+		 AND s.consrc LIKE '%geometrytype(% = %'));
 	IF (gtype IS NULL) THEN
 		-- Try to find geotype from the geometry itself
 		EXECUTE 'SELECT geometrytype(' || quote_ident(gcs.attname) || ')
@@ -2748,21 +3085,24 @@ LANGUAGE 'plpgsql' VOLATILE;
 
 -----------------------------------------------------------------------
 -- ADDGEOMETRYCOLUMN
---   <catalogue>, <schema>, <table>, <column>, <srid>, <type>, <dim>
+--   <catalogue>, <schema>, <table>, <column>, <srid>, <type>, <dim>, <use_typmod>
 -----------------------------------------------------------------------
 --
 -- Type can be one of GEOMETRY, GEOMETRYCOLLECTION, POINT, MULTIPOINT, POLYGON,
 -- MULTIPOLYGON, LINESTRING, or MULTILINESTRING.
 --
--- Geometry types (except GEOMETRY) are checked for consistency using a CHECK constraint.
 -- Uses an ALTER TABLE command to add the geometry column to the table.
 -- Addes a row to geometry_columns.
--- Addes a constraint on the table that all the geometries MUST have the same
--- SRID. Checks the coord_dimension to make sure its between 0 and 3.
+-- With use_typmod the column is declared as geometry(Type,SRID), which
+-- checks the type, dimensions and SRID of every geometry stored.
+-- Otherwise, or when the SRID is -1, which a typmod cannot express,
+-- CHECK constraints are added to the table instead: geometry types
+-- (except GEOMETRY) are checked for consistency, all the geometries MUST
+-- have the same SRID and the same number of dimensions.
 -- Should also check the precision grid (future expansion).
 --
 -----------------------------------------------------------------------
-CREATE OR REPLACE FUNCTION AddGeometryColumn(varchar,varchar,varchar,varchar,integer,varchar,integer)
+CREATE OR REPLACE FUNCTION AddGeometryColumn(varchar,varchar,varchar,varchar,integer,varchar,integer,boolean)
 	RETURNS text
 	AS
 $$
@@ -2774,10 +3114,12 @@ DECLARE
 	new_srid alias for $5;
 	new_type alias for $6;
 	new_dim alias for $7;
+	use_typmod alias for $8;
 	rec RECORD;
 	sr varchar;
 	real_schema name;
 	sql text;
+	typmod text;
 
 BEGIN
 
@@ -2880,11 +3222,32 @@ BEGIN
 	END IF;
 
 
+	-- Build the typmod: M types already carry their suffix
+	typmod := new_type;
+	IF ( NOT (new_type LIKE '%M') ) THEN
+		IF ( new_dim = 3 ) THEN
+			typmod := typmod || 'Z';
+		ELSIF ( new_dim = 4 ) THEN
+			typmod := typmod || 'ZM';
+		END IF;
+	END IF;
+	IF ( new_srid > 0 ) THEN
+		typmod := typmod || ',' || new_srid::text;
+	END IF;
+
+
 	-- Add geometry column to table
-	sql := 'ALTER TABLE ' ||
-		quote_ident(real_schema) || '.' || quote_ident(table_name)
-		|| ' ADD COLUMN ' || quote_ident(column_name) ||
-		' geometry ';
+	IF ( use_typmod ) THEN
+		sql := 'ALTER TABLE ' ||
+			quote_ident(real_schema) || '.' || quote_ident(table_name)
+			|| ' ADD COLUMN ' || quote_ident(column_name) ||
+			' geometry(' || typmod || ') ';
+	ELSE
+		sql := 'ALTER TABLE ' ||
+			quote_ident(real_schema) || '.' || quote_ident(table_name)
+			|| ' ADD COLUMN ' || quote_ident(column_name) ||
+			' geometry ';
+	END IF;
 	RAISE DEBUG '%', sql;
 	EXECUTE sql;
 
@@ -2915,35 +3278,39 @@ BEGIN
 	EXECUTE sql;
 
 
-	-- Add table CHECKs
-	sql := 'ALTER TABLE ' ||
-		quote_ident(real_schema) || '.' || quote_ident(table_name)
-		|| ' ADD CONSTRAINT '
-		|| quote_ident('enforce_srid_' || column_name)
-		|| ' CHECK (ST_SRID(' || quote_ident(column_name) ||
-		') = ' || new_srid::text || ')' ;
-	RAISE DEBUG '%', sql;
-	EXECUTE sql;
-
-	sql := 'ALTER TABLE ' ||
-		quote_ident(real_schema) || '.' || quote_ident(table_name)
-		|| ' ADD CONSTRAINT '
-		|| quote_ident('enforce_dims_' || column_name)
-		|| ' CHECK (ST_NDims(' || quote_ident(column_name) ||
-		') = ' || new_dim::text || ')' ;
-	RAISE DEBUG '%', sql;
-	EXECUTE sql;
+	-- Add table CHECKs for whatever the typmod does not enforce
+	IF ( NOT use_typmod OR new_srid <= 0 ) THEN
+		sql := 'ALTER TABLE ' ||
+			quote_ident(real_schema) || '.' || quote_ident(table_name)
+			|| ' ADD CONSTRAINT '
+			|| quote_ident('enforce_srid_' || column_name)
+			|| ' CHECK (ST_SRID(' || quote_ident(column_name) ||
+			') = ' || new_srid::text || ')' ;
+		RAISE DEBUG '%', sql;
+		EXECUTE sql;
+	END IF;
 
-	IF ( NOT (new_type = 'GEOMETRY')) THEN
+	IF ( NOT use_typmod ) THEN
 		sql := 'ALTER TABLE ' ||
-			quote_ident(real_schema) || '.' || quote_ident(table_name) || ' ADD CONSTRAINT ' ||
-			quote_ident('enforce_geotype_' || column_name) ||
-			' CHECK (GeometryType(' ||
-			quote_ident(column_name) || ')=' ||
-			quote_literal(new_type) || ' OR (' ||
-			quote_ident(column_name) || ') is null)';
+			quote_ident(real_schema) || '.' || quote_ident(table_name)
+			|| ' ADD CONSTRAINT '
+			|| quote_ident('enforce_dims_' || column_name)
+			|| ' CHECK (ST_NDims(' || quote_ident(column_name) ||
+			') = ' || new_dim::text || ')' ;
 		RAISE DEBUG '%', sql;
 		EXECUTE sql;
+
+		IF ( NOT (new_type = 'GEOMETRY')) THEN
+			sql := 'ALTER TABLE ' ||
+				quote_ident(real_schema) || '.' || quote_ident(table_name) || ' ADD CONSTRAINT ' ||
+				quote_ident('enforce_geotype_' || column_name) ||
+				' CHECK (GeometryType(' ||
+				quote_ident(column_name) || ')=' ||
+				quote_literal(new_type) || ' OR (' ||
+				quote_ident(column_name) || ') is null)';
+			RAISE DEBUG '%', sql;
+			EXECUTE sql;
+		END IF;
 	END IF;
 
 	RETURN
@@ -2956,6 +3323,29 @@ END;
 $$
 LANGUAGE 'plpgsql' VOLATILE STRICT;
 
+----------------------------------------------------------------------------
+-- ADDGEOMETRYCOLUMN ( <catalogue>, <schema>, <table>, <column>, <srid>, <type>, <dim> )
+----------------------------------------------------------------------------
+--
+-- This is a wrapper to the real AddGeometryColumn, declaring the
+-- column with a typmod when the geometry type accepts one. Databases
+-- upgraded from an older release keep a geometry type without
+-- typmod_in, and get constraints instead.
+--
+----------------------------------------------------------------------------
+-- Availability: 1.5.4 (typmod)
+CREATE OR REPLACE FUNCTION AddGeometryColumn(varchar,varchar,varchar,varchar,integer,varchar,integer) RETURNS text AS $$
+DECLARE
+	ret  text;
+	use_typmod boolean;
+BEGIN
+	SELECT typmodin::oid <> 0 FROM pg_type WHERE oid = 'geometry'::regtype INTO use_typmod;
+	SELECT AddGeometryColumn($1,$2,$3,$4,$5,$6,$7,use_typmod) into ret;
+	RETURN ret;
+END;
+$$
+LANGUAGE 'plpgsql' VOLATILE STRICT;
+
 ----------------------------------------------------------------------------
 -- ADDGEOMETRYCOLUMN ( <schema>, <table>, <column>, <srid>, <type>, <dim> )
 ----------------------------------------------------------------------------
@@ -3199,6 +3589,8 @@ DECLARE
 	okay boolean;
 	cname varchar;
 	real_schema name;
+	col_typmod integer;
+	typmod text;
 
 BEGIN
 
@@ -3230,6 +3622,13 @@ BEGIN
 		RETURN 'f';
 	END IF;
 
+	-- Find out if the column SRID is held in a typmod
+	SELECT a.atttypmod INTO col_typmod
+		FROM pg_attribute a, pg_class c, pg_namespace n
+		WHERE a.attrelid = c.oid AND c.relnamespace = n.oid
+		AND n.nspname = real_schema AND c.relname = table_name
+		AND a.attname = column_name AND NOT a.attisdropped;
+
 	-- Update ref from geometry_columns table
 	EXECUTE 'UPDATE geometry_columns SET SRID = ' || new_srid::text ||
 		' where f_table_schema = ' ||
@@ -3240,24 +3639,61 @@ BEGIN
 	-- Make up constraint name
 	cname = 'enforce_srid_'  || column_name;
 
-	-- Drop enforce_srid constraint
-	EXECUTE 'ALTER TABLE ' || quote_ident(real_schema) ||
-		'.' || quote_ident(table_name) ||
-		' DROP constraint ' || quote_ident(cname);
-
-	-- Update geometries SRID
-	EXECUTE 'UPDATE ' || quote_ident(real_schema) ||
-		'.' || quote_ident(table_name) ||
-		' SET ' || quote_ident(column_name) ||
-		' = setSRID(' || quote_ident(column_name) ||
-		', ' || new_srid::text || ')';
-
-	-- Reset enforce_srid constraint
-	EXECUTE 'ALTER TABLE ' || quote_ident(real_schema) ||
-		'.' || quote_ident(table_name) ||
-		' ADD constraint ' || quote_ident(cname) ||
-		' CHECK (srid(' || quote_ident(column_name) ||
-		') = ' || new_srid::text || ')';
+	IF ( col_typmod >= 0 ) THEN
+		-- An SRID of -1 cannot be held in the typmod, so such
+		-- columns carry an enforce_srid constraint as well
+		IF ( postgis_typmod_srid(col_typmod) <= 0 ) THEN
+			EXECUTE 'ALTER TABLE ' || quote_ident(real_schema) ||
+				'.' || quote_ident(table_name) ||
+				' DROP constraint ' || quote_ident(cname);
+		END IF;
+
+		typmod := postgis_typmod_type(col_typmod);
+		IF ( NOT (typmod LIKE '%M') ) THEN
+			IF ( postgis_typmod_dims(col_typmod) = 3 ) THEN
+				typmod := typmod || 'Z';
+			ELSIF ( postgis_typmod_dims(col_typmod) = 4 ) THEN
+				typmod := typmod || 'ZM';
+			END IF;
+		END IF;
+		IF ( new_srid > 0 ) THEN
+			typmod := typmod || ',' || new_srid::text;
+		END IF;
+
+		-- Rewrite the column with the new typmod and SRID
+		EXECUTE 'ALTER TABLE ' || quote_ident(real_schema) ||
+			'.' || quote_ident(table_name) ||
+			' ALTER COLUMN ' || quote_ident(column_name) ||
+			' TYPE geometry(' || typmod || ') USING setSRID(' ||
+			quote_ident(column_name) || ', ' || new_srid::text || ')';
+
+		IF ( new_srid <= 0 ) THEN
+			EXECUTE 'ALTER TABLE ' || quote_ident(real_schema) ||
+				'.' || quote_ident(table_name) ||
+				' ADD constraint ' || quote_ident(cname) ||
+				' CHECK (srid(' || quote_ident(column_name) ||
+				') = ' || new_srid::text || ')';
+		END IF;
+	ELSE
+		-- Drop enforce_srid constraint
+		EXECUTE 'ALTER TABLE ' || quote_ident(real_schema) ||
+			'.' || quote_ident(table_name) ||
+			' DROP constraint ' || quote_ident(cname);
+
+		-- Update geometries SRID
+		EXECUTE 'UPDATE ' || quote_ident(real_schema) ||
+			'.' || quote_ident(table_name) ||
+			' SET ' || quote_ident(column_name) ||
+			' = setSRID(' || quote_ident(column_name) ||
+			', ' || new_srid::text || ')';
+
+		-- Reset enforce_srid constraint
+		EXECUTE 'ALTER TABLE ' || quote_ident(real_schema) ||
+			'.' || quote_ident(table_name) ||
+			' ADD constraint ' || quote_ident(cname) ||
+			' CHECK (srid(' || quote_ident(column_name) ||
+			') = ' || new_srid::text || ')';
+	END IF;
 
 	RETURN real_schema || '.' || table_name || '.' || column_name ||' SRID changed to ' || new_srid::text;
 
@@ -3366,6 +3802,31 @@ CREATE OR REPLACE FUNCTION ST_Transform(geometry,integer)
 	AS 'MODULE_PATHNAME','transform'
 	LANGUAGE 'C' IMMUTABLE STRICT;
 
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION postgis_proj_cache_invalidate()
+	RETURNS trigger
+	AS 'MODULE_PATHNAME', 'postgis_proj_cache_invalidate'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION postgis_proj_cache_stats()
+	RETURNS text
+	AS 'MODULE_PATHNAME', 'postgis_proj_cache_stats'
+	LANGUAGE 'C' VOLATILE;
+
+-- Availability: 1.5.4
+-- Empties the cached projections in every backend when the table changes
+-- TRUNCATE triggers need PostgreSQL 8.4
+#if POSTGIS_PGSQL_VERSION >= 84
+CREATE TRIGGER spatial_ref_sys_proj_cache
+	AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON spatial_ref_sys
+	FOR EACH STATEMENT EXECUTE PROCEDURE postgis_proj_cache_invalidate();
+#else
+CREATE TRIGGER spatial_ref_sys_proj_cache
+	AFTER INSERT OR UPDATE OR DELETE ON spatial_ref_sys
+	FOR EACH STATEMENT EXECUTE PROCEDURE postgis_proj_cache_invalidate();
+#endif
+
 
 -----------------------------------------------------------------------
 -- POSTGIS_VERSION()
@@ -4082,6 +4543,66 @@ CREATE TYPE pgis_abs (
 	alignment = double
 );
 
+--
+-- Parallel aggregation needs an internal state type to be able to
+-- serialize the partial states, which pgis_abs cannot be.
+--
+#if POSTGIS_PGSQL_VERSION >= 96
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_accum_transfn(internal, geometry)
+	RETURNS internal
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_accum_finalfn(internal)
+	RETURNS geometry[]
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_union_finalfn(internal)
+	RETURNS geometry
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_collect_finalfn(internal)
+	RETURNS geometry
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_polygonize_finalfn(internal)
+	RETURNS geometry
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_makeline_finalfn(internal)
+	RETURNS geometry
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_accum_combinefn(internal, internal)
+	RETURNS internal
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_accum_serialfn(internal)
+	RETURNS bytea
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C' STRICT;
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION pgis_geometry_accum_deserialfn(bytea, internal)
+	RETURNS internal
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'C' STRICT;
+
+#else
 -- Availability: 1.4.0
 CREATE OR REPLACE FUNCTION pgis_geometry_accum_transfn(pgis_abs, geometry)
 	RETURNS pgis_abs
@@ -4118,11 +4639,21 @@ CREATE OR REPLACE FUNCTION pgis_geometry_makeline_finalfn(pgis_abs)
 	AS 'MODULE_PATHNAME'
 	LANGUAGE 'C';
 
+#endif
+
 -- Deprecation in: 1.2.3
 CREATE AGGREGATE accum (
 	sfunc = pgis_geometry_accum_transfn,
 	basetype = geometry,
+#if POSTGIS_PGSQL_VERSION >= 96
+	stype = internal,
+	combinefunc = pgis_geometry_accum_combinefn,
+	serialfunc = pgis_geometry_accum_serialfn,
+	deserialfunc = pgis_geometry_accum_deserialfn,
+	parallel = safe,
+#else
 	stype = pgis_abs,
+#endif
 	finalfunc = pgis_geometry_accum_finalfn
 	);
 
@@ -4130,7 +4661,15 @@ CREATE AGGREGATE accum (
 CREATE AGGREGATE ST_Accum (
 	sfunc = pgis_geometry_accum_transfn,
 	basetype = geometry,
+#if POSTGIS_PGSQL_VERSION >= 96
+	stype = internal,
+	combinefunc = pgis_geometry_accum_combinefn,
+	serialfunc = pgis_geometry_accum_serialfn,
+	deserialfunc = pgis_geometry_accum_deserialfn,
+	parallel = safe,
+#else
 	stype = pgis_abs,
+#endif
 	finalfunc = pgis_geometry_accum_finalfn
 	);
 
@@ -4156,7 +4695,15 @@ CREATE OR REPLACE FUNCTION ST_Union (geometry[])
 CREATE AGGREGATE ST_Union (
 	basetype = geometry,
 	sfunc = pgis_geometry_accum_transfn,
+#if POSTGIS_PGSQL_VERSION >= 96
+	stype = internal,
+	combinefunc = pgis_geometry_accum_combinefn,
+	serialfunc = pgis_geometry_accum_serialfn,
+	deserialfunc = pgis_geometry_accum_deserialfn,
+	parallel = safe,
+#else
 	stype = pgis_abs,
+#endif
 	finalfunc = pgis_geometry_union_finalfn
 	);
 
@@ -4164,7 +4711,15 @@ CREATE AGGREGATE ST_Union (
 CREATE AGGREGATE collect (
 	basetype = geometry,
 	sfunc = pgis_geometry_accum_transfn,
+#if POSTGIS_PGSQL_VERSION >= 96
+	stype = internal,
+	combinefunc = pgis_geometry_accum_combinefn,
+	serialfunc = pgis_geometry_accum_serialfn,
+	deserialfunc = pgis_geometry_accum_deserialfn,
+	parallel = safe,
+#else
 	stype = pgis_abs,
+#endif
 	finalfunc = pgis_geometry_collect_finalfn
 );
 
@@ -4172,7 +4727,15 @@ CREATE AGGREGATE collect (
 CREATE AGGREGATE ST_Collect (
 	BASETYPE = geometry,
 	SFUNC = pgis_geometry_accum_transfn,
+#if POSTGIS_PGSQL_VERSION >= 96
+	STYPE = internal,
+	COMBINEFUNC = pgis_geometry_accum_combinefn,
+	SERIALFUNC = pgis_geometry_accum_serialfn,
+	DESERIALFUNC = pgis_geometry_accum_deserialfn,
+	PARALLEL = SAFE,
+#else
 	STYPE = pgis_abs,
+#endif
 	FINALFUNC = pgis_geometry_collect_finalfn
 	);
 
@@ -4180,7 +4743,15 @@ CREATE AGGREGATE ST_Collect (
 CREATE AGGREGATE Polygonize (
 	BASETYPE = geometry,
 	SFUNC = pgis_geometry_accum_transfn,
+#if POSTGIS_PGSQL_VERSION >= 96
+	STYPE = internal,
+	COMBINEFUNC = pgis_geometry_accum_combinefn,
+	SERIALFUNC = pgis_geometry_accum_serialfn,
+	DESERIALFUNC = pgis_geometry_accum_deserialfn,
+	PARALLEL = SAFE,
+#else
 	STYPE = pgis_abs,
+#endif
 	FINALFUNC = pgis_geometry_polygonize_finalfn
 	);
 
@@ -4188,7 +4759,15 @@ CREATE AGGREGATE Polygonize (
 CREATE AGGREGATE ST_Polygonize (
 	BASETYPE = geometry,
 	SFUNC = pgis_geometry_accum_transfn,
+#if POSTGIS_PGSQL_VERSION >= 96
+	STYPE = internal,
+	COMBINEFUNC = pgis_geometry_accum_combinefn,
+	SERIALFUNC = pgis_geometry_accum_serialfn,
+	DESERIALFUNC = pgis_geometry_accum_deserialfn,
+	PARALLEL = SAFE,
+#else
 	STYPE = pgis_abs,
+#endif
 	FINALFUNC = pgis_geometry_polygonize_finalfn
 	);
 
@@ -4196,7 +4775,15 @@ CREATE AGGREGATE ST_Polygonize (
 CREATE AGGREGATE makeline (
 	BASETYPE = geometry,
 	SFUNC = pgis_geometry_accum_transfn,
+#if POSTGIS_PGSQL_VERSION >= 96
+	STYPE = internal,
+	COMBINEFUNC = pgis_geometry_accum_combinefn,
+	SERIALFUNC = pgis_geometry_accum_serialfn,
+	DESERIALFUNC = pgis_geometry_accum_deserialfn,
+	PARALLEL = SAFE,
+#else
 	STYPE = pgis_abs,
+#endif
 	FINALFUNC = pgis_geometry_makeline_finalfn
 	);
 
@@ -4204,7 +4791,15 @@ CREATE AGGREGATE makeline (
 CREATE AGGREGATE ST_MakeLine (
 	BASETYPE = geometry,
 	SFUNC = pgis_geometry_accum_transfn,
+#if POSTGIS_PGSQL_VERSION >= 96
+	STYPE = internal,
+	COMBINEFUNC = pgis_geometry_accum_combinefn,
+	SERIALFUNC = pgis_geometry_accum_serialfn,
+	DESERIALFUNC = pgis_geometry_accum_deserialfn,
+	PARALLEL = SAFE,
+#else
 	STYPE = pgis_abs,
+#endif
 	FINALFUNC = pgis_geometry_makeline_finalfn
 	);
 
@@ -6168,6 +6763,52 @@ LANGUAGE 'plpgsql' IMMUTABLE STRICT;
 #include "sqlmm.sql.in.c"
 #include "geography.sql.in.c"
 
+---------------------------------------------------------------
+-- N-D GEOMETRY INDEX
+--
+-- A GiST opclass keyed on gidx (see geography.sql.in.c) so that
+-- Z and M ranges take part in index pruning. Penalty, union,
+-- picksplit, same and decompress are shared with geography.
+---------------------------------------------------------------
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_gist_consistent_nd(internal,geometry,int4)
+	RETURNS bool
+	AS 'MODULE_PATHNAME' ,'geometry_gist_consistent_nd'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_gist_compress_nd(internal)
+	RETURNS internal
+	AS 'MODULE_PATHNAME','geometry_gist_compress_nd'
+	LANGUAGE 'C';
+
+-- Availability: 1.5.4
+CREATE OR REPLACE FUNCTION geometry_overlaps_nd(geometry, geometry)
+	RETURNS boolean
+	AS 'MODULE_PATHNAME' ,'geometry_overlaps_nd'
+	LANGUAGE 'C' IMMUTABLE STRICT;
+
+-- Availability: 1.5.4
+CREATE OPERATOR &&& (
+	LEFTARG = geometry, RIGHTARG = geometry, PROCEDURE = geometry_overlaps_nd,
+	COMMUTATOR = '&&&',
+	RESTRICT = geometry_gist_sel, JOIN = geometry_gist_joinsel
+);
+
+-- Availability: 1.5.4
+CREATE OPERATOR CLASS gist_geometry_ops_nd
+	FOR TYPE geometry USING GIST AS
+	STORAGE 	gidx,
+	OPERATOR        3        &&&	,
+	FUNCTION        1        geometry_gist_consistent_nd (internal, geometry, int4),
+	FUNCTION        2        geography_gist_union (bytea, internal),
+	FUNCTION        3        geometry_gist_compress_nd (internal),
+	FUNCTION        4        geography_gist_decompress (internal),
+	FUNCTION        5        geography_gist_penalty (internal, internal, internal),
+	FUNCTION        6        geography_gist_picksplit (internal, internal),
+	FUNCTION        7        geography_gist_same (box2d, box2d, internal);
+
 ---------------------------------------------------------------
 -- SQL-MM
 ---------------------------------------------------------------
@@ -45,6 +45,13 @@ DROP FUNCTION ST_CurveToLine(geometry, integer);
 -- OGC defined
 ------------------------------------------------------------------------
 
+-- N-D geometry index
+DROP OPERATOR CLASS gist_geometry_ops_nd USING gist CASCADE;
+DROP OPERATOR &&& (geometry, geometry);
+DROP FUNCTION geometry_overlaps_nd(geometry, geometry);
+DROP FUNCTION geometry_gist_compress_nd(internal);
+DROP FUNCTION geometry_gist_consistent_nd(internal,geometry,int4);
+
 #include "uninstall_sqlmm.sql.in.c"
 #include "uninstall_long_xact.sql.in.c"
 #include "uninstall_geography.sql.in.c"
@@ -331,12 +338,24 @@ DROP FUNCTION unite_garray (geometry[]);
 DROP AGGREGATE ST_Accum(geometry);
 DROP AGGREGATE accum(geometry);
 
+#if POSTGIS_PGSQL_VERSION >= 96
+DROP FUNCTION pgis_geometry_accum_deserialfn(bytea, internal);
+DROP FUNCTION pgis_geometry_accum_serialfn(internal);
+DROP FUNCTION pgis_geometry_accum_combinefn(internal, internal);
+DROP FUNCTION pgis_geometry_makeline_finalfn(internal);
+DROP FUNCTION pgis_geometry_polygonize_finalfn(internal);
+DROP FUNCTION pgis_geometry_collect_finalfn(internal);
+DROP FUNCTION pgis_geometry_union_finalfn(internal);
+DROP FUNCTION pgis_geometry_accum_finalfn(internal);
+DROP FUNCTION pgis_geometry_accum_transfn(internal, geometry);
+#else
 DROP FUNCTION pgis_geometry_makeline_finalfn(pgis_abs);
 DROP FUNCTION pgis_geometry_polygonize_finalfn(pgis_abs);
 DROP FUNCTION pgis_geometry_collect_finalfn(pgis_abs);
 DROP FUNCTION pgis_geometry_union_finalfn(pgis_abs);
 DROP FUNCTION pgis_geometry_accum_finalfn(pgis_abs);
 DROP FUNCTION pgis_geometry_accum_transfn(pgis_abs, geometry);
+#endif
 -- This drops pgis_abs_in, pgis_abs_out and the type in an atomic fashion
 DROP TYPE pgis_abs CASCADE;
 
@@ -489,6 +508,9 @@ DROP FUNCTION postgis_proj_version();
 -- PROJ support
 ---------------------------------------------------------------
 
+DROP TRIGGER spatial_ref_sys_proj_cache ON spatial_ref_sys;
+DROP FUNCTION postgis_proj_cache_stats();
+DROP FUNCTION postgis_proj_cache_invalidate();
 DROP FUNCTION ST_Transform(geometry,integer);
 DROP FUNCTION transform(geometry,integer);
 DROP FUNCTION get_proj4_from_srid(integer);
@@ -511,6 +533,7 @@ DROP FUNCTION DropGeometryColumn(varchar, varchar,varchar,varchar);
 DROP FUNCTION AddGeometryColumn(varchar,varchar,integer,varchar,integer);
 DROP FUNCTION AddGeometryColumn(varchar,varchar,varchar,integer,varchar,integer);
 DROP FUNCTION AddGeometryColumn(varchar,varchar,varchar,varchar,integer,varchar,integer);
+DROP FUNCTION AddGeometryColumn(varchar,varchar,varchar,varchar,integer,varchar,integer,boolean);
 DROP FUNCTION probe_geometry_columns();
 DROP FUNCTION populate_geometry_columns(oid);
 DROP FUNCTION populate_geometry_columns();
@@ -536,16 +559,22 @@ DROP FUNCTION ST_find_extent(text,text);
 DROP FUNCTION find_extent(text,text);
 DROP FUNCTION ST_find_extent(text,text,text);
 DROP FUNCTION find_extent(text,text,text);
+DROP FUNCTION ST_Index_Extent(text,text);
+DROP FUNCTION ST_Index_Extent(text,text,text);
 DROP FUNCTION ST_estimated_extent(text,text);
 DROP FUNCTION estimated_extent(text,text);
 DROP FUNCTION ST_estimated_extent(text,text,text);
 DROP FUNCTION estimated_extent(text,text,text);
 DROP AGGREGATE ST_Extent3d(geometry);
 DROP AGGREGATE Extent3d(geometry);
+DROP FUNCTION pgis_geometry_extent_combinefn(box3d,box3d);
+DROP FUNCTION pgis_geometry_extent_transfn(box3d,geometry);
 DROP FUNCTION ST_Combine_BBox(box3d,geometry);
 DROP FUNCTION combine_bbox(box3d,geometry);
 DROP AGGREGATE ST_Extent(geometry);
 DROP AGGREGATE Extent(geometry);
+DROP FUNCTION pgis_geometry_extent_combinefn(box3d_extent,box3d_extent);
+DROP FUNCTION pgis_geometry_extent_transfn(box3d_extent,geometry);
 DROP FUNCTION ST_Combine_BBox(box3d_extent,geometry);
 DROP FUNCTION combine_bbox(box3d_extent,geometry);
 DROP FUNCTION ST_Combine_BBox(box2d,geometry);
@@ -606,6 +635,12 @@ DROP FUNCTION MakePoint(float8, float8);
 
 DROP FUNCTION ST_GeomFromEWKT(text);
 DROP FUNCTION GeomFromEWKT(text);
+DROP FUNCTION ST_GeomFromTWKB(bytea, integer);
+DROP FUNCTION ST_GeomFromTWKB(bytea);
+DROP FUNCTION ST_AsTWKB(geometry[], bigint[], integer, boolean, boolean);
+DROP FUNCTION ST_AsTWKB(geometry[], bigint[], integer);
+DROP FUNCTION ST_AsTWKB(geometry, integer, boolean, boolean);
+DROP FUNCTION ST_AsTWKB(geometry, integer);
 DROP FUNCTION ST_GeomFromEWKB(bytea);
 DROP FUNCTION GeomFromEWKB(bytea);
 DROP FUNCTION ST_AsEWKB(geometry,text);
@@ -738,6 +773,41 @@ DROP FUNCTION dropBBOX(geometry);
 DROP FUNCTION addBBOX(geometry);
 
 
+-------------------------------------------
+-- SP-GiST opclasses for point geometries
+-------------------------------------------
+
+#if POSTGIS_PGSQL_VERSION >= 92
+DROP OPERATOR CLASS spgist_geometry_kd_ops USING spgist CASCADE;
+DROP OPERATOR CLASS spgist_geometry_quad_ops USING spgist CASCADE;
+DROP FUNCTION geometry_spgist_leaf_consistent(internal, internal);
+DROP FUNCTION geometry_spgist_kd_inner_consistent(internal, internal);
+DROP FUNCTION geometry_spgist_kd_picksplit(internal, internal);
+DROP FUNCTION geometry_spgist_kd_choose(internal, internal);
+DROP FUNCTION geometry_spgist_kd_config(internal, internal);
+DROP FUNCTION geometry_spgist_quad_inner_consistent(internal, internal);
+DROP FUNCTION geometry_spgist_quad_picksplit(internal, internal);
+DROP FUNCTION geometry_spgist_quad_choose(internal, internal);
+DROP FUNCTION geometry_spgist_quad_config(internal, internal);
+#endif
+DROP OPERATOR <-> (geometry,geometry);
+DROP FUNCTION geometry_distance_centroid(geometry, geometry);
+
+-------------------------------------------
+-- GiST opclass with quantized keys
+-------------------------------------------
+
+#if POSTGIS_PGSQL_VERSION >= 130
+DROP OPERATOR CLASS gist_geometry_ops_q USING gist CASCADE;
+DROP FUNCTION geometry_gist_q_same(int8, int8, internal);
+DROP FUNCTION geometry_gist_q_union(internal, internal);
+DROP FUNCTION geometry_gist_q_picksplit(internal, internal);
+DROP FUNCTION geometry_gist_q_penalty(internal,internal,internal);
+DROP FUNCTION geometry_gist_q_compress(internal);
+DROP FUNCTION geometry_gist_q_consistent(internal,geometry,int4);
+DROP FUNCTION geometry_gist_q_options(internal);
+#endif
+
 -------------------------------------------
 -- GIST opclass index binding entries.
 -------------------------------------------
@@ -807,6 +877,7 @@ DROP FUNCTION postgis_gist_sel (internal, oid, internal, int4);
 -- Sorting operators for Btree
 --
 
+DROP OPERATOR CLASS hash_geometry_ops USING hash;
 DROP OPERATOR CLASS btree_geometry_ops USING btree;
 DROP OPERATOR > (geometry,geometry);
 DROP OPERATOR >= (geometry,geometry);
@@ -820,6 +891,10 @@ DROP OPERATOR < (geometry,geometry);
 -------------------------------------------------------------------
 
 
+#if POSTGIS_PGSQL_VERSION >= 92
+DROP FUNCTION geometry_sortsupport(internal);
+#endif
+DROP FUNCTION geometry_hash(geometry);
 DROP FUNCTION ST_geometry_cmp(geometry, geometry);
 DROP FUNCTION geometry_cmp(geometry, geometry);
 DROP FUNCTION ST_geometry_eq(geometry, geometry);
@@ -910,6 +985,11 @@ DROP FUNCTION Affine(geometry,float8,float8,float8,float8,float8,float8);
 DROP FUNCTION ST_Affine(geometry,float8,float8,float8,float8,float8,float8,float8,float8,float8,float8,float8,float8);
 DROP FUNCTION Affine(geometry,float8,float8,float8,float8,float8,float8,float8,float8,float8,float8,float8,float8);
 
+DROP FUNCTION postgis_typmod_type(integer);
+DROP FUNCTION postgis_typmod_srid(integer);
+DROP FUNCTION postgis_typmod_dims(integer);
+DROP CAST (geometry AS geometry);
+DROP FUNCTION geometry(geometry, integer, boolean);
 
 -------------------------------------------------------------------
 --  GEOMETRY TYPE (geometry_dump)
@@ -925,6 +1005,8 @@ DROP TYPE geometry_dump CASCADE;
 
 DROP TYPE geometry CASCADE;
 
+DROP FUNCTION geometry_typmod_out(integer);
+DROP FUNCTION geometry_typmod_in(cstring[]);
 DROP FUNCTION ST_geometry_analyze(internal);
 DROP FUNCTION geometry_analyze(internal);
 DROP FUNCTION geometry_gist_sel (internal, oid, internal, int4);
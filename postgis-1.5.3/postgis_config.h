@@ -22,6 +22,9 @@
 /* Define to 1 if you have the `proj' library (-lproj). */
 #define HAVE_LIBPROJ 1
 
+/* Defined if shp2pgsql reprojects with PROJ.4 */
+#define HAVE_LOADER_PROJ 1
+
 /* Define to 1 if you have the <memory.h> header file. */
 #define HAVE_MEMORY_H 1
 
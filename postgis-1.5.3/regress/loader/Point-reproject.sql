@@ -0,0 +1 @@
+select asewkt(snaptogrid(the_geom, 0.01)) from loadedshp;
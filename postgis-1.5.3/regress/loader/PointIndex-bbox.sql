@@ -0,0 +1 @@
+select id, asewkt(the_geom) from loadedshp order by id;
@@ -0,0 +1 @@
+select gid, encode(convert_to(name, 'UTF8'), 'escape'), encode(convert_to(country, 'UTF8'), 'escape'), asewkt(the_geom) from loadedshp order by gid;
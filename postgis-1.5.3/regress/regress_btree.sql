@@ -0,0 +1,65 @@
+-- Ordering follows the bbox: xmin, ymin, xmax, ymax
+SELECT ST_AsText(g) FROM (
+	SELECT 'POINT(2 2)'::geometry AS g
+	UNION ALL SELECT 'POINT(1 5)'::geometry
+	UNION ALL SELECT 'LINESTRING(0 0, 3 3)'::geometry
+	UNION ALL SELECT 'POINT(1 1)'::geometry
+) AS t ORDER BY g;
+
+-- Sorted output must agree with the btree support function
+CREATE TABLE test_btree (g geometry);
+INSERT INTO test_btree
+	SELECT ST_MakePoint(i % 97, (i * 7919) % 101) AS g
+	FROM generate_series(1, 10000) AS i;
+
+SELECT 'inversions', count(*) FROM (
+	SELECT geometry_cmp(g, lead(g) OVER (ORDER BY g)) > 0 AS inverted
+	FROM test_btree
+) AS s WHERE inverted;
+
+SELECT 'distinct', count(*) FROM (SELECT DISTINCT g FROM test_btree) AS s;
+
+-- Hash aggregation must give the same groups as sorting
+SET enable_sort = off;
+SELECT 'hashed distinct', count(*) FROM (SELECT DISTINCT g FROM test_btree) AS s;
+RESET enable_sort;
+
+-- Mixed SRIDs are an error, even when the abbreviated keys differ
+SELECT 'mixed srid', count(*) FROM (
+	SELECT g FROM test_btree
+	UNION ALL SELECT 'SRID=4326;POINT(500 500)'::geometry
+	ORDER BY 1
+) AS s;
+
+DROP TABLE test_btree;
+
+-- Abbreviation gives up when nearly every key is the same, and the
+-- order is unchanged
+CREATE TABLE test_btree_abort (g geometry);
+INSERT INTO test_btree_abort
+	SELECT ST_MakePoint(0, (i * 7919) % 20011) AS g
+	FROM generate_series(1, 20000) AS i;
+
+SELECT 'abort inversions', count(*) FROM (
+	SELECT geometry_cmp(g, lead(g) OVER (ORDER BY g)) > 0 AS inverted
+	FROM test_btree_abort
+) AS s WHERE inverted;
+
+DROP TABLE test_btree_abort;
+
+-- Equality is exact, not bbox equality
+SELECT 'same box', 'LINESTRING(0 0, 1 1)'::geometry = 'LINESTRING(1 1, 0 0)'::geometry;
+SELECT 'same geom', 'LINESTRING(0 0, 1 1)'::geometry = 'LINESTRING(0 0, 1 1)'::geometry;
+SELECT 'same box order', geometry_cmp('LINESTRING(0 0, 1 1)', 'LINESTRING(1 1, 0 0)')
+	= -geometry_cmp('LINESTRING(1 1, 0 0)', 'LINESTRING(0 0, 1 1)');
+
+-- A cached bbox does not change equality or the hash
+SELECT 'bbox eq', postgis_addbbox(g) = postgis_dropbbox(g),
+	geometry_hash(postgis_addbbox(g)) = geometry_hash(postgis_dropbbox(g))
+	FROM (SELECT 'LINESTRING(0 0, 1 1, 2 0)'::geometry AS g) AS t;
+
+SELECT 'srid hash', geometry_hash('SRID=4326;POINT(1 1)') = geometry_hash('POINT(1 1)');
+
+-- Equality across SRIDs is an error, as for the other btree operators
+SELECT 'srid eq', 'SRID=4326;POINT(1 1)'::geometry = 'POINT(1 1)'::geometry;
+SELECT 'srid cmp', geometry_cmp('SRID=4326;POINT(1 1)'::geometry, 'POINT(1 1)'::geometry);
@@ -0,0 +1,16 @@
+--- NULL and EMPTY rows leave the extent untouched
+SELECT 'extent', ST_Extent(g) FROM (SELECT NULL::geometry AS g UNION ALL SELECT 'POINT(1 2)' UNION ALL SELECT 'GEOMETRYCOLLECTION EMPTY' UNION ALL SELECT 'POINT(3 -4)') AS f;
+SELECT 'extent null', ST_Extent(g) IS NULL FROM (SELECT NULL::geometry AS g UNION ALL SELECT 'GEOMETRYCOLLECTION EMPTY') AS f;
+SELECT 'extent3d', ST_Extent3d(g) FROM (SELECT 'POINT(1 2 3)'::geometry AS g UNION ALL SELECT 'POINT(0 5 -1)') AS f;
+
+--- array accumulating aggregates
+SELECT 'accum', array_upper(ST_Accum(g), 1) FROM (SELECT 'POINT(1 2)'::geometry AS g UNION ALL SELECT NULL UNION ALL SELECT 'POINT(3 4)') AS f;
+SELECT 'collect', ST_AsText(ST_Collect(g)) FROM (SELECT 'POINT(1 2)'::geometry AS g UNION ALL SELECT 'POINT(3 4)') AS f;
+
+--- called directly, the extent functions must not modify their table argument
+CREATE TABLE test_extent (b box3d_extent);
+INSERT INTO test_extent VALUES ('BOX3D(0 0 0,1 1 0)');
+SELECT 'direct transfn', pgis_geometry_extent_transfn(b, 'POINT(10 10)') FROM test_extent;
+SELECT 'direct combinefn', pgis_geometry_extent_combinefn(b, 'BOX3D(-1 -1 0,0 0 0)') FROM test_extent;
+SELECT 'unchanged', b FROM test_extent;
+DROP TABLE test_extent;
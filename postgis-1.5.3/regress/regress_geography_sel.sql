@@ -0,0 +1,38 @@
+--- city sized geography columns: dense points and a few spread around, small squares
+
+CREATE TABLE geogsel_pts (id int, g geography);
+CREATE TABLE geogsel_sq (id int, g geography);
+
+INSERT INTO geogsel_pts SELECT i, ST_SetSRID(ST_MakePoint(78.46 + (i * 7919 % 1000) / 50000.0, 17.39 + (i * 104729 % 1000) / 50000.0), 4326)::geography FROM generate_series(1, 9000) AS i;
+INSERT INTO geogsel_pts SELECT 9000 + i, ST_SetSRID(ST_MakePoint(78.3 + (i * 6007 % 1000) / 3000.0, 17.25 + (i * 3001 % 1000) / 3000.0), 4326)::geography FROM generate_series(1, 1000) AS i;
+
+INSERT INTO geogsel_sq SELECT i, ST_SetSRID(ST_MakeBox2d(ST_MakePoint(x, y), ST_MakePoint(x + 0.002, y + 0.002))::geometry, 4326)::geography
+	FROM (SELECT i, 78.46 + (i * 6007 % 1000) / 50000.0 AS x, 17.39 + (i * 3001 % 1000) / 50000.0 AS y FROM generate_series(1, 300) AS i) AS foo;
+
+ANALYZE geogsel_pts;
+ANALYZE geogsel_sq;
+
+--- planner row estimate of a query, from the first line of EXPLAIN
+
+CREATE FUNCTION geogsel_estimate(text) RETURNS float8 AS $$
+DECLARE
+	line text;
+BEGIN
+	FOR line IN EXECUTE 'EXPLAIN ' || $1 LOOP
+		RETURN substring(line from 'rows=([0-9]+)')::float8;
+	END LOOP;
+END;
+$$ LANGUAGE 'plpgsql';
+
+--- estimates within a factor of two of the actual counts
+
+SELECT 'restrict', geogsel_estimate('SELECT * FROM geogsel_pts WHERE g && ''POLYGON((78.46501 17.39501,78.47001 17.39501,78.47001 17.40001,78.46501 17.40001,78.46501 17.39501))''::geography') /
+	(SELECT count(*) FROM geogsel_pts WHERE g && 'POLYGON((78.46501 17.39501,78.47001 17.39501,78.47001 17.40001,78.46501 17.40001,78.46501 17.39501))'::geography) BETWEEN 0.5 AND 2.0;
+SELECT 'join', geogsel_estimate('SELECT * FROM geogsel_pts p, geogsel_sq s WHERE p.g && s.g') /
+	(SELECT count(*) FROM geogsel_pts p, geogsel_sq s WHERE p.g && s.g) BETWEEN 0.5 AND 2.0;
+SELECT 'commuted', geogsel_estimate('SELECT * FROM geogsel_pts p, geogsel_sq s WHERE s.g && p.g') /
+	(SELECT count(*) FROM geogsel_pts p, geogsel_sq s WHERE p.g && s.g) BETWEEN 0.5 AND 2.0;
+
+DROP FUNCTION geogsel_estimate(text);
+DROP TABLE geogsel_pts;
+DROP TABLE geogsel_sq;
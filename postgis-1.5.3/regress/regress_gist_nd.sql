@@ -0,0 +1,25 @@
+--- XYZ points with z = id, and XYZM points with z = 0 and m = id - 10000
+
+CREATE TABLE test_nd (id int, g geometry);
+INSERT INTO test_nd SELECT i, ST_MakePoint(i % 100, i / 100, i) FROM generate_series(0, 9999) AS i;
+INSERT INTO test_nd SELECT 10000 + i, ST_MakePoint(i % 100, i / 100, 0, i) FROM generate_series(0, 9999) AS i;
+
+--- sequential scan
+
+select 'seq &&', count(*) from test_nd where g && 'LINESTRING(10 10 1000, 20 20 1515)'::geometry;
+select 'seq &&& z', count(*), sum(id) from test_nd where g &&& 'LINESTRING(10 10 1000, 20 20 1515)'::geometry;
+select 'seq &&& zm', count(*), sum(id) from test_nd where g &&& 'LINESTRING(10 10 0 1000, 20 20 0 1515)'::geometry;
+
+--- n-d index scan
+
+CREATE INDEX test_nd_gist on test_nd using gist (g gist_geometry_ops_nd);
+
+set enable_seqscan = off;
+
+select 'idx &&& z', count(*), sum(id) from test_nd where g &&& 'LINESTRING(10 10 1000, 20 20 1515)'::geometry;
+select 'idx &&& zm', count(*), sum(id) from test_nd where g &&& 'LINESTRING(10 10 0 1000, 20 20 0 1515)'::geometry;
+select 'idx &&& empty', count(*) from test_nd where g &&& 'LINESTRING(10 10 -5, 20 20 -1)'::geometry;
+
+set enable_seqscan = on;
+
+DROP TABLE test_nd;
@@ -0,0 +1,25 @@
+--- build a larger database
+\i regress_lots_of_points.sql
+
+--- quantized keys over an extent covering the data
+
+CREATE INDEX quick_gist_q on test using gist (the_geom gist_geometry_ops_q (xmin=0, ymin=0, xmax=1000, ymax=1000));
+
+set enable_seqscan = off;
+
+select 'q &&', num,ST_astext(the_geom) from test where the_geom && 'BOX3D(125 125,135 135)'::box3d order by num;
+select 'q @', num from test where the_geom @ 'BOX3D(125 125,135 135)'::box3d order by num;
+select 'q ~', num from test where the_geom ~ 'POINT(130.504303 126.53112)'::geometry order by num;
+select 'q ~=', num from test where the_geom ~= 'POINT(130.504303 126.53112)'::geometry order by num;
+
+DROP INDEX quick_gist_q;
+
+--- everything outside the extent still has to be found
+
+CREATE INDEX quick_gist_q on test using gist (the_geom gist_geometry_ops_q (xmin=0, ymin=0, xmax=1, ymax=1));
+
+select 'clamped &&', num from test where the_geom && 'BOX3D(125 125,135 135)'::box3d order by num;
+
+set enable_seqscan = on;
+
+DROP TABLE test;
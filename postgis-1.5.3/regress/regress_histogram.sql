@@ -0,0 +1,36 @@
+--- skewed table: most points in a unit square, a few spread far away
+
+CREATE TABLE histogram_pts (id int, g geometry);
+
+INSERT INTO histogram_pts SELECT i, ST_MakePoint(500 + (i * 7919 % 1000) / 1000.0, 500 + (i * 104729 % 1000) / 1000.0) FROM generate_series(1, 9000) AS i;
+INSERT INTO histogram_pts SELECT 9000 + i, ST_MakePoint(i * 6007 % 1000, i * 3001 % 1000) FROM generate_series(1, 1000) AS i;
+
+ANALYZE histogram_pts;
+
+--- planner row estimate of a query, from the first line of EXPLAIN
+
+CREATE FUNCTION histogram_estimate(text) RETURNS float8 AS $$
+DECLARE
+	line text;
+BEGIN
+	FOR line IN EXECUTE 'EXPLAIN ' || $1 LOOP
+		RETURN substring(line from 'rows=([0-9]+)')::float8;
+	END LOOP;
+END;
+$$ LANGUAGE 'plpgsql';
+
+--- estimates within a factor of two, inside and outside the dense area
+
+SELECT 'dense', count(*) FROM histogram_pts WHERE g && 'POLYGON((500.25 500.25,500.25 500.75,500.75 500.75,500.75 500.25,500.25 500.25))'::geometry;
+SELECT 'dense estimate', histogram_estimate('SELECT * FROM histogram_pts WHERE g && ''POLYGON((500.25 500.25,500.25 500.75,500.75 500.75,500.75 500.25,500.25 500.25))''::geometry') / 2493 BETWEEN 0.5 AND 2.0;
+SELECT 'sparse', count(*) FROM histogram_pts WHERE g && 'POLYGON((0 0,0 400,400 400,400 0,0 0))'::geometry;
+SELECT 'sparse estimate', histogram_estimate('SELECT * FROM histogram_pts WHERE g && ''POLYGON((0 0,0 400,400 400,400 0,0 0))''::geometry') / 173 BETWEEN 0.5 AND 2.0;
+
+--- radius searches expand the column, estimated like the expanded constant
+
+SELECT 'radius', count(*) FROM histogram_pts WHERE 'POINT(500.5 500.5)'::geometry && ST_Expand(g, 0.25);
+SELECT 'radius estimate', histogram_estimate('SELECT * FROM histogram_pts WHERE ''POINT(500.5 500.5)''::geometry && ST_Expand(g, 0.25)') / 2493 BETWEEN 0.5 AND 2.0;
+SELECT 'radius commuted', histogram_estimate('SELECT * FROM histogram_pts WHERE ST_Expand(g, 0.25) && ''POINT(500.5 500.5)''::geometry') / 2493 BETWEEN 0.5 AND 2.0;
+
+DROP FUNCTION histogram_estimate(text);
+DROP TABLE histogram_pts;
@@ -0,0 +1,20 @@
+--- a root page holding leaf keys
+CREATE TABLE ie_small (id int, the_geom geometry);
+CREATE INDEX ie_small_gist ON ie_small USING gist (the_geom);
+SELECT 'empty', ST_Index_Extent('ie_small', 'the_geom') IS NULL;
+INSERT INTO ie_small VALUES (1, 'POINT(1 2)');
+INSERT INTO ie_small VALUES (2, 'LINESTRING(-10 5,20 40)');
+INSERT INTO ie_small VALUES (3, NULL);
+SELECT 'small', ST_Index_Extent('ie_small', 'the_geom');
+SELECT 'small schema', ST_Index_Extent(current_schema(), 'ie_small', 'the_geom');
+DROP TABLE ie_small;
+
+--- a root page holding internal keys
+\i regress_lots_of_points.sql
+CREATE INDEX quick_gist on test using gist (the_geom);
+
+SELECT 'large', abs(ST_XMin(i) - ST_XMin(e)) < 0.001, abs(ST_YMin(i) - ST_YMin(e)) < 0.001,
+	abs(ST_XMax(i) - ST_XMax(e)) < 0.001, abs(ST_YMax(i) - ST_YMax(e)) < 0.001
+	FROM (SELECT ST_Index_Extent('test', 'the_geom') AS i, (SELECT ST_Extent(the_geom) FROM test) AS e) AS f;
+
+DROP TABLE test;
@@ -0,0 +1,43 @@
+--- skewed join: dense listings and stations near the origin, a few far away
+
+CREATE TABLE joinsel_a (id int, g geometry);
+CREATE TABLE joinsel_b (id int, g geometry);
+
+INSERT INTO joinsel_a SELECT i, ST_MakePoint((i * 7919 % 1000) / 100.0, (i * 104729 % 1000) / 100.0) FROM generate_series(1, 3000) AS i;
+INSERT INTO joinsel_a SELECT 3000 + i, ST_MakePoint(i * 7919 % 1000, i * 104729 % 1000) FROM generate_series(1, 300) AS i;
+
+INSERT INTO joinsel_b SELECT i, ST_MakeBox2d(ST_MakePoint(x, y), ST_MakePoint(x + 0.5, y + 0.5))::geometry
+	FROM (SELECT i, (i * 6007 % 1000) / 100.0 AS x, (i * 3001 % 1000) / 100.0 AS y FROM generate_series(1, 200) AS i) AS foo;
+INSERT INTO joinsel_b SELECT 200 + i, ST_MakeBox2d(ST_MakePoint(x, y), ST_MakePoint(x + 0.5, y + 0.5))::geometry
+	FROM (SELECT i, i * 6007 % 1000 AS x, i * 3001 % 1000 AS y FROM generate_series(1, 50) AS i) AS foo;
+
+ANALYZE joinsel_a;
+ANALYZE joinsel_b;
+
+--- planner row estimate of a query, from the first line of EXPLAIN
+
+CREATE FUNCTION joinsel_estimate(text) RETURNS float8 AS $$
+DECLARE
+	line text;
+BEGIN
+	FOR line IN EXECUTE 'EXPLAIN ' || $1 LOOP
+		RETURN substring(line from 'rows=([0-9]+)')::float8;
+	END LOOP;
+END;
+$$ LANGUAGE 'plpgsql';
+
+--- estimate within a factor of two of the actual join size
+
+SELECT 'actual', count(*) FROM joinsel_a a, joinsel_b b WHERE a.g && b.g;
+SELECT 'estimate', joinsel_estimate('SELECT * FROM joinsel_a a, joinsel_b b WHERE a.g && b.g') / 1530 BETWEEN 0.5 AND 2.0;
+SELECT 'commuted', joinsel_estimate('SELECT * FROM joinsel_a a, joinsel_b b WHERE b.g && a.g') / 1530 BETWEEN 0.5 AND 2.0;
+
+--- disjoint extents estimate (close to) nothing
+
+UPDATE joinsel_b SET g = ST_Translate(g, 5000, 5000);
+ANALYZE joinsel_b;
+SELECT 'disjoint', joinsel_estimate('SELECT * FROM joinsel_a a, joinsel_b b WHERE a.g && b.g') <= 1;
+
+DROP FUNCTION joinsel_estimate(text);
+DROP TABLE joinsel_a;
+DROP TABLE joinsel_b;
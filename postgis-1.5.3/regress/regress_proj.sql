@@ -63,5 +63,63 @@ SELECT ST_transform(ST_GeomFromEWKT('SRID=-1;POINT(0 0)'),1000002);
 --- test #8: Transforming to same SRID
 SELECT 8,ST_AsEWKT(ST_transform(ST_GeomFromEWKT('SRID=1000002;POINT(0 0)'),1000002));
 
+--- test #9: a changed spatial_ref_sys entry replaces the cached projection
+UPDATE spatial_ref_sys SET proj4text = '+proj=utm +zone=32 +ellps=WGS84 +datum=WGS84 +units=m +no_defs ' WHERE srid = 1000001;
+SELECT 9,ST_AsEWKT(ST_SnapToGrid(ST_transform(ST_GeomFromEWKT('SRID=1000002;POINT(16 48)'),1000001),10));
+
+--- The systems transform_pointarray_fast() handles without PROJ.4, with the
+--- proj4text of spatial_ref_sys.sql: 4326, 3857 (and 900913), 32644, 32744
+INSERT INTO "spatial_ref_sys" ("srid","proj4text") VALUES (1000003,'+proj=longlat +ellps=WGS84 +datum=WGS84 +no_defs ');
+INSERT INTO "spatial_ref_sys" ("srid","proj4text") VALUES (1000004,'+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +units=m +k=1.0 +nadgrids=@null +no_defs');
+INSERT INTO "spatial_ref_sys" ("srid","proj4text") VALUES (1000005,'+proj=utm +zone=44 +ellps=WGS84 +datum=WGS84 +units=m +no_defs ');
+INSERT INTO "spatial_ref_sys" ("srid","proj4text") VALUES (1000006,'+proj=utm +zone=44 +south +ellps=WGS84 +datum=WGS84 +units=m +no_defs ');
+--- The same projected systems with +towgs84 added, which changes nothing
+--- for PROJ.4 but keeps them off the fast path
+INSERT INTO "spatial_ref_sys" ("srid","proj4text") VALUES (1000014,'+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +units=m +k=1.0 +nadgrids=@null +no_defs +towgs84=0,0,0');
+INSERT INTO "spatial_ref_sys" ("srid","proj4text") VALUES (1000015,'+proj=utm +zone=44 +ellps=WGS84 +datum=WGS84 +units=m +no_defs +towgs84=0,0,0');
+INSERT INTO "spatial_ref_sys" ("srid","proj4text") VALUES (1000016,'+proj=utm +zone=44 +south +ellps=WGS84 +datum=WGS84 +units=m +no_defs +towgs84=0,0,0');
+
+-- Whether two points agree to tol in x and y
+CREATE FUNCTION _regress_proj_agree(geometry, geometry, float8) RETURNS boolean AS $$
+	SELECT abs(ST_X($1) - ST_X($2)) < $3 AND abs(ST_Y($1) - ST_Y($2)) < $3;
+$$ LANGUAGE 'sql';
+
+-- The snapped result of a transform, or 'error' if it fails
+CREATE FUNCTION _regress_proj_try(geometry, integer) RETURNS text AS $$
+BEGIN
+	RETURN ST_AsText(ST_SnapToGrid(ST_Transform($1, $2), 0.01));
+EXCEPTION WHEN OTHERS THEN
+	RETURN 'error';
+END;
+$$ LANGUAGE 'plpgsql';
+
+--- test #10: longitude/latitude to web Mercator and back
+SELECT 10,ST_AsEWKT(ST_SnapToGrid(ST_Transform(ST_GeomFromEWKT('SRID=1000003;LINESTRING(16 48,-179.5 -85)'),1000004),0.01));
+SELECT 10,round(ST_X(ST_Transform(ST_GeomFromEWKT('SRID=1000004;POINT(1781111.85 6106854.83)'),1000003))::numeric,6),round(ST_Y(ST_Transform(ST_GeomFromEWKT('SRID=1000004;POINT(1781111.85 6106854.83)'),1000003))::numeric,6);
+SELECT 10,_regress_proj_agree(ST_Transform(ST_GeomFromEWKT('SRID=1000003;POINT(16 48)'),1000004),ST_Transform(ST_GeomFromEWKT('SRID=1000003;POINT(16 48)'),1000014),1e-6);
+SELECT 10,_regress_proj_agree(ST_Transform(ST_GeomFromEWKT('SRID=1000003;POINT(-179.5 -85)'),1000004),ST_Transform(ST_GeomFromEWKT('SRID=1000003;POINT(-179.5 -85)'),1000014),1e-6);
+SELECT 10,_regress_proj_agree(ST_Transform(ST_GeomFromEWKT('SRID=1000004;POINT(1781111.85 6106854.83)'),1000003),ST_Transform(ST_GeomFromEWKT('SRID=1000014;POINT(1781111.85 6106854.83)'),1000003),1e-9);
+
+--- test #11: longitude/latitude to UTM 44N and back
+SELECT 11,ST_AsEWKT(ST_SnapToGrid(ST_Transform(ST_GeomFromEWKT('SRID=1000003;LINESTRING(81 12,83.5 30.25)'),1000005),0.01));
+SELECT 11,round(ST_X(ST_Transform(ST_GeomFromEWKT('SRID=1000005;POINT(740550.42 3349132.77)'),1000003))::numeric,6),round(ST_Y(ST_Transform(ST_GeomFromEWKT('SRID=1000005;POINT(740550.42 3349132.77)'),1000003))::numeric,6);
+SELECT 11,_regress_proj_agree(ST_Transform(ST_GeomFromEWKT('SRID=1000003;POINT(83.5 30.25)'),1000005),ST_Transform(ST_GeomFromEWKT('SRID=1000003;POINT(83.5 30.25)'),1000015),1e-6);
+SELECT 11,_regress_proj_agree(ST_Transform(ST_GeomFromEWKT('SRID=1000005;POINT(740550.42 3349132.77)'),1000003),ST_Transform(ST_GeomFromEWKT('SRID=1000015;POINT(740550.42 3349132.77)'),1000003),1e-9);
+
+--- test #12: longitude/latitude to UTM 44S and back
+SELECT 12,ST_AsEWKT(ST_SnapToGrid(ST_Transform(ST_GeomFromEWKT('SRID=1000003;LINESTRING(81 -12,78.3 -33.7)'),1000006),0.01));
+SELECT 12,round(ST_X(ST_Transform(ST_GeomFromEWKT('SRID=1000006;POINT(249751.87 6267833.61)'),1000003))::numeric,6),round(ST_Y(ST_Transform(ST_GeomFromEWKT('SRID=1000006;POINT(249751.87 6267833.61)'),1000003))::numeric,6);
+SELECT 12,_regress_proj_agree(ST_Transform(ST_GeomFromEWKT('SRID=1000003;POINT(78.3 -33.7)'),1000006),ST_Transform(ST_GeomFromEWKT('SRID=1000003;POINT(78.3 -33.7)'),1000016),1e-6);
+SELECT 12,_regress_proj_agree(ST_Transform(ST_GeomFromEWKT('SRID=1000006;POINT(249751.87 6267833.61)'),1000003),ST_Transform(ST_GeomFromEWKT('SRID=1000016;POINT(249751.87 6267833.61)'),1000003),1e-9);
+
+--- test #13: points the fast path refuses are left to PROJ.4
+SELECT 13,ST_Transform(ST_GeomFromEWKT('SRID=1000003;POINT(0 90)'),1000004);
+SELECT 13,_regress_proj_try(ST_GeomFromEWKT('SRID=1000003;POINT(0 90)'),1000004) = _regress_proj_try(ST_GeomFromEWKT('SRID=1000003;POINT(0 90)'),1000014);
+SELECT 13,_regress_proj_try(ST_GeomFromEWKT('SRID=1000003;POINT(172 10)'),1000005) = _regress_proj_try(ST_GeomFromEWKT('SRID=1000003;POINT(172 10)'),1000015);
+SELECT 13,_regress_proj_try(ST_GeomFromEWKT('SRID=1000003;LINESTRING(81 10,172 10)'),1000005) = _regress_proj_try(ST_GeomFromEWKT('SRID=1000003;LINESTRING(81 10,172 10)'),1000015);
+
+DROP FUNCTION _regress_proj_agree(geometry, geometry, float8);
+DROP FUNCTION _regress_proj_try(geometry, integer);
+
 DELETE FROM spatial_ref_sys WHERE srid >= 1000000;
 
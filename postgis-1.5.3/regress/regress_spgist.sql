@@ -0,0 +1,35 @@
+--- build a larger database
+\i regress_lots_of_points.sql
+
+--- quadtree
+
+CREATE INDEX quick_spgist on test using spgist (the_geom spgist_geometry_quad_ops);
+
+set enable_seqscan = off;
+
+select 'quad &&', num,ST_astext(the_geom) from test where the_geom && 'BOX3D(125 125,135 135)'::box3d order by num;
+select 'quad @', num from test where the_geom @ 'BOX3D(125 125,135 135)'::box3d order by num;
+select 'quad ~', num from test where the_geom ~ 'POINT(130.504303 126.53112)'::geometry order by num;
+select 'quad <->', num from test order by the_geom <-> 'POINT(130 130)'::geometry limit 3;
+
+DROP INDEX quick_spgist;
+
+--- k-d tree
+
+CREATE INDEX quick_spgist on test using spgist (the_geom spgist_geometry_kd_ops);
+
+select 'kd &&', num,ST_astext(the_geom) from test where the_geom && 'BOX3D(125 125,135 135)'::box3d order by num;
+select 'kd @', num from test where the_geom @ 'BOX3D(125 125,135 135)'::box3d order by num;
+select 'kd ~', num from test where the_geom ~ 'POINT(130.504303 126.53112)'::geometry order by num;
+select 'kd <->', num from test order by the_geom <-> 'POINT(130 130)'::geometry limit 3;
+
+DROP INDEX quick_spgist;
+
+--- only points can be indexed
+
+set enable_seqscan = on;
+
+INSERT INTO test (num, the_geom) VALUES (0, 'LINESTRING(0 0, 1 1)');
+CREATE INDEX quick_spgist on test using spgist (the_geom spgist_geometry_quad_ops);
+
+DROP TABLE test;
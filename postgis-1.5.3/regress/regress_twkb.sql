@@ -0,0 +1,45 @@
+--- TWKB output
+SELECT 'point', encode(ST_AsTWKB('POINT(1.234 -5.678)'::geometry, 2), 'hex');
+SELECT 'line', encode(ST_AsTWKB('LINESTRING(100.01 200.02,100.03 200.05,100.1 200.1)'::geometry, 2), 'hex');
+SELECT 'polygon', encode(ST_AsTWKB('POLYGON((0 0,10 0,10 10,0 10,0 0))'::geometry, 0), 'hex');
+SELECT 'multipoint', encode(ST_AsTWKB('MULTIPOINT(1 1,2 2)'::geometry, 0), 'hex');
+SELECT 'collection', encode(ST_AsTWKB('GEOMETRYCOLLECTION(POINT(1 2),LINESTRING(3 4,5 6))'::geometry, 0), 'hex');
+SELECT 'pointz', encode(ST_AsTWKB('POINT(1.5 2.5 3.25)'::geometry, 1), 'hex');
+SELECT 'empty', encode(ST_AsTWKB('GEOMETRYCOLLECTION EMPTY'::geometry, 0), 'hex');
+SELECT 'negprec', encode(ST_AsTWKB('SRID=4326;POINT(1234 5678)'::geometry, -2), 'hex');
+
+SELECT 'size', encode(ST_AsTWKB('LINESTRING(100.01 200.02,100.03 200.05,100.1 200.1)'::geometry, 2, true, false), 'hex');
+SELECT 'bbox', encode(ST_AsTWKB('LINESTRING(100.01 200.02,100.03 200.05,100.1 200.1)'::geometry, 2, false, true), 'hex');
+SELECT 'size_bbox', encode(ST_AsTWKB('GEOMETRYCOLLECTION(POINT(1 2),LINESTRING(3 4,5 6),POINT(-1 0))'::geometry, 0, true, true), 'hex');
+
+--- TWKB from arrays, with ids
+SELECT 'ids', encode(ST_AsTWKB(ARRAY['POINT(1 1)'::geometry, 'POINT(2 2)', 'POINT(5 -3)'], ARRAY[10, 20, -5]::bigint[], 0), 'hex');
+SELECT 'ids_size_bbox', encode(ST_AsTWKB(ARRAY['POINT(1 1)'::geometry, 'POINT(2 2)', 'POINT(5 -3)'], ARRAY[10, 20, -5]::bigint[], 0, true, true), 'hex');
+SELECT 'agg', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB(array_agg(g), array_agg(id), 0)))
+	FROM (SELECT id, ST_MakePoint(id, -id) AS g FROM generate_series(1, 4) AS id ORDER BY id) AS foo;
+
+SELECT 'rt_point', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB('POINT(1.234 -5.678)'::geometry, 2)));
+SELECT 'rt_line', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB('LINESTRING(100.01 200.02,100.03 200.05,100.1 200.1)'::geometry, 2)));
+SELECT 'rt_polygon', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB('POLYGON((0 0,10 0,10 10,0 10,0 0),(1 1,2 1,2 2,1 1))'::geometry, 0)));
+SELECT 'rt_mpoly', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB('MULTIPOLYGON(((0 0,1 0,1 1,0 0)),((5 5,6 5,6 6,5 5)))'::geometry, 0)));
+SELECT 'rt_collection', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB('GEOMETRYCOLLECTION(POINT(1 2),LINESTRING(3 4,5 6))'::geometry, 0)));
+SELECT 'rt_pointm', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB('POINTM(1 2 3)'::geometry, 0)));
+SELECT 'rt_point4d', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB('POINT(1 2 3 4)'::geometry, 0)));
+SELECT 'rt_empty', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB('GEOMETRYCOLLECTION EMPTY'::geometry, 0)));
+SELECT 'rt_size_bbox', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB('GEOMETRYCOLLECTION(POINT(1 2),LINESTRING(3 4,5 6),POINT(-1 0))'::geometry, 0, true, true)));
+SELECT 'rt_ids', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB(ARRAY['LINESTRING(0 0,1 1)'::geometry, 'POINT(2 2)'], ARRAY[1, 2]::bigint[], 0, true, true)));
+SELECT 'rt_srid', ST_AsEWKT(ST_GeomFromTWKB(ST_AsTWKB('SRID=4326;POINT(1 2)'::geometry, 0), 4326));
+
+--- errors
+SELECT 'precision', ST_AsTWKB('POINT(1 2)'::geometry, 8);
+SELECT 'curve', ST_AsTWKB('CIRCULARSTRING(0 0,1 1,2 0)'::geometry, 0);
+SELECT 'idcount', ST_AsTWKB(ARRAY['POINT(1 1)'::geometry, 'POINT(2 2)'], ARRAY[1]::bigint[], 0);
+SELECT 'badsize', ST_GeomFromTWKB(decode('42027f03a29c01c4b80204060e0a', 'hex'));
+SELECT 'truncated', ST_GeomFromTWKB(decode('4100f6', 'hex'));
+SELECT 'trailing', ST_GeomFromTWKB(decode('4100f601ef0800', 'hex'));
+SELECT 'badtype', ST_GeomFromTWKB(decode('0800', 'hex'));
+SELECT 'truncated_ids', ST_GeomFromTWKB(decode('0404031428', 'hex'));
+SELECT 'huge_idcount', ST_GeomFromTWKB(decode('0404ffffffffffffffff7f', 'hex'));
+SELECT 'huge_ncoll', ST_GeomFromTWKB(decode('0700ffffffffffffffff7f', 'hex'));
+SELECT 'huge_npoints', ST_GeomFromTWKB(decode('0200ffffffff0f', 'hex'));
+SELECT 'huge_nrings', ST_GeomFromTWKB(decode('0300ffffffff0f', 'hex'));
@@ -0,0 +1,56 @@
+--- typmod parsing and output
+CREATE TABLE tm (g geometry(Point,4326), gz geometry(LINESTRINGZ), gm geometry(PointM), gc geometry(GeometryCollection));
+SELECT 'format', format_type(atttypid, atttypmod) FROM pg_attribute WHERE attrelid = 'tm'::regclass AND attnum > 0 ORDER BY attnum;
+
+--- matching geometries are accepted
+INSERT INTO tm (g) VALUES ('SRID=4326;POINT(1 2)');
+INSERT INTO tm (gz) VALUES ('LINESTRING(0 0 1,1 1 2)');
+INSERT INTO tm (gm) VALUES ('POINTM(1 2 3)');
+INSERT INTO tm (gc) VALUES ('MULTIPOINT(1 2,3 4)');
+SELECT 'count', count(*) FROM tm;
+
+--- mismatches are rejected
+INSERT INTO tm (g) VALUES ('SRID=3857;POINT(1 2)');
+INSERT INTO tm (g) VALUES ('SRID=4326;LINESTRING(0 0,1 1)');
+INSERT INTO tm (gz) VALUES ('LINESTRING(0 0,1 1)');
+INSERT INTO tm (gm) VALUES ('POINT(1 2 3)');
+INSERT INTO tm (gc) VALUES ('POINT(1 2)');
+UPDATE tm SET g = 'POINT(1 2)' WHERE g IS NOT NULL;
+SELECT 'count', count(*) FROM tm;
+
+--- invalid modifiers
+SELECT 'POINT(1 2)'::geometry(Pointy);
+SELECT 'POINT(1 2)'::geometry(Point,4326,1);
+
+--- explicit casts check the typmod too
+SELECT 'cast', ST_AsEWKT('SRID=4326;POINT(1 2)'::geometry::geometry(Point,4326));
+SELECT 'cast', ST_AsEWKT('POINT(1 2)'::geometry::geometry(Point,4326));
+
+--- typmod accessors
+SELECT 'accessors', postgis_typmod_type(atttypmod), postgis_typmod_srid(atttypmod), postgis_typmod_dims(atttypmod) FROM pg_attribute WHERE attrelid = 'tm'::regclass AND attnum > 0 ORDER BY attnum;
+DROP TABLE tm;
+
+--- geometry(Geometry) is printed, and still only accepts 2D geometries
+CREATE TABLE tm (g geometry(Geometry));
+SELECT 'format', format_type(atttypid, atttypmod) FROM pg_attribute WHERE attrelid = 'tm'::regclass AND attnum > 0;
+INSERT INTO tm (g) VALUES ('POINT(1 2 3)');
+DROP TABLE tm;
+
+--- AddGeometryColumn declares the typmod, populate_geometry_columns reads it back
+CREATE TABLE tm (id integer);
+SELECT 'add', AddGeometryColumn('tm', 'g', 4326, 'MULTIPOLYGON', 2);
+SELECT 'add', AddGeometryColumn('tm', 'g3', 4326, 'POINT', 3);
+SELECT 'add', AddGeometryColumn('tm', 'gu', -1, 'LINESTRING', 2);
+SELECT 'addtypmod', format_type(atttypid, atttypmod) FROM pg_attribute WHERE attrelid = 'tm'::regclass AND attnum > 1 ORDER BY attnum;
+SELECT 'constraints', count(*) FROM pg_constraint WHERE conrelid = 'tm'::regclass;
+DELETE FROM geometry_columns WHERE f_table_name = 'tm';
+SELECT 'populate', populate_geometry_columns('tm'::regclass);
+SELECT 'columns', f_geometry_column, coord_dimension, srid, type FROM geometry_columns WHERE f_table_name = 'tm' ORDER BY f_geometry_column;
+
+--- UpdateGeometrySRID rewrites the typmod
+SELECT 'update', UpdateGeometrySRID('tm', 'g', 3857);
+SELECT 'updatetypmod', format_type(atttypid, atttypmod) FROM pg_attribute WHERE attrelid = 'tm'::regclass AND attname = 'g';
+SELECT 'drop', DropGeometryColumn('tm', 'g');
+SELECT 'drop', DropGeometryColumn('tm', 'g3');
+SELECT 'drop', DropGeometryColumn('tm', 'gu');
+DROP TABLE tm;
@@ -209,6 +209,22 @@ while(<INPUT>)
 		print $def;
 	}
 	
+	# This code handles triggers by dropping and recreating them.
+	if ( /^create trigger\s+(\w+)/i )
+	{
+		my $trgname = $1;
+		my $trgtable = 'unknown';
+		my $def = $_;
+		$trgtable = $1 if ( /\son\s+(\w+)/i );
+		while( ! /\;/ && ($_ = <INPUT>) )
+		{
+			$def .= $_;
+			$trgtable = $1 if ( /\son\s+(\w+)/i );
+		}
+		print "DROP TRIGGER IF EXISTS $trgname ON $trgtable;\n";
+		print $def;
+	}
+
 	# This code handles operators by creating them if we are doing a major upgrade
 	if ( /^create operator\s+(\S+)\s*\(/i )
 	{